@@ -1,9 +1,13 @@
 #include "../collections/ConcurrentQueue.hpp"
+#include "../collections/SPSCQueue.hpp"
+#include "../collections/ConcurrentPriorityQueue.hpp"
 #include "../time/time.hpp"
 #include <tbb/concurrent_queue.h>
 #include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 #include <deque>
 #include <mutex>
+#include <queue>
 #include <thread>
 #include <vector>
 #include <iostream>
@@ -785,6 +789,284 @@ public:
 private:
 	sprawl::collections::ConcurrentBoundedQueue<t_ElementType, NUM_ELEMENTS>* m_queue;
 };
+template<typename t_ElementType>
+class QueueWrapper<boost::lockfree::spsc_queue<t_ElementType>, TicketType::PERSISTENT>
+{
+public:
+	QueueWrapper()
+		: m_queue(NUM_ELEMENTS)
+	{
+
+	}
+
+	void enqueue(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = t_ElementType();
+			m_queue.push(data);
+		}
+	}
+	void enqueueMove(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = t_ElementType();
+			m_queue.push(std::move(data));
+		}
+	}
+	void dequeue(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			while (!m_queue.pop(data)) {};
+		}
+	}
+	void dequeueEmpty(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			m_queue.pop(data);
+		}
+	}
+private:
+	boost::lockfree::spsc_queue<t_ElementType> m_queue;
+};
+
+template<typename t_ElementType>
+class QueueWrapper<sprawl::collections::SPSCQueue<t_ElementType, NUM_ELEMENTS>, TicketType::PERSISTENT>
+{
+public:
+	QueueWrapper()
+		: m_queue(new sprawl::collections::SPSCQueue<t_ElementType, NUM_ELEMENTS>())
+	{}
+
+	~QueueWrapper()
+	{
+		delete m_queue;
+	}
+
+	void enqueue(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = t_ElementType();
+			m_queue->Enqueue(data);
+		}
+	}
+	void enqueueMove(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = t_ElementType();
+			m_queue->Enqueue(std::move(data));
+		}
+	}
+	void dequeue(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			while (!m_queue->Dequeue(data)) {};
+		}
+	}
+	void dequeueEmpty(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			m_queue->Dequeue(data);
+		}
+	}
+private:
+	sprawl::collections::SPSCQueue<t_ElementType, NUM_ELEMENTS>* m_queue;
+};
+
+template<typename t_ElementType>
+class QueueWrapper<sprawl::collections::SPSCUnboundedQueue<t_ElementType>, TicketType::PERSISTENT>
+{
+public:
+	void enqueue(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = t_ElementType();
+			m_queue.Enqueue(data);
+		}
+	}
+	void enqueueMove(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = t_ElementType();
+			m_queue.Enqueue(std::move(data));
+		}
+	}
+	void dequeue(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			while (!m_queue.Dequeue(data)) {};
+		}
+	}
+	void dequeueEmpty(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			m_queue.Dequeue(data);
+		}
+	}
+private:
+	sprawl::collections::SPSCUnboundedQueue<t_ElementType> m_queue;
+};
+
+// Priority queue wrappers push scrambled keys rather than default-constructed values, so the heaps actually have
+// to do some sifting.
+template<typename t_ElementType>
+inline t_ElementType PriorityKey(size_t i)
+{
+	return t_ElementType((i * 2654435761u) % NUM_ELEMENTS);
+}
+
+template<typename t_ElementType>
+class QueueWrapper<std::priority_queue<t_ElementType>, TicketType::PERSISTENT>
+{
+public:
+	void enqueue(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = PriorityKey<t_ElementType>(i);
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_queue.push(data);
+		}
+	}
+	void enqueueMove(size_t nElements)
+	{
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = PriorityKey<t_ElementType>(i);
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_queue.push(std::move(data));
+		}
+	}
+	void dequeue(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			for (;;)
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				if (m_queue.empty())
+				{
+					continue;
+				}
+				data = m_queue.top();
+				m_queue.pop();
+				break;
+			}
+		}
+	}
+	void dequeueEmpty(size_t nElements)
+	{
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			if (m_queue.empty())
+			{
+				continue;
+			}
+			data = m_queue.top();
+			m_queue.pop();
+		}
+	}
+private:
+	std::mutex m_mtx;
+	std::priority_queue<t_ElementType> m_queue;
+};
+
+template<typename t_ElementType, TicketType t_TicketType>
+class QueueWrapper<sprawl::collections::ConcurrentPriorityQueue<t_ElementType>, t_TicketType>
+{
+public:
+	void enqueue(size_t nElements)
+	{
+		sprawl::collections::PriorityQueueTicket ticket;
+		m_queue.InitializeTicket(ticket);
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = PriorityKey<t_ElementType>(i);
+			if (t_TicketType == TicketType::NONE)
+			{
+				m_queue.Push(data);
+			}
+			else
+			{
+				m_queue.Push(data, ticket);
+			}
+		}
+	}
+	void enqueueMove(size_t nElements)
+	{
+		sprawl::collections::PriorityQueueTicket ticket;
+		m_queue.InitializeTicket(ticket);
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			t_ElementType data = PriorityKey<t_ElementType>(i);
+			if (t_TicketType == TicketType::NONE)
+			{
+				m_queue.Push(std::move(data));
+			}
+			else
+			{
+				m_queue.Push(std::move(data), ticket);
+			}
+		}
+	}
+	void dequeue(size_t nElements)
+	{
+		sprawl::collections::PriorityQueueTicket ticket;
+		m_queue.InitializeTicket(ticket);
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			if (t_TicketType == TicketType::NONE)
+			{
+				while (!m_queue.Pop(data)) {};
+			}
+			else
+			{
+				while (!m_queue.Pop(data, ticket)) {};
+			}
+		}
+	}
+	void dequeueEmpty(size_t nElements)
+	{
+		sprawl::collections::PriorityQueueTicket ticket;
+		m_queue.InitializeTicket(ticket);
+		t_ElementType data = t_ElementType();
+		for (size_t i = 0; i < nElements; ++i)
+		{
+			if (t_TicketType == TicketType::NONE)
+			{
+				m_queue.Pop(data);
+			}
+			else
+			{
+				m_queue.Pop(data, ticket);
+			}
+		}
+	}
+private:
+	sprawl::collections::ConcurrentPriorityQueue<t_ElementType> m_queue;
+};
+
 template<typename t_Type>
 struct TypeName
 {
@@ -1193,6 +1475,229 @@ void RunTestsOnElementType(NoBoost const&)
 	RunTestsOnQueueType<t_ElementType, sprawl::collections::ConcurrentBoundedQueue<t_ElementType, NUM_ELEMENTS>, TicketType::NONE>();
 }
 
+// SPSC queues are only valid with exactly one producer and one consumer, so they're only compared at 1x1.
+template<typename t_ElementType>
+void RunSPSCTestsOnElementType()
+{
+	RunTestsOnQueueTypeWithThreadCounts<t_ElementType, boost::lockfree::spsc_queue<t_ElementType>>(1, 1);
+	RunTestsOnQueueTypeWithThreadCounts<t_ElementType, sprawl::collections::SPSCQueue<t_ElementType, NUM_ELEMENTS>>(1, 1);
+	RunTestsOnQueueTypeWithThreadCounts<t_ElementType, sprawl::collections::SPSCUnboundedQueue<t_ElementType>>(1, 1);
+	RunTestsOnQueueTypeWithThreadCounts<t_ElementType, sprawl::collections::ConcurrentBoundedQueue<t_ElementType, NUM_ELEMENTS>>(1, 1);
+	RunTestsOnQueueTypeWithThreadCounts<t_ElementType, sprawl::collections::ConcurrentQueue<t_ElementType>>(1, 1);
+}
+
+template<typename t_QueueType>
+class BulkQueueWrapper;
+
+// Neither tbb nor boost::lockfree offer bulk operations on their MPMC queues, so their batches are element-by-element.
+template<typename t_ElementType>
+class BulkQueueWrapper<tbb::concurrent_queue<t_ElementType>>
+{
+public:
+	void enqueue(size_t nElements, size_t batchSize)
+	{
+		std::vector<t_ElementType> batch(batchSize);
+		for (size_t i = 0; i < nElements; i += batchSize)
+		{
+			for (auto& data : batch)
+			{
+				m_queue.push(data);
+			}
+		}
+	}
+	void dequeue(size_t nElements, size_t batchSize)
+	{
+		std::vector<t_ElementType> batch(batchSize);
+		size_t i = 0;
+		while (i < nElements)
+		{
+			for (size_t j = 0; j < batchSize && i < nElements; ++j)
+			{
+				if (m_queue.try_pop(batch[j]))
+				{
+					++i;
+				}
+			}
+		}
+	}
+private:
+	tbb::concurrent_queue<t_ElementType> m_queue;
+};
+
+template<typename t_ElementType>
+class BulkQueueWrapper<boost::lockfree::queue<t_ElementType>>
+{
+public:
+	BulkQueueWrapper()
+		: m_queue(NUM_ELEMENTS)
+	{
+
+	}
+
+	void enqueue(size_t nElements, size_t batchSize)
+	{
+		std::vector<t_ElementType> batch(batchSize);
+		for (size_t i = 0; i < nElements; i += batchSize)
+		{
+			for (auto& data : batch)
+			{
+				m_queue.push(data);
+			}
+		}
+	}
+	void dequeue(size_t nElements, size_t batchSize)
+	{
+		std::vector<t_ElementType> batch(batchSize);
+		size_t i = 0;
+		while (i < nElements)
+		{
+			for (size_t j = 0; j < batchSize && i < nElements; ++j)
+			{
+				if (m_queue.pop(batch[j]))
+				{
+					++i;
+				}
+			}
+		}
+	}
+private:
+	boost::lockfree::queue<t_ElementType> m_queue;
+};
+
+template<typename t_ElementType>
+class BulkQueueWrapper<sprawl::collections::ConcurrentQueue<t_ElementType>>
+{
+public:
+	void enqueue(size_t nElements, size_t batchSize)
+	{
+		std::vector<t_ElementType> batch(batchSize);
+		for (size_t i = 0; i < nElements; i += batchSize)
+		{
+			m_queue.EnqueueBulk(batch.begin(), batch.end());
+		}
+	}
+	void dequeue(size_t nElements, size_t batchSize)
+	{
+		sprawl::collections::ReadReservationTicket<t_ElementType> ticket;
+		m_queue.InitializeReservationTicket(ticket);
+
+		std::vector<t_ElementType> batch(batchSize);
+		size_t i = 0;
+		while (i < nElements)
+		{
+			size_t remaining = nElements - i;
+			i += m_queue.DequeueBulk(batch.begin(), remaining < batchSize ? remaining : batchSize, ticket);
+		}
+	}
+private:
+	sprawl::collections::ConcurrentQueue<t_ElementType> m_queue;
+};
+
+template<typename t_ElementType, typename t_QueueType>
+void RunBulkTestsOnQueueTypeWithBatchSize(size_t enqueueThreads, size_t dequeueThreads, size_t batchSize)
+{
+	size_t adjustedNumElements = NUM_ELEMENTS;
+	while(adjustedNumElements % (enqueueThreads * batchSize) != 0 || adjustedNumElements % dequeueThreads != 0)
+	{
+		--adjustedNumElements;
+	}
+	size_t nEnqueueElements = adjustedNumElements / enqueueThreads;
+	size_t nDequeueElements = adjustedNumElements / dequeueThreads;
+
+	std::vector<int64_t> times;
+	times.resize(nIters);
+
+	for (int iter = 0; iter < nIters; ++iter)
+	{
+		// Time enqueues and dequeues happening concurrently.
+		BulkQueueWrapper<t_QueueType> wrapper;
+		std::vector<std::thread> threads;
+		threads.reserve(enqueueThreads + dequeueThreads);
+
+		for (size_t i = 0; i < enqueueThreads + dequeueThreads; ++i)
+		{
+			std::function<void()> fn;
+			if (i < dequeueThreads)
+			{
+				fn = std::bind(&BulkQueueWrapper<t_QueueType>::dequeue, &wrapper, nDequeueElements, batchSize);
+			}
+			else
+			{
+				fn = std::bind(&BulkQueueWrapper<t_QueueType>::enqueue, &wrapper, nEnqueueElements, batchSize);
+			}
+			threads.emplace_back(
+				std::bind(
+					timeFn,
+					fn
+				)
+			);
+#ifdef _WIN32
+			if(!SetThreadAffinityMask(threads.back().native_handle(), 1 << (i % std::thread::hardware_concurrency())))
+			{
+				abort();
+			}
+#else
+			cpu_set_t cpuset;
+			pthread_t thread = threads.back().native_handle();
+
+			CPU_ZERO(&cpuset);
+			CPU_SET((i % std::thread::hardware_concurrency()), &cpuset);
+			if(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset) != 0)
+			{
+				abort();
+			}
+#endif
+		}
+		while(started.load() < dequeueThreads + enqueueThreads) {}
+		started.store(0);
+		int64_t start = sprawl::time::SteadyNow();
+		timer.store(start);
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		times[iter] = timer.exchange(-1) - start;
+	}
+
+	std::cout << TypeName<t_QueueType>::GetName(false, TicketType::PERSISTENT) << " [bulk]\t" << batchSize << "\t" << enqueueThreads << "\t" << dequeueThreads << "\t" <<
+		OpsPerSecond(mean(times), adjustedNumElements) << "\t" <<
+		OpsPerSecond(Max(times), adjustedNumElements) << "\t" <<
+		OpsPerSecond(Min(times), adjustedNumElements) << std::endl;
+}
+
+template<typename t_ElementType, typename t_QueueType>
+void RunBulkTestsOnQueueType()
+{
+	size_t halfThreads = std::thread::hardware_concurrency() / 2;
+	if (halfThreads == 0)
+	{
+		halfThreads = 1;
+	}
+	for (size_t batchSize = 1; batchSize <= 1024; batchSize *= 4)
+	{
+		RunBulkTestsOnQueueTypeWithBatchSize<t_ElementType, t_QueueType>(1, 1, batchSize);
+		RunBulkTestsOnQueueTypeWithBatchSize<t_ElementType, t_QueueType>(halfThreads, halfThreads, batchSize);
+	}
+}
+
+template<typename t_ElementType>
+void RunBulkTestsOnElementType()
+{
+	RunBulkTestsOnQueueType<t_ElementType, tbb::concurrent_queue<t_ElementType>>();
+	RunBulkTestsOnQueueType<t_ElementType, boost::lockfree::queue<t_ElementType>>();
+	RunBulkTestsOnQueueType<t_ElementType, sprawl::collections::ConcurrentQueue<t_ElementType>>();
+}
+
+// Both priority queues return elements in (roughly, for ConcurrentPriorityQueue) sorted order rather than FIFO,
+// so they're only compared against each other.
+template<typename t_ElementType>
+void RunPriorityTestsOnElementType()
+{
+	RunTestsOnQueueType<t_ElementType, std::priority_queue<t_ElementType>>();
+	RunTestsOnQueueType<t_ElementType, sprawl::collections::ConcurrentPriorityQueue<t_ElementType>>();
+	RunTestsOnQueueType<t_ElementType, sprawl::collections::ConcurrentPriorityQueue<t_ElementType>, TicketType::NONE>();
+}
+
 template<size_t t_Size>
 class FixedStaticString
 {
@@ -1219,4 +1724,11 @@ int main()
 	RunTestsOnElementType<char>();
 	RunTestsOnElementType<int64_t>();
 	RunTestsOnElementType<FixedStaticString<64>>(NoBoost());
+
+	RunBulkTestsOnElementType<int64_t>();
+
+	RunSPSCTestsOnElementType<char>();
+	RunSPSCTestsOnElementType<int64_t>();
+
+	RunPriorityTestsOnElementType<int64_t>();
 }
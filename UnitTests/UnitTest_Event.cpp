@@ -1,9 +1,14 @@
 #include "../../threading/event.hpp"
+#include "../../threading/eventset.hpp"
 #include "../../threading/thread.hpp"
 #include "../../time/time.hpp"
 #include <gtest/gtest.h>
 #include "../../threading/condition_variable.hpp"
 #include "../../collections/ConcurrentQueue.hpp"
+#include "../../common/compat.hpp"
+#include <functional>
+#include <memory>
+#include <stdio.h>
 
 class EventTest : public testing::Test
 {
@@ -747,4 +752,172 @@ TEST_F(EventTest, NotifyDuringAllEventProperlyClearsStateForSingleEvent_Template
 	sprawl::threading::Event::NotifyAll(event, event2, event3, event4, event5);
 
 	t.Join();
-}
\ No newline at end of file
+}
+TEST_F(EventTest, NotifyAndWakeLatency)
+{
+	// Nobody waiting: Notify() and the Wait() that consumes it should stay in userspace.
+	int const uncontendedCount = 1000000;
+	int64_t start = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+	for(int i = 0; i < uncontendedCount; ++i)
+	{
+		event.Notify();
+		event.Wait();
+	}
+	int64_t const uncontended = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) - start;
+
+	// Two threads taking turns, so every Notify() has a parked thread to wake.
+	int const roundTrips = 10000;
+	sprawl::threading::Thread pong([&]()
+	{
+		for(int i = 0; i < roundTrips; ++i)
+		{
+			event.Wait();
+			event2.Notify();
+		}
+	});
+	pong.Start();
+	start = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+	for(int i = 0; i < roundTrips; ++i)
+	{
+		event.Notify();
+		event2.Wait();
+	}
+	int64_t const pingPong = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) - start;
+	pong.Join();
+
+	// The same, but waiting on a large group where only the last event ever fires.
+	int const groupSize = 512;
+	int const groupRoundTrips = 2000;
+	std::unique_ptr<sprawl::threading::Event[]> many(new sprawl::threading::Event[groupSize]);
+	sprawl::threading::Event::EventGroup bigGroup;
+	for(int i = 0; i < groupSize; ++i)
+	{
+		bigGroup.PushBack(&many[i]);
+	}
+	std::atomic<int> wrongEvent(0);
+	sprawl::threading::Thread groupPong([&]()
+	{
+		for(int i = 0; i < groupRoundTrips; ++i)
+		{
+			if(sprawl::threading::Event::WaitAny(bigGroup) != &many[groupSize - 1])
+			{
+				++wrongEvent;
+			}
+			event2.Notify();
+		}
+	});
+	groupPong.Start();
+	start = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+	for(int i = 0; i < groupRoundTrips; ++i)
+	{
+		many[groupSize - 1].Notify();
+		event2.Wait();
+	}
+	int64_t const groupPingPong = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) - start;
+	groupPong.Join();
+	ASSERT_EQ(0, wrongEvent.load());
+
+	printf("\tEvent latency: uncontended Notify+Wait %" SPRAWL_I64FMT "d ns, ping-pong round trip %" SPRAWL_I64FMT "d ns, WaitAny over %d events round trip %" SPRAWL_I64FMT "d ns\n",
+		uncontended / uncontendedCount, pingPong / roundTrips, groupSize, groupPingPong / groupRoundTrips);
+}
+
+TEST_F(EventTest, EventSetWorks)
+{
+	sprawl::threading::EventSet set;
+	set.Add(event);
+	set.Add(event2);
+	set.Add(event3);
+	set.Add(event3);
+	ASSERT_EQ(size_t(3), set.Size());
+
+	ASSERT_EQ(nullptr, set.WaitFor(100 * sprawl::time::Resolution::Milliseconds));
+
+	// Both come back, one per wait, and both notifications are consumed.
+	event.Notify();
+	event3.Notify();
+	sprawl::threading::Event const* first = set.Wait();
+	sprawl::threading::Event const* second = set.Wait();
+	ASSERT_TRUE((first == &event && second == &event3) || (first == &event3 && second == &event));
+	ASSERT_FALSE(event.WaitFor(0));
+	ASSERT_FALSE(event3.WaitFor(0));
+	ASSERT_EQ(nullptr, set.WaitFor(100 * sprawl::time::Resolution::Milliseconds));
+
+	// Notified before it joined.
+	event4.Notify();
+	set.Add(event4);
+	ASSERT_EQ(&event4, set.WaitFor(100 * sprawl::time::Resolution::Milliseconds));
+
+	// Once removed, it's left alone.
+	set.Remove(event2);
+	ASSERT_EQ(size_t(3), set.Size());
+	event2.Notify();
+	ASSERT_EQ(nullptr, set.WaitFor(100 * sprawl::time::Resolution::Milliseconds));
+	ASSERT_TRUE(event2.WaitFor(0));
+}
+
+TEST_F(EventTest, EventSetMembersCanChangeDuringWait)
+{
+	sprawl::threading::EventSet set;
+	set.Add(event);
+
+	sprawl::threading::Thread t([&]()
+	{
+		ASSERT_EQ(&event5, set.Wait());
+	});
+	t.Start();
+
+	sprawl::this_thread::Sleep(100 * sprawl::time::Resolution::Milliseconds);
+	set.Add(event5);
+	set.Remove(event);
+	event.Notify();
+	event5.Notify();
+
+	t.Join();
+}
+
+TEST_F(EventTest, EventSetLatency)
+{
+	// The same group of events waited on over and over, with the last one fired each time.
+	int const groupSize = 512;
+	int const roundTrips = 2000;
+	std::unique_ptr<sprawl::threading::Event[]> many(new sprawl::threading::Event[groupSize]);
+	sprawl::threading::Event::EventGroup bigGroup;
+	sprawl::threading::EventSet set;
+	for(int i = 0; i < groupSize; ++i)
+	{
+		bigGroup.PushBack(&many[i]);
+		set.Add(many[i]);
+	}
+
+	auto measure = [&](std::function<sprawl::threading::Event const*()> const& wait)
+	{
+		std::atomic<int> wrongEvent(0);
+		sprawl::threading::Thread pong([&]()
+		{
+			for(int i = 0; i < roundTrips; ++i)
+			{
+				if(wait() != &many[groupSize - 1])
+				{
+					++wrongEvent;
+				}
+				event2.Notify();
+			}
+		});
+		pong.Start();
+		int64_t const start = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+		for(int i = 0; i < roundTrips; ++i)
+		{
+			many[groupSize - 1].Notify();
+			event2.Wait();
+		}
+		int64_t const elapsed = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) - start;
+		pong.Join();
+		EXPECT_EQ(0, wrongEvent.load());
+		return elapsed / roundTrips;
+	};
+
+	int64_t const waitAny = measure([&]() { return sprawl::threading::Event::WaitAny(bigGroup); });
+	int64_t const eventSet = measure([&]() { return set.Wait(); });
+
+	printf("\tRe-wait on %d events, round trip: Event::WaitAny %" SPRAWL_I64FMT "d ns, EventSet %" SPRAWL_I64FMT "d ns\n", groupSize, waitAny, eventSet);
+}
@@ -1,6 +1,11 @@
 #define SPRAWL_CONCURRENT_QUEUE_DEBUG_ASSERTS 1
 
 #include "../../collections/ConcurrentQueue.hpp"
+#include "../../collections/BlockingConcurrentQueue.hpp"
+#include "../../collections/SPSCQueue.hpp"
+#include "../../collections/IntrusiveMPSCQueue.hpp"
+#include "../../collections/ConcurrentPriorityQueue.hpp"
+#include "../../collections/WorkStealingDeque.hpp"
 #include "../../collections/List.hpp"
 #include <gtest/gtest.h>
 #include "../../collections/HashMap.hpp"
@@ -216,5 +221,745 @@ namespace ConcurrentQueue
 		delete queueSlow;
 	}
 #endif
+
+	const int numBulkInsertsPerThread = 100000;
+	const int bulkBlockSize = 1000;
+	sprawl::collections::ConcurrentQueue<int, bulkBlockSize>* queueBulk;
+
+	void EnqueueBulk(int startingPoint)
+	{
+		int values[97];
+		int batchSize = 1;
+		int i = startingPoint;
+		while(i < startingPoint + numBulkInsertsPerThread)
+		{
+			int count = 0;
+			for(; count < batchSize && i < startingPoint + numBulkInsertsPerThread; ++count, ++i)
+			{
+				values[count] = i;
+			}
+			queueBulk->EnqueueBulk(values, values + count);
+			// Vary the batch size so runs straddle buffer boundaries at different offsets.
+			batchSize = batchSize % 97 + 1;
+		}
+	}
+
+	void DequeueBulk()
+	{
+		sprawl::collections::BasicHashMap<int, int> localResults;
+		sprawl::collections::ConcurrentQueue<int, bulkBlockSize>::ReadReservationTicket ticket;
+		queueBulk->InitializeReservationTicket(ticket);
+		int values[64];
+		int received = 0;
+		bool single = false;
+		while(received < numBulkInsertsPerThread)
+		{
+			// Alternate between bulk and single dequeues to make sure they agree on the state of the ticket.
+			if(single)
+			{
+				if(queueBulk->Dequeue(values[0], ticket))
+				{
+					++localResults[values[0]];
+					++received;
+				}
+			}
+			else
+			{
+				size_t max = size_t(numBulkInsertsPerThread - received) < 64 ? size_t(numBulkInsertsPerThread - received) : 64;
+				size_t count = queueBulk->DequeueBulk(values, max, ticket);
+				for(size_t idx = 0; idx < count; ++idx)
+				{
+					++localResults[values[idx]];
+				}
+				received += int(count);
+			}
+			single = !single;
+		}
+
+		sprawl::threading::ScopedLock lock(mtx);
+		for(auto& kvp : localResults)
+		{
+			results[kvp.Key()] += kvp.Value();
+		}
+	}
+
+#if 1
+	TEST_F(ConcurrentQueue, BulkOperationsWorkOnManyThreads)
+	{
+		queueBulk = new sprawl::collections::ConcurrentQueue<int, bulkBlockSize>();
+		results.Clear();
+
+		sprawl::collections::List<std::unique_ptr<sprawl::threading::Thread>> threads;
+		for(int i = 0; i < nThreads; ++i)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread(EnqueueBulk, numBulkInsertsPerThread * i)));
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread(DequeueBulk)));
+		}
+
+		for(auto& thread : threads)
+		{
+			thread->Start();
+		}
+		for(auto& thread : threads)
+		{
+			thread->Join();
+		}
+
+		for(int i = 0; i < numBulkInsertsPerThread * nThreads; ++i)
+		{
+			EXPECT_TRUE(results.Has(i)) << "Item " << i << " is missing.";
+			if(results.Has(i))
+				ASSERT_EQ(1, results.Get(i)) << "Item " << i << " dequeued more than once.";
+		}
+		int values[16];
+		sprawl::collections::ConcurrentQueue<int, bulkBlockSize>::ReadReservationTicket ticket;
+		queueBulk->InitializeReservationTicket(ticket);
+		ASSERT_EQ(size_t(0), queueBulk->DequeueBulk(values, 16, ticket)) << "Items were still in the queue?";
+
+		results.Clear();
+
+		delete queueBulk;
+	}
+#endif
+	constexpr int numBlockingInsertsPerThread = 10000;
+	sprawl::collections::BlockingConcurrentQueue<int, bulkBlockSize>* queueBlocking;
+
+	void EnqueueBlocking(int startingPoint)
+	{
+		for(int i = startingPoint; i < startingPoint + numBlockingInsertsPerThread; ++i)
+		{
+			queueBlocking->Enqueue(i);
+			// Sleep now and then so consumers actually run out of work and have to park.
+			if(i % 1000 == 0)
+			{
+				sprawl::this_thread::Sleep(sprawl::time::Resolution::Milliseconds);
+			}
+		}
+	}
+
+	void DequeueBlocking()
+	{
+		sprawl::collections::BasicHashMap<int, int> localResults;
+		sprawl::collections::BlockingConcurrentQueue<int, bulkBlockSize>::ReadReservationTicket ticket;
+		queueBlocking->InitializeReservationTicket(ticket);
+		for(int i = 0; i < numBlockingInsertsPerThread; ++i)
+		{
+			int j;
+			queueBlocking->DequeueWait(j, ticket);
+			++localResults[j];
+		}
+
+		sprawl::threading::ScopedLock lock(mtx);
+		for(auto& kvp : localResults)
+		{
+			results[kvp.Key()] += kvp.Value();
+		}
+	}
+
+#if 1
+	TEST_F(ConcurrentQueue, BlockingDequeueWorksOnManyThreads)
+	{
+		queueBlocking = new sprawl::collections::BlockingConcurrentQueue<int, bulkBlockSize>();
+		results.Clear();
+
+		sprawl::collections::List<std::unique_ptr<sprawl::threading::Thread>> threads;
+		for(int i = 0; i < nThreads; ++i)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread(DequeueBlocking)));
+		}
+		for(auto& thread : threads)
+		{
+			thread->Start();
+		}
+
+		// Give the consumers time to park on an empty queue before anything is enqueued.
+		sprawl::this_thread::Sleep(50 * sprawl::time::Resolution::Milliseconds);
+
+		for(int i = 0; i < nThreads; ++i)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread(EnqueueBlocking, numBlockingInsertsPerThread * i)));
+			threads.Back()->Start();
+		}
+		for(auto& thread : threads)
+		{
+			thread->Join();
+		}
+
+		for(int i = 0; i < numBlockingInsertsPerThread * nThreads; ++i)
+		{
+			EXPECT_TRUE(results.Has(i)) << "Item " << i << " is missing.";
+			if(results.Has(i))
+				ASSERT_EQ(1, results.Get(i)) << "Item " << i << " dequeued more than once.";
+		}
+
+		results.Clear();
+
+		delete queueBlocking;
+	}
+
+	TEST_F(ConcurrentQueue, DequeueWaitForTimesOut)
+	{
+		sprawl::collections::BlockingConcurrentQueue<int> blockingQueue;
+		sprawl::collections::BlockingConcurrentQueue<int>::ReadReservationTicket ticket;
+		blockingQueue.InitializeReservationTicket(ticket);
+
+		int value = 0;
+		int64_t start = sprawl::time::SteadyNow();
+		ASSERT_FALSE(blockingQueue.DequeueWaitFor(value, ticket, 20 * sprawl::time::Resolution::Milliseconds));
+		ASSERT_GE(sprawl::time::SteadyNow() - start, 20 * sprawl::time::Resolution::Milliseconds);
+
+		blockingQueue.Enqueue(5);
+		ASSERT_TRUE(blockingQueue.DequeueWaitFor(value, ticket, 20 * sprawl::time::Resolution::Milliseconds));
+		ASSERT_EQ(5, value);
+
+		bool stop = true;
+		ASSERT_FALSE(blockingQueue.DequeueWait(value, ticket, [&stop](){ return stop; }));
+	}
+#endif
+	constexpr int numSPSCInserts = 1000000;
+	sprawl::collections::SPSCQueue<int, 64>* queueSPSC;
+	sprawl::collections::SPSCUnboundedQueue<int, 64>* queueSPSCUnbounded;
+	bool spscInOrder;
+
+	void EnqueueSPSC()
+	{
+		for(int i = 0; i < numSPSCInserts; ++i)
+		{
+			while(!queueSPSC->Enqueue(i))
+			{
+				sprawl::this_thread::Yield();
+			}
+		}
+	}
+
+	void DequeueSPSC()
+	{
+		for(int i = 0; i < numSPSCInserts; ++i)
+		{
+			int j;
+			while(!queueSPSC->Dequeue(j))
+			{
+				sprawl::this_thread::Yield();
+			}
+			if(j != i)
+			{
+				spscInOrder = false;
+			}
+		}
+	}
+
+	void EnqueueSPSCUnbounded()
+	{
+		for(int i = 0; i < numSPSCInserts; ++i)
+		{
+			queueSPSCUnbounded->Enqueue(i);
+		}
+	}
+
+	void DequeueSPSCUnbounded()
+	{
+		for(int i = 0; i < numSPSCInserts; ++i)
+		{
+			int j;
+			while(!queueSPSCUnbounded->Dequeue(j))
+			{
+			}
+			if(j != i)
+			{
+				spscInOrder = false;
+			}
+		}
+	}
+
+#if 1
+	TEST_F(ConcurrentQueue, SPSCQueueWorks)
+	{
+		queueSPSC = new sprawl::collections::SPSCQueue<int, 64>();
+		spscInOrder = true;
+
+		sprawl::threading::Thread producer(EnqueueSPSC);
+		sprawl::threading::Thread consumer(DequeueSPSC);
+		producer.Start();
+		consumer.Start();
+		producer.Join();
+		consumer.Join();
+
+		ASSERT_TRUE(spscInOrder) << "Items were dequeued out of order.";
+		int val;
+		ASSERT_FALSE(queueSPSC->Dequeue(val)) << "Items were still in the queue?";
+
+		for(int i = 0; i < 64; ++i)
+		{
+			ASSERT_TRUE(queueSPSC->Enqueue(i));
+		}
+		ASSERT_FALSE(queueSPSC->Enqueue(64)) << "Queue accepted more items than its capacity.";
+
+		delete queueSPSC;
+	}
+
+	TEST_F(ConcurrentQueue, SPSCUnboundedQueueWorks)
+	{
+		queueSPSCUnbounded = new sprawl::collections::SPSCUnboundedQueue<int, 64>();
+		spscInOrder = true;
+
+		sprawl::threading::Thread producer(EnqueueSPSCUnbounded);
+		sprawl::threading::Thread consumer(DequeueSPSCUnbounded);
+		producer.Start();
+		consumer.Start();
+		producer.Join();
+		consumer.Join();
+
+		ASSERT_TRUE(spscInOrder) << "Items were dequeued out of order.";
+		int val;
+		ASSERT_FALSE(queueSPSCUnbounded->Dequeue(val)) << "Items were still in the queue?";
+
+		delete queueSPSCUnbounded;
+	}
+
+	TEST_F(ConcurrentQueue, SPSCQueuesDestroyRemainingItems)
+	{
+		std::shared_ptr<int> item(new int(0));
+		{
+			sprawl::collections::SPSCQueue<std::shared_ptr<int>, 16> bounded;
+			sprawl::collections::SPSCUnboundedQueue<std::shared_ptr<int>, 16> unbounded;
+			for(int i = 0; i < 10; ++i)
+			{
+				bounded.Enqueue(item);
+			}
+			for(int i = 0; i < 100; ++i)
+			{
+				unbounded.Enqueue(item);
+			}
+			std::shared_ptr<int> out;
+			for(int i = 0; i < 50; ++i)
+			{
+				ASSERT_TRUE(unbounded.Dequeue(out));
+			}
+			out.reset();
+			ASSERT_EQ(61, item.use_count());
+		}
+		ASSERT_EQ(1, item.use_count());
+	}
+#endif
+	struct IntrusiveItem : public sprawl::collections::IntrusiveMPSCQueueNode
+	{
+		int producer;
+		int value;
+	};
+
+	constexpr int numIntrusiveInsertsPerThread = 100000;
+	sprawl::collections::IntrusiveMPSCQueue<IntrusiveItem>* queueIntrusive;
+	IntrusiveItem* intrusiveItems;
+
+	void EnqueueIntrusive(int producer)
+	{
+		IntrusiveItem* items = intrusiveItems + producer * numIntrusiveInsertsPerThread;
+		for(int i = 0; i < numIntrusiveInsertsPerThread; ++i)
+		{
+			items[i].producer = producer;
+			items[i].value = i;
+			queueIntrusive->Enqueue(&items[i]);
+		}
+	}
+
+#if 1
+	TEST_F(ConcurrentQueue, IntrusiveMPSCQueueWorks)
+	{
+		queueIntrusive = new sprawl::collections::IntrusiveMPSCQueue<IntrusiveItem>();
+		intrusiveItems = new IntrusiveItem[numIntrusiveInsertsPerThread * nThreads];
+
+		sprawl::collections::List<std::unique_ptr<sprawl::threading::Thread>> threads;
+		for(int i = 0; i < nThreads; ++i)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread(EnqueueIntrusive, i)));
+		}
+		for(auto& thread : threads)
+		{
+			thread->Start();
+		}
+
+		// Items from any single producer must come out in the order that producer enqueued them.
+		int nextExpected[nThreads] = {};
+		int received = 0;
+		while(received < numIntrusiveInsertsPerThread * nThreads)
+		{
+			IntrusiveItem* item = queueIntrusive->Dequeue();
+			if(item == nullptr)
+			{
+				sprawl::this_thread::Yield();
+				continue;
+			}
+			ASSERT_EQ(nextExpected[item->producer], item->value) << "Producer " << item->producer << " items dequeued out of order.";
+			++nextExpected[item->producer];
+			++received;
+		}
+
+		for(auto& thread : threads)
+		{
+			thread->Join();
+		}
+
+		ASSERT_EQ(nullptr, queueIntrusive->Dequeue()) << "Items were still in the queue?";
+
+		delete queueIntrusive;
+		delete[] intrusiveItems;
+	}
+#endif
+#if 1
+	TEST_F(ConcurrentQueue, ShrinkToFitReleasesSpareBuffers)
+	{
+		typedef sprawl::collections::ConcurrentQueue<int, 64> SmallQueue;
+		SmallQueue smallQueue;
+		ASSERT_EQ(size_t(1), smallQueue.BufferCount());
+		ASSERT_EQ(sizeof(SmallQueue::Buffer), smallQueue.RetainedBytes());
+
+		// This ticket never reads anything before the shrink, so it doesn't hold a reference to its buffer.
+		SmallQueue::ReadReservationTicket idleTicket;
+		smallQueue.InitializeReservationTicket(idleTicket);
+
+		SmallQueue::ReadReservationTicket ticket;
+		smallQueue.InitializeReservationTicket(ticket);
+		for(int i = 0; i < 64 * 10; ++i)
+		{
+			smallQueue.Enqueue(i);
+		}
+		ASSERT_EQ(size_t(10), smallQueue.BufferCount());
+		ASSERT_EQ(size_t(0), smallQueue.SpareBufferCount());
+
+		int val;
+		for(int i = 0; i < 64 * 10; ++i)
+		{
+			ASSERT_TRUE(smallQueue.Dequeue(val, ticket));
+			ASSERT_EQ(i, val);
+		}
+		// Enqueue a few more so every fully-read buffer gets retired.
+		for(int i = 0; i < 64; ++i)
+		{
+			smallQueue.Enqueue(i);
+		}
+		ASSERT_EQ(size_t(10), smallQueue.BufferCount()) << "Retired buffers should be reused, not reallocated.";
+		for(int i = 0; i < 64; ++i)
+		{
+			ASSERT_TRUE(smallQueue.Dequeue(val, ticket));
+		}
+		ASSERT_FALSE(smallQueue.Dequeue(val, ticket));
+		ASSERT_LT(size_t(0), smallQueue.SpareBufferCount());
+
+		smallQueue.SetMaxSpareBuffers(2);
+		smallQueue.ShrinkToFit();
+		ASSERT_EQ(size_t(2), smallQueue.SpareBufferCount());
+		size_t const countWithSpares = smallQueue.BufferCount();
+
+		// The failed dequeue above moved the read buffer into the first spare, so that one has to stay.
+		smallQueue.SetMaxSpareBuffers(0);
+		smallQueue.ShrinkToFit();
+		ASSERT_EQ(size_t(1), smallQueue.SpareBufferCount());
+		ASSERT_EQ(countWithSpares - 1, smallQueue.BufferCount());
+		ASSERT_EQ(smallQueue.BufferCount() * sizeof(SmallQueue::Buffer), smallQueue.RetainedBytes());
+
+		// Both tickets have to keep working after the shrink.
+		for(int i = 0; i < 64 * 3; ++i)
+		{
+			smallQueue.Enqueue(i);
+		}
+		for(int i = 0; i < 64 * 3; ++i)
+		{
+			ASSERT_TRUE(smallQueue.Dequeue(val, (i % 2) == 0 ? idleTicket : ticket));
+		}
+		ASSERT_FALSE(smallQueue.Dequeue(val, ticket));
+	}
+#endif
+#if 1
+	TEST_F(ConcurrentQueue, PriorityQueueWithOneHeapIsStrictlyOrdered)
+	{
+		sprawl::collections::ConcurrentPriorityQueue<int, std::greater<int>> queue(1);
+		sprawl::collections::PriorityQueueTicket ticket;
+		queue.InitializeTicket(ticket);
+		ASSERT_EQ(size_t(1), queue.HeapCount());
+
+		int const count = 1000;
+		for(int i = 0; i < count; ++i)
+		{
+			// 7 is coprime to 1000, so this pushes every value in [0, count) exactly once, out of order.
+			queue.Push((i * 7) % count, ticket);
+		}
+		ASSERT_EQ(size_t(count), queue.Size());
+
+		int val;
+		for(int i = 0; i < count; ++i)
+		{
+			ASSERT_TRUE(queue.Pop(val, ticket));
+			ASSERT_EQ(i, val);
+		}
+		ASSERT_FALSE(queue.Pop(val, ticket));
+		ASSERT_TRUE(queue.Empty());
+	}
+#endif
+
+#if 1
+	TEST_F(ConcurrentQueue, PriorityQueueWorksOnManyThreads)
+	{
+		int const producerCount = 4;
+		int const consumerCount = 4;
+		int const perProducer = 10000;
+		int const total = producerCount * perProducer;
+
+		sprawl::collections::ConcurrentPriorityQueue<int> queue(8);
+		std::unique_ptr<std::atomic<int>[]> seen(new std::atomic<int>[total]);
+		for(int i = 0; i < total; ++i)
+		{
+			seen[i] = 0;
+		}
+		std::atomic<int> popped(0);
+		std::atomic<int> producersDone(0);
+
+		sprawl::collections::List<std::unique_ptr<sprawl::threading::Thread>> threads;
+		for(int p = 0; p < producerCount; ++p)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread([&, p]()
+			{
+				sprawl::collections::PriorityQueueTicket ticket;
+				queue.InitializeTicket(ticket);
+				for(int i = 0; i < perProducer; ++i)
+				{
+					queue.Push(p * perProducer + i, ticket);
+				}
+				++producersDone;
+			})));
+		}
+		for(int c = 0; c < consumerCount; ++c)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread([&]()
+			{
+				sprawl::collections::PriorityQueueTicket ticket;
+				queue.InitializeTicket(ticket);
+				int val;
+				while(popped.load() < total)
+				{
+					if(queue.Pop(val, ticket))
+					{
+						++seen[val];
+						++popped;
+					}
+					else
+					{
+						sprawl::this_thread::Yield();
+					}
+				}
+			})));
+		}
+		for(auto& thread : threads)
+		{
+			thread->Start();
+		}
+		for(auto& thread : threads)
+		{
+			thread->Join();
+		}
+
+		ASSERT_EQ(producerCount, producersDone.load());
+		ASSERT_TRUE(queue.Empty());
+		for(int i = 0; i < total; ++i)
+		{
+			ASSERT_EQ(1, seen[i].load()) << "Element " << i << " was popped the wrong number of times.";
+		}
+	}
+#endif
+
+#if 1
+	TEST_F(ConcurrentQueue, PriorityQueueIsRoughlyOrdered)
+	{
+		// With several sub-heaps the order is relaxed, but draining a pre-filled queue from one thread should
+		// still come out close to sorted - nothing should come out far ahead of where it belongs.
+		sprawl::collections::ConcurrentPriorityQueue<int, std::greater<int>> queue(8);
+		int const count = 8000;
+		for(int i = 0; i < count; ++i)
+		{
+			queue.Push((i * 7) % count);
+		}
+
+		sprawl::collections::PriorityQueueTicket ticket;
+		queue.InitializeTicket(ticket);
+		int val;
+		int maxError = 0;
+		for(int i = 0; i < count; ++i)
+		{
+			ASSERT_TRUE(queue.Pop(val, ticket));
+			int const error = val > i ? val - i : i - val;
+			maxError = error > maxError ? error : maxError;
+		}
+		ASSERT_FALSE(queue.Pop(val, ticket));
+		ASSERT_GT(count / 10, maxError);
+	}
+#endif
+#if 1
+	TEST_F(ConcurrentQueue, WorkStealingDequeWorks)
+	{
+		int const total = 100000;
+		int const thiefCount = 3;
+
+		// Start small so the owner has to grow the deque while thieves are reading from it.
+		sprawl::collections::WorkStealingDeque<int*> deque(4);
+		std::unique_ptr<int[]> values(new int[total]);
+		std::unique_ptr<std::atomic<int>[]> seen(new std::atomic<int>[total]);
+		for(int i = 0; i < total; ++i)
+		{
+			values[i] = i;
+			seen[i] = 0;
+		}
+		std::atomic<int> taken(0);
+
+		auto take = [&](int* val)
+		{
+			++seen[*val];
+			++taken;
+		};
+
+		sprawl::collections::List<std::unique_ptr<sprawl::threading::Thread>> threads;
+		for(int t = 0; t < thiefCount; ++t)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread([&]()
+			{
+				int* val;
+				while(taken.load() < total)
+				{
+					if(deque.Steal(val))
+					{
+						take(val);
+					}
+					else
+					{
+						sprawl::this_thread::Yield();
+					}
+				}
+			})));
+		}
+		for(auto& thread : threads)
+		{
+			thread->Start();
+		}
+
+		// The owner pushes in bursts and pops some of each burst back off, so pops and steals race for the
+		// last element regularly.
+		int* val;
+		for(int i = 0; i < total; ++i)
+		{
+			deque.Push(&values[i]);
+			if(i % 3 == 0 && deque.Pop(val))
+			{
+				take(val);
+			}
+		}
+		while(deque.Pop(val))
+		{
+			take(val);
+		}
+		for(auto& thread : threads)
+		{
+			thread->Join();
+		}
+
+		ASSERT_TRUE(deque.Empty());
+		for(int i = 0; i < total; ++i)
+		{
+			ASSERT_EQ(1, seen[i].load()) << "Element " << i << " was taken the wrong number of times.";
+		}
+	}
+#endif
+#if 1
+	TEST_F(ConcurrentQueue, WorkStealingDequeReallocateWorks)
+	{
+		int values[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+		sprawl::collections::WorkStealingDeque<int*> deque(8);
+		for(int i = 0; i < 8; ++i)
+		{
+			deque.Push(&values[i]);
+		}
+		int* val;
+		ASSERT_TRUE(deque.Steal(val));
+		ASSERT_EQ(0, *val);
+
+		// Nothing moves or goes missing, and both ends still come out in order.
+		deque.Reallocate();
+		ASSERT_EQ(size_t(7), deque.Size());
+		ASSERT_TRUE(deque.Steal(val));
+		ASSERT_EQ(1, *val);
+		for(int i = 7; i >= 2; --i)
+		{
+			ASSERT_TRUE(deque.Pop(val));
+			ASSERT_EQ(i, *val);
+		}
+		ASSERT_FALSE(deque.Pop(val));
+
+		// And while thieves are reading from the old array.
+		int const total = 100000;
+		int const thiefCount = 3;
+		std::unique_ptr<int[]> stolenValues(new int[total]);
+		std::unique_ptr<std::atomic<int>[]> seen(new std::atomic<int>[total]);
+		for(int i = 0; i < total; ++i)
+		{
+			stolenValues[i] = i;
+			seen[i] = 0;
+		}
+		std::atomic<int> taken(0);
+
+		auto take = [&](int* value)
+		{
+			++seen[*value];
+			++taken;
+		};
+
+		sprawl::collections::List<std::unique_ptr<sprawl::threading::Thread>> threads;
+		for(int t = 0; t < thiefCount; ++t)
+		{
+			threads.PushBack(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread([&]()
+			{
+				int* value;
+				while(taken.load() < total)
+				{
+					if(deque.Steal(value))
+					{
+						take(value);
+					}
+					else
+					{
+						sprawl::this_thread::Yield();
+					}
+				}
+			})));
+		}
+		for(auto& thread : threads)
+		{
+			thread->Start();
+		}
+
+		for(int i = 0; i < total; ++i)
+		{
+			deque.Push(&stolenValues[i]);
+			if(i % 3 == 0 && deque.Pop(val))
+			{
+				take(val);
+			}
+			if(i % 1000 == 0)
+			{
+				deque.Reallocate();
+			}
+		}
+		while(deque.Pop(val))
+		{
+			take(val);
+		}
+		for(auto& thread : threads)
+		{
+			thread->Join();
+		}
+
+		ASSERT_TRUE(deque.Empty());
+		for(int i = 0; i < total; ++i)
+		{
+			ASSERT_EQ(1, seen[i].load()) << "Element " << i << " was taken the wrong number of times.";
+		}
+	}
+#endif
 }
 #endif
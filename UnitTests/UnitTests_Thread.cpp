@@ -8,9 +8,19 @@
 #include "../threading/threadmanager.hpp"
 #include "../threading/threadlocal.hpp"
 #include "../threading/coroutine.hpp"
+#include "../threading/taskgraph.hpp"
+#include "../threading/future.hpp"
+#include "../threading/barrier.hpp"
+#include "../threading/fiber.hpp"
+#include "../threading/task.hpp"
 
 #include <unordered_map>
 #include <unordered_set>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <string.h>
 
 #include "gtest_helpers.hpp"
 #include <gtest/gtest.h>
@@ -243,6 +253,1180 @@ TEST(ThreadingTest, ThreadManagerWorks)
 	EXPECT_EQ(100, k) << "ThreadManager failed to properly increment k";
 }
 
+TEST(ThreadingTest, WorkStealingThreadManagerWorks)
+{
+	int const fanOut = 8;
+	int const depth = 4;
+	int const leafCount = fanOut * fanOut * fanOut * fanOut;
+
+	sprawl::threading::ThreadManager stealingManager;
+	stealingManager.SetWorkStealing(true);
+	stealingManager.AddThreads(1, 4);
+
+	// Every leaf task plus the future task counts down; whoever reaches zero stops the manager.
+	std::atomic<int> remaining(leafCount + 1);
+	std::atomic<int> leavesRun(0);
+	std::atomic<bool> futureRan(false);
+
+	auto finishOne = [&]()
+	{
+		if(--remaining == 0)
+		{
+			stealingManager.Stop();
+		}
+	};
+
+	// Each task fans out from inside a worker, so the children land on that worker's own deque and the
+	// other workers only get them by stealing.
+	std::function<void(int)> spawn = [&](int level)
+	{
+		if(level == 0)
+		{
+			++leavesRun;
+			finishOne();
+			return;
+		}
+		for(int i = 0; i < fanOut; ++i)
+		{
+			stealingManager.AddTask(std::bind(spawn, level - 1), 1);
+		}
+	};
+
+	stealingManager.AddTask(std::bind(spawn, depth), 1);
+	stealingManager.AddFutureTask([&]()
+	{
+		futureRan = true;
+		finishOne();
+	}, 1, 100 * sprawl::time::Resolution::Milliseconds);
+
+	stealingManager.Run(0);
+	stealingManager.ShutDown();
+
+	EXPECT_EQ(leafCount, leavesRun.load());
+	EXPECT_TRUE(futureRan.load()) << "Future tasks should still run through the timer path in work-stealing mode";
+}
+
+TEST(ThreadingTest, FutureTaskCancellationWorks)
+{
+	sprawl::threading::ThreadManager timedManager;
+	timedManager.AddThreads(1, 2);
+
+	std::atomic<bool> cancelledRan(false);
+	std::atomic<bool> keptRan(false);
+	std::atomic<bool> farRan(false);
+	std::atomic<bool> farCancelled(false);
+
+	sprawl::threading::ThreadManager::TaskHandle cancelled = timedManager.AddFutureTask([&]() { cancelledRan = true; }, 1, 50 * sprawl::time::Resolution::Milliseconds);
+	sprawl::threading::ThreadManager::TaskHandle kept = timedManager.AddFutureTask([&]() { keptRan = true; }, 1, 50 * sprawl::time::Resolution::Milliseconds);
+	EXPECT_TRUE(cancelled.Cancel());
+	EXPECT_FALSE(cancelled.Cancel()) << "A task can only be cancelled once";
+
+	// This one will already be sitting in the mailman's timer wheel by the time it's cancelled.
+	sprawl::threading::ThreadManager::TaskHandle far = timedManager.AddFutureTask([&]() { farRan = true; }, 1, 10 * sprawl::time::Resolution::Seconds);
+	timedManager.AddFutureTask([&]() { farCancelled = far.Cancel(); }, 1, 20 * sprawl::time::Resolution::Milliseconds);
+
+	timedManager.AddFutureTask([&]() { timedManager.Stop(); }, 1, 200 * sprawl::time::Resolution::Milliseconds);
+	timedManager.Run(0);
+	timedManager.ShutDown();
+
+	EXPECT_FALSE(cancelledRan.load());
+	EXPECT_TRUE(keptRan.load());
+	EXPECT_TRUE(farCancelled.load());
+	EXPECT_FALSE(farRan.load());
+	EXPECT_FALSE(kept.Cancel()) << "A task that already ran can't be cancelled";
+}
+
+TEST(ThreadingTest, InplaceTasksWork)
+{
+	std::shared_ptr<int> tracker(new int(0));
+	{
+		sprawl::threading::InplaceTask<64> task([tracker]() { ++*tracker; });
+		sprawl::threading::InplaceTask<64> moved(std::move(task));
+		EXPECT_FALSE(bool(task));
+		moved();
+		EXPECT_EQ(1, *tracker);
+		EXPECT_EQ(2, tracker.use_count());
+		moved = nullptr;
+		EXPECT_EQ(1, tracker.use_count()) << "Clearing an InplaceTask should destroy its callable";
+	}
+
+	sprawl::threading::ThreadManager inplaceManager;
+	inplaceManager.AddThreads(1, 2);
+
+	std::atomic<int> moveOnlyResult(0);
+	std::atomic<int> largeResult(0);
+	std::unique_ptr<int> moveOnly(new int(5));
+	inplaceManager.AddTask([&moveOnlyResult, moveOnly = std::move(moveOnly)]() { moveOnlyResult = *moveOnly; }, 1);
+
+	// Too big to store inline, so it goes through the std::function path instead.
+	int64_t large[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+	auto largeTask = [&largeResult, large]()
+	{
+		int64_t sum = 0;
+		for(auto value : large)
+		{
+			sum += value;
+		}
+		largeResult = int(sum);
+	};
+	static_assert(!sprawl::threading::ThreadManager::InlineTask::Fits<decltype(largeTask)>(), "Test callable should not fit inline");
+	inplaceManager.AddTask(largeTask, 1);
+
+	sprawl::threading::ThreadManager::Task compatTask = [tracker]() { ++*tracker; };
+	inplaceManager.AddTask(compatTask, 1);
+
+	inplaceManager.AddFutureTask([&]() { inplaceManager.Stop(); }, 1, 50 * sprawl::time::Resolution::Milliseconds);
+	inplaceManager.Run(0);
+	inplaceManager.ShutDown();
+
+	EXPECT_EQ(5, moveOnlyResult.load());
+	EXPECT_EQ(136, largeResult.load());
+	EXPECT_EQ(2, *tracker);
+	compatTask = nullptr;
+	EXPECT_EQ(1, tracker.use_count()) << "Finished tasks should release their callables";
+}
+
+TEST(ThreadingTest, BatchedTasksWork)
+{
+	sprawl::threading::ThreadManager batchManager;
+	batchManager.AddThreads(1, 3);
+
+	std::atomic<int> batchRun(0);
+	std::atomic<int> discardedRun(0);
+	std::atomic<int> rangeRun(0);
+	std::atomic<int64_t> indexSum(0);
+	std::atomic<int> indicesVisited(0);
+
+	{
+		sprawl::threading::ThreadManager::TaskBatch batch(batchManager);
+		for(int i = 0; i < 100; ++i)
+		{
+			batch.Add([&batchRun]() { ++batchRun; }, 1);
+		}
+		EXPECT_EQ(size_t(100), batch.Size());
+		batch.Submit();
+		EXPECT_TRUE(batch.Empty());
+
+		batch.Add([&discardedRun]() { ++discardedRun; }, 1);
+		// Dropping the batch without submitting discards what's in it.
+	}
+
+	std::vector<std::function<void()>> rangeTasks(50, [&rangeRun]() { ++rangeRun; });
+	batchManager.AddTasks(rangeTasks, 1);
+
+	int64_t const begin = 3;
+	int64_t const end = 1000;
+	batchManager.ParallelFor(begin, end, int64_t(64), [&](int64_t i)
+	{
+		indexSum += i;
+		++indicesVisited;
+	}, 1);
+
+	batchManager.AddFutureTask([&]() { batchManager.Stop(); }, 1, 100 * sprawl::time::Resolution::Milliseconds);
+	batchManager.Run(0);
+	batchManager.ShutDown();
+
+	EXPECT_EQ(100, batchRun.load());
+	EXPECT_EQ(0, discardedRun.load());
+	EXPECT_EQ(50, rangeRun.load());
+	EXPECT_EQ(int(end - begin), indicesVisited.load());
+	EXPECT_EQ((end - 1) * end / 2 - (begin - 1) * begin / 2, indexSum.load());
+}
+
+TEST(ThreadingTest, BatchedWorkStealingTasksWork)
+{
+	sprawl::threading::ThreadManager stealingManager;
+	stealingManager.SetWorkStealing(true);
+	stealingManager.AddThreads(1, 4);
+
+	int const outer = 64;
+	int const inner = 256;
+	std::atomic<int> remaining(outer * inner);
+
+	// Each worker-side ParallelFor lands on that worker's deque in one batch, for the others to steal.
+	stealingManager.ParallelFor(0, outer, 1, [&](int)
+	{
+		stealingManager.ParallelFor(0, inner, 16, [&](int)
+		{
+			if(--remaining == 0)
+			{
+				stealingManager.Stop();
+			}
+		}, 1);
+	}, 1);
+
+	stealingManager.Run(0);
+	stealingManager.ShutDown();
+
+	EXPECT_EQ(0, remaining.load());
+}
+
+TEST(ThreadingTest, TaskGraphWorks)
+{
+	sprawl::threading::ThreadManager graphManager;
+	graphManager.AddThreads(1, 4);
+	graphManager.Start(0);
+
+	// A fan-out/fan-in diamond followed by a short chain, plus one node with no dependencies at all.
+	int const middleCount = 8;
+	int const nodeCount = middleCount + 6;
+	std::atomic<int> sequence(0);
+	std::vector<int> order(nodeCount, -1);
+	std::vector<std::pair<size_t, size_t>> edges;
+
+	sprawl::threading::TaskGraph graph;
+	std::vector<sprawl::threading::TaskGraph::NodeId> ids;
+	for(int i = 0; i < nodeCount; ++i)
+	{
+		ids.push_back(graph.AddNode([&sequence, &order, i]() { order[i] = sequence++; }, 1));
+	}
+	size_t const root = 0;
+	size_t const join = middleCount + 1;
+	for(int i = 1; i <= middleCount; ++i)
+	{
+		edges.emplace_back(root, i);
+		edges.emplace_back(i, join);
+	}
+	edges.emplace_back(join, join + 1);
+	edges.emplace_back(join + 1, join + 2);
+	edges.emplace_back(join + 2, join + 3);
+	for(auto& edge : edges)
+	{
+		graph.AddDependency(ids[edge.first], ids[edge.second]);
+	}
+
+	for(int frame = 0; frame < 20; ++frame)
+	{
+		sequence = 0;
+		std::fill(order.begin(), order.end(), -1);
+
+		graph.Submit(graphManager);
+		graph.Wait();
+		ASSERT_TRUE(graph.IsComplete());
+
+		for(int i = 0; i < nodeCount; ++i)
+		{
+			EXPECT_NE(-1, order[i]) << "Node " << i << " didn't run in frame " << frame;
+		}
+		for(auto& edge : edges)
+		{
+			EXPECT_LT(order[edge.first], order[edge.second]) << "Node " << edge.second << " ran before its dependency " << edge.first << " in frame " << frame;
+		}
+	}
+
+	graphManager.ShutDown();
+}
+
+TEST(ThreadingTest, FuturesWork)
+{
+	sprawl::threading::ThreadManager futureManager;
+	// A single worker, so a task waiting on another task's result can only finish if Get() helps out.
+	futureManager.AddThreads(1, 1);
+	futureManager.Start(0);
+
+	sprawl::threading::Future<int> answer = futureManager.AddTaskWithResult([]() { return 21; }, 1);
+	sprawl::threading::Future<int> doubled = answer.Then([](int value) { return value * 2; }, 1);
+	sprawl::threading::Future<std::string> described = doubled.Then([](int value) { return std::to_string(value); }, 1);
+	EXPECT_EQ(42, doubled.Get());
+	EXPECT_EQ("42", described.Get());
+	EXPECT_EQ(21, answer.Get());
+
+	std::atomic<bool> voidRan(false);
+	sprawl::threading::Future<void> done = futureManager.AddTaskWithResult([&voidRan]() { voidRan = true; }, 1);
+	sprawl::threading::Future<int> afterVoid = done.Then([]() { return 7; }, 1);
+	EXPECT_EQ(7, afterVoid.Get());
+	EXPECT_TRUE(voidRan.load());
+
+	// Continuations added after the result is ready still run.
+	EXPECT_EQ(8, answer.Then([](int value) { return value - 13; }, 1).Get());
+
+	sprawl::threading::Future<int64_t> chain = futureManager.AddTaskWithResult<int64_t>([]() { return 0; }, 1);
+	for(int i = 0; i < 100; ++i)
+	{
+		chain = chain.Then([](int64_t value) { return value + 1; }, 1);
+	}
+	EXPECT_EQ(100, chain.Get());
+
+	std::vector<sprawl::threading::Future<int>> parts;
+	for(int i = 0; i < 16; ++i)
+	{
+		parts.push_back(futureManager.AddTaskWithResult([i]() { return i; }, 1));
+	}
+	sprawl::threading::WhenAll(parts).Get();
+	int sum = 0;
+	for(auto& part : parts)
+	{
+		EXPECT_TRUE(part.IsReady());
+		sum += part.Get();
+	}
+	EXPECT_EQ(120, sum);
+
+	std::vector<sprawl::threading::Future<int>> racers;
+	racers.push_back(sprawl::threading::Future<int>());
+	racers.push_back(futureManager.AddTaskWithResult([]() { return 1; }, 1));
+	size_t const first = sprawl::threading::WhenAny(racers).Get();
+	EXPECT_EQ(size_t(1), first);
+
+	EXPECT_TRUE(sprawl::threading::WhenAll(std::vector<sprawl::threading::Future<int>>()).IsReady());
+
+	// Waiting inside the only worker: the inner task can only run if Get() runs it while it waits.
+	sprawl::threading::Future<int> nested = futureManager.AddTaskWithResult([&futureManager]()
+	{
+		sprawl::threading::Future<int> inner = futureManager.AddTaskWithResult([]() { return 5; }, 1);
+		return inner.Get() + 1;
+	}, 1);
+	EXPECT_EQ(6, nested.Get());
+
+	futureManager.ShutDown();
+}
+
+namespace FutureTestsStatic
+{
+	std::atomic<int> liveResults(0);
+
+	struct CountedResult
+	{
+		explicit CountedResult(int value_)
+			: value(value_)
+		{
+			++liveResults;
+		}
+
+		CountedResult(CountedResult const& other)
+			: value(other.value)
+		{
+			++liveResults;
+		}
+
+		~CountedResult()
+		{
+			--liveResults;
+		}
+
+		int value;
+	};
+}
+
+TEST(ThreadingTest, FuturesAreReleased)
+{
+	using FutureTestsStatic::CountedResult;
+	using FutureTestsStatic::liveResults;
+
+	{
+		sprawl::threading::ThreadManager futureManager;
+		futureManager.AddThreads(1, 1);
+		futureManager.Start(0);
+
+		// States are created on this thread and released on the worker; every one of them has to go away.
+		int64_t total = 0;
+		for(int i = 0; i < 100000; ++i)
+		{
+			total += futureManager.AddTaskWithResult([i]() { return CountedResult(i); }, 1).Then([](CountedResult const& result) { return CountedResult(result.value + 1); }, 1).Get().value;
+		}
+		EXPECT_EQ(int64_t(100000) * 100001 / 2, total);
+
+		// Waiting on a worker while the result is produced by a task that hasn't been queued yet.
+		sprawl::threading::Future<int> outer = futureManager.AddTaskWithResult([&futureManager]()
+		{
+			sprawl::threading::Future<int> later = futureManager.AddTaskWithResult([]() { return 1; }, 1).Then([](int value) { return value + 1; }, 1);
+			return later.Get() + 1;
+		}, 1);
+		EXPECT_EQ(3, outer.Get());
+
+		futureManager.ShutDown();
+	}
+	EXPECT_EQ(0, liveResults.load());
+
+	// A task dropped without running abandons its result and everything chained to it, instead of leaving their
+	// waiters hanging.
+	sprawl::threading::Future<CountedResult> chained;
+	{
+		sprawl::threading::ThreadManager neverStarted;
+		chained = neverStarted.AddTaskWithResult([]() { return CountedResult(1); }, 1).Then([](CountedResult const& result) { return CountedResult(result.value + 1); }, 1);
+		EXPECT_FALSE(chained.IsReady());
+	}
+	ASSERT_TRUE(chained.IsReady());
+	EXPECT_TRUE(chained.Abandoned());
+	chained.Wait();
+	chained = sprawl::threading::Future<CountedResult>();
+	EXPECT_EQ(0, liveResults.load());
+}
+
+TEST(ThreadingTest, AffinityAndPriorityWork)
+{
+	sprawl::threading::CpuSet const available = sprawl::threading::GetAvailableCpus();
+	ASSERT_FALSE(available.Empty());
+	EXPECT_EQ(available.Count(), sprawl::threading::GetCpuCount());
+	EXPECT_GE(sprawl::threading::GetNumaNodeCount(), size_t(1));
+
+	// Every available CPU belongs to exactly one core.
+	sprawl::collections::Vector<sprawl::threading::CpuSet> cores = sprawl::threading::GetPhysicalCores();
+	ASSERT_FALSE(cores.Empty());
+	sprawl::threading::CpuSet covered;
+	size_t coveredCount = 0;
+	for(auto& core : cores)
+	{
+		EXPECT_FALSE(core.Empty());
+		coveredCount += core.Count();
+		covered |= core;
+	}
+	EXPECT_EQ(available, covered);
+	EXPECT_EQ(available.Count(), coveredCount);
+
+	size_t const cpu = available.Next(0);
+	sprawl::threading::CpuSet seen;
+	bool prioritySet = false;
+	sprawl::threading::Thread pinned([&]()
+	{
+		seen = sprawl::this_thread::GetAffinity();
+		// Lowering priority never needs special permission.
+		prioritySet = sprawl::this_thread::SetPriority(sprawl::threading::ThreadPriority::Low);
+	});
+	pinned.SetAffinity(sprawl::threading::CpuSet::Single(cpu));
+	pinned.Start();
+	pinned.Join();
+	EXPECT_TRUE(prioritySet);
+#ifndef __APPLE__
+	EXPECT_EQ(sprawl::threading::CpuSet::Single(cpu), seen);
+#endif
+
+	// One worker per core, each held to its own core, in a low-priority group.
+	sprawl::threading::ThreadManager manager;
+	int const added = manager.AddThreadPerCore(1, 4);
+	EXPECT_EQ(int(cores.Size() < 4 ? cores.Size() : 4), added);
+	manager.SetGroupPriority(1, sprawl::threading::ThreadPriority::Low);
+	manager.Start(0);
+
+	std::atomic<int> remaining(added * 4);
+	std::atomic<int> misplaced(0);
+	sprawl::threading::Mutex doneMutex;
+	sprawl::threading::ConditionVariable done;
+	for(int i = 0; i < added * 4; ++i)
+	{
+		manager.AddTask([&]()
+		{
+			sprawl::threading::CpuSet const affinity = sprawl::this_thread::GetAffinity();
+			bool matchesCore = false;
+			for(auto& core : cores)
+			{
+				matchesCore = matchesCore || affinity == core;
+			}
+			if(!matchesCore)
+			{
+				++misplaced;
+			}
+			if(--remaining == 0)
+			{
+				sprawl::threading::ScopedLock lock(doneMutex);
+				done.NotifyAll();
+			}
+		}, 1);
+	}
+	{
+		sprawl::threading::SharedLock lock(doneMutex);
+		while(remaining.load() != 0)
+		{
+			done.Wait(lock);
+		}
+	}
+	manager.ShutDown();
+#ifndef __APPLE__
+	EXPECT_EQ(0, misplaced.load());
+#endif
+}
+
+TEST(ThreadingTest, MetricsAndTracingWork)
+{
+	sprawl::threading::ThreadManager manager;
+	manager.AddThreads(1, 2);
+	manager.SetMetricsEnabled(true);
+	manager.SetTracing(100);
+	manager.Start(2);
+
+	int const taskCount = 50;
+	std::atomic<int> run(0);
+	for(int i = 0; i < taskCount; ++i)
+	{
+		manager.AddTask([&run]() { ++run; }, 1);
+	}
+	manager.AddFutureTask([&run]() { ++run; }, 1, 5 * sprawl::time::Resolution::Milliseconds);
+
+	// The counters are updated just after each task returns, so wait on them rather than on the tasks themselves.
+	uint64_t counted = 0;
+	int64_t const deadline = sprawl::time::Now() + 10 * sprawl::time::Resolution::Seconds;
+	sprawl::threading::ThreadManager::Metrics metrics;
+	while(sprawl::time::Now() < deadline)
+	{
+		metrics = manager.GetMetrics();
+		counted = 0;
+		for(auto& thread : metrics.threads)
+		{
+			counted += thread.tasksRun;
+		}
+		if(counted == uint64_t(taskCount + 1))
+		{
+			break;
+		}
+		sprawl::this_thread::Sleep(sprawl::time::Resolution::Milliseconds);
+	}
+	EXPECT_EQ(taskCount + 1, run.load());
+	EXPECT_EQ(uint64_t(taskCount + 1), counted);
+
+	ASSERT_EQ(3, metrics.threads.Size());
+	for(auto& thread : metrics.threads)
+	{
+		if(thread.flags == 2)
+		{
+			EXPECT_EQ(uint64_t(0), thread.tasksRun);
+		}
+		EXPECT_GE(thread.maxWaitTime, int64_t(0));
+		EXPECT_LE(thread.maxWaitTime, thread.totalWaitTime);
+	}
+	for(auto& group : metrics.groups)
+	{
+		EXPECT_EQ(int64_t(0), group.queueDepth);
+		EXPECT_EQ(group.flags == 1 ? size_t(2) : size_t(1), group.threadCount);
+	}
+	EXPECT_EQ(uint64_t(taskCount + 1), metrics.tasksDelivered);
+	EXPECT_GE(metrics.maxMailmanLag, int64_t(0));
+
+	FILE* trace = tmpfile();
+	ASSERT_NE(nullptr, trace);
+	manager.WriteChromeTrace(trace);
+	long const size = ftell(trace);
+	rewind(trace);
+	std::string json(size_t(size), '\0');
+	ASSERT_EQ(size_t(size), fread(&json[0], 1, size_t(size), trace));
+	fclose(trace);
+	manager.ShutDown();
+
+	EXPECT_EQ(0u, json.find("{\"displayTimeUnit\""));
+	size_t taskEvents = 0;
+	for(size_t pos = json.find("\"ph\":\"X\""); pos != std::string::npos; pos = json.find("\"ph\":\"X\"", pos + 1))
+	{
+		++taskEvents;
+	}
+	EXPECT_EQ(size_t(taskCount + 1), taskEvents);
+	EXPECT_NE(std::string::npos, json.find("\"name\":\"thread_name\""));
+}
+
+TEST(ThreadingTest, DeadlineTasksWork)
+{
+	sprawl::threading::ThreadManager manager;
+	manager.AddThread(1);
+	manager.Start(2);
+
+	// Hold the only worker so everything below is queued up by the time it's free.
+	std::atomic<bool> open(false);
+	manager.AddTask([&open]()
+	{
+		while(!open)
+		{
+			sprawl::this_thread::Sleep(sprawl::time::Resolution::Milliseconds);
+		}
+	}, 1);
+	sprawl::this_thread::Sleep(10 * sprawl::time::Resolution::Milliseconds);
+
+	std::vector<int> order;
+	std::atomic<int> shed(0);
+	sprawl::threading::Mutex doneMutex;
+	sprawl::threading::ConditionVariable done;
+	bool finished = false;
+
+	int64_t const now = sprawl::time::Now();
+	int64_t const second = sprawl::time::Resolution::Seconds;
+	manager.AddTask([&]()
+	{
+		order.push_back(6);
+		sprawl::threading::ScopedLock lock(doneMutex);
+		finished = true;
+		done.NotifyAll();
+	}, 1);
+	manager.AddDeadlineTask([&order]() { order.push_back(5); }, 1, now + 50 * second);
+	manager.AddDeadlineTask([&order]() { order.push_back(3); }, 1, now + 30 * second);
+	manager.AddDeadlineTask([&order]() { order.push_back(1); }, 1, now + 10 * second);
+	manager.AddDeadlineTask([&order]() { order.push_back(4); }, 1, now + 40 * second);
+	manager.AddDeadlineTask([&order]() { order.push_back(0); }, 1, sprawl::threading::ThreadManager::c_noDeadline, 1);
+	manager.AddDeadlineTask([&order]() { order.push_back(2); }, 1, now + 20 * second);
+	// These two will be long past their deadlines by the time the worker gets to them.
+	manager.AddDeadlineTask([&order]() { order.push_back(-1); }, 1, now + sprawl::time::Resolution::Milliseconds, 0, [&shed]() { ++shed; });
+	manager.AddDeadlineTask([&order]() { order.push_back(-1); }, 1, now + sprawl::time::Resolution::Milliseconds, 5, [&shed]() { ++shed; });
+	sprawl::this_thread::Sleep(20 * sprawl::time::Resolution::Milliseconds);
+	open = true;
+
+	{
+		sprawl::threading::SharedLock lock(doneMutex);
+		while(!finished)
+		{
+			done.Wait(lock);
+		}
+	}
+	manager.ShutDown();
+
+	EXPECT_EQ(std::vector<int>({ 0, 1, 2, 3, 4, 5, 6 }), order);
+	EXPECT_EQ(2, shed.load());
+	EXPECT_EQ(uint64_t(2), manager.GetShedCount());
+}
+
+TEST(ThreadingTest, ElasticThreadsWork)
+{
+	int64_t const ms = sprawl::time::Resolution::Milliseconds;
+	sprawl::threading::ThreadManager manager;
+	manager.SetElastic(1, 1, 4, ms, 50 * ms);
+	manager.Start(2);
+	EXPECT_EQ(1, manager.GetActiveThreadCount(1));
+
+	auto waitFor = [](std::function<bool()> const& condition)
+	{
+		int64_t const giveUp = sprawl::time::Now() + 10 * sprawl::time::Resolution::Seconds;
+		while(!condition() && sprawl::time::Now() < giveUp)
+		{
+			sprawl::this_thread::Sleep(sprawl::time::Resolution::Milliseconds);
+		}
+	};
+
+	// A backlog of slow tasks should bring in every thread the group is allowed.
+	std::atomic<int> ran(0);
+	int maxSeen = 0;
+	for(int i = 0; i < 40; ++i)
+	{
+		manager.AddTask([&ran]() { sprawl::this_thread::Sleep(5 * sprawl::time::Resolution::Milliseconds); ++ran; }, 1);
+	}
+	waitFor([&]()
+	{
+		int const active = manager.GetActiveThreadCount(1);
+		maxSeen = active > maxSeen ? active : maxSeen;
+		return ran == 40;
+	});
+	EXPECT_EQ(40, ran.load());
+	EXPECT_EQ(4, maxSeen);
+
+	// Once it's drained, the extras retire.
+	waitFor([&]() { return manager.GetActiveThreadCount(1) == 1; });
+	EXPECT_EQ(1, manager.GetActiveThreadCount(1));
+
+	// Retired threads still hold places in the queue; work landing there must still get run.
+	for(int i = 0; i < 20; ++i)
+	{
+		manager.AddTask([&ran]() { ++ran; }, 1);
+	}
+	waitFor([&]() { return ran == 60; });
+	EXPECT_EQ(60, ran.load());
+
+	manager.ShutDown();
+}
+
+TEST(ThreadingTest, ElasticThreadsGrowWhileBusy)
+{
+	int64_t const ms = sprawl::time::Resolution::Milliseconds;
+	auto waitFor = [](std::function<bool()> const& condition)
+	{
+		int64_t const giveUp = sprawl::time::Now() + 10 * sprawl::time::Resolution::Seconds;
+		while(!condition() && sprawl::time::Now() < giveUp)
+		{
+			sprawl::this_thread::Sleep(sprawl::time::Resolution::Milliseconds);
+		}
+	};
+
+	// With no minimum, nothing runs until there's work, and a thread has to be started for it.
+	std::atomic<int> ran(0);
+	{
+		sprawl::threading::ThreadManager manager;
+		manager.SetElastic(1, 0, 2, ms, 20 * ms);
+		manager.Start(2);
+		EXPECT_EQ(0, manager.GetActiveThreadCount(1));
+
+		for(int i = 0; i < 10; ++i)
+		{
+			manager.AddTask([&ran]() { ++ran; }, 1);
+		}
+		waitFor([&]() { return ran == 10; });
+		EXPECT_EQ(10, ran.load());
+
+		waitFor([&]() { return manager.GetActiveThreadCount(1) == 0; });
+		EXPECT_EQ(0, manager.GetActiveThreadCount(1));
+
+		// And again once they've all retired.
+		manager.AddTask([&ran]() { ++ran; }, 1);
+		waitFor([&]() { return ran == 11; });
+		EXPECT_EQ(11, ran.load());
+
+		manager.ShutDown();
+	}
+
+	// The only running thread is stuck in a long task, so it never picks anything up to notice the backlog;
+	// the group has to grow from the queue alone.
+	{
+		sprawl::threading::ThreadManager manager;
+		manager.SetElastic(1, 1, 4, ms, 200 * ms);
+		manager.Start(2);
+
+		sprawl::threading::Event release;
+		std::atomic<bool> longStarted(false);
+		manager.AddTask([&]() { longStarted = true; release.Wait(); }, 1);
+		waitFor([&]() { return longStarted.load(); });
+		ASSERT_TRUE(longStarted.load());
+
+		ran = 0;
+		for(int i = 0; i < 10; ++i)
+		{
+			manager.AddTask([&ran]() { ++ran; }, 1);
+		}
+		waitFor([&]() { return ran == 10; });
+		EXPECT_EQ(10, ran.load()) << "Quick tasks shouldn't wait behind a long one while the group can still grow";
+		EXPECT_GE(manager.GetActiveThreadCount(1), 2);
+
+		release.Notify();
+		manager.ShutDown();
+	}
+}
+
+TEST(ThreadingTest, FibersWork)
+{
+	namespace fiber = sprawl::threading::fiber;
+
+	sprawl::threading::ThreadManager manager;
+	manager.SetWorkStealing(true);
+	manager.AddThreads(1, 4);
+	manager.Start(0);
+
+	// Far more fibers than threads, each one yielding and contending a lock partway through.
+	int const fiberCount = 10000;
+	fiber::Mutex mutex;
+	int counter = 0;
+	std::atomic<int> inFiber(0);
+	std::atomic<int> finished(0);
+	sprawl::threading::Event allFinished;
+	for(int i = 0; i < fiberCount; ++i)
+	{
+		fiber::Spawn(manager, 1, [&]()
+		{
+			if(fiber::InFiber())
+			{
+				++inFiber;
+			}
+			fiber::Yield();
+			mutex.Lock();
+			int const seen = counter;
+			fiber::Yield();
+			counter = seen + 1;
+			mutex.Unlock();
+			if(++finished == fiberCount)
+			{
+				allFinished.Notify();
+			}
+		});
+	}
+	allFinished.Wait();
+	EXPECT_EQ(fiberCount, counter);
+	EXPECT_EQ(fiberCount, inFiber.load());
+	EXPECT_FALSE(fiber::InFiber());
+
+	// Two fibers taking turns through a pair of events.
+	int const rounds = 1000;
+	fiber::Event ping;
+	fiber::Event pong;
+	std::atomic<int> pings(0);
+	std::atomic<int> pongs(0);
+	fiber::Event pongDone;
+	fiber::Spawn(manager, 1, [&]()
+	{
+		for(int i = 0; i < rounds; ++i)
+		{
+			ping.Wait();
+			EXPECT_EQ(pings.load(), pongs.load() + 1);
+			++pongs;
+			pong.Notify();
+		}
+		pongDone.Notify();
+	});
+	fiber::Spawn(manager, 1, [&]()
+	{
+		for(int i = 0; i < rounds; ++i)
+		{
+			++pings;
+			ping.Notify();
+			pong.Wait();
+		}
+	});
+
+	// A plain thread can wait on fiber primitives too.
+	pongDone.Wait();
+	EXPECT_EQ(rounds, pings.load());
+	EXPECT_EQ(rounds, pongs.load());
+
+	manager.ShutDown();
+}
+
+#if SPRAWL_COROUTINE_TASKS
+sprawl::threading::Task<int> AddOnWorker(sprawl::threading::ThreadManager& manager, int left, int right, sprawl::threading::Handle* ranOn)
+{
+	co_await manager.Schedule(1);
+	*ranOn = sprawl::this_thread::GetHandle();
+	co_return left + right;
+}
+
+sprawl::threading::Task<int> SumOnWorkers(sprawl::threading::ThreadManager& manager, int count)
+{
+	sprawl::threading::Handle ranOn;
+	int total = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		total += co_await AddOnWorker(manager, i, 1, &ranOn);
+	}
+	co_return total;
+}
+
+sprawl::threading::Task<> SleepOnWorker(sprawl::threading::ThreadManager& manager, int64_t nanoseconds, int64_t* slept)
+{
+	int64_t const start = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds);
+	co_await manager.SleepFor(1, nanoseconds);
+	*slept = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) - start;
+}
+
+sprawl::threading::Task<> CountAfterEvent(sprawl::threading::ThreadManager& manager, sprawl::threading::Event const& event, std::atomic<int>* count)
+{
+	co_await manager.WaitForEvent(event, 1);
+	++*count;
+}
+
+sprawl::threading::Task<int> SumGenerator(sprawl::threading::Generator<int>& generator)
+{
+	int total = 0;
+	while(std::optional<int> value = co_await sprawl::threading::Next(generator))
+	{
+		total += *value;
+	}
+	co_return total;
+}
+
+#if SPRAWL_EXCEPTIONS_ENABLED
+sprawl::threading::Task<int> ThrowOnWorker(sprawl::threading::ThreadManager& manager)
+{
+	co_await manager.Schedule(1);
+	throw std::runtime_error("task failed");
+}
+#endif
+
+TEST(ThreadingTest, TasksWork)
+{
+	sprawl::threading::ThreadManager manager;
+	manager.AddThreads(1, 2);
+	manager.Start(0);
+
+	sprawl::threading::Handle ranOn;
+	EXPECT_EQ(5, AddOnWorker(manager, 2, 3, &ranOn).Wait());
+	EXPECT_NE(sprawl::this_thread::GetHandle(), ranOn);
+	EXPECT_EQ(55, SumOnWorkers(manager, 10).Wait());
+
+	int64_t slept = 0;
+	SleepOnWorker(manager, 20 * sprawl::time::Resolution::Milliseconds, &slept).Wait();
+	EXPECT_GE(slept, 15 * sprawl::time::Resolution::Milliseconds);
+
+	// Each notification resumes one waiting task.
+	sprawl::threading::Event event;
+	std::atomic<int> count(0);
+	int const waiters = 3;
+	for(int i = 0; i < waiters; ++i)
+	{
+		CountAfterEvent(manager, event, &count).Detach();
+	}
+	for(int i = 1; i <= waiters; ++i)
+	{
+		event.Notify();
+		int64_t const deadline = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) + 5 * sprawl::time::Resolution::Seconds;
+		while(count.load() < i && sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) < deadline)
+		{
+			sprawl::this_thread::Sleep(sprawl::time::Resolution::Milliseconds);
+		}
+		EXPECT_EQ(i, count.load());
+	}
+	// An event that's already signaled doesn't suspend at all.
+	event.Notify();
+	CountAfterEvent(manager, event, &count).Wait();
+	EXPECT_EQ(waiters + 1, count.load());
+
+	// Tasks step through generators...
+	sprawl::threading::Generator<int> generator = numberGenerator(1);
+	EXPECT_EQ(4950, SumGenerator(generator).Wait());
+
+	// ...and generators, fibers, and other stackful code wait on tasks.
+	sprawl::threading::Generator<int> fromTasks([&]()
+	{
+		sprawl::threading::Handle unused;
+		for(int i = 0; i < 3; ++i)
+		{
+			sprawl::threading::Coroutine::Yield(AddOnWorker(manager, i, i, &unused).Wait());
+		}
+		return -1;
+	});
+	int expected = 0;
+	for(int value : fromTasks)
+	{
+		EXPECT_EQ(expected, value);
+		expected += 2;
+	}
+	EXPECT_EQ(6, expected);
+
+	sprawl::threading::Event fiberDone;
+	int fromFiber = 0;
+	sprawl::threading::fiber::Spawn(manager, 1, [&]()
+	{
+		fromFiber = SumOnWorkers(manager, 4).Wait();
+		fiberDone.Notify();
+	});
+	fiberDone.Wait();
+	EXPECT_EQ(10, fromFiber);
+
+#if SPRAWL_EXCEPTIONS_ENABLED
+	EXPECT_THROW(ThrowOnWorker(manager).Wait(), std::runtime_error);
+#endif
+
+	manager.ShutDown();
+}
+#endif
+
+TEST(ThreadingTest, FiberChannelsWork)
+{
+	namespace fiber = sprawl::threading::fiber;
+
+	sprawl::threading::ThreadManager manager;
+	manager.SetWorkStealing(true);
+	manager.AddThreads(1, 4);
+	manager.Start(0);
+
+	// Outlives the loop: the last consumer can still be inside Notify() when the main thread wakes up.
+	sprawl::threading::Event consumersDone;
+
+	// Unbuffered and buffered, several fibers sending to several fibers and a plain thread.
+	for(size_t capacity : { size_t(0), size_t(8) })
+	{
+		fiber::Channel<int64_t> channel(capacity);
+		int const producers = 8;
+		int const consumers = 4;
+		int const perProducer = 2000;
+		std::atomic<int> producersLeft(producers);
+		std::atomic<int64_t> received(0);
+		std::atomic<int64_t> receivedCount(0);
+		std::atomic<int> consumersLeft(consumers);
+
+		for(int i = 0; i < producers; ++i)
+		{
+			fiber::Spawn(manager, 1, [&, i]()
+			{
+				for(int j = 1; j <= perProducer; ++j)
+				{
+					EXPECT_TRUE(channel.Send(int64_t(i) * perProducer + j));
+				}
+				if(--producersLeft == 0)
+				{
+					channel.Close();
+				}
+			});
+		}
+
+		auto consume = [&]()
+		{
+			int64_t value;
+			while(channel.Receive(value))
+			{
+				received += value;
+				++receivedCount;
+			}
+			if(--consumersLeft == 0)
+			{
+				consumersDone.Notify();
+			}
+		};
+		for(int i = 0; i < consumers - 1; ++i)
+		{
+			fiber::Spawn(manager, 1, consume);
+		}
+		consume();
+		consumersDone.Wait();
+
+		int64_t const total = int64_t(producers) * perProducer;
+		EXPECT_EQ(total, receivedCount.load());
+		EXPECT_EQ(total * (total + 1) / 2, received.load());
+
+		int64_t value = 0;
+		EXPECT_FALSE(channel.Send(1));
+		EXPECT_FALSE(channel.Receive(value));
+	}
+
+	manager.ShutDown();
+}
+
+TEST(ThreadingTest, BarrierWorks)
+{
+	// A fan-in of 2 with 7 participants gives a lopsided three-level tree.
+	size_t const participantCount = 7;
+	int const rounds = 500;
+	sprawl::threading::Barrier barrier(participantCount, 2, 16);
+	std::atomic<int> arrived(0);
+	std::atomic<int> mismatches(0);
+
+	auto participate = [&](size_t index)
+	{
+		for(int round = 0; round < rounds; ++round)
+		{
+			++arrived;
+			barrier.Wait(index);
+			if(arrived.load() != (round + 1) * int(participantCount))
+			{
+				++mismatches;
+			}
+			barrier.Wait(index);
+		}
+	};
+
+	std::vector<std::unique_ptr<sprawl::threading::Thread>> threads;
+	for(size_t i = 1; i < participantCount; ++i)
+	{
+		threads.push_back(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread([&participate, i]() { participate(i); })));
+		threads.back()->Start();
+	}
+	participate(0);
+	for(auto& thread : threads)
+	{
+		thread->Join();
+	}
+	EXPECT_EQ(0, mismatches.load());
+
+	// Breaking releases whoever's waiting and fails every later wait.
+	sprawl::threading::Barrier broken(2);
+	sprawl::threading::Thread breaker([&broken]()
+	{
+		sprawl::this_thread::Sleep(10 * sprawl::time::Resolution::Milliseconds);
+		broken.Break();
+	});
+	breaker.Start();
+	EXPECT_FALSE(broken.Wait(0));
+	breaker.Join();
+	EXPECT_FALSE(broken.Wait(1));
+}
+
+TEST(ThreadingTest, StageTurnaroundLatency)
+{
+	int const stages = 200;
+	for(size_t threadCount = 2; threadCount <= 64; threadCount *= 2)
+	{
+		// Barrier alone, then a full empty RunNextStage() with the same number of threads (including the main one).
+		int64_t barrierTime;
+		{
+			sprawl::threading::Barrier barrier(threadCount);
+			std::vector<std::unique_ptr<sprawl::threading::Thread>> threads;
+			for(size_t i = 1; i < threadCount; ++i)
+			{
+				threads.push_back(std::unique_ptr<sprawl::threading::Thread>(new sprawl::threading::Thread([&barrier, i, stages]()
+				{
+					for(int round = 0; round < stages; ++round)
+					{
+						barrier.Wait(i);
+					}
+				})));
+				threads.back()->Start();
+			}
+			int64_t const start = sprawl::time::Now();
+			for(int round = 0; round < stages; ++round)
+			{
+				barrier.Wait(0);
+			}
+			barrierTime = sprawl::time::Now() - start;
+			for(auto& thread : threads)
+			{
+				thread->Join();
+			}
+		}
+
+		int64_t stageTime;
+		{
+			sprawl::threading::ThreadManager stageManager;
+			stageManager.SetMaxStage(1);
+			stageManager.AddThreads(1, int(threadCount) - 1);
+			stageManager.Start(2);
+			sprawl::threading::ThreadManager::ReservationTicket ticket;
+			int64_t const start = sprawl::time::Now();
+			for(int round = 0; round < stages; ++round)
+			{
+				stageManager.RunNextStage(ticket);
+			}
+			stageTime = sprawl::time::Now() - start;
+			stageManager.ShutDown();
+		}
+
+		printf("\tEmpty stage turnaround, %2d threads: barrier %" SPRAWL_I64FMT "d ns, RunNextStage %" SPRAWL_I64FMT "d ns\n",
+			int(threadCount), barrierTime / stages, stageTime / stages);
+	}
+	fflush(stdout);
+}
+
+template<typename t_SubmitType>
+static int64_t MeasureEmptyTasks(int taskCount, t_SubmitType const& submit)
+{
+	sprawl::threading::ThreadManager benchManager;
+	benchManager.AddThreads(1, 1);
+	benchManager.Start(0);
+
+	std::atomic<int> completed(0);
+	int64_t const start = sprawl::time::Now();
+	submit(benchManager, completed, taskCount);
+	while(completed.load(std::memory_order_acquire) != taskCount)
+	{
+		sprawl::this_thread::Yield();
+	}
+	int64_t const elapsed = sprawl::time::Now() - start;
+
+	benchManager.ShutDown();
+	return elapsed;
+}
+
+TEST(ThreadingTest, EmptyTaskThroughput)
+{
+	int const taskCount = 200000;
+
+	// Warm up the allocator and the task pools so neither run pays for first-touch page faults.
+	auto submitInline = [](sprawl::threading::ThreadManager& m, std::atomic<int>& completed, int count)
+	{
+		for(int i = 0; i < count; ++i)
+		{
+			m.AddTask([&completed]() { completed.fetch_add(1, std::memory_order_release); }, 1);
+		}
+	};
+	MeasureEmptyTasks(taskCount, submitInline);
+
+	int64_t const inlineTime = MeasureEmptyTasks(taskCount, submitInline);
+	int64_t const functionTime = MeasureEmptyTasks(taskCount, [](sprawl::threading::ThreadManager& m, std::atomic<int>& completed, int count)
+	{
+		for(int i = 0; i < count; ++i)
+		{
+			// Deliberately too large for std::function's small buffer, which is the allocation InplaceTask avoids.
+			int64_t padding[3] = { 0, 0, 0 };
+			m.AddTask(sprawl::threading::ThreadManager::Task([&completed, padding]() { completed.fetch_add(1 + int(padding[0]), std::memory_order_release); }), 1);
+		}
+	});
+	int64_t const batchTime = MeasureEmptyTasks(taskCount, [](sprawl::threading::ThreadManager& m, std::atomic<int>& completed, int count)
+	{
+		sprawl::threading::ThreadManager::TaskBatch batch(m);
+		for(int i = 0; i < count; ++i)
+		{
+			batch.Add([&completed]() { completed.fetch_add(1, std::memory_order_release); }, 1);
+			if(batch.Size() == 1024)
+			{
+				batch.Submit();
+			}
+		}
+		batch.Submit();
+	});
+
+	printf("\tEmpty task submit+execute, %d tasks: inline %" SPRAWL_I64FMT "d ns/task (%" SPRAWL_I64FMT "d tasks/sec), std::function %" SPRAWL_I64FMT "d ns/task (%" SPRAWL_I64FMT "d tasks/sec), batched %" SPRAWL_I64FMT "d ns/task (%" SPRAWL_I64FMT "d tasks/sec)\n",
+		taskCount,
+		inlineTime / taskCount, int64_t(taskCount) * sprawl::time::Resolution::Seconds / (inlineTime > 0 ? inlineTime : 1),
+		functionTime / taskCount, int64_t(taskCount) * sprawl::time::Resolution::Seconds / (functionTime > 0 ? functionTime : 1),
+		batchTime / taskCount, int64_t(taskCount) * sprawl::time::Resolution::Seconds / (batchTime > 0 ? batchTime : 1));
+	fflush(stdout);
+}
+
 #if SPRAWL_EXCEPTIONS_ENABLED
 void ThrowBadAlloc()
 {
@@ -665,6 +1849,273 @@ int TryYieldWrongType()
 	return 3;
 }
 
+TEST(CoroutineTest, SwitchLatency)
+{
+	int const roundTrips = 500000;
+	bool running = true;
+	sprawl::threading::Coroutine bounce([&running]()
+	{
+		while(running)
+		{
+			ASSERT_NO_SPRAWL_EXCEPT(sprawl::threading::Coroutine::Yield());
+		}
+	});
+
+	// Fault in the stack first.
+	for(int i = 0; i < 1000; ++i)
+	{
+		bounce.Resume();
+	}
+
+	int64_t const start = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds);
+	for(int i = 0; i < roundTrips; ++i)
+	{
+		bounce.Resume();
+	}
+	int64_t const elapsed = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) - start;
+
+	running = false;
+	bounce.Resume();
+	EXPECT_EQ(sprawl::threading::CoroutineState::Completed, bounce.State());
+
+	// The same ping-pong through a generator, which hands a value back on every round trip.
+	running = true;
+	sprawl::threading::Generator<int> counter([&running]()
+	{
+		int value = 0;
+		while(running)
+		{
+			ABORT_ON_SPRAWL_EXCEPT(sprawl::threading::Coroutine::Yield(value++));
+		}
+		return value;
+	});
+	for(int i = 0; i < 1000; ++i)
+	{
+		counter();
+	}
+
+	int64_t const generatorStart = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds);
+	int sum = 0;
+	for(int i = 0; i < roundTrips; ++i)
+	{
+		sum += counter();
+	}
+	int64_t const generatorElapsed = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) - generatorStart;
+
+	running = false;
+	counter();
+	EXPECT_EQ(sprawl::threading::CoroutineState::Completed, counter.State());
+	EXPECT_NE(0, sum);
+
+	// Each round trip is two switches: into the coroutine, and back out of it.
+	printf("\tCoroutine switch latency, %d round trips: %.1f ns/switch, generator %.1f ns/switch\n", roundTrips,
+		double(elapsed) / (2.0 * roundTrips), double(generatorElapsed) / (2.0 * roundTrips));
+	fflush(stdout);
+}
+
+TEST(CoroutineTest, StackPoolWorks)
+{
+	sprawl::threading::StackPool pool(2, true);
+	size_t const stackSize = 64 * 1024;
+
+	int ran = 0;
+	{
+		sprawl::threading::Coroutine first([&ran]() { ++ran; }, stackSize, &pool);
+		EXPECT_EQ(0u, pool.CachedCount());
+		first.Resume();
+	}
+	EXPECT_EQ(1, ran);
+	EXPECT_EQ(1u, pool.CachedCount());
+
+	// The next one of the same size reuses that stack; one of a different size doesn't.
+	{
+		sprawl::threading::Coroutine second([&ran]() { ++ran; }, stackSize, &pool);
+		EXPECT_EQ(0u, pool.CachedCount());
+		sprawl::threading::Coroutine third([&ran]() { ++ran; }, 4 * stackSize, &pool);
+		second.Resume();
+		third.Resume();
+	}
+	EXPECT_EQ(3, ran);
+	EXPECT_EQ(2u, pool.CachedCount());
+
+	// Past the limit, stacks are unmapped rather than kept.
+	{
+		sprawl::threading::Coroutine a([&ran]() { ++ran; }, stackSize, &pool);
+		sprawl::threading::Coroutine b([&ran]() { ++ran; }, stackSize, &pool);
+		sprawl::threading::Coroutine c([&ran]() { ++ran; }, stackSize, &pool);
+		a.Resume();
+		b.Resume();
+		c.Resume();
+	}
+	EXPECT_EQ(6, ran);
+	EXPECT_EQ(3u, pool.CachedCount());
+
+	pool.Trim();
+	EXPECT_EQ(0u, pool.CachedCount());
+}
+
+static int RecurseDeeply(int depth)
+{
+	volatile char padding[256];
+	padding[0] = char(depth);
+	if(depth == 1000000)
+	{
+		return padding[0];
+	}
+	return RecurseDeeply(depth + 1) + padding[0];
+}
+
+TEST(CoroutineDeathTest, StackOverflowHitsGuardPage)
+{
+	// Far deeper than the stack, so it runs off the end long before it would return.
+	EXPECT_DEATH(
+		{
+			sprawl::threading::Coroutine overflow([]() { RecurseDeeply(0); }, 16 * 1024);
+			overflow.Resume();
+		},
+		""
+	);
+}
+
+struct CopyCounted
+{
+	CopyCounted()
+		: value(0)
+	{
+		//
+	}
+
+	explicit CopyCounted(int value_)
+		: value(value_)
+	{
+		//
+	}
+
+	// Moves count too: with these declared, they turn into copies.
+	CopyCounted(CopyCounted const& other)
+		: value(other.value)
+	{
+		memcpy(payload, other.payload, sizeof(payload));
+		++copies;
+	}
+
+	CopyCounted& operator=(CopyCounted const& other)
+	{
+		value = other.value;
+		memcpy(payload, other.payload, sizeof(payload));
+		++copies;
+		return *this;
+	}
+
+	int value;
+	char payload[4096];
+
+	static int copies;
+};
+
+int CopyCounted::copies = 0;
+
+TEST(CoroutineTest, ZeroCopyChannelsWork)
+{
+	CopyCounted::copies = 0;
+	sprawl::threading::Generator<CopyCounted> generator([]()
+	{
+		for(int i = 1; i <= 10; ++i)
+		{
+			CopyCounted value(i);
+			ABORT_ON_SPRAWL_EXCEPT(sprawl::threading::Coroutine::YieldRef(value));
+		}
+		return CopyCounted(0);
+	});
+	int expected = 1;
+	for(CopyCounted& value : generator)
+	{
+		EXPECT_EQ(expected++, value.value);
+		EXPECT_EQ(0, CopyCounted::copies);
+	}
+	EXPECT_EQ(11, expected);
+
+	// Both directions at once: the coroutine bumps what it's sent in place and lends it back.
+	CopyCounted::copies = 0;
+	sprawl::threading::CoroutineWithChannel<CopyCounted, CopyCounted> bump([]()
+	{
+		CopyCounted first(0);
+		CopyCounted* received = &static_cast<CopyCounted&>(sprawl::threading::Coroutine::ReceiveRef<CopyCounted>(first));
+		for(;;)
+		{
+			++received->value;
+			received = &static_cast<CopyCounted&>(sprawl::threading::Coroutine::ReceiveRef<CopyCounted>(*received));
+		}
+		return CopyCounted(0);
+	});
+	EXPECT_EQ(0, bump.Start().value);
+	CopyCounted sent(5);
+	for(int i = 0; i < 3; ++i)
+	{
+		CopyCounted& reply = bump.SendRef(sent);
+		EXPECT_EQ(&sent, &reply);
+	}
+	EXPECT_EQ(8, sent.value);
+
+	int total = 0;
+	sprawl::threading::CoroutineWithChannel<CopyCounted, void> sink([&total]()
+	{
+		for(;;)
+		{
+			CopyCounted& received = sprawl::threading::Coroutine::Receive<CopyCounted>();
+			total += received.value;
+		}
+	});
+	sink.Start();
+	for(int i = 1; i <= 4; ++i)
+	{
+		CopyCounted value(i);
+		sink.SendRef(value);
+	}
+	EXPECT_EQ(10, total);
+	EXPECT_EQ(0, CopyCounted::copies);
+
+	// A pipeline stage over the large struct, lent versus copied.
+	int const count = 100000;
+	bool lend = false;
+	sprawl::threading::Generator<CopyCounted> source([&lend]()
+	{
+		CopyCounted value(0);
+		for(;;)
+		{
+			++value.value;
+			if(lend)
+			{
+				ABORT_ON_SPRAWL_EXCEPT(sprawl::threading::Coroutine::YieldRef(value));
+			}
+			else
+			{
+				ABORT_ON_SPRAWL_EXCEPT(sprawl::threading::Coroutine::Yield(value));
+			}
+		}
+		return value;
+	});
+	int64_t sum = 0;
+	int64_t const copyStart = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds);
+	for(int i = 0; i < count; ++i)
+	{
+		sum += source().value;
+	}
+	int64_t const copyElapsed = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) - copyStart;
+	lend = true;
+	int64_t const lendStart = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds);
+	for(int i = 0; i < count; ++i)
+	{
+		sum += source().value;
+	}
+	int64_t const lendElapsed = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) - lendStart;
+	EXPECT_EQ(int64_t(2 * count) * (2 * count + 1) / 2, sum);
+
+	printf("\tGenerator of %d-byte values, %d values: copied %.1f ns/value, lent %.1f ns/value\n", int(sizeof(CopyCounted)),
+		count, double(copyElapsed) / count, double(lendElapsed) / count);
+	fflush(stdout);
+}
+
 TEST(CoroutineTest, CoroutinesWithInvalidTypesProperlyThrowExceptions)
 {
 	//First test: A basic coroutine trying to yield a value, completely invalid coroutine type.
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "ConcurrentQueue.hpp"
+#include "../threading/eventcount.hpp"
+#include "../time/time.hpp"
+
+namespace sprawl
+{
+	namespace collections
+	{
+		template<typename t_ElementType, size_t t_BlockSize = 8192, typename t_AllocatorType = std::allocator<t_ElementType>>
+		class BlockingConcurrentQueue;
+	}
+}
+
+/**
+* @class   sprawl::collections::BlockingConcurrentQueue
+*
+* @brief   A ConcurrentQueue whose consumers can sleep until there's something to dequeue.
+*
+* @details Adds DequeueWait() and DequeueWaitFor() on top of the regular non-blocking interface, backed by a
+*          threading::EventCount. Consumers spin on the queue for a short, bounded number of attempts before
+*          parking, and producers only pay for a wake syscall when at least one consumer is actually parked -
+*          in the busy case an enqueue costs one extra fence and load over a plain ConcurrentQueue.
+*
+*          Because a failed Dequeue() leaves the element it reserved on the consumer's ticket, the element a
+*          producer writes belongs to one specific consumer, so a producer wakes every parked consumer rather
+*          than an arbitrary one. Consumers whose reserved element is still empty simply go back to sleep.
+*
+*          This requires linking against the threading library. Code that never waits should keep using
+*          ConcurrentQueue directly.
+*/
+template<typename t_ElementType, size_t t_BlockSize, typename t_AllocatorType>
+class sprawl::collections::BlockingConcurrentQueue : private sprawl::collections::ConcurrentQueue<t_ElementType, t_BlockSize, t_AllocatorType>
+{
+public:
+	typedef sprawl::collections::ConcurrentQueue<t_ElementType, t_BlockSize, t_AllocatorType> BaseType;
+	typedef typename BaseType::ReadReservationTicket ReadReservationTicket;
+
+	/**
+	* @brief   Construct a blocking queue.
+	*
+	* @param   maxConcurrentTicketlessReads   See ConcurrentQueue
+	* @param   spinCount                      Number of dequeue attempts a waiting consumer will make before it parks
+	*/
+	BlockingConcurrentQueue(size_t const maxConcurrentTicketlessReads = 0, int const spinCount = 100)
+		: BaseType(maxConcurrentTicketlessReads)
+		, m_eventCount()
+		, m_spinCount(spinCount)
+	{
+
+	}
+
+	using BaseType::InitializeReservationTicket;
+	using BaseType::Dequeue;
+	using BaseType::DequeueBulk;
+	using BaseType::SetMaxSpareBuffers;
+	using BaseType::ShrinkToFit;
+	using BaseType::BufferCount;
+	using BaseType::SpareBufferCount;
+	using BaseType::RetainedBytes;
+
+	/**
+	* @brief   Enqueue an item by reference, calling the copy constructor, and wake any parked consumers.
+	*
+	* @param   val   The value to equeue
+	*/
+	inline void Enqueue(t_ElementType const& val)
+	{
+		BaseType::Enqueue(val);
+		m_eventCount.NotifyAll();
+	}
+
+	/**
+	* @brief   Enqueue an item by rvalue, calling the move constructor, and wake any parked consumers.
+	*
+	* @param   val   The value to equeue
+	*/
+	inline void Enqueue(t_ElementType&& val)
+	{
+		BaseType::Enqueue(std::move(val));
+		m_eventCount.NotifyAll();
+	}
+
+	/**
+	* @brief   Enqueue a range of items and wake any parked consumers. Consumers are only notified once,
+	*          after the whole range has been written.
+	*
+	* @param   first   Iterator to the first item to enqueue. Must be at least a forward iterator.
+	* @param   last    Iterator one past the last item to enqueue.
+	*/
+	template<typename t_IteratorType>
+	inline void EnqueueBulk(t_IteratorType first, t_IteratorType last)
+	{
+		BaseType::EnqueueBulk(first, last);
+		m_eventCount.NotifyAll();
+	}
+
+	/**
+	* @brief   Dequeue an item, sleeping until one is available if the queue is empty.
+	*
+	* @details Same ticket rules as ConcurrentQueue::Dequeue(). Always returns true; the return value exists for
+	*          symmetry with the other waiting functions.
+	*
+	* @param   val      A reference to a value, which will be filled with the contents of the dequeued element.
+	* @param   ticket   A reservation ticket which will hold cached data to improve performance.
+	*
+	* @return  true
+	*/
+	inline bool DequeueWait(t_ElementType& val, ReadReservationTicket& ticket)
+	{
+		return DequeueWait(val, ticket, [](){ return false; });
+	}
+
+	/**
+	* @brief   Dequeue an item, sleeping until one is available or stopWaiting() returns true.
+	*
+	* @details stopWaiting() is checked after the consumer has announced that it's about to park, so any thread
+	*          that makes it return true and then calls NotifyWaiters() is guaranteed to wake this one.
+	*          Same ticket rules as ConcurrentQueue::Dequeue() - if this returns false, the ticket must be passed
+	*          back in later.
+	*
+	* @param   val           A reference to a value, which will be filled with the contents of the dequeued element, if any.
+	* @param   ticket        A reservation ticket which will hold cached data to improve performance.
+	* @param   stopWaiting   A callable returning bool; when it returns true, the wait is abandoned.
+	*
+	* @return  true if the dequeue succeeded and the value holds a valid item, false if stopWaiting() returned true.
+	*/
+	template<typename t_PredicateType>
+	inline bool DequeueWait(t_ElementType& val, ReadReservationTicket& ticket, t_PredicateType const& stopWaiting)
+	{
+		if (SPRAWL_LIKELY(spin_(val, ticket)))
+		{
+			return true;
+		}
+		for (;;)
+		{
+			uint32_t const key = m_eventCount.PrepareWait();
+			if (BaseType::Dequeue(val, ticket))
+			{
+				m_eventCount.CancelWait();
+				return true;
+			}
+			if (stopWaiting())
+			{
+				m_eventCount.CancelWait();
+				return false;
+			}
+			m_eventCount.Wait(key);
+			if (BaseType::Dequeue(val, ticket))
+			{
+				return true;
+			}
+		}
+	}
+
+	/**
+	* @brief   Dequeue an item, sleeping for up to the given amount of time until one is available if the queue is empty.
+	*
+	* @details Same ticket rules as ConcurrentQueue::Dequeue() - in particular, if this returns false, the ticket
+	*          must be passed back in later.
+	*
+	* @param   val           A reference to a value, which will be filled with the contents of the dequeued element, if any.
+	* @param   ticket        A reservation ticket which will hold cached data to improve performance.
+	* @param   nanoseconds   The maximum amount of time to wait
+	*
+	* @return  true if the dequeue succeeded and the value holds a valid item, false if the wait timed out.
+	*/
+	inline bool DequeueWaitFor(t_ElementType& val, ReadReservationTicket& ticket, int64_t nanoseconds)
+	{
+		return DequeueWaitFor(val, ticket, nanoseconds, [](){ return false; });
+	}
+
+	/**
+	* @brief   Combination of DequeueWaitFor() and the stopWaiting version of DequeueWait().
+	*
+	* @return  true if the dequeue succeeded and the value holds a valid item, false if the wait timed out
+	*          or stopWaiting() returned true.
+	*/
+	template<typename t_PredicateType>
+	inline bool DequeueWaitFor(t_ElementType& val, ReadReservationTicket& ticket, int64_t nanoseconds, t_PredicateType const& stopWaiting)
+	{
+		if (SPRAWL_LIKELY(spin_(val, ticket)))
+		{
+			return true;
+		}
+		int64_t const deadline = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+		for (;;)
+		{
+			uint32_t const key = m_eventCount.PrepareWait();
+			if (BaseType::Dequeue(val, ticket))
+			{
+				m_eventCount.CancelWait();
+				return true;
+			}
+			if (stopWaiting())
+			{
+				m_eventCount.CancelWait();
+				return false;
+			}
+			bool const notified = m_eventCount.WaitFor(key, deadline - sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds));
+			if (BaseType::Dequeue(val, ticket))
+			{
+				return true;
+			}
+			if (!notified)
+			{
+				return false;
+			}
+		}
+	}
+
+	/**
+	* @brief   Wake every consumer parked in one of the waiting functions without enqueuing anything, so they
+	*          can re-check their stopWaiting() condition.
+	*/
+	inline void NotifyWaiters()
+	{
+		m_eventCount.NotifyAll();
+	}
+
+private:
+	inline bool spin_(t_ElementType& val, ReadReservationTicket& ticket)
+	{
+		for (int i = 0; i < m_spinCount; ++i)
+		{
+			if (BaseType::Dequeue(val, ticket))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	SPRAWL_PAD_CACHELINE;
+	sprawl::threading::EventCount m_eventCount;
+	SPRAWL_PAD_CACHELINE;
+	int const m_spinCount;
+};
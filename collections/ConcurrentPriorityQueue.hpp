@@ -0,0 +1,425 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../common/compat.hpp"
+#include "../common/CachePad.hpp"
+#include "ConcurrentQueue.hpp"
+
+namespace sprawl
+{
+	namespace collections
+	{
+		struct PriorityQueueTicket;
+
+		template<typename t_ElementType, typename t_CompareType = std::less<t_ElementType>, typename t_AllocatorType = std::allocator<t_ElementType>>
+		class ConcurrentPriorityQueue;
+	}
+}
+
+/**
+* @struct  sprawl::collections::PriorityQueueTicket
+*
+* @brief   Per-thread state for ConcurrentPriorityQueue operations.
+*
+* @details Holds the index of the sub-heap the owning thread prefers to push to and pop from, and the state for
+*          the cheap random number generator used to pick other sub-heaps. A ticket must only be used by one
+*          thread at a time, but unlike a ReadReservationTicket it never holds anything in reserve, so it's
+*          fine to drop one and initialize another at any time.
+*
+* @warning You must call queue.InitializeTicket() on this before using it!
+*/
+struct sprawl::collections::PriorityQueueTicket
+{
+	PriorityQueueTicket()
+		: homeHeap(0)
+		, randomState(0)
+	{
+
+	}
+
+	size_t homeHeap;
+	uint64_t randomState;
+};
+
+/**
+* @class   sprawl::collections::ConcurrentPriorityQueue
+*
+* @brief   Relaxed multi-producer, multi-consumer priority queue.
+*
+* @details Rather than one heap behind one lock, this holds a number of independent sub-heaps, each with its own
+*          try-lock. Each thread pushes onto its "home" sub-heap, so producers on different threads generally
+*          don't touch each other's cache lines at all. Pops lock the home sub-heap plus one other sub-heap chosen
+*          at random and take the better of the two tops, which keeps the elements that come out close to the
+*          global order without every consumer fighting over a single top-of-heap.
+*
+*          The tradeoff is that ordering is approximate: Pop() returns *one of* the best elements rather than
+*          the single best one. With n sub-heaps, the element returned is in practice within a small multiple of
+*          n of the true top. Anything that needs strict ordering should either use a single sub-heap (at which
+*          point this is just a locked heap) or tolerate an element occasionally being handled slightly early.
+*
+*          If a push or pop can't get its preferred sub-heap's lock on the first try, it moves on to a different
+*          sub-heap rather than waiting. Pop() only returns false if it finds every sub-heap empty.
+*
+*          Ordering follows std::priority_queue - the element popped first is the one that compares greatest
+*          under t_CompareType. Use std::greater<> to pop the smallest element (e.g., the earliest deadline) first.
+*
+* @tparam  t_ElementType     The type of element to store in the queue
+*
+* @tparam  t_CompareType     Strict weak ordering over t_ElementType, as with std::priority_queue.
+*
+* @tparam  t_AllocatorType   An allocator class compatible with std::allocator. Used for the storage of the sub-heaps
+*                            themselves, and must support `rebind`.
+*/
+template<typename t_ElementType, typename t_CompareType, typename t_AllocatorType>
+class sprawl::collections::ConcurrentPriorityQueue
+{
+public:
+	typedef PriorityQueueTicket Ticket;
+
+	/**
+	* @brief   Construct a priority queue.
+	*
+	* @param   heapCount   The number of independent sub-heaps. More sub-heaps means less contention and looser
+	*                      ordering. This will be rounded up to a power of 2. If 0, twice the hardware thread count
+	*                      is used, which is the usual recommendation for this design. A count of 1 gives strict
+	*                      ordering.
+	* @param   compare     The comparison object to order elements with.
+	*/
+	explicit ConcurrentPriorityQueue(size_t heapCount = 0, t_CompareType const& compare = t_CompareType())
+		: m_heaps(nullptr)
+		, m_heapCount(0)
+		, m_heapMask(0)
+		, m_compare(compare)
+		, m_nextHomeHeap(0)
+		, m_heapAllocator()
+	{
+		if (heapCount == 0)
+		{
+			heapCount = std::thread::hardware_concurrency() * 2;
+			if (heapCount < 2)
+			{
+				heapCount = 2;
+			}
+		}
+		m_heapCount = detail::nextPowerOf2(heapCount);
+		m_heapMask = m_heapCount - 1;
+
+		m_heaps = m_heapAllocator.allocate(m_heapCount);
+		for (size_t i = 0; i < m_heapCount; ++i)
+		{
+			new(&m_heaps[i]) SubHeap();
+		}
+	}
+
+	~ConcurrentPriorityQueue()
+	{
+		for (size_t i = 0; i < m_heapCount; ++i)
+		{
+			m_heaps[i].~SubHeap();
+		}
+		m_heapAllocator.deallocate(m_heaps, m_heapCount);
+	}
+
+	/**
+	* @brief   Assign a home sub-heap to a ticket and seed its random number generator. Home sub-heaps are handed
+	*          out round-robin, so as long as there are no more tickets than sub-heaps, each thread gets its own.
+	*
+	* @param   ticket   The ticket to initialize
+	*/
+	void InitializeTicket(PriorityQueueTicket& ticket)
+	{
+		size_t const idx = m_nextHomeHeap.fetch_add(1, std::memory_order_relaxed);
+		ticket.homeHeap = idx & m_heapMask;
+		// Any odd seed will do; this just makes sure each ticket produces a different sequence.
+		ticket.randomState = (uint64_t(idx) + 1) * 0x9E3779B97F4A7C15ull;
+	}
+
+	/**
+	* @brief   Push an item by reference, calling the copy constructor. Will not fail (unless OOM).
+	*
+	* @param   val      The value to push
+	* @param   ticket   The calling thread's ticket
+	*/
+	inline void Push(t_ElementType const& val, PriorityQueueTicket& ticket)
+	{
+		SubHeap& heap = lockForPush_(ticket);
+		heap.items.push_back(val);
+		finishPush_(heap);
+	}
+
+	/**
+	* @brief   Push an item by rvalue, calling the move constructor. Will not fail (unless OOM).
+	*
+	* @param   val      The value to push
+	* @param   ticket   The calling thread's ticket
+	*/
+	inline void Push(t_ElementType&& val, PriorityQueueTicket& ticket)
+	{
+		SubHeap& heap = lockForPush_(ticket);
+		heap.items.push_back(std::move(val));
+		finishPush_(heap);
+	}
+
+	/**
+	* @brief   Push without a ticket. This is slower than using a ticket, since it has to pick a sub-heap via a
+	*          shared counter.
+	*
+	* @param   val   The value to push
+	*/
+	inline void Push(t_ElementType const& val)
+	{
+		PriorityQueueTicket ticket;
+		InitializeTicket(ticket);
+		Push(val, ticket);
+	}
+
+	/**
+	* @brief   Push without a ticket. This is slower than using a ticket, since it has to pick a sub-heap via a
+	*          shared counter.
+	*
+	* @param   val   The value to push
+	*/
+	inline void Push(t_ElementType&& val)
+	{
+		PriorityQueueTicket ticket;
+		InitializeTicket(ticket);
+		Push(std::move(val), ticket);
+	}
+
+	/**
+	* @brief   Pop one of the highest-priority items. See the class description for how close to the true top it is.
+	*
+	* @param   val      A reference to a value, which will be filled with the popped element, if any.
+	*                   The move assignment operator will be called on the value, if one exists.
+	* @param   ticket   The calling thread's ticket
+	*
+	* @return  true if an item was popped, false if every sub-heap was empty.
+	*/
+	inline bool Pop(t_ElementType& val, PriorityQueueTicket& ticket)
+	{
+		size_t first = ticket.homeHeap;
+		// A handful of sampled attempts before falling back to a scan. Each attempt that finds both candidates
+		// empty or locked moves on to a fresh pair.
+		for (size_t attempt = 0; attempt < c_sampleAttempts; ++attempt)
+		{
+			size_t second = nextRandom_(ticket) & m_heapMask;
+			if (second == first)
+			{
+				second = (second + 1) & m_heapMask;
+			}
+
+			SubHeap* a = tryLockNonEmpty_(m_heaps[first]);
+			SubHeap* b = tryLockNonEmpty_(m_heaps[second]);
+
+			SubHeap* best = a;
+			if (b != nullptr)
+			{
+				if (best == nullptr || m_compare(a->items.front(), b->items.front()))
+				{
+					best = b;
+				}
+			}
+
+			if (best != nullptr)
+			{
+				popFrom_(*best, val);
+			}
+			if (a != nullptr)
+			{
+				a->Unlock();
+			}
+			if (b != nullptr)
+			{
+				b->Unlock();
+			}
+			if (best != nullptr)
+			{
+				return true;
+			}
+
+			first = nextRandom_(ticket) & m_heapMask;
+		}
+
+		return popScan_(val, ticket);
+	}
+
+	/**
+	* @brief   Pop without a ticket. This is slower than using a ticket, since it has to pick sub-heaps via a
+	*          shared counter.
+	*
+	* @param   val   A reference to a value, which will be filled with the popped element, if any.
+	*
+	* @return  true if an item was popped, false if every sub-heap was empty.
+	*/
+	inline bool Pop(t_ElementType& val)
+	{
+		PriorityQueueTicket ticket;
+		InitializeTicket(ticket);
+		return Pop(val, ticket);
+	}
+
+	/**
+	* @brief   Approximate number of elements in the queue. Exact if no other thread is pushing or popping.
+	*/
+	size_t Size() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < m_heapCount; ++i)
+		{
+			total += m_heaps[i].size.load(std::memory_order_relaxed);
+		}
+		return total;
+	}
+
+	/**
+	* @brief   Approximate emptiness check. Exact if no other thread is pushing or popping.
+	*/
+	bool Empty() const
+	{
+		for (size_t i = 0; i < m_heapCount; ++i)
+		{
+			if (m_heaps[i].size.load(std::memory_order_relaxed) != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	* @brief   The number of sub-heaps, after rounding.
+	*/
+	size_t HeapCount() const
+	{
+		return m_heapCount;
+	}
+
+private:
+	ConcurrentPriorityQueue(ConcurrentPriorityQueue const& other) = delete;
+	ConcurrentPriorityQueue& operator=(ConcurrentPriorityQueue const& other) = delete;
+
+	constexpr static size_t c_sampleAttempts = 4;
+
+	struct SubHeap
+	{
+		SubHeap()
+			: locked(false)
+			, size(0)
+			, items()
+		{
+
+		}
+
+		inline bool TryLock()
+		{
+			return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+		}
+
+		inline void Lock()
+		{
+			while (!TryLock()) {}
+		}
+
+		inline void Unlock()
+		{
+			locked.store(false, std::memory_order_release);
+		}
+
+		SPRAWL_PAD_CACHELINE;
+		std::atomic<bool> locked;
+		// Written only while locked, but read without the lock by pops that want to skip empty sub-heaps.
+		std::atomic<size_t> size;
+		std::vector<t_ElementType, t_AllocatorType> items;
+		SPRAWL_PAD_CACHELINE;
+	};
+
+	inline uint64_t nextRandom_(PriorityQueueTicket& ticket)
+	{
+		// xorshift64* - plenty for choosing sub-heaps, and it's just a few instructions.
+		uint64_t x = ticket.randomState;
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		ticket.randomState = x;
+		return (x * 0x2545F4914F6CDD1Dull) >> 32;
+	}
+
+	inline SubHeap& lockForPush_(PriorityQueueTicket& ticket)
+	{
+		SubHeap* heap = &m_heaps[ticket.homeHeap];
+		while (SPRAWL_UNLIKELY(!heap->TryLock()))
+		{
+			heap = &m_heaps[nextRandom_(ticket) & m_heapMask];
+		}
+		return *heap;
+	}
+
+	inline void finishPush_(SubHeap& heap)
+	{
+		std::push_heap(heap.items.begin(), heap.items.end(), m_compare);
+		heap.size.store(heap.items.size(), std::memory_order_relaxed);
+		heap.Unlock();
+	}
+
+	inline SubHeap* tryLockNonEmpty_(SubHeap& heap)
+	{
+		if (heap.size.load(std::memory_order_relaxed) == 0 || !heap.TryLock())
+		{
+			return nullptr;
+		}
+		if (heap.items.empty())
+		{
+			heap.Unlock();
+			return nullptr;
+		}
+		return &heap;
+	}
+
+	inline void popFrom_(SubHeap& heap, t_ElementType& val)
+	{
+		std::pop_heap(heap.items.begin(), heap.items.end(), m_compare);
+		val = std::move(heap.items.back());
+		heap.items.pop_back();
+		heap.size.store(heap.items.size(), std::memory_order_relaxed);
+	}
+
+	SPRAWL_FORCE_NO_INLINE bool popScan_(t_ElementType& val, PriorityQueueTicket& ticket)
+	{
+		// Sampling kept missing, so either the queue is nearly empty or it's very contended. Walk every sub-heap,
+		// this time waiting for locks, so a false return really does mean everything was empty when we looked.
+		size_t const start = nextRandom_(ticket) & m_heapMask;
+		for (size_t i = 0; i < m_heapCount; ++i)
+		{
+			SubHeap& heap = m_heaps[(start + i) & m_heapMask];
+			if (heap.size.load(std::memory_order_relaxed) == 0)
+			{
+				continue;
+			}
+			heap.Lock();
+			if (!heap.items.empty())
+			{
+				popFrom_(heap, val);
+				heap.Unlock();
+				return true;
+			}
+			heap.Unlock();
+		}
+		return false;
+	}
+
+	SubHeap* m_heaps;
+	size_t m_heapCount;
+	size_t m_heapMask;
+	t_CompareType m_compare;
+	SPRAWL_PAD_CACHELINE;
+	std::atomic<size_t> m_nextHomeHeap;
+	SPRAWL_PAD_CACHELINE;
+
+	typename std::allocator_traits<t_AllocatorType>::template rebind_alloc<SubHeap> m_heapAllocator;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <iterator>
 #include <memory>
 #include <string.h>
 
@@ -223,6 +224,22 @@ public:
 		return m_readPos.fetch_add(1, std::memory_order_acq_rel);
 	}
 
+	/**
+	* @brief   Retrieve a contiguous run of elements for dequeue with a single atomic operation.
+	*
+	* @details Same rules as GetForRead(), except that the caller owns every element from the returned
+	*          pointer up to (returned pointer + count). Any portion of that run that is >= this->GetEnd()
+	*          is not valid to read from and must be ignored.
+	*
+	* @param   count   The number of elements to reserve
+	*
+	* @return  A pointer to the first reserved element.
+	*/
+	inline BufferElement* GetForRead(ptrdiff_t count)
+	{
+		return m_readPos.fetch_add(count, std::memory_order_acq_rel);
+	}
+
 	/**
 	* @brief   Retrieve a pointer to an element for enqueue.
 	*
@@ -239,6 +256,53 @@ public:
 		return m_writePos.fetch_add(1, std::memory_order_acq_rel);
 	}
 
+	/**
+	* @brief   Retrieve a contiguous run of elements for enqueue with a single atomic operation.
+	*
+	* @details Same rules as GetForWrite(), except that the caller owns every element from the returned
+	*          pointer up to (returned pointer + count). Any portion of that run that is >= this->GetEnd()
+	*          is not valid to write to, and the caller must write the remainder to the next buffer.
+	*
+	* @param   count   The number of elements to reserve
+	*
+	* @return  A pointer to the first reserved element.
+	*/
+	inline BufferElement* GetForWrite(ptrdiff_t count)
+	{
+		return m_writePos.fetch_add(count, std::memory_order_acq_rel);
+	}
+
+	/**
+	* @brief   Get an estimate of how many elements have been reserved for write but not yet reserved for read.
+	*
+	* @details This is only a hint - both positions can move while it's being calculated. It's used by bulk
+	*          dequeues to avoid reserving far more elements than have actually been written, since reserved
+	*          elements can only be read by the ticket that reserved them.
+	*
+	* @return  The estimated number of unread elements in this buffer, 0 if there are none.
+	*/
+	inline ptrdiff_t ApproximateUnreadCount() const
+	{
+		BufferElement* readPos = m_readPos.load(std::memory_order_relaxed);
+		BufferElement* writePos = m_writePos.load(std::memory_order_relaxed);
+		if (writePos > m_end)
+		{
+			writePos = const_cast<BufferElement*>(m_end);
+		}
+		return writePos > readPos ? writePos - readPos : 0;
+	}
+
+	/**
+	* @brief   Get a pointer to the first element of the buffer, ignoring the read and write positions.
+	*          Used by queues that track their own positions instead of using GetForRead()/GetForWrite().
+	*
+	* @return  A pointer to the start of the buffer.
+	*/
+	inline BufferElement* GetBegin()
+	{
+		return reinterpret_cast<BufferElement*>(m_buffer);
+	}
+
 	/**
 	* @brief   Get a pointer to the end of the queue. If a returned pointer is >= this value, it's not valid,
 	*          and a reallocation or call to GetNext() is required.
@@ -317,8 +381,12 @@ struct sprawl::collections::ReadReservationTicket
 {
 	detail::Buffer<t_ElementType, t_BlockSize>* buffer{ nullptr };
 	typename detail::Buffer<t_ElementType, t_BlockSize>::BufferElement* ptr{ nullptr };
+	// End of a run of elements reserved by DequeueBulk() that haven't been read yet; ptr is the first of them.
+	typename detail::Buffer<t_ElementType, t_BlockSize>::BufferElement* reservedEnd{ nullptr };
 	sprawl::collections::ConcurrentQueue<t_ElementType, t_BlockSize, t_AllocatorType>* queue{ nullptr };
 	int count{ 0 };
+	// The queue's ShrinkToFit() generation at the time buffer was last known to be safe to access.
+	uint32_t generation{ 0 };
 
 	ReadReservationTicket() {}
 
@@ -330,18 +398,28 @@ struct sprawl::collections::ReadReservationTicket
 	ReadReservationTicket(ReadReservationTicket&& other) noexcept
 		: buffer(other.buffer)
 		, ptr(other.ptr)
+		, reservedEnd(other.reservedEnd)
 		, queue(other.queue)
+		, count(other.count)
+		, generation(other.generation)
 	{
 		other.buffer = nullptr;
 		other.ptr = nullptr;
+		other.reservedEnd = nullptr;
+		other.count = 0;
 	}
 	ReadReservationTicket& operator=(ReadReservationTicket&& other) noexcept
 	{
 		buffer = other.buffer;
 		ptr = other.ptr;
+		reservedEnd = other.reservedEnd;
 		queue = other.queue;
+		count = other.count;
+		generation = other.generation;
 		other.buffer = nullptr;
 		other.ptr = nullptr;
+		other.reservedEnd = nullptr;
+		other.count = 0;
 		return *this;
 	}
 };
@@ -428,7 +506,7 @@ private:
 		t_ElementType item;
 	};
 
-	typename t_AllocatorType::template rebind<Element>::other m_allocator;
+	typename std::allocator_traits<t_AllocatorType>::template rebind_alloc<Element> m_allocator;
 
 	Element* m_buffer;
 	SPRAWL_PAD_CACHELINE;
@@ -525,6 +603,7 @@ private:
 		tail->SetNext(buffer);
 		buffer->SetNext(nullptr);
 		m_tail.store(buffer, std::memory_order_release);
+		m_spareBufferCount.fetch_add(1, std::memory_order_relaxed);
 	}
 
 	/**
@@ -569,14 +648,14 @@ private:
 	*          keeps the code for the COMMON case small, and the cost of a function call for the uncommon case
 	*          is largely irrelevant.
 	*/
-	SPRAWL_FORCE_NO_INLINE void fetchNextWriteBuffer_(typename Buffer::BufferElement*& element, Buffer*& buffer)
+	SPRAWL_FORCE_NO_INLINE void fetchNextWriteBuffer_(typename Buffer::BufferElement*& element, Buffer*& buffer, ptrdiff_t const count = 1)
 	{
 		// Just because we won the lottery, though, doesn't mean we're the only ones who won.
 		// Someone else may have already claimed the prize. We need to make sure we still
 		// need to do this before we actually do it.
 		// We do that by re-fetching the buffer and element and re-doing the above check.
 		buffer = m_writeBuffer.load(std::memory_order_acquire);
-		element = buffer->GetForWrite();
+		element = buffer->GetForWrite(count);
 
 		if (element >= buffer->GetEnd())
 		{
@@ -589,12 +668,17 @@ private:
 				// If we get nullptr back from this, then we actually need to allocate.
 				newBuffer = m_allocator.allocate(1);
 				new(newBuffer) Buffer();
+				m_bufferCount.fetch_add(1, std::memory_order_relaxed);
 				buffer->SetNext(newBuffer);
 				if (buffer == m_tail.load(std::memory_order_acquire))
 				{
 					m_tail.store(newBuffer, std::memory_order_release);
 				}
 			}
+			else
+			{
+				m_spareBufferCount.fetch_sub(1, std::memory_order_relaxed);
+			}
 			SPRAWL_CONCURRENT_QUEUE_ASSERT(newBuffer != buffer);
 			// Once we've either obtained or allocated the new buffer, we need to make sure
 			// the write position's set to the start of the queue, otherwise we'll just
@@ -611,7 +695,7 @@ private:
 			// as well so we can do this in a while loop
 			consumeUnlocked_(buffer);
 			buffer = newBuffer;
-			element = buffer->GetForWrite();
+			element = buffer->GetForWrite(count);
 		}
 	}
 
@@ -624,10 +708,10 @@ private:
 	*          keeps the code for the COMMON case small, and the cost of a function call for the uncommon case
 	*          is largely irrelevant.
 	*/
-	SPRAWL_FORCE_NO_INLINE bool fetchNextReadBuffer_(typename Buffer::BufferElement*& element, Buffer*& buffer, ReadReservationTicket& ticket)
+	SPRAWL_FORCE_NO_INLINE bool fetchNextReadBuffer_(typename Buffer::BufferElement*& element, Buffer*& buffer, ReadReservationTicket& ticket, ptrdiff_t const count = 1)
 	{
 		buffer = m_readBuffer.load(std::memory_order_acquire);
-		element = buffer->GetForRead();
+		element = buffer->GetForRead(count);
 
 		if (element >= buffer->GetEnd())
 		{
@@ -647,7 +731,7 @@ private:
 			m_readBuffer.store(nextBuffer, std::memory_order_release);
 			consumeUnlocked_(buffer);
 			buffer = nextBuffer;
-			element = buffer->GetForRead();
+			element = buffer->GetForRead(count);
 		}
 		// This bit allows us to be very efficient about reference counting
 		// by keeping the count on a non-shared variable and only performing operations on
@@ -665,6 +749,22 @@ private:
 		return true;
 	}
 
+	/**
+	* @brief   Bring a ticket up to date after a ShrinkToFit().
+	*
+	* @details A ticket that hasn't read anything from its buffer doesn't hold a reference to it, so ShrinkToFit()
+	*          may have freed that buffer out from under it. Such tickets are pointed back at the current read buffer.
+	*          Tickets that have read from their buffer are holding a reference to it, so it can't have been freed.
+	*/
+	SPRAWL_FORCE_NO_INLINE void refreshTicket_(ReadReservationTicket& ticket)
+	{
+		if (ticket.count == 0)
+		{
+			ticket.buffer = m_readBuffer.load(std::memory_order_acquire);
+		}
+		ticket.generation = m_generation.load(std::memory_order_acquire);
+	}
+
 	/**
 	* @brief   Retrieve the next element to write to.
 	*
@@ -702,6 +802,40 @@ private:
 		return *element;
 	}
 
+	/**
+	* @brief   Retrieve a contiguous run of elements to write to.
+	*
+	* @details Bulk version of getNextElement_(). Reserves up to count elements with a single atomic operation.
+	*          If the run crosses the end of the current write buffer, only the portion that fits is returned
+	*          and count is reduced to match; the caller is expected to call this again for the remainder,
+	*          which will then spill into the next buffer.
+	*
+	* @param   count   On input, the number of elements desired. On output, the number of elements actually reserved.
+	*
+	* @return  A pointer to the first of count viable write elements
+	*/
+	inline typename Buffer::BufferElement* getNextElements_(ptrdiff_t& count)
+	{
+		Buffer* buffer = m_writeBuffer.load(std::memory_order_acquire);
+		typename Buffer::BufferElement* element = buffer->GetForWrite(count);
+
+		while (SPRAWL_UNLIKELY(element >= buffer->GetEnd()))
+		{
+			if (!m_reallocatingBuffer.exchange(true, std::memory_order_seq_cst))
+			{
+				fetchNextWriteBuffer_(element, buffer, count);
+				m_reallocatingBuffer.store(false, std::memory_order_release);
+			}
+		}
+
+		ptrdiff_t const available = buffer->GetEnd() - element;
+		if (available < count)
+		{
+			count = available;
+		}
+		return element;
+	}
+
 public:
 
 	ConcurrentQueue(size_t const maxConcurrentTicketlessReads = 0)
@@ -711,6 +845,10 @@ public:
 		, m_tail(nullptr)
 		, m_subQueue(maxConcurrentTicketlessReads)
 		, m_failedReads(0)
+		, m_bufferCount(1)
+		, m_spareBufferCount(0)
+		, m_maxSpareBuffers(0)
+		, m_generation(0)
 	{
 		Buffer* buffer = m_allocator.allocate(1);
 		new(buffer) Buffer();
@@ -745,6 +883,101 @@ public:
 	{
 		ticket.buffer = m_readBuffer.load(std::memory_order_acquire);
 		ticket.queue = this;
+		ticket.generation = m_generation.load(std::memory_order_acquire);
+	}
+
+	/**
+	* @brief   Set the number of spare buffers ShrinkToFit() will keep around for reuse.
+	*
+	* @details Buffers that have been completely read are never freed during normal operation - they're moved to
+	*          the end of the buffer list and reused for later writes, so a queue under bursty load doesn't
+	*          keep returning memory to the allocator only to ask for it back. The flip side is that the queue
+	*          holds onto its peak footprint. This sets how many of those spare buffers survive a ShrinkToFit().
+	*
+	* @param   maxSpareBuffers   The number of spare buffers to retain. Defaults to 0.
+	*/
+	void SetMaxSpareBuffers(size_t const maxSpareBuffers)
+	{
+		m_maxSpareBuffers = maxSpareBuffers;
+	}
+
+	/**
+	* @brief   Free spare buffers in excess of the limit set by SetMaxSpareBuffers().
+	*
+	* @details Spare buffers can still be referenced by threads that are in the middle of an operation or by
+	*          tickets that haven't read anything yet, so this is NOT safe to call concurrently with any other
+	*          operation on the queue. Tickets that are still alive are fine - they'll notice the shrink the
+	*          next time they're used.
+	*/
+	void ShrinkToFit()
+	{
+		while (m_reallocatingBuffer.exchange(true, std::memory_order_seq_cst)) {}
+
+		// Everything after the write buffer is a spare. Keep the first m_maxSpareBuffers of them.
+		Buffer* last = m_writeBuffer.load(std::memory_order_acquire);
+		size_t kept = 0;
+
+		// A reader that finds the write buffer exhausted moves on to the next spare and reserves elements in it
+		// before any writer gets there, so the read buffer may be one of the spares. It and everything before it
+		// have to stay no matter what the limit is.
+		Buffer* const readBuffer = m_readBuffer.load(std::memory_order_acquire);
+		size_t ahead = 0;
+		for (Buffer* buffer = last->GetNext(); buffer != nullptr; buffer = buffer->GetNext())
+		{
+			++ahead;
+			if (buffer == readBuffer)
+			{
+				last = buffer;
+				kept = ahead;
+				break;
+			}
+		}
+
+		for (; kept < m_maxSpareBuffers && last->GetNext() != nullptr; ++kept)
+		{
+			last = last->GetNext();
+		}
+
+		Buffer* buffer = last->GetNext();
+		last->SetNext(nullptr);
+		m_tail.store(last, std::memory_order_release);
+
+		while (buffer)
+		{
+			Buffer* nextBuffer = buffer->GetNext();
+			buffer->~Buffer();
+			m_allocator.deallocate(buffer, 1);
+			m_bufferCount.fetch_sub(1, std::memory_order_relaxed);
+			m_spareBufferCount.fetch_sub(1, std::memory_order_relaxed);
+			buffer = nextBuffer;
+		}
+
+		m_generation.fetch_add(1, std::memory_order_release);
+		m_reallocatingBuffer.store(false, std::memory_order_release);
+	}
+
+	/**
+	* @brief   Get the number of buffers currently allocated by the queue, including spares.
+	*/
+	size_t BufferCount() const
+	{
+		return m_bufferCount.load(std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief   Get the number of buffers that have been completely read and are waiting to be reused.
+	*/
+	size_t SpareBufferCount() const
+	{
+		return m_spareBufferCount.load(std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief   Get the total number of bytes of buffer memory held by the queue, including spares.
+	*/
+	size_t RetainedBytes() const
+	{
+		return BufferCount() * sizeof(Buffer);
 	}
 
 	/**
@@ -773,6 +1006,39 @@ public:
 		element.ready.store(true, std::memory_order_release);
 	}
 
+	/**
+	* @brief   Enqueue a range of items, calling the copy constructor (or move constructor, if given move iterators).
+	*          Will not fail (unless OOM).
+	*
+	* @details Rather than performing one atomic reservation per element, this reserves the entire range
+	*          with a single atomic operation per buffer it touches. If the range doesn't fit in what's
+	*          left of the current write buffer, the remainder spills into the next one.
+	*
+	*          Items within the range are made available to consumers one at a time as they're constructed,
+	*          so consumers may begin reading the start of the range before the end of it has been written.
+	*
+	* @param   first   Iterator to the first item to enqueue. Must be at least a forward iterator.
+	* @param   last    Iterator one past the last item to enqueue.
+	*/
+	template<typename t_IteratorType>
+	inline void EnqueueBulk(t_IteratorType first, t_IteratorType last)
+	{
+		ptrdiff_t remaining = ptrdiff_t(std::distance(first, last));
+		while (remaining > 0)
+		{
+			ptrdiff_t count = remaining;
+			typename Buffer::BufferElement* element = getNextElements_(count);
+			typename Buffer::BufferElement* const end = element + count;
+			for (; element != end; ++element, ++first)
+			{
+				new(&element->item) t_ElementType(*first);
+				SPRAWL_CONCURRENT_QUEUE_ASSERT(element->ready.load() == false);
+				element->ready.store(true, std::memory_order_release);
+			}
+			remaining -= count;
+		}
+	}
+
 	/**
 	* @brief   Attempt to dequeue an item. Not guaranteed to succeed, as the queue may be empty.
 	*
@@ -809,6 +1075,13 @@ public:
 			// In this case we don't have to worry about acquiring the read buffer, because it's cached. We only have
 			// to do that if the current one is exhausted.
 
+			// If a ShrinkToFit() has happened since this ticket was last used, its buffer may not exist anymore.
+			if (SPRAWL_UNLIKELY(ticket.generation != m_generation.load(std::memory_order_relaxed)))
+			{
+				refreshTicket_(ticket);
+				buffer = ticket.buffer;
+			}
+
 			// Step one, get the next element and determine if the current buffer is exhausted!
 			element = buffer->GetForRead();
 			while (SPRAWL_UNLIKELY(element >= buffer->GetEnd()))
@@ -839,6 +1112,19 @@ public:
 			// Otherwise we'd just keep ending up reading the same cached element over and over.
 			ticket.ptr = nullptr;
 
+			// The exception is when DequeueBulk() left a run of reserved elements on the ticket - then we move on to the next one.
+			if (SPRAWL_UNLIKELY(ticket.reservedEnd != nullptr))
+			{
+				if (element + 1 < ticket.reservedEnd)
+				{
+					ticket.ptr = element + 1;
+				}
+				else
+				{
+					ticket.reservedEnd = nullptr;
+				}
+			}
+
 			// Increase the ticket's read count, which is used in the block above to perform bulk DecRefs
 			++ticket.count;
 
@@ -854,6 +1140,105 @@ public:
 		return false;
 	}
 
+	/**
+	* @brief   Attempt to dequeue up to max items at once. Not guaranteed to dequeue any, as the queue may be empty.
+	*
+	* @details Reserves a contiguous run of elements with a single atomic operation per buffer, and applies
+	*          the reference counting for the whole run to the ticket at once. The size of the run is limited
+	*          to the number of elements that appear to have been written, so a bulk dequeue on a nearly-empty
+	*          queue won't claim elements that other consumers could otherwise read.
+	*
+	*          The same rules apply to the ticket as for Dequeue(): if this returns fewer than max items, the
+	*          ticket may be holding reserved elements that haven't been written yet, and it MUST be passed back
+	*          into Dequeue() or DequeueBulk() later. Either function will read those elements first.
+	*
+	* @param   out      An output iterator that will be assigned each dequeued item, in order, via move.
+	* @param   max      The maximum number of items to dequeue.
+	* @param   ticket   A reservation ticket which will hold cached data to improve performance.
+	*
+	* @return  The number of items written to out.
+	*/
+	template<typename t_OutputIteratorType>
+	inline size_t DequeueBulk(t_OutputIteratorType out, size_t max, ReadReservationTicket& ticket)
+	{
+		size_t dequeued = 0;
+		while (dequeued < max)
+		{
+			typename Buffer::BufferElement* element = ticket.ptr;
+			typename Buffer::BufferElement* end;
+
+			if (SPRAWL_LIKELY(!element))
+			{
+				if (SPRAWL_UNLIKELY(ticket.generation != m_generation.load(std::memory_order_relaxed)))
+				{
+					refreshTicket_(ticket);
+				}
+				Buffer* buffer = ticket.buffer;
+				ptrdiff_t count = ptrdiff_t(max - dequeued);
+				ptrdiff_t const available = buffer->ApproximateUnreadCount();
+				if (available < count)
+				{
+					// Always reserve at least one, otherwise we'd never find out whether a new buffer is waiting.
+					count = available > 0 ? available : 1;
+				}
+
+				element = buffer->GetForRead(count);
+				while (SPRAWL_UNLIKELY(element >= buffer->GetEnd()))
+				{
+					// See comments in Dequeue()
+					if (!m_reallocatingBuffer.exchange(true, std::memory_order_seq_cst))
+					{
+						if (!fetchNextReadBuffer_(element, buffer, ticket, count))
+						{
+							m_reallocatingBuffer.store(false, std::memory_order_release);
+							return dequeued;
+						}
+						m_reallocatingBuffer.store(false, std::memory_order_release);
+					}
+				}
+				end = element + count;
+				if (end > buffer->GetEnd())
+				{
+					end = const_cast<typename Buffer::BufferElement*>(buffer->GetEnd());
+				}
+			}
+			else
+			{
+				// Left over from a previous failed read - either a run from a bulk read or a single element.
+				end = ticket.reservedEnd ? ticket.reservedEnd : element + 1;
+			}
+
+			typename Buffer::BufferElement* const start = element;
+			for (; element != end; ++element)
+			{
+				if (!element->ready.load(std::memory_order_acquire))
+				{
+					break;
+				}
+				*out = std::move(element->item);
+				++out;
+				element->item.~t_ElementType();
+				SPRAWL_CONCURRENT_QUEUE_ASSERT(element->ready.exchange(false) == true);
+			}
+
+			// One update to the ticket's batched reference count for the entire run.
+			ticket.count += int(element - start);
+			dequeued += size_t(element - start);
+
+			if (element != end)
+			{
+				// Hit an element that hasn't been written yet. Everything from here to the end of the run
+				// belongs to this ticket now, so we have to hold onto it.
+				ticket.ptr = element;
+				ticket.reservedEnd = end;
+				return dequeued;
+			}
+			ticket.ptr = nullptr;
+			ticket.reservedEnd = nullptr;
+		}
+		return dequeued;
+	}
+
 	/**
 	* @brief   Attempt to dequeue an item without passing in any tickets.
 	*
@@ -930,9 +1315,15 @@ private:
 	SPRAWL_PAD_CACHELINE;
 	std::atomic<ssize_t> m_failedReads;
 	SPRAWL_PAD_CACHELINE;
+	// Statistics and ShrinkToFit() state. Only modified when buffers are allocated, retired, or freed.
+	std::atomic<size_t> m_bufferCount;
+	std::atomic<size_t> m_spareBufferCount;
+	size_t m_maxSpareBuffers;
+	std::atomic<uint32_t> m_generation;
+	SPRAWL_PAD_CACHELINE;
 
 
-	typename t_AllocatorType::template rebind<Buffer>::other m_allocator;
+	typename std::allocator_traits<t_AllocatorType>::template rebind_alloc<Buffer> m_allocator;
 };
 
 template<typename t_ElementType, size_t t_BlockSize, typename t_AllocatorType>
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+
+#include "../common/compat.hpp"
+#include "../common/CachePad.hpp"
+
+namespace sprawl
+{
+	namespace collections
+	{
+		struct IntrusiveMPSCQueueNode;
+
+		template<typename t_ElementType>
+		class IntrusiveMPSCQueue;
+	}
+}
+
+/**
+* @struct  sprawl::collections::IntrusiveMPSCQueueNode
+*
+* @brief   Base class for anything that can be linked into an IntrusiveMPSCQueue.
+*
+* @details An object can only be in one IntrusiveMPSCQueue at a time, since the link lives in the object itself.
+*/
+struct sprawl::collections::IntrusiveMPSCQueueNode
+{
+	IntrusiveMPSCQueueNode()
+		: m_next(nullptr)
+	{
+
+	}
+
+	std::atomic<IntrusiveMPSCQueueNode*> m_next;
+};
+
+/**
+* @class   sprawl::collections::IntrusiveMPSCQueue
+*
+* @brief   Unbounded multi-producer, single-consumer queue that links elements through a pointer embedded
+*          in the elements themselves.
+*
+* @details t_ElementType must derive from IntrusiveMPSCQueueNode. The queue never allocates and never copies
+*          - Enqueue() is a single atomic exchange plus a store, and memory use is the same no matter how many
+*          elements are in flight, since each element carries its own link.
+*
+*          This is Dmitry Vyukov's intrusive MPSC algorithm. One consequence of it is that Dequeue() can return
+*          nullptr for a brief window while a producer is between its exchange and its store, even if other
+*          elements were enqueued before that one. Consumers should treat nullptr as "try again later", which
+*          the consumer of a work queue is generally doing anyway.
+*
+*          Enqueue() may be called from any number of threads. Dequeue() must only be called from one thread
+*          at a time. The queue doesn't own the elements - whatever is left in it on destruction is not freed.
+*/
+template<typename t_ElementType>
+class sprawl::collections::IntrusiveMPSCQueue
+{
+public:
+	IntrusiveMPSCQueue()
+		: m_head(&m_stub)
+		, m_tail(&m_stub)
+		, m_stub()
+	{
+
+	}
+
+	/**
+	* @brief   Link an element into the queue. Safe to call from any thread.
+	*
+	* @param   element   The element to enqueue. Must not currently be in any IntrusiveMPSCQueue.
+	*/
+	inline void Enqueue(t_ElementType* element)
+	{
+		enqueue_(static_cast<IntrusiveMPSCQueueNode*>(element));
+	}
+
+	/**
+	* @brief   Link a chain of elements into the queue with a single atomic exchange. Safe to call from any thread.
+	*
+	* @details The elements must already be linked to each other through m_next, from first to last. The whole
+	*          chain becomes visible to the consumer at once, in order, as if each element had been enqueued
+	*          individually with nothing from other producers in between.
+	*
+	* @param   first   The first element of the chain
+	* @param   last    The last element of the chain. May be the same as first.
+	*/
+	inline void EnqueueChain(t_ElementType* first, t_ElementType* last)
+	{
+		IntrusiveMPSCQueueNode* lastNode = static_cast<IntrusiveMPSCQueueNode*>(last);
+		lastNode->m_next.store(nullptr, std::memory_order_relaxed);
+		IntrusiveMPSCQueueNode* prev = m_head.exchange(lastNode, std::memory_order_acq_rel);
+		prev->m_next.store(static_cast<IntrusiveMPSCQueueNode*>(first), std::memory_order_release);
+	}
+
+	/**
+	* @brief   Unlink the oldest element from the queue. Must only be called from the consumer thread.
+	*
+	* @return  The dequeued element, or nullptr if the queue is empty (or momentarily appears empty because a
+	*          producer is mid-enqueue).
+	*/
+	inline t_ElementType* Dequeue()
+	{
+		IntrusiveMPSCQueueNode* tail = m_tail;
+		IntrusiveMPSCQueueNode* next = tail->m_next.load(std::memory_order_acquire);
+
+		// The stub sits in the queue whenever it would otherwise be empty. Skip past it.
+		if (tail == &m_stub)
+		{
+			if (next == nullptr)
+			{
+				return nullptr;
+			}
+			m_tail = next;
+			tail = next;
+			next = next->m_next.load(std::memory_order_acquire);
+		}
+
+		if (SPRAWL_LIKELY(next != nullptr))
+		{
+			m_tail = next;
+			return static_cast<t_ElementType*>(tail);
+		}
+
+		// tail is the last linked element. If it isn't also the head, a producer has exchanged the head
+		// but hasn't linked its element to tail yet - we'll see it on a later call.
+		if (tail != m_head.load(std::memory_order_acquire))
+		{
+			return nullptr;
+		}
+
+		// Otherwise tail really is the only element. Put the stub back behind it so we can unlink it.
+		enqueue_(&m_stub);
+		next = tail->m_next.load(std::memory_order_acquire);
+		if (next != nullptr)
+		{
+			m_tail = next;
+			return static_cast<t_ElementType*>(tail);
+		}
+		return nullptr;
+	}
+
+private:
+	IntrusiveMPSCQueue(IntrusiveMPSCQueue const& other) = delete;
+	IntrusiveMPSCQueue& operator=(IntrusiveMPSCQueue const& other) = delete;
+
+	inline void enqueue_(IntrusiveMPSCQueueNode* node)
+	{
+		node->m_next.store(nullptr, std::memory_order_relaxed);
+		IntrusiveMPSCQueueNode* prev = m_head.exchange(node, std::memory_order_acq_rel);
+		prev->m_next.store(node, std::memory_order_release);
+	}
+
+	SPRAWL_PAD_CACHELINE;
+	// Producers exchange themselves onto the head...
+	std::atomic<IntrusiveMPSCQueueNode*> m_head;
+	SPRAWL_PAD_CACHELINE;
+	// ...and the consumer follows the links from the tail.
+	IntrusiveMPSCQueueNode* m_tail;
+	IntrusiveMPSCQueueNode m_stub;
+	SPRAWL_PAD_CACHELINE;
+};
@@ -0,0 +1,335 @@
+#pragma once
+
+#include "ConcurrentQueue.hpp"
+
+namespace sprawl
+{
+	namespace collections
+	{
+		template<typename t_ElementType, size_t t_QueueSize>
+		class SPSCQueue;
+
+		template<typename t_ElementType, size_t t_BlockSize = 8192, typename t_AllocatorType = std::allocator<t_ElementType>>
+		class SPSCUnboundedQueue;
+	}
+}
+
+/**
+* @class   sprawl::collections::SPSCQueue
+*
+* @brief   Bounded queue for exactly one producer thread and exactly one consumer thread.
+*
+* @details Each side owns its own index and keeps a cached copy of the other side's index, only reloading
+*          it when the cached copy says the queue is full (for the producer) or empty (for the consumer).
+*          That means the common case is a relaxed load of its own index, the element copy, and a release
+*          store - no read-modify-write operations and no per-element ready flags. Producer and consumer
+*          state live on separate cache lines so the two threads don't invalidate each other's lines
+*          except when actually exchanging indices.
+*
+*          Calling Enqueue() from more than one thread, or Dequeue() from more than one thread, is undefined.
+*          Tickets aren't needed since a failed operation never reserves anything.
+*/
+template<typename t_ElementType, size_t t_QueueSize>
+class sprawl::collections::SPSCQueue
+{
+public:
+	SPSCQueue()
+		: m_writeIdx(0)
+		, m_cachedReadIdx(0)
+		, m_readIdx(0)
+		, m_cachedWriteIdx(0)
+	{
+
+	}
+
+	~SPSCQueue()
+	{
+		size_t const writeIdx = m_writeIdx.load(std::memory_order_acquire);
+		for (size_t idx = m_readIdx.load(std::memory_order_relaxed); idx != writeIdx; ++idx)
+		{
+			getElement_(idx)->~t_ElementType();
+		}
+	}
+
+	/**
+	* @brief   Enqueue an item by reference, calling the copy constructor. Will fail if the queue is full.
+	*          Must only be called from the producer thread.
+	*
+	* @param   val   The value to equeue
+	*
+	* @return  true if the element was successfully enqueued, false otherwise
+	*/
+	inline bool Enqueue(t_ElementType const& val)
+	{
+		size_t const idx = m_writeIdx.load(std::memory_order_relaxed);
+		if (SPRAWL_UNLIKELY(!hasRoom_(idx)))
+		{
+			return false;
+		}
+		new(getElement_(idx)) t_ElementType(val);
+		m_writeIdx.store(idx + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	* @brief   Enqueue an item by rvalue, calling the move constructor. Will fail if the queue is full.
+	*          Must only be called from the producer thread.
+	*
+	* @param   val   The value to equeue
+	*
+	* @return  true if the element was successfully enqueued, false otherwise
+	*/
+	inline bool Enqueue(t_ElementType&& val)
+	{
+		size_t const idx = m_writeIdx.load(std::memory_order_relaxed);
+		if (SPRAWL_UNLIKELY(!hasRoom_(idx)))
+		{
+			return false;
+		}
+		new(getElement_(idx)) t_ElementType(std::move(val));
+		m_writeIdx.store(idx + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	* @brief   Dequeue an item. Will fail if the queue is empty. Must only be called from the consumer thread.
+	*
+	* @param   val   A reference to a value, which will be filled with the contents of the dequeued element, if any.
+	*                The move assignment operator will be called on the value, if one exists.
+	*
+	* @return  true if the dequeue succeeded and the value holds a valid item, false if the queue was empty.
+	*/
+	inline bool Dequeue(t_ElementType& val)
+	{
+		size_t const idx = m_readIdx.load(std::memory_order_relaxed);
+		if (SPRAWL_UNLIKELY(idx == m_cachedWriteIdx))
+		{
+			m_cachedWriteIdx = m_writeIdx.load(std::memory_order_acquire);
+			if (idx == m_cachedWriteIdx)
+			{
+				return false;
+			}
+		}
+		t_ElementType* element = getElement_(idx);
+		val = std::move(*element);
+		element->~t_ElementType();
+		m_readIdx.store(idx + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	SPSCQueue(SPSCQueue const& other) = delete;
+	SPSCQueue& operator=(SPSCQueue const& other) = delete;
+
+	inline bool hasRoom_(size_t const idx)
+	{
+		if (SPRAWL_LIKELY(idx - m_cachedReadIdx < c_adjustedSize))
+		{
+			return true;
+		}
+		m_cachedReadIdx = m_readIdx.load(std::memory_order_acquire);
+		return idx - m_cachedReadIdx < c_adjustedSize;
+	}
+
+	inline t_ElementType* getElement_(size_t const idx)
+	{
+		return reinterpret_cast<t_ElementType*>(&m_buffer[idx & (c_adjustedSize - 1)]);
+	}
+
+	constexpr static size_t c_adjustedSize = detail::nextPowerOf2(t_QueueSize);
+
+	SPRAWL_PAD_CACHELINE;
+	// Producer state
+	std::atomic<size_t> m_writeIdx;
+	size_t m_cachedReadIdx;
+	SPRAWL_PAD_CACHELINE;
+	// Consumer state
+	std::atomic<size_t> m_readIdx;
+	size_t m_cachedWriteIdx;
+	SPRAWL_PAD_CACHELINE;
+	typename std::aligned_storage<sizeof(t_ElementType), alignof(t_ElementType)>::type m_buffer[c_adjustedSize];
+};
+
+/**
+* @class   sprawl::collections::SPSCUnboundedQueue
+*
+* @brief   Unbounded queue for exactly one producer thread and exactly one consumer thread.
+*
+* @details Built from the same detail::Buffer blocks as ConcurrentQueue, but without using their atomic
+*          read/write positions or ready flags. The producer and consumer each walk their own position
+*          through the chain of blocks, and the only shared state is the total number of elements written
+*          (which the consumer caches and only reloads when it runs dry) and the block the consumer is
+*          currently reading from (which the producer only checks when it needs a new block).
+*
+*          Blocks the consumer has finished with are recycled by the producer instead of freed, so a queue
+*          that has reached its steady-state size never allocates.
+*
+*          Calling Enqueue() from more than one thread, or Dequeue() from more than one thread, is undefined.
+*/
+template<typename t_ElementType, size_t t_BlockSize, typename t_AllocatorType>
+class sprawl::collections::SPSCUnboundedQueue
+{
+public:
+	typedef detail::Buffer<t_ElementType, t_BlockSize> Buffer;
+
+	SPSCUnboundedQueue()
+		: m_writeBuffer(nullptr)
+		, m_writePos(nullptr)
+		, m_oldestBuffer(nullptr)
+		, m_cachedReadBuffer(nullptr)
+		, m_writeCount(0)
+		, m_localWriteCount(0)
+		, m_readBuffer(nullptr)
+		, m_readPos(nullptr)
+		, m_readCount(0)
+		, m_cachedWriteCount(0)
+		, m_publishedReadBuffer(nullptr)
+	{
+		Buffer* buffer = m_allocator.allocate(1);
+		new(buffer) Buffer();
+		m_writeBuffer = buffer;
+		m_writePos = buffer->GetBegin();
+		m_oldestBuffer = buffer;
+		m_cachedReadBuffer = buffer;
+		m_readBuffer = buffer;
+		m_readPos = buffer->GetBegin();
+		m_publishedReadBuffer = buffer;
+	}
+
+	~SPSCUnboundedQueue()
+	{
+		size_t const writeCount = m_writeCount.load(std::memory_order_acquire);
+		for (; m_readCount != writeCount; ++m_readCount, ++m_readPos)
+		{
+			if (m_readPos == m_readBuffer->GetEnd())
+			{
+				m_readBuffer = m_readBuffer->GetNext();
+				m_readPos = m_readBuffer->GetBegin();
+			}
+			m_readPos->item.~t_ElementType();
+		}
+
+		Buffer* buffer = m_oldestBuffer;
+		while (buffer)
+		{
+			Buffer* nextBuffer = buffer->GetNext();
+			buffer->~Buffer();
+			m_allocator.deallocate(buffer, 1);
+			buffer = nextBuffer;
+		}
+	}
+
+	/**
+	* @brief   Enqueue an item by reference, calling the copy constructor. Will not fail (unless OOM).
+	*          Must only be called from the producer thread.
+	*
+	* @param   val   The value to equeue
+	*/
+	inline void Enqueue(t_ElementType const& val)
+	{
+		new(&getNextElement_()->item) t_ElementType(val);
+		m_writeCount.store(++m_localWriteCount, std::memory_order_release);
+	}
+
+	/**
+	* @brief   Enqueue an item by rvalue, calling the move constructor. Will not fail (unless OOM).
+	*          Must only be called from the producer thread.
+	*
+	* @param   val   The value to equeue
+	*/
+	inline void Enqueue(t_ElementType&& val)
+	{
+		new(&getNextElement_()->item) t_ElementType(std::move(val));
+		m_writeCount.store(++m_localWriteCount, std::memory_order_release);
+	}
+
+	/**
+	* @brief   Dequeue an item. Will fail if the queue is empty. Must only be called from the consumer thread.
+	*
+	* @param   val   A reference to a value, which will be filled with the contents of the dequeued element, if any.
+	*                The move assignment operator will be called on the value, if one exists.
+	*
+	* @return  true if the dequeue succeeded and the value holds a valid item, false if the queue was empty.
+	*/
+	inline bool Dequeue(t_ElementType& val)
+	{
+		if (SPRAWL_UNLIKELY(m_readCount == m_cachedWriteCount))
+		{
+			m_cachedWriteCount = m_writeCount.load(std::memory_order_acquire);
+			if (m_readCount == m_cachedWriteCount)
+			{
+				return false;
+			}
+		}
+		if (SPRAWL_UNLIKELY(m_readPos == m_readBuffer->GetEnd()))
+		{
+			// The producer links the next block before publishing any element in it, so this can't be null.
+			m_readBuffer = m_readBuffer->GetNext();
+			m_readPos = m_readBuffer->GetBegin();
+			// Once this is published, the producer is free to recycle every block before this one.
+			m_publishedReadBuffer.store(m_readBuffer, std::memory_order_release);
+		}
+		val = std::move(m_readPos->item);
+		m_readPos->item.~t_ElementType();
+		++m_readPos;
+		++m_readCount;
+		return true;
+	}
+
+private:
+	SPSCUnboundedQueue(SPSCUnboundedQueue const& other) = delete;
+	SPSCUnboundedQueue& operator=(SPSCUnboundedQueue const& other) = delete;
+
+	inline typename Buffer::BufferElement* getNextElement_()
+	{
+		if (SPRAWL_UNLIKELY(m_writePos == m_writeBuffer->GetEnd()))
+		{
+			fetchNextWriteBuffer_();
+		}
+		return m_writePos++;
+	}
+
+	SPRAWL_FORCE_NO_INLINE void fetchNextWriteBuffer_()
+	{
+		// Blocks form a chain of oldest -> ... -> consumer's current block -> ... -> producer's current block.
+		// Anything strictly before the consumer's current block has been fully read and can be reused.
+		Buffer* buffer;
+		if (m_oldestBuffer == m_cachedReadBuffer)
+		{
+			m_cachedReadBuffer = m_publishedReadBuffer.load(std::memory_order_acquire);
+		}
+		if (m_oldestBuffer != m_cachedReadBuffer)
+		{
+			buffer = m_oldestBuffer;
+			m_oldestBuffer = buffer->GetNext();
+			buffer->SetNext(nullptr);
+		}
+		else
+		{
+			buffer = m_allocator.allocate(1);
+			new(buffer) Buffer();
+		}
+		m_writeBuffer->SetNext(buffer);
+		m_writeBuffer = buffer;
+		m_writePos = buffer->GetBegin();
+	}
+
+	SPRAWL_PAD_CACHELINE;
+	// Producer state
+	Buffer* m_writeBuffer;
+	typename Buffer::BufferElement* m_writePos;
+	Buffer* m_oldestBuffer;
+	Buffer* m_cachedReadBuffer;
+	std::atomic<size_t> m_writeCount;
+	size_t m_localWriteCount;
+	SPRAWL_PAD_CACHELINE;
+	// Consumer state
+	Buffer* m_readBuffer;
+	typename Buffer::BufferElement* m_readPos;
+	size_t m_readCount;
+	size_t m_cachedWriteCount;
+	std::atomic<Buffer*> m_publishedReadBuffer;
+	SPRAWL_PAD_CACHELINE;
+
+	typename std::allocator_traits<t_AllocatorType>::template rebind_alloc<Buffer> m_allocator;
+};
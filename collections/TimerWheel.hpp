@@ -0,0 +1,337 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../common/compat.hpp"
+
+namespace sprawl
+{
+	namespace collections
+	{
+		struct TimerWheelNode;
+
+		template<typename t_ElementType>
+		class TimerWheel;
+	}
+}
+
+/**
+* @struct  sprawl::collections::TimerWheelNode
+*
+* @brief   Base class for anything that can be scheduled in a TimerWheel.
+*
+* @details An object can only be in one TimerWheel at a time, since the links live in the object itself.
+*/
+struct sprawl::collections::TimerWheelNode
+{
+	TimerWheelNode()
+		: m_timerPrev(nullptr)
+		, m_timerNext(nullptr)
+		, m_timerTick(0)
+	{
+
+	}
+
+	TimerWheelNode* m_timerPrev;
+	TimerWheelNode* m_timerNext;
+	int64_t m_timerTick;
+};
+
+/**
+* @class   sprawl::collections::TimerWheel
+*
+* @brief   Hierarchical hashed timer wheel with O(1) insert and remove.
+*
+* @details Time is divided into ticks of a fixed size. Level 0 has one slot per tick for the next 256 ticks. Each
+*          level above that has 256 slots that are each 256 times wider than the level below, so four levels cover
+*          2^32 ticks. An element is placed in the lowest level whose range covers its expiry. When a level's
+*          current slot comes up, its elements are moved down into the lower levels (a "cascade"). Each element
+*          is moved at most once per level over its lifetime.
+*
+*          Expiry times are rounded up to the next tick, so an element never fires early and fires at most one
+*          tick late. Elements scheduled beyond the range of the top level are parked in the top level and
+*          re-placed each time they cascade until they come into range.
+*
+*          t_ElementType must derive from TimerWheelNode. The wheel doesn't own its elements and never allocates
+*          after construction. It's not thread-safe - it's meant to be owned by the one thread that services it.
+*
+* @tparam  t_ElementType   The element type, which must derive from TimerWheelNode
+*/
+template<typename t_ElementType>
+class sprawl::collections::TimerWheel
+{
+public:
+	/**
+	* @brief   Construct an empty wheel.
+	*
+	* @param   startTime    The current time. Elements with an expiry at or before this fire on the first Advance().
+	* @param   tickSize     The width of one tick, in the same units as startTime and the expiry times.
+	* @param   levelCount   The number of levels. Each level multiplies the range of the wheel by 256.
+	*/
+	TimerWheel(int64_t const startTime, int64_t const tickSize, size_t const levelCount = 4)
+		: m_slots(nullptr)
+		, m_levelCount(levelCount < 1 ? 1 : levelCount)
+		, m_tickSize(tickSize < 1 ? 1 : tickSize)
+		, m_currentTick(startTime / m_tickSize)
+		, m_size(0)
+		, m_expired()
+	{
+		m_slots = new TimerWheelNode[m_levelCount * c_slotsPerLevel];
+		for (size_t i = 0; i < m_levelCount * c_slotsPerLevel; ++i)
+		{
+			initSentinel_(m_slots[i]);
+		}
+		initSentinel_(m_expired);
+	}
+
+	~TimerWheel()
+	{
+		delete[] m_slots;
+	}
+
+	/**
+	* @brief   Schedule an element.
+	*
+	* @param   element   The element to schedule. Must not currently be in a TimerWheel.
+	* @param   expiry    The time at which the element should fire.
+	*/
+	inline void Insert(t_ElementType* element, int64_t const expiry)
+	{
+		TimerWheelNode* node = static_cast<TimerWheelNode*>(element);
+		node->m_timerTick = (expiry + m_tickSize - 1) / m_tickSize;
+		place_(node);
+		++m_size;
+	}
+
+	/**
+	* @brief   Unschedule an element before it fires.
+	*
+	* @param   element   The element to remove. Must currently be in this wheel.
+	*/
+	inline void Remove(t_ElementType* element)
+	{
+		unlink_(static_cast<TimerWheelNode*>(element));
+		--m_size;
+	}
+
+	/**
+	* @brief   Check whether an element is currently scheduled in a wheel.
+	*/
+	static inline bool Contains(t_ElementType const* element)
+	{
+		return static_cast<TimerWheelNode const*>(element)->m_timerNext != nullptr;
+	}
+
+	/**
+	* @brief   Move the wheel forward to the given time and fire everything that has expired.
+	*
+	* @details Elements are unlinked before their callback is called, so the callback is free to re-insert them
+	*          or to remove other elements.
+	*
+	* @param   now           The current time
+	* @param   onExpired     Callable taking a t_ElementType*, called once for each expired element.
+	*/
+	template<typename t_CallbackType>
+	void Advance(int64_t const now, t_CallbackType const& onExpired)
+	{
+		int64_t const targetTick = now / m_tickSize;
+		if (m_size == 0 && targetTick > m_currentTick)
+		{
+			// Nothing to cascade, so there's no need to walk the ticks in between.
+			m_currentTick = targetTick;
+		}
+		while (m_currentTick < targetTick)
+		{
+			++m_currentTick;
+			cascade_();
+			drain_(slot_(0, size_t(m_currentTick) & c_slotMask));
+		}
+		fire_(m_expired, onExpired);
+	}
+
+	/**
+	* @brief   Find the earliest time at which Advance() might fire something.
+	*
+	* @details If the earliest element is in one of the upper levels, this returns the time it will cascade
+	*          rather than its exact expiry, so the caller may wake up, advance, and find nothing has expired yet.
+	*
+	* @param   when   Filled with the time, if the wheel isn't empty.
+	*
+	* @return  false if the wheel is empty, true otherwise.
+	*/
+	bool NextExpiry(int64_t& when) const
+	{
+		if (m_size == 0)
+		{
+			return false;
+		}
+		if (m_expired.m_timerNext != &m_expired)
+		{
+			when = m_currentTick * m_tickSize;
+			return true;
+		}
+		// A level's first occupied slot is the earliest it has anything to do, but an upper level can cascade
+		// before a lower one fires, so every level has to be checked.
+		bool found = false;
+		int64_t earliestTick = 0;
+		for (size_t level = 0; level < m_levelCount; ++level)
+		{
+			size_t const shift = level * c_slotBits;
+			int64_t const base = m_currentTick >> shift;
+			for (int64_t i = 1; i <= int64_t(c_slotsPerLevel); ++i)
+			{
+				int64_t const tick = (base + i) << shift;
+				if (found && tick >= earliestTick)
+				{
+					break;
+				}
+				TimerWheelNode const& slot = m_slots[level * c_slotsPerLevel + (size_t(base + i) & c_slotMask)];
+				if (slot.m_timerNext != &slot)
+				{
+					earliestTick = tick;
+					found = true;
+					break;
+				}
+			}
+		}
+		if (found)
+		{
+			when = earliestTick * m_tickSize;
+		}
+		return found;
+	}
+
+	/**
+	* @brief   Remove every element from the wheel without firing it.
+	*
+	* @param   onRemoved   Callable taking a t_ElementType*, called once for each element.
+	*/
+	template<typename t_CallbackType>
+	void Clear(t_CallbackType const& onRemoved)
+	{
+		for (size_t i = 0; i < m_levelCount * c_slotsPerLevel; ++i)
+		{
+			fire_(m_slots[i], onRemoved);
+		}
+		fire_(m_expired, onRemoved);
+	}
+
+	size_t Size() const
+	{
+		return m_size;
+	}
+
+	bool Empty() const
+	{
+		return m_size == 0;
+	}
+
+private:
+	TimerWheel(TimerWheel const& other) = delete;
+	TimerWheel& operator=(TimerWheel const& other) = delete;
+
+	constexpr static size_t c_slotBits = 8;
+	constexpr static size_t c_slotsPerLevel = size_t(1) << c_slotBits;
+	constexpr static size_t c_slotMask = c_slotsPerLevel - 1;
+
+	static inline void initSentinel_(TimerWheelNode& sentinel)
+	{
+		sentinel.m_timerPrev = &sentinel;
+		sentinel.m_timerNext = &sentinel;
+	}
+
+	static inline void linkTail_(TimerWheelNode& list, TimerWheelNode* node)
+	{
+		node->m_timerPrev = list.m_timerPrev;
+		node->m_timerNext = &list;
+		list.m_timerPrev->m_timerNext = node;
+		list.m_timerPrev = node;
+	}
+
+	static inline void unlink_(TimerWheelNode* node)
+	{
+		node->m_timerPrev->m_timerNext = node->m_timerNext;
+		node->m_timerNext->m_timerPrev = node->m_timerPrev;
+		node->m_timerPrev = nullptr;
+		node->m_timerNext = nullptr;
+	}
+
+	inline TimerWheelNode& slot_(size_t const level, size_t const idx)
+	{
+		return m_slots[level * c_slotsPerLevel + idx];
+	}
+
+	void place_(TimerWheelNode* node)
+	{
+		int64_t const delta = node->m_timerTick - m_currentTick;
+		if (delta <= 0)
+		{
+			linkTail_(m_expired, node);
+			return;
+		}
+		for (size_t level = 0; level < m_levelCount; ++level)
+		{
+			size_t const nextShift = (level + 1) * c_slotBits;
+			if (nextShift >= 63 || delta < (int64_t(1) << nextShift))
+			{
+				linkTail_(slot_(level, size_t(node->m_timerTick >> (level * c_slotBits)) & c_slotMask), node);
+				return;
+			}
+		}
+		// Beyond the range of the wheel. Park it in the furthest slot of the top level; it'll be re-placed when
+		// that slot cascades.
+		size_t const topLevel = m_levelCount - 1;
+		int64_t const parkedTick = m_currentTick + (int64_t(1) << (m_levelCount * c_slotBits)) - 1;
+		linkTail_(slot_(topLevel, size_t(parkedTick >> (topLevel * c_slotBits)) & c_slotMask), node);
+	}
+
+	void cascade_()
+	{
+		// Each level's current slot comes up when every level below it has wrapped around to 0.
+		for (size_t level = 1; level < m_levelCount; ++level)
+		{
+			if (((m_currentTick >> ((level - 1) * c_slotBits)) & c_slotMask) != 0)
+			{
+				break;
+			}
+			redistribute_(slot_(level, size_t(m_currentTick >> (level * c_slotBits)) & c_slotMask));
+		}
+	}
+
+	void redistribute_(TimerWheelNode& slot)
+	{
+		while (slot.m_timerNext != &slot)
+		{
+			TimerWheelNode* node = slot.m_timerNext;
+			unlink_(node);
+			place_(node);
+		}
+	}
+
+	void drain_(TimerWheelNode& slot)
+	{
+		// Elements parked from beyond the wheel's range can land in a level 0 slot before they're due, so re-place
+		// rather than assuming everything here has expired.
+		redistribute_(slot);
+	}
+
+	template<typename t_CallbackType>
+	void fire_(TimerWheelNode& list, t_CallbackType const& callback)
+	{
+		while (list.m_timerNext != &list)
+		{
+			TimerWheelNode* node = list.m_timerNext;
+			unlink_(node);
+			--m_size;
+			callback(static_cast<t_ElementType*>(node));
+		}
+	}
+
+	TimerWheelNode* m_slots;
+	size_t m_levelCount;
+	int64_t m_tickSize;
+	int64_t m_currentTick;
+	size_t m_size;
+	TimerWheelNode m_expired;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <type_traits>
+
+#include "../common/compat.hpp"
+#include "../common/CachePad.hpp"
+
+namespace sprawl
+{
+	namespace collections
+	{
+		template<typename t_ElementType, typename t_AllocatorType = std::allocator<t_ElementType>>
+		class WorkStealingDeque;
+	}
+}
+
+/**
+* @class   sprawl::collections::WorkStealingDeque
+*
+* @brief   Chase-Lev work-stealing deque: one owner thread pushes and pops at the bottom, any number of other
+*          threads steal from the top.
+*
+* @details The owner's Push() and Pop() don't use any read-modify-write operations except when Pop() races a
+*          thief for the very last element, so a worker feeding itself from its own deque runs at close to the
+*          speed of a plain array. Thieves take the oldest element with a single compare-and-swap, which keeps
+*          them away from the end of the deque the owner is working on.
+*
+*          The deque grows by doubling when full. Thieves may still be reading from an old array while it grows,
+*          so old arrays are kept until the deque is destroyed rather than freed right away - since each one is
+*          half the size of the next, this costs at most as much memory as the current array.
+*
+*          Elements are stored in std::atomic, so t_ElementType must be trivially copyable. In practice this is
+*          meant to hold pointers.
+*
+*          Push() and Pop() must only be called from the owning thread. Steal() may be called from any thread.
+*
+* @tparam  t_ElementType     The type of element to store; must be trivially copyable
+*
+* @tparam  t_AllocatorType   An allocator class compatible with std::allocator. Must support `rebind`.
+*/
+template<typename t_ElementType, typename t_AllocatorType>
+class sprawl::collections::WorkStealingDeque
+{
+public:
+	static_assert(std::is_trivially_copyable<t_ElementType>::value, "WorkStealingDeque elements must be trivially copyable.");
+
+	/**
+	* @brief   Construct an empty deque.
+	*
+	* @param   initialCapacity   Number of elements to allocate space for up front. Rounded up to a power of 2.
+	*/
+	explicit WorkStealingDeque(size_t initialCapacity = 256)
+		: m_top(0)
+		, m_bottom(0)
+		, m_array(nullptr)
+		, m_arrayAllocator()
+		, m_elementAllocator()
+	{
+		size_t capacity = 2;
+		while (capacity < initialCapacity)
+		{
+			capacity *= 2;
+		}
+		m_array.store(allocateArray_(capacity, nullptr), std::memory_order_relaxed);
+	}
+
+	~WorkStealingDeque()
+	{
+		Array* array = m_array.load(std::memory_order_relaxed);
+		while (array != nullptr)
+		{
+			Array* previous = array->previous;
+			freeArray_(array);
+			array = previous;
+		}
+	}
+
+	/**
+	* @brief   Push an element onto the bottom of the deque. Must only be called from the owning thread.
+	*
+	* @param   val   The value to push
+	*/
+	inline void Push(t_ElementType const val)
+	{
+		int64_t const bottom = m_bottom.load(std::memory_order_relaxed);
+		int64_t const top = m_top.load(std::memory_order_acquire);
+		Array* array = m_array.load(std::memory_order_relaxed);
+		if (SPRAWL_UNLIKELY(bottom - top > int64_t(array->mask)))
+		{
+			array = grow_(array, top, bottom);
+		}
+		array->Put(bottom, val);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief   Pop the most recently pushed element from the bottom of the deque. Must only be called from the
+	*          owning thread.
+	*
+	* @param   val   A reference to a value, which will be filled with the popped element, if any.
+	*
+	* @return  true if an element was popped, false if the deque was empty or a thief took the last element.
+	*/
+	inline bool Pop(t_ElementType& val)
+	{
+		int64_t const bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		Array* array = m_array.load(std::memory_order_relaxed);
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = m_top.load(std::memory_order_relaxed);
+
+		if (SPRAWL_UNLIKELY(top > bottom))
+		{
+			// Empty.
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		val = array->Get(bottom);
+		if (top != bottom)
+		{
+			// More than one element left, so no thief can be competing for this one.
+			return true;
+		}
+
+		// Last element - whoever moves top first gets it.
+		bool const won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return won;
+	}
+
+	/**
+	* @brief   Take the oldest element from the top of the deque. May be called from any thread.
+	*
+	* @param   val   A reference to a value, which will be filled with the stolen element, if any.
+	*
+	* @return  true if an element was stolen, false if the deque was empty or another thread got there first.
+	*/
+	inline bool Steal(t_ElementType& val)
+	{
+		int64_t top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t const bottom = m_bottom.load(std::memory_order_acquire);
+		if (top >= bottom)
+		{
+			return false;
+		}
+
+		Array* array = m_array.load(std::memory_order_acquire);
+		t_ElementType const stolen = array->Get(top);
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			return false;
+		}
+		val = stolen;
+		return true;
+	}
+
+	/**
+	* @brief   Move the elements into a newly allocated array of the same capacity. Must only be called from the
+	*          owning thread.
+	*
+	* @details Lets the owner place the array in memory that's local to it - on NUMA systems, memory usually comes
+	*          from the node of the thread that first touches it, which isn't necessarily the one that constructed
+	*          the deque. As with growing, the old array is kept until the deque is destroyed.
+	*/
+	void Reallocate()
+	{
+		Array* array = m_array.load(std::memory_order_relaxed);
+		resize_(array, array->mask + 1, m_top.load(std::memory_order_acquire), m_bottom.load(std::memory_order_relaxed));
+	}
+
+	/**
+	* @brief   Approximate number of elements in the deque. Exact if called from the owner with no thieves active.
+	*/
+	size_t Size() const
+	{
+		int64_t const bottom = m_bottom.load(std::memory_order_relaxed);
+		int64_t const top = m_top.load(std::memory_order_relaxed);
+		return bottom > top ? size_t(bottom - top) : 0;
+	}
+
+	/**
+	* @brief   Approximate emptiness check. Exact if called from the owner with no thieves active.
+	*/
+	bool Empty() const
+	{
+		return Size() == 0;
+	}
+
+private:
+	WorkStealingDeque(WorkStealingDeque const& other) = delete;
+	WorkStealingDeque& operator=(WorkStealingDeque const& other) = delete;
+
+	struct Array
+	{
+		inline t_ElementType Get(int64_t const idx) const
+		{
+			return elements[size_t(idx) & mask].load(std::memory_order_relaxed);
+		}
+
+		inline void Put(int64_t const idx, t_ElementType const val)
+		{
+			elements[size_t(idx) & mask].store(val, std::memory_order_relaxed);
+		}
+
+		std::atomic<t_ElementType>* elements;
+		size_t mask;
+		Array* previous;
+	};
+
+	Array* allocateArray_(size_t const capacity, Array* previous)
+	{
+		Array* array = m_arrayAllocator.allocate(1);
+		array->elements = m_elementAllocator.allocate(capacity);
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			new(&array->elements[i]) std::atomic<t_ElementType>();
+		}
+		array->mask = capacity - 1;
+		array->previous = previous;
+		return array;
+	}
+
+	void freeArray_(Array* array)
+	{
+		m_elementAllocator.deallocate(array->elements, array->mask + 1);
+		m_arrayAllocator.deallocate(array, 1);
+	}
+
+	SPRAWL_FORCE_NO_INLINE Array* grow_(Array* array, int64_t const top, int64_t const bottom)
+	{
+		return resize_(array, (array->mask + 1) * 2, top, bottom);
+	}
+
+	Array* resize_(Array* array, size_t const capacity, int64_t const top, int64_t const bottom)
+	{
+		Array* newArray = allocateArray_(capacity, array);
+		for (int64_t i = top; i < bottom; ++i)
+		{
+			newArray->Put(i, array->Get(i));
+		}
+		m_array.store(newArray, std::memory_order_release);
+		return newArray;
+	}
+
+	SPRAWL_PAD_CACHELINE;
+	// Thieves contend on top...
+	std::atomic<int64_t> m_top;
+	SPRAWL_PAD_CACHELINE;
+	// ...while bottom and the array pointer are only written by the owner.
+	std::atomic<int64_t> m_bottom;
+	std::atomic<Array*> m_array;
+	SPRAWL_PAD_CACHELINE;
+
+	typename std::allocator_traits<t_AllocatorType>::template rebind_alloc<Array> m_arrayAllocator;
+	typename std::allocator_traits<t_AllocatorType>::template rebind_alloc<std::atomic<t_ElementType>> m_elementAllocator;
+};
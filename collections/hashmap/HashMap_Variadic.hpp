@@ -98,7 +98,7 @@ namespace sprawl
 					RequestedKeyType::error_invalid_key_index_combination();
 				}
 
-				inline size_t Size()
+				inline size_t Size() const
 				{
 					return m_size;
 				}
@@ -113,7 +113,7 @@ namespace sprawl
 					return ValueType::error_invalid_index();
 				}
 
-				inline bool Empty()
+				inline bool Empty() const
 				{
 					return m_size == 0;
 				}
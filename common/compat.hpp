@@ -66,6 +66,18 @@
 #	define SPRAWL_FORCE_NO_INLINE __declspec(noinline)
 #endif
 
+// C++20 coroutines (threading/task.hpp). Define to 0 to leave them out even where the compiler supports them.
+#ifndef SPRAWL_COROUTINE_TASKS
+#	if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && defined(__has_include)
+#		if __has_include(<coroutine>)
+#			define SPRAWL_COROUTINE_TASKS 1
+#		endif
+#	endif
+#	ifndef SPRAWL_COROUTINE_TASKS
+#		define SPRAWL_COROUTINE_TASKS 0
+#	endif
+#endif
+
 #define SPRAWL_CONCAT_2(left, right) left ## right
 #define SPRAWL_CONCAT(left, right) SPRAWL_CONCAT_2(left, right)
 
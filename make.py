@@ -110,9 +110,9 @@ with csbuild.Project("threading", "threading"):
 
 	csbuild.ToolchainGroup("gnu").AddExcludeFiles("threading/*_windows.cpp")
 	if platform.system() == "Darwin":
-		csbuild.ToolchainGroup("gnu").AddExcludeFiles("threading/event_linux.cpp")
+		csbuild.ToolchainGroup("gnu").AddExcludeFiles("threading/event_linux.cpp", "threading/eventcount_linux.cpp")
 	else:
-		csbuild.ToolchainGroup("gnu").AddExcludeFiles("threading/event_osx.cpp")
+		csbuild.ToolchainGroup("gnu").AddExcludeFiles("threading/event_osx.cpp", "threading/eventcount_osx.cpp")
 
 	csbuild.Toolchain("msvc").AddExcludeFiles(
 		"threading/*_linux.cpp",
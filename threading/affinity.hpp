@@ -0,0 +1,190 @@
+#pragma once
+
+namespace sprawl
+{
+	namespace threading
+	{
+		class CpuSet;
+	}
+}
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../collections/Vector.hpp"
+#include "../common/errors.hpp"
+
+#ifndef SPRAWL_MAX_CPUS
+#	define SPRAWL_MAX_CPUS 1024
+#endif
+
+/**
+ * @brief	A set of logical CPU indices, used to say where a thread may run.
+ * @details	A fixed-size bitmap, so it can be copied around and stored in a Thread without allocating. CPU
+ *			numbers are the operating system's own; SPRAWL_MAX_CPUS sets the largest one that can be represented.
+ */
+class sprawl::threading::CpuSet
+{
+public:
+	static constexpr size_t c_maxCpus = SPRAWL_MAX_CPUS;
+
+	CpuSet()
+		: m_bits()
+	{
+		//
+	}
+
+	static CpuSet Single(size_t cpu)
+	{
+		CpuSet set;
+		set.Add(cpu);
+		return set;
+	}
+
+	void Add(size_t cpu)
+	{
+		if(cpu >= c_maxCpus)
+		{
+			SPRAWL_ABORT_MSG("CPU index exceeds SPRAWL_MAX_CPUS.");
+		}
+		m_bits[cpu / 64] |= uint64_t(1) << (cpu % 64);
+	}
+
+	void Remove(size_t cpu)
+	{
+		if(cpu < c_maxCpus)
+		{
+			m_bits[cpu / 64] &= ~(uint64_t(1) << (cpu % 64));
+		}
+	}
+
+	bool Contains(size_t cpu) const
+	{
+		return cpu < c_maxCpus && (m_bits[cpu / 64] & (uint64_t(1) << (cpu % 64))) != 0;
+	}
+
+	void Clear()
+	{
+		for(size_t i = 0; i < c_wordCount; ++i)
+		{
+			m_bits[i] = 0;
+		}
+	}
+
+	size_t Count() const
+	{
+		size_t count = 0;
+		for(size_t i = 0; i < c_wordCount; ++i)
+		{
+			uint64_t word = m_bits[i];
+			while(word != 0)
+			{
+				word &= word - 1;
+				++count;
+			}
+		}
+		return count;
+	}
+
+	bool Empty() const
+	{
+		for(size_t i = 0; i < c_wordCount; ++i)
+		{
+			if(m_bits[i] != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief	The lowest CPU in the set that's at least `from`, or c_maxCpus if there isn't one.
+	 * @details	Iterate with `for(size_t cpu = set.Next(0); cpu != CpuSet::c_maxCpus; cpu = set.Next(cpu + 1))`.
+	 */
+	size_t Next(size_t from) const
+	{
+		for(size_t cpu = from; cpu < c_maxCpus; ++cpu)
+		{
+			uint64_t const word = m_bits[cpu / 64] >> (cpu % 64);
+			if(word == 0)
+			{
+				// Nothing else in this word; skip to the start of the next one.
+				cpu |= 63;
+				continue;
+			}
+			if(word & 1)
+			{
+				return cpu;
+			}
+		}
+		return c_maxCpus;
+	}
+
+	CpuSet& operator|=(CpuSet const& other)
+	{
+		for(size_t i = 0; i < c_wordCount; ++i)
+		{
+			m_bits[i] |= other.m_bits[i];
+		}
+		return *this;
+	}
+
+	CpuSet& operator&=(CpuSet const& other)
+	{
+		for(size_t i = 0; i < c_wordCount; ++i)
+		{
+			m_bits[i] &= other.m_bits[i];
+		}
+		return *this;
+	}
+
+	bool operator==(CpuSet const& other) const
+	{
+		for(size_t i = 0; i < c_wordCount; ++i)
+		{
+			if(m_bits[i] != other.m_bits[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool operator!=(CpuSet const& other) const
+	{
+		return !(*this == other);
+	}
+private:
+	static constexpr size_t c_wordCount = (c_maxCpus + 63) / 64;
+	uint64_t m_bits[c_wordCount];
+};
+
+namespace sprawl
+{
+	namespace threading
+	{
+		/**
+		 * @brief	Every logical CPU this process is allowed to run on.
+		 */
+		CpuSet GetAvailableCpus();
+
+		size_t GetCpuCount();
+
+		/**
+		 * @brief	Group the available CPUs by physical core.
+		 * @details	Each entry holds the hardware threads (hyperthreads) that share one physical core. Cores are
+		 *			ordered by NUMA node, then by their lowest CPU number, so consecutive entries share caches and
+		 *			memory wherever possible. Only CPUs this process may run on are included. On platforms that
+		 *			don't expose topology, every CPU is treated as its own core.
+		 */
+		collections::Vector<CpuSet> GetPhysicalCores();
+
+		size_t GetNumaNodeCount();
+
+		/**
+		 * @brief	The NUMA node a CPU belongs to; 0 on systems (or platforms) without NUMA information.
+		 */
+		size_t GetNumaNode(size_t cpu);
+	}
+}
@@ -0,0 +1,178 @@
+#include "affinity.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef __APPLE__
+#	include <sched.h>
+#endif
+
+namespace AffinityStatic
+{
+	// Parse a sysfs list such as "0-3,8,10-11" - used for both CPU and NUMA node numbers.
+	static bool ReadList(char const* path, sprawl::threading::CpuSet& set)
+	{
+		FILE* file = fopen(path, "r");
+		if(file == nullptr)
+		{
+			return false;
+		}
+		char buffer[4096];
+		bool const read = fgets(buffer, sizeof(buffer), file) != nullptr;
+		fclose(file);
+		if(!read)
+		{
+			return false;
+		}
+
+		char* c = buffer;
+		while(*c != '\0')
+		{
+			if(*c < '0' || *c > '9')
+			{
+				++c;
+				continue;
+			}
+			size_t const first = size_t(strtoul(c, &c, 10));
+			size_t last = first;
+			if(*c == '-')
+			{
+				last = size_t(strtoul(c + 1, &c, 10));
+			}
+			for(size_t i = first; i <= last && i < sprawl::threading::CpuSet::c_maxCpus; ++i)
+			{
+				set.Add(i);
+			}
+		}
+		return true;
+	}
+
+	static bool ReadNodeCpus(size_t node, sprawl::threading::CpuSet& cpus)
+	{
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+		return ReadList(path, cpus);
+	}
+
+	static sprawl::threading::CpuSet GetOnlineNodes()
+	{
+		sprawl::threading::CpuSet nodes;
+		if(!ReadList("/sys/devices/system/node/online", nodes) || nodes.Empty())
+		{
+			nodes.Clear();
+			nodes.Add(0);
+		}
+		return nodes;
+	}
+}
+
+sprawl::threading::CpuSet sprawl::threading::GetAvailableCpus()
+{
+	CpuSet cpus;
+#ifndef __APPLE__
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if(sched_getaffinity(0, sizeof(mask), &mask) == 0)
+	{
+		for(size_t cpu = 0; cpu < CPU_SETSIZE && cpu < CpuSet::c_maxCpus; ++cpu)
+		{
+			if(CPU_ISSET(cpu, &mask))
+			{
+				cpus.Add(cpu);
+			}
+		}
+		if(!cpus.Empty())
+		{
+			return cpus;
+		}
+	}
+#endif
+	long const count = sysconf(_SC_NPROCESSORS_ONLN);
+	for(long cpu = 0; cpu < count && size_t(cpu) < CpuSet::c_maxCpus; ++cpu)
+	{
+		cpus.Add(size_t(cpu));
+	}
+	if(cpus.Empty())
+	{
+		cpus.Add(0);
+	}
+	return cpus;
+}
+
+size_t sprawl::threading::GetCpuCount()
+{
+	return GetAvailableCpus().Count();
+}
+
+sprawl::collections::Vector<sprawl::threading::CpuSet> sprawl::threading::GetPhysicalCores()
+{
+	CpuSet const available = GetAvailableCpus();
+	CpuSet const nodes = AffinityStatic::GetOnlineNodes();
+	CpuSet assigned;
+	collections::Vector<CpuSet> cores;
+
+	for(size_t node = nodes.Next(0); node != CpuSet::c_maxCpus; node = nodes.Next(node + 1))
+	{
+		CpuSet nodeCpus;
+		if(!AffinityStatic::ReadNodeCpus(node, nodeCpus))
+		{
+			// No NUMA information at all - it's all one node.
+			nodeCpus = available;
+		}
+		nodeCpus &= available;
+
+		for(size_t cpu = nodeCpus.Next(0); cpu != CpuSet::c_maxCpus; cpu = nodeCpus.Next(cpu + 1))
+		{
+			if(assigned.Contains(cpu))
+			{
+				continue;
+			}
+			char path[128];
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", cpu);
+			CpuSet core;
+			if(!AffinityStatic::ReadList(path, core) || !core.Contains(cpu))
+			{
+				core = CpuSet::Single(cpu);
+			}
+			core &= available;
+			assigned |= core;
+			cores.PushBack(core);
+		}
+	}
+
+	// Anything the node lists missed (e.g., a CPU that came online after we read them) still gets a core of its own.
+	for(size_t cpu = available.Next(0); cpu != CpuSet::c_maxCpus; cpu = available.Next(cpu + 1))
+	{
+		if(!assigned.Contains(cpu))
+		{
+			cores.PushBack(CpuSet::Single(cpu));
+		}
+	}
+	return cores;
+}
+
+size_t sprawl::threading::GetNumaNodeCount()
+{
+	CpuSet const nodes = AffinityStatic::GetOnlineNodes();
+	size_t count = 0;
+	for(size_t node = nodes.Next(0); node != CpuSet::c_maxCpus; node = nodes.Next(node + 1))
+	{
+		count = node + 1;
+	}
+	return count;
+}
+
+size_t sprawl::threading::GetNumaNode(size_t cpu)
+{
+	CpuSet const nodes = AffinityStatic::GetOnlineNodes();
+	for(size_t node = nodes.Next(0); node != CpuSet::c_maxCpus; node = nodes.Next(node + 1))
+	{
+		CpuSet nodeCpus;
+		if(AffinityStatic::ReadNodeCpus(node, nodeCpus) && nodeCpus.Contains(cpu))
+		{
+			return node;
+		}
+	}
+	return 0;
+}
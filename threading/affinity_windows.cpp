@@ -0,0 +1,110 @@
+#include "affinity.hpp"
+
+#include <Windows.h>
+#include <stdlib.h>
+
+// Only the calling process's processor group is considered, which covers up to 64 logical CPUs.
+
+sprawl::threading::CpuSet sprawl::threading::GetAvailableCpus()
+{
+	CpuSet cpus;
+	DWORD_PTR processMask;
+	DWORD_PTR systemMask;
+	if(GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+	{
+		for(size_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu)
+		{
+			if(processMask & (DWORD_PTR(1) << cpu))
+			{
+				cpus.Add(cpu);
+			}
+		}
+	}
+	if(cpus.Empty())
+	{
+		cpus.Add(0);
+	}
+	return cpus;
+}
+
+size_t sprawl::threading::GetCpuCount()
+{
+	return GetAvailableCpus().Count();
+}
+
+sprawl::collections::Vector<sprawl::threading::CpuSet> sprawl::threading::GetPhysicalCores()
+{
+	CpuSet const available = GetAvailableCpus();
+	collections::Vector<CpuSet> unordered;
+
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION*)malloc(length);
+	if(info != nullptr && GetLogicalProcessorInformation(info, &length))
+	{
+		size_t const count = length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(info[i].Relationship != RelationProcessorCore)
+			{
+				continue;
+			}
+			CpuSet core;
+			for(size_t cpu = 0; cpu < sizeof(ULONG_PTR) * 8; ++cpu)
+			{
+				if(info[i].ProcessorMask & (ULONG_PTR(1) << cpu))
+				{
+					core.Add(cpu);
+				}
+			}
+			core &= available;
+			if(!core.Empty())
+			{
+				unordered.PushBack(core);
+			}
+		}
+	}
+	free(info);
+
+	if(unordered.Empty())
+	{
+		for(size_t cpu = available.Next(0); cpu != CpuSet::c_maxCpus; cpu = available.Next(cpu + 1))
+		{
+			unordered.PushBack(CpuSet::Single(cpu));
+		}
+	}
+
+	collections::Vector<CpuSet> cores;
+	size_t const nodeCount = GetNumaNodeCount();
+	for(size_t node = 0; node < nodeCount; ++node)
+	{
+		for(auto& core : unordered)
+		{
+			if(GetNumaNode(core.Next(0)) == node)
+			{
+				cores.PushBack(core);
+			}
+		}
+	}
+	return cores;
+}
+
+size_t sprawl::threading::GetNumaNodeCount()
+{
+	ULONG highest = 0;
+	if(!GetNumaHighestNodeNumber(&highest))
+	{
+		return 1;
+	}
+	return size_t(highest) + 1;
+}
+
+size_t sprawl::threading::GetNumaNode(size_t cpu)
+{
+	UCHAR node = 0;
+	if(cpu > 255 || !GetNumaProcessorNode(UCHAR(cpu), &node) || node == 0xFF)
+	{
+		return 0;
+	}
+	return size_t(node);
+}
@@ -0,0 +1,159 @@
+#include "barrier.hpp"
+#include "thread.hpp"
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+namespace
+{
+	inline void relax()
+	{
+#if defined(_MSC_VER)
+		_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+}
+
+sprawl::threading::Barrier::Barrier(size_t participantCount, size_t fanIn, int spinCount)
+	: m_nodes(nullptr)
+	, m_participantCount(participantCount < 1 ? 1 : participantCount)
+	, m_fanIn(fanIn < 2 ? 2 : fanIn)
+	, m_spinCount(spinCount)
+	, m_sense(false)
+	, m_broken(false)
+	, m_parked(0)
+	, m_parkMutex()
+	, m_parkCondition()
+{
+	build_();
+}
+
+sprawl::threading::Barrier::~Barrier()
+{
+	delete[] m_nodes;
+}
+
+void sprawl::threading::Barrier::Reset(size_t participantCount)
+{
+	m_participantCount = participantCount < 1 ? 1 : participantCount;
+	m_broken.store(false, std::memory_order_relaxed);
+	build_();
+}
+
+void sprawl::threading::Barrier::build_()
+{
+	delete[] m_nodes;
+
+	size_t nodeCount = 0;
+	for(size_t width = m_participantCount; ; width = (width + m_fanIn - 1) / m_fanIn)
+	{
+		size_t const levelNodes = (width + m_fanIn - 1) / m_fanIn;
+		nodeCount += levelNodes;
+		if(levelNodes == 1)
+		{
+			break;
+		}
+	}
+	m_nodes = new Node[nodeCount];
+
+	// Leaves first, then each level above them, ending with the root.
+	size_t levelStart = 0;
+	size_t width = m_participantCount;
+	for(;;)
+	{
+		size_t const levelNodes = (width + m_fanIn - 1) / m_fanIn;
+		size_t const nextStart = levelStart + levelNodes;
+		for(size_t i = 0; i < levelNodes; ++i)
+		{
+			Node& node = m_nodes[levelStart + i];
+			node.count.store(0, std::memory_order_relaxed);
+			node.expected = (i == levelNodes - 1 && width % m_fanIn != 0) ? width % m_fanIn : m_fanIn;
+			node.parent = levelNodes == 1 ? nullptr : &m_nodes[nextStart + i / m_fanIn];
+		}
+		if(levelNodes == 1)
+		{
+			break;
+		}
+		levelStart = nextStart;
+		width = levelNodes;
+	}
+}
+
+bool sprawl::threading::Barrier::released_(bool sense) const
+{
+	return m_sense.load(std::memory_order_acquire) != sense || m_broken.load(std::memory_order_acquire);
+}
+
+bool sprawl::threading::Barrier::Wait(size_t participant)
+{
+	if(m_broken.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	// The sense can't flip again until we've arrived, so reading it up front is as good as keeping our own copy.
+	bool const sense = m_sense.load(std::memory_order_acquire);
+	Node* node = &m_nodes[participant / m_fanIn];
+	for(;;)
+	{
+		if(node->count.fetch_add(1, std::memory_order_acq_rel) + 1 != node->expected)
+		{
+			break;
+		}
+		// Last one here - reset for the next phase and carry on up the tree.
+		node->count.store(0, std::memory_order_relaxed);
+		node = node->parent;
+		if(node == nullptr)
+		{
+			release_(sense);
+			return true;
+		}
+	}
+
+	for(int i = 0; i < m_spinCount; ++i)
+	{
+		if(released_(sense))
+		{
+			return !m_broken.load(std::memory_order_acquire);
+		}
+		relax();
+	}
+	if(!released_(sense))
+	{
+		// Someone else may be waiting for this core.
+		this_thread::Yield();
+	}
+
+	m_parked.fetch_add(1, std::memory_order_seq_cst);
+	{
+		SharedLock lock(m_parkMutex);
+		while(!released_(sense))
+		{
+			m_parkCondition.Wait(lock);
+		}
+	}
+	m_parked.fetch_sub(1, std::memory_order_seq_cst);
+	return !m_broken.load(std::memory_order_acquire);
+}
+
+void sprawl::threading::Barrier::release_(bool sense)
+{
+	m_sense.store(!sense, std::memory_order_seq_cst);
+	if(m_parked.load(std::memory_order_seq_cst) != 0)
+	{
+		ScopedLock lock(m_parkMutex);
+		m_parkCondition.NotifyAll();
+	}
+}
+
+void sprawl::threading::Barrier::Break()
+{
+	m_broken.store(true, std::memory_order_seq_cst);
+	ScopedLock lock(m_parkMutex);
+	m_parkCondition.NotifyAll();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+namespace sprawl
+{
+	namespace threading
+	{
+		class Barrier;
+	}
+}
+
+#include <stddef.h>
+#include <atomic>
+
+#include "../common/compat.hpp"
+#include "../common/CachePad.hpp"
+#include "mutex.hpp"
+#include "condition_variable.hpp"
+
+/**
+ * @brief	Reusable barrier for a fixed set of participants: nobody gets past Wait() until everyone has called it.
+ * @details	Participants arrive at a combining tree of counters instead of a single shared one. Each leaf is shared
+ *			by up to fanIn participants; the last to arrive at a node carries on to its parent, and whoever
+ *			completes the root releases everyone by flipping a shared sense flag. With a small fanIn, no cache
+ *			line is contended by more than fanIn threads at a time, which keeps arrival cheap at high core counts.
+ *			With participantCount <= fanIn it's just a single counter.
+ *
+ *			Waiters spin on the sense flag for a while before parking, so a barrier whose participants arrive
+ *			close together never makes a system call. Releasing only touches the parking lock if someone is
+ *			actually parked.
+ *
+ *			Each participant passes its own index (0 to participantCount - 1) to Wait(); two threads must never
+ *			use the same index in the same phase.
+ */
+class sprawl::threading::Barrier
+{
+public:
+	/**
+	 * @param	participantCount	The number of participants per phase
+	 * @param	fanIn				The maximum number of arrivals combined at each node of the tree
+	 * @param	spinCount			How many times to check for release before parking
+	 */
+	explicit Barrier(size_t participantCount = 1, size_t fanIn = 4, int spinCount = 256);
+	~Barrier();
+
+	/**
+	 * @brief	Change the participant count and clear a Break(). Must not be called while anyone is in Wait().
+	 */
+	void Reset(size_t participantCount);
+
+	/**
+	 * @brief	Arrive at the barrier and wait for every other participant to arrive.
+	 * @param	participant		This participant's index
+	 * @return	true once everyone has arrived; false if the barrier was broken.
+	 */
+	bool Wait(size_t participant);
+
+	/**
+	 * @brief	Release everyone currently waiting, and make every Wait() return false right away until Reset().
+	 */
+	void Break();
+
+	size_t ParticipantCount() const { return m_participantCount; }
+private:
+	Barrier(Barrier const& other) = delete;
+	Barrier& operator=(Barrier const& other) = delete;
+
+	struct Node
+	{
+		SPRAWL_PAD_CACHELINE;
+		std::atomic<size_t> count;
+		size_t expected;
+		Node* parent;
+		SPRAWL_PAD_CACHELINE;
+	};
+
+	void build_();
+	void release_(bool sense);
+	bool released_(bool sense) const;
+
+	Node* m_nodes;
+	size_t m_participantCount;
+	size_t m_fanIn;
+	int m_spinCount;
+
+	SPRAWL_PAD_CACHELINE;
+	std::atomic<bool> m_sense;
+	std::atomic<bool> m_broken;
+	std::atomic<int> m_parked;
+	SPRAWL_PAD_CACHELINE;
+
+	Mutex m_parkMutex;
+	ConditionVariable m_parkCondition;
+};
@@ -1,7 +1,6 @@
 #include "coroutine.hpp"
 
-/*static*/ sprawl::threading::ThreadLocal<sprawl::threading::CoroutineBase*> sprawl::threading::CoroutineBase::ms_coroutineInitHelper;
-/*static*/ sprawl::threading::ThreadLocal<sprawl::threading::CoroutineBase> sprawl::threading::CoroutineBase::ms_thisThreadCoroutine;
+/*static*/ thread_local sprawl::threading::CoroutineBase::Holder<void>* sprawl::threading::CoroutineBase::ms_current = nullptr;
 
 sprawl::threading::CoroutineBase::CoroutineBase()
 	: m_holder(Holder<void>::Create())
@@ -14,10 +13,7 @@ sprawl::threading::CoroutineBase::CoroutineBase(sprawl::threading::CoroutineBase
 	: m_holder(holder)
 	, m_ownsHolder(true)
 {
-	if(m_holder && !ms_thisThreadCoroutine)
-	{
-		ms_thisThreadCoroutine = CoroutineBase();
-	}
+	// NOP
 }
 
 sprawl::threading::CoroutineBase::CoroutineBase(CoroutineBase const& other)
@@ -54,36 +50,84 @@ sprawl::threading::CoroutineState sprawl::threading::CoroutineBase::State()
 	return m_holder ? m_holder->m_state : CoroutineState::Invalid;
 }
 
-void sprawl::threading::CoroutineBase::run_()
+void sprawl::threading::CoroutineBase::Resume()
+{
+	Holder<void>* prior = current_();
+	if(prior == nullptr)
+	{
+		prior = threadRoot_();
+	}
+
+	m_holder->m_state = CoroutineState::Executing;
+	m_holder->m_priorCoroutine = prior;
+	prior->m_state = CoroutineState::Paused;
+	setCurrent_(m_holder);
+
+	switch_(prior, m_holder);
+#if SPRAWL_EXCEPTIONS_ENABLED
+	if(m_holder->m_exception)
+	{
+		std::rethrow_exception(m_holder->m_exception);
+	}
+#endif
+}
+
+void sprawl::threading::CoroutineBase::Pause()
+{
+	Holder<void>* prior = m_holder->m_priorCoroutine;
+
+	m_holder->m_state = CoroutineState::Paused;
+	prior->m_state = CoroutineState::Executing;
+	setCurrent_(prior);
+
+	switch_(m_holder, prior);
+}
+
+/*static*/ void sprawl::threading::CoroutineBase::run_(Holder<void>* holder)
 {
 #if SPRAWL_EXCEPTIONS_ENABLED
 	try
 	{
-		m_holder->RunFunction();
+		holder->RunFunction();
 	}
 	catch(...)
 	{
-		m_holder->m_exception = std::current_exception();
+		holder->m_exception = std::current_exception();
 	}
 #else
-	m_holder->RunFunction();
+	holder->RunFunction();
 #endif
-	m_holder->m_state = CoroutineState::Completed;
-	m_holder->m_priorCoroutine.reactivate_();
+	Holder<void>* prior = holder->m_priorCoroutine;
+
+	holder->m_state = CoroutineState::Completed;
+	prior->m_state = CoroutineState::Executing;
+	setCurrent_(prior);
+
+	// Never comes back.
+	switch_(holder, prior);
 }
 
 /*static*/ void sprawl::threading::CoroutineBase::entryPoint_()
 {
-	ms_coroutineInitHelper->run_();
+	// Whoever resumed this for the first time made it current before switching to it.
+	run_(current_());
 }
 
-void sprawl::threading::CoroutineBase::releaseRef_()
+/*static*/ SPRAWL_FORCE_NO_INLINE sprawl::threading::CoroutineBase::Holder<void>* sprawl::threading::CoroutineBase::current_()
 {
-	if(m_holder && m_ownsHolder)
-	{
-		m_holder->DecRef();
-		m_ownsHolder = false;
-	}
+	return ms_current;
+}
+
+/*static*/ SPRAWL_FORCE_NO_INLINE void sprawl::threading::CoroutineBase::setCurrent_(Holder<void>* holder)
+{
+	ms_current = holder;
+}
+
+/*static*/ SPRAWL_FORCE_NO_INLINE sprawl::threading::CoroutineBase::Holder<void>* sprawl::threading::CoroutineBase::threadRoot_()
+{
+	// Owns the thread's root holder, and releases it when the thread exits.
+	static thread_local CoroutineBase root;
+	return root.m_holder;
 }
 
 size_t sprawl::threading::CoroutineBase::StackSize()
@@ -93,12 +137,23 @@ size_t sprawl::threading::CoroutineBase::StackSize()
 
 /*static*/ sprawl::threading::CoroutineBase sprawl::threading::CoroutineBase::GetCurrentCoroutine()
 {
-	return *ms_thisThreadCoroutine;
+	Holder<void>* holder = current_();
+	if(holder == nullptr)
+	{
+		holder = threadRoot_();
+	}
+	holder->IncRef();
+	return CoroutineBase(holder);
 }
 
 sprawl::threading::CoroutineBase sprawl::threading::CoroutineBase::GetCallingCoroutine()
 {
-	return m_holder->m_priorCoroutine;
+	Holder<void>* prior = m_holder->m_priorCoroutine;
+	if(prior != nullptr)
+	{
+		prior->IncRef();
+	}
+	return CoroutineBase(prior);
 }
 
 sprawl::threading::CoroutineType sprawl::threading::CoroutineBase::Type()
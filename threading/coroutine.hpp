@@ -1,15 +1,37 @@
 #pragma once
 
 #include <functional>
-#include "threadlocal.hpp"
 #include <atomic>
 #include "../memory/PoolAllocator.hpp"
 #include "../common/type_traits.hpp"
 #include "../common/errors.hpp"
+#include "coroutinestack.hpp"
+
+// On x86-64 and AArch64, switch stacks with a few instructions of assembly that save only the callee-saved
+// registers, instead of swapcontext(), which also makes a syscall to save and restore the signal mask on every
+// switch. Define this to 0 to go back to ucontext.
+//
+// AddressSanitizer has to be told about every stack switch; it intercepts swapcontext() to find out, but can't
+// see ours, so sanitized builds stay on ucontext.
+#if defined(__SANITIZE_ADDRESS__)
+#	define SPRAWL_COROUTINE_ASAN 1
+#elif defined(__has_feature)
+#	if __has_feature(address_sanitizer)
+#		define SPRAWL_COROUTINE_ASAN 1
+#	endif
+#endif
+
+#ifndef SPRAWL_COROUTINE_ASM_SWITCH
+#	if !defined(_WIN32) && !defined(SPRAWL_COROUTINE_ASAN) && (defined(__x86_64__) || defined(__aarch64__))
+#		define SPRAWL_COROUTINE_ASM_SWITCH 1
+#	else
+#		define SPRAWL_COROUTINE_ASM_SWITCH 0
+#	endif
+#endif
 
 #ifdef _WIN32
 #	undef Yield
-#else
+#elif !SPRAWL_COROUTINE_ASM_SWITCH
 	#ifdef __APPLE__
 		#include <sys/ucontext.h>
 	#else
@@ -79,6 +101,15 @@ public:
 	template<typename YieldType>
 	static SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<void> Yield(YieldType&& value, typename std::enable_if<!std::is_reference<YieldType>::value>::type* = 0);
 
+	/**
+	 * @brief	Yield() and Receive() without the copy: the caller gets a reference to value itself, good until it
+	 *			resumes the current coroutine again. See CoroutineWithChannel::YieldRef().
+	 */
+	template<typename YieldType>
+	static SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<void> YieldRef(YieldType& value);
+	template<typename SendType, typename YieldType>
+	static SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<SendType&> ReceiveRef(YieldType& value);
+
 	CoroutineBase();
 
 	CoroutineBase(CoroutineBase const& other);
@@ -116,19 +147,52 @@ protected:
 	template<typename YieldType, typename CoroutineType>
 	friend class CoroutineIterator;
 
-	static ThreadLocal<CoroutineBase*> ms_coroutineInitHelper;
-	static ThreadLocal<CoroutineBase> ms_thisThreadCoroutine;
-
-	static void entryPoint_();
-	void run_();
-	void reactivate_();
-	void releaseRef_();
-
 	template<typename ReturnType>
 	struct Holder;
 
+	/**
+	 * @brief	The coroutine running on this thread, or null if the thread hasn't resumed one yet.
+	 * @details	Always go through these rather than touching ms_current directly. A coroutine can be paused on
+	 *			one thread and resumed on another, and if an access got inlined, the compiler would be free to
+	 *			keep using the thread-local address it looked up before the switch.
+	 */
+	static Holder<void>* current_();
+	static void setCurrent_(Holder<void>* holder);
+
+	/**
+	 * @brief	Stands in for the thread's own stack, so there's somewhere to switch back to.
+	 */
+	static Holder<void>* threadRoot_();
+
+	static void entryPoint_();
+	static void run_(Holder<void>* holder);
+
+	// Platform-specific.
+	static void switch_(Holder<void>* from, Holder<void>* to);
+#if SPRAWL_COROUTINE_ASM_SWITCH
+	/**
+	 * @brief	Lay out a new stack so that the first switch to it starts entryPoint_().
+	 * @return	The stack pointer to switch to.
+	 */
+	static void* prepareStack_(void* stack, size_t stackSize);
+#endif
+
 	explicit CoroutineBase(Holder<void>* holder);
 
+	struct Borrowed {};
+
+	/**
+	 * @brief	A handle that doesn't hold a reference, for use while something else is known to.
+	 */
+	CoroutineBase(Holder<void>* holder, Borrowed)
+		: m_holder(holder)
+		, m_ownsHolder(false)
+	{
+		//
+	}
+
+	static thread_local Holder<void>* ms_current;
+
 	Holder<void>* m_holder;
 	bool m_ownsHolder;
 };
@@ -149,27 +213,30 @@ struct sprawl::threading::CoroutineBase::Holder
 	std::function<ReturnType ()> m_function;
 	size_t m_stackSize;
 	void* m_stack;
+	StackAllocator* m_stackAllocator;
+	// The fiber on Windows. With the assembly switch, where the stack pointer was saved when this last switched away.
 	void* m_stackPointer;
 	CoroutineState m_state;
 
-	#ifndef _WIN32
+	#if !defined(_WIN32) && !SPRAWL_COROUTINE_ASM_SWITCH
 		ucontext_t m_context;
 	#endif
 
 	std::atomic<int> m_refCount;
 
-	CoroutineBase m_priorCoroutine;
+	// Whoever resumed this coroutine. Not counted: it's stuck in Resume() until this one switches back to it.
+	Holder<void>* m_priorCoroutine;
 
 #if SPRAWL_EXCEPTIONS_ENABLED
 	std::exception_ptr m_exception;
 #endif
 
-	static inline Holder<ReturnType>* Create(std::function<ReturnType()> function, size_t stackSize)
+	static inline Holder<ReturnType>* Create(std::function<ReturnType()> function, size_t stackSize, StackAllocator* stackAllocator)
 	{
 		typedef memory::PoolAllocator<sizeof(Holder)> holderAlloc;
 
 		Holder* ret = (Holder*)holderAlloc::alloc();
-		new(ret)Holder(function, stackSize);
+		new(ret)Holder(function, stackSize, stackAllocator);
 		return ret;
 	}
 
@@ -200,7 +267,7 @@ struct sprawl::threading::CoroutineBase::Holder
 	virtual ~Holder();
 protected:
 	Holder();
-	Holder(std::function<ReturnType ()> function, size_t stackSize);
+	Holder(std::function<ReturnType ()> function, size_t stackSize, StackAllocator* stackAllocator);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -221,7 +288,8 @@ public:
 	YieldType& operator*();
 private:
 	CoroutineBase& m_routine;
-	YieldType m_value;
+	// Whatever the last resume left in the channel, which stays put until the next one.
+	YieldType* m_value;
 	CoroutineState m_state;
 };
 
@@ -238,14 +306,14 @@ public:
 		//
 	}
 
-	Coroutine(std::function<void()> function, size_t stackSize = 0)
-		: CoroutineBase(CoroutineBase::Holder<void>::Create(function, stackSize))
+	Coroutine(std::function<void()> function, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(CoroutineBase::Holder<void>::Create(function, stackSize, stackAllocator))
 	{
 		//
 	}
 
-	Coroutine(std::nullptr_t npt, size_t stackSize = 0)
-		: CoroutineBase(CoroutineBase::Holder<void>::Create(npt, stackSize))
+	Coroutine(std::nullptr_t npt, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(CoroutineBase::Holder<void>::Create(npt, stackSize, stackAllocator))
 	{
 		//
 	}
@@ -266,7 +334,7 @@ public:
 		>::type
 	>
 	Coroutine(Callable && callable, Params &&... params)
-		: CoroutineBase(CoroutineBase::Holder<void>::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0))
+		: CoroutineBase(CoroutineBase::Holder<void>::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0, nullptr))
 	{
 		//
 	}
@@ -280,14 +348,14 @@ template<typename SendType, typename YieldType>
 class sprawl::threading::CoroutineWithChannel : public sprawl::threading::CoroutineBase
 {
 public:
-	CoroutineWithChannel(std::function<YieldType()> function, size_t stackSize = 0)
-		: CoroutineBase(ChannelHolder::Create(function, stackSize))
+	CoroutineWithChannel(std::function<YieldType()> function, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(ChannelHolder::Create(function, stackSize, stackAllocator))
 	{
 		// NOP
 	}
 
-	CoroutineWithChannel(std::nullptr_t npt, size_t stackSize = 0)
-		: CoroutineBase(ChannelHolder::Create(npt, stackSize))
+	CoroutineWithChannel(std::nullptr_t npt, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(ChannelHolder::Create(npt, stackSize, stackAllocator))
 	{
 		// NOP
 	}
@@ -308,7 +376,7 @@ public:
 		>::type
 	>
 	CoroutineWithChannel(Callable && callable, Params &&... params)
-		: CoroutineBase(ChannelHolder::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0))
+		: CoroutineBase(ChannelHolder::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0, nullptr))
 	{
 		//
 	}
@@ -321,36 +389,70 @@ public:
 
 	SendType& Receive(YieldType const& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue = value;
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_receivedValue = value;
+		holder->m_received = &holder->m_receivedValue;
 		Pause();
-		return reinterpret_cast<ChannelHolder*>(m_holder)->m_sentValue;
+		return *holder->m_sent;
 	}
 
 	YieldType& Send(SendType const& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_sentValue = value;
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_sentValue = value;
+		holder->m_sent = &holder->m_sentValue;
 		Resume();
-		return reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue;
+		return *holder->m_received;
 	}
 
 	SendType& Receive(YieldType&& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue = std::move(value);
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_receivedValue = std::move(value);
+		holder->m_received = &holder->m_receivedValue;
 		Pause();
-		return reinterpret_cast<ChannelHolder*>(m_holder)->m_sentValue;
+		return *holder->m_sent;
 	}
 
 	YieldType& Send(SendType&& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_sentValue = std::move(value);
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_sentValue = std::move(value);
+		holder->m_sent = &holder->m_sentValue;
 		Resume();
-		return reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue;
+		return *holder->m_received;
+	}
+
+	/**
+	 * @brief	Like Receive(), but hands the caller a reference to value itself instead of a copy.
+	 * @details	The reference is good until the caller next resumes this coroutine, which is also when this
+	 *			returns, so value only has to outlive the call. The caller is free to modify it or move from it.
+	 */
+	SendType& ReceiveRef(YieldType& value)
+	{
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_received = &value;
+		Pause();
+		return *holder->m_sent;
+	}
+
+	/**
+	 * @brief	Like Send(), but hands the coroutine a reference to value itself instead of a copy.
+	 * @details	The reference is good until the coroutine next pauses, which is also when this returns, so value
+	 *			only has to outlive the call. The coroutine is free to modify it or move from it.
+	 */
+	YieldType& SendRef(SendType& value)
+	{
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_sent = &value;
+		Resume();
+		return *holder->m_received;
 	}
 
 	YieldType& Start()
 	{
 		Resume();
-		return reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue;
+		return *reinterpret_cast<ChannelHolder*>(m_holder)->m_received;
 	}
 
 	YieldType& operator()()
@@ -369,16 +471,26 @@ public:
 	}
 
 private:
+	friend class CoroutineBase;
+
+	// For CoroutineBase's static helpers, which work on whichever coroutine is current without owning it.
+	CoroutineWithChannel(CoroutineBase::Holder<void>* holder, Borrowed borrowed)
+		: CoroutineBase(holder, borrowed)
+	{
+		//
+	}
 
+	// Values are passed through m_sent and m_received, which point either at the holder's own copies or, for
+	// SendRef() and ReceiveRef(), at the other side's originals.
 	struct ChannelHolder : public CoroutineBase::Holder<YieldType>
 	{
 		static_assert(sizeof(CoroutineBase::Holder<void>) == sizeof(CoroutineBase::Holder<YieldType>), "Holder size must not change based on template type.");
-		static CoroutineBase::Holder<void>* Create(std::function<YieldType()> function, size_t stackSize)
+		static CoroutineBase::Holder<void>* Create(std::function<YieldType()> function, size_t stackSize, StackAllocator* stackAllocator)
 		{
 			typedef memory::PoolAllocator<sizeof(ChannelHolder)> holderAlloc;
 
 			ChannelHolder* ret = (ChannelHolder*)holderAlloc::alloc();
-			new(ret)ChannelHolder(function, stackSize);
+			new(ret)ChannelHolder(function, stackSize, stackAllocator);
 			return reinterpret_cast<CoroutineBase::Holder<void>*>(ret);
 		}
 
@@ -398,18 +510,23 @@ private:
 		virtual void RunFunction() override
 		{
 			m_receivedValue = this->m_function();
+			m_received = &m_receivedValue;
 		}
 
-		ChannelHolder(std::function<YieldType ()> function, size_t stackSize)
-			: Holder<YieldType>(function, stackSize)
+		ChannelHolder(std::function<YieldType ()> function, size_t stackSize, StackAllocator* stackAllocator)
+			: Holder<YieldType>(function, stackSize, stackAllocator)
 			, m_sentValue()
 			, m_receivedValue()
+			, m_sent(&m_sentValue)
+			, m_received(&m_receivedValue)
 		{
 			// NOP
 		}
 
 		SendType m_sentValue;
 		YieldType m_receivedValue;
+		SendType* m_sent;
+		YieldType* m_received;
 	};
 };
 
@@ -421,14 +538,14 @@ template<typename SendType>
 class sprawl::threading::CoroutineWithChannel<SendType, void> : public sprawl::threading::CoroutineBase
 {
 public:
-	CoroutineWithChannel(std::function<void ()> function, size_t stackSize = 0)
-		: CoroutineBase(ChannelHolder::Create(function, stackSize))
+	CoroutineWithChannel(std::function<void ()> function, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(ChannelHolder::Create(function, stackSize, stackAllocator))
 	{
 		// NOP
 	}
 
-	CoroutineWithChannel(std::nullptr_t npt, size_t stackSize = 0)
-		: CoroutineBase(ChannelHolder::Create(npt, stackSize))
+	CoroutineWithChannel(std::nullptr_t npt, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(ChannelHolder::Create(npt, stackSize, stackAllocator))
 	{
 		// NOP
 	}
@@ -455,7 +572,7 @@ public:
 		>::type
 	>
 	CoroutineWithChannel(Callable && callable, Params &&... params)
-		: CoroutineBase(ChannelHolder::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0))
+		: CoroutineBase(ChannelHolder::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0, nullptr))
 	{
 		//
 	}
@@ -463,18 +580,33 @@ public:
 	SendType& Receive()
 	{
 		Pause();
-		return reinterpret_cast<ChannelHolder*>(m_holder)->m_sentValue;
+		return *reinterpret_cast<ChannelHolder*>(m_holder)->m_sent;
 	}
 
 	void Send(SendType const& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_sentValue = value;
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_sentValue = value;
+		holder->m_sent = &holder->m_sentValue;
 		Resume();
 	}
 
 	void Send(SendType&& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_sentValue = std::move(value);
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_sentValue = std::move(value);
+		holder->m_sent = &holder->m_sentValue;
+		Resume();
+	}
+
+	/**
+	 * @brief	Like Send(), but hands the coroutine a reference to value itself instead of a copy.
+	 * @details	The reference is good until the coroutine next pauses, which is also when this returns, so value
+	 *			only has to outlive the call. The coroutine is free to modify it or move from it.
+	 */
+	void SendRef(SendType& value)
+	{
+		reinterpret_cast<ChannelHolder*>(m_holder)->m_sent = &value;
 		Resume();
 	}
 
@@ -491,15 +623,23 @@ public:
 	}
 
 private:
+	friend class CoroutineBase;
+
+	// For CoroutineBase's static helpers, which work on whichever coroutine is current without owning it.
+	CoroutineWithChannel(CoroutineBase::Holder<void>* holder, Borrowed borrowed)
+		: CoroutineBase(holder, borrowed)
+	{
+		//
+	}
 
 	struct ChannelHolder : public CoroutineBase::Holder<void>
 	{
-		static CoroutineBase::Holder<void>* Create(std::function<void()> function, size_t stackSize = 0)
+		static CoroutineBase::Holder<void>* Create(std::function<void()> function, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
 		{
 			typedef memory::PoolAllocator<sizeof(ChannelHolder)> holderAlloc;
 
 			ChannelHolder* ret = (ChannelHolder*)holderAlloc::alloc();
-			new(ret) ChannelHolder(function, stackSize);
+			new(ret) ChannelHolder(function, stackSize, stackAllocator);
 			return ret;
 		}
 
@@ -515,14 +655,17 @@ private:
 
 		virtual size_t SizeOfSendType() override { return sizeof(SendType); }
 
-		ChannelHolder(std::function<void()> function, size_t stackSize)
-			: Holder(function, stackSize)
+		ChannelHolder(std::function<void()> function, size_t stackSize, StackAllocator* stackAllocator)
+			: Holder(function, stackSize, stackAllocator)
 			, m_sentValue()
+			, m_sent(&m_sentValue)
 		{
 			// NOP
 		}
 
 		SendType m_sentValue;
+		// Points at m_sentValue, or for SendRef(), at the sender's original.
+		SendType* m_sent;
 	};
 };
 
@@ -536,14 +679,14 @@ class sprawl::threading::CoroutineWithChannel<void, YieldType> : public sprawl::
 public:
 	typedef CoroutineIterator<YieldType, CoroutineWithChannel<void, YieldType>> iterator;
 
-	CoroutineWithChannel(std::function<YieldType ()> function, size_t stackSize = 0)
-		: CoroutineBase(ChannelHolder::Create(function, stackSize))
+	CoroutineWithChannel(std::function<YieldType ()> function, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(ChannelHolder::Create(function, stackSize, stackAllocator))
 	{
 		// NOP
 	}
 
-	CoroutineWithChannel(std::nullptr_t npt, size_t stackSize = 0)
-		: CoroutineBase(ChannelHolder::Create(npt, stackSize))
+	CoroutineWithChannel(std::nullptr_t npt, size_t stackSize = 0, StackAllocator* stackAllocator = nullptr)
+		: CoroutineBase(ChannelHolder::Create(npt, stackSize, stackAllocator))
 	{
 		// NOP
 	}
@@ -570,27 +713,42 @@ public:
 		>::type
 	>
 	CoroutineWithChannel(Callable && callable, Params &&... params)
-		: CoroutineBase(ChannelHolder::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0))
+		: CoroutineBase(ChannelHolder::Create(std::bind(std::forward<Callable>(callable), std::forward<Params>(params)...), 0, nullptr))
 	{
 		//
 	}
 
 	void Yield(YieldType const& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue = value;
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_receivedValue = value;
+		holder->m_received = &holder->m_receivedValue;
 		Pause();
 	}
 
 	void Yield(YieldType&& value)
 	{
-		reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue = std::move(value);
+		ChannelHolder* holder = reinterpret_cast<ChannelHolder*>(m_holder);
+		holder->m_receivedValue = std::move(value);
+		holder->m_received = &holder->m_receivedValue;
+		Pause();
+	}
+
+	/**
+	 * @brief	Like Yield(), but hands the caller a reference to value itself instead of a copy.
+	 * @details	The reference is good until the caller next resumes this coroutine, which is also when this
+	 *			returns, so value only has to outlive the call. The caller is free to modify it or move from it.
+	 */
+	void YieldRef(YieldType& value)
+	{
+		reinterpret_cast<ChannelHolder*>(m_holder)->m_received = &value;
 		Pause();
 	}
 
 	YieldType& Resume()
 	{
 		CoroutineBase::Resume();
-		return reinterpret_cast<ChannelHolder*>(m_holder)->m_receivedValue;
+		return *reinterpret_cast<ChannelHolder*>(m_holder)->m_received;
 	}
 
 	YieldType& Start()
@@ -614,15 +772,24 @@ public:
 	}
 
 private:
+	friend class CoroutineBase;
+
+	// For CoroutineBase's static helpers, which work on whichever coroutine is current without owning it.
+	CoroutineWithChannel(CoroutineBase::Holder<void>* holder, Borrowed borrowed)
+		: CoroutineBase(holder, borrowed)
+	{
+		//
+	}
+
 	struct ChannelHolder : public CoroutineBase::Holder<YieldType>
 	{
 		static_assert(sizeof(CoroutineBase::Holder<void>) == sizeof(CoroutineBase::Holder<YieldType>), "Holder size must not change based on template type.");
-		static CoroutineBase::Holder<void>* Create(std::function<YieldType()> function, size_t stackSize)
+		static CoroutineBase::Holder<void>* Create(std::function<YieldType()> function, size_t stackSize, StackAllocator* stackAllocator)
 		{
 			typedef memory::PoolAllocator<sizeof(ChannelHolder)> holderAlloc;
 
 			ChannelHolder* ret = (ChannelHolder*)holderAlloc::alloc();
-			new(ret) ChannelHolder(function, stackSize);
+			new(ret) ChannelHolder(function, stackSize, stackAllocator);
 			return reinterpret_cast<CoroutineBase::Holder<void>*>(ret);
 		}
 
@@ -641,16 +808,20 @@ private:
 		virtual void RunFunction() override
 		{
 			m_receivedValue = this->m_function();
+			m_received = &m_receivedValue;
 		}
 
-		ChannelHolder(std::function<YieldType ()> function, size_t stackSize)
-			: Holder<YieldType>(function, stackSize)
+		ChannelHolder(std::function<YieldType ()> function, size_t stackSize, StackAllocator* stackAllocator)
+			: Holder<YieldType>(function, stackSize, stackAllocator)
 			, m_receivedValue()
+			, m_received(&m_receivedValue)
 		{
 			// NOP
 		}
 
 		YieldType m_receivedValue;
+		// Points at m_receivedValue, or for YieldRef(), at the yielder's original.
+		YieldType* m_received;
 	};
 };
 
@@ -671,7 +842,7 @@ class sprawl::threading::CoroutineWithChannel<void, void> : public sprawl::threa
 template<typename SendType, typename YieldType>
 /*static*/ SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<SendType&> sprawl::threading::CoroutineBase::Receive(YieldType const& value)
 {
-	CoroutineWithChannel<SendType, YieldType> withChannel = *CoroutineBase::ms_thisThreadCoroutine;
+	CoroutineWithChannel<SendType, YieldType> withChannel(current_(), Borrowed());
 
 #if SPRAWL_COROUTINE_SAFETY_CHECKS
 	if(withChannel.m_holder->Type() != CoroutineType::BiDirectional)
@@ -688,14 +859,13 @@ template<typename SendType, typename YieldType>
 	}
 #endif
 
-	withChannel.releaseRef_();
 	return withChannel.Receive(value);
 }
 
 template<typename SendType, typename YieldType>
 /*static*/ SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<SendType&> sprawl::threading::CoroutineBase::Receive(YieldType&& value, typename std::enable_if<!std::is_reference<YieldType>::value>::type*)
 {
-	CoroutineWithChannel<SendType, YieldType> withChannel = *CoroutineBase::ms_thisThreadCoroutine;
+	CoroutineWithChannel<SendType, YieldType> withChannel(current_(), Borrowed());
 
 #if SPRAWL_COROUTINE_SAFETY_CHECKS
 	if(withChannel.m_holder->Type() != CoroutineType::BiDirectional)
@@ -712,14 +882,13 @@ template<typename SendType, typename YieldType>
 	}
 #endif
 
-	withChannel.releaseRef_();
 	return withChannel.Receive(std::move(value));
 }
 
 template<typename SendType>
 /*static*/ SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<SendType&> sprawl::threading::CoroutineBase::Receive()
 {
-	CoroutineWithChannel<SendType, void> withChannel = *CoroutineBase::ms_thisThreadCoroutine;
+	CoroutineWithChannel<SendType, void> withChannel(current_(), Borrowed());
 
 #if SPRAWL_COROUTINE_SAFETY_CHECKS
 	if(withChannel.m_holder->Type() != CoroutineType::SendOnly)
@@ -732,14 +901,13 @@ template<typename SendType>
 	}
 #endif
 
-	withChannel.releaseRef_();
 	return withChannel.Receive();
 }
 
 template<typename YieldType>
 /*static*/ SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<void> sprawl::threading::CoroutineBase::Yield(YieldType const& value)
 {
-	CoroutineWithChannel<void, YieldType> withChannel = *CoroutineBase::ms_thisThreadCoroutine;
+	CoroutineWithChannel<void, YieldType> withChannel(current_(), Borrowed());
 
 #if SPRAWL_COROUTINE_SAFETY_CHECKS
 	if(withChannel.m_holder->Type() != CoroutineType::ReceiveOnly)
@@ -752,7 +920,6 @@ template<typename YieldType>
 	}
 #endif
 
-	withChannel.releaseRef_();
 	withChannel.Yield(value);
 
 	return ErrorState<void>();
@@ -761,7 +928,7 @@ template<typename YieldType>
 template<typename YieldType>
 /*static*/ SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<void> sprawl::threading::CoroutineBase::Yield(YieldType&& value, typename std::enable_if<!std::is_reference<YieldType>::value>::type*)
 {
-	CoroutineWithChannel<void, YieldType> withChannel = *CoroutineBase::ms_thisThreadCoroutine;
+	CoroutineWithChannel<void, YieldType> withChannel(current_(), Borrowed());
 
 #if SPRAWL_COROUTINE_SAFETY_CHECKS
 	if(withChannel.m_holder->Type() != CoroutineType::ReceiveOnly)
@@ -774,15 +941,58 @@ template<typename YieldType>
 	}
 #endif
 
-	withChannel.releaseRef_();
 	withChannel.Yield(std::move(value));
 
 	return ErrorState<void>();
 }
 
+template<typename YieldType>
+/*static*/ SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<void> sprawl::threading::CoroutineBase::YieldRef(YieldType& value)
+{
+	CoroutineWithChannel<void, YieldType> withChannel(current_(), Borrowed());
+
+#if SPRAWL_COROUTINE_SAFETY_CHECKS
+	if(withChannel.m_holder->Type() != CoroutineType::ReceiveOnly)
+	{
+		SPRAWL_THROW_EXCEPTION(sprawl::InvalidCoroutineType());
+	}
+	if(withChannel.m_holder->SizeOfYieldType() != sizeof(YieldType))
+	{
+		SPRAWL_THROW_EXCEPTION(sprawl::InvalidYieldType());
+	}
+#endif
+
+	withChannel.YieldRef(value);
+
+	return ErrorState<void>();
+}
+
+template<typename SendType, typename YieldType>
+/*static*/ SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<SendType&> sprawl::threading::CoroutineBase::ReceiveRef(YieldType& value)
+{
+	CoroutineWithChannel<SendType, YieldType> withChannel(current_(), Borrowed());
+
+#if SPRAWL_COROUTINE_SAFETY_CHECKS
+	if(withChannel.m_holder->Type() != CoroutineType::BiDirectional)
+	{
+		SPRAWL_THROW_EXCEPTION(sprawl::InvalidCoroutineType());
+	}
+	if(withChannel.m_holder->SizeOfSendType() != sizeof(SendType))
+	{
+		SPRAWL_THROW_EXCEPTION(sprawl::InvalidSendType());
+	}
+	if(withChannel.m_holder->SizeOfYieldType() != sizeof(YieldType))
+	{
+		SPRAWL_THROW_EXCEPTION(sprawl::InvalidYieldType());
+	}
+#endif
+
+	return withChannel.ReceiveRef(value);
+}
+
 /*static*/ inline SPRAWL_WARN_UNUSED_RESULT sprawl::ErrorState<void> sprawl::threading::CoroutineBase::Yield()
 {
-	CoroutineBase routine = *CoroutineBase::ms_thisThreadCoroutine;
+	CoroutineBase routine(current_(), Borrowed());
 
 #if SPRAWL_COROUTINE_SAFETY_CHECKS
 	if(routine.m_holder->Type() != CoroutineType::Basic)
@@ -791,7 +1001,6 @@ template<typename YieldType>
 	}
 #endif
 
-	routine.releaseRef_();
 	routine.Pause();
 
 	return ErrorState<void>();
@@ -804,7 +1013,7 @@ template<typename YieldType>
 template<typename YieldType, typename CoroutineType>
 sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::CoroutineIterator(CoroutineBase& routine)
 	: m_routine(routine)
-	, m_value(reinterpret_cast<CoroutineType&>(m_routine)())
+	, m_value(&reinterpret_cast<CoroutineType&>(m_routine)())
 	, m_state(m_routine.State())
 {
 
@@ -813,7 +1022,7 @@ sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::CoroutineIterato
 template<typename YieldType, typename CoroutineType>
 sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::CoroutineIterator(CoroutineBase& routine, CoroutineState state)
 	: m_routine(routine)
-	, m_value()
+	, m_value(nullptr)
 	, m_state(state)
 {
 
@@ -822,7 +1031,7 @@ sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::CoroutineIterato
 template<typename YieldType, typename CoroutineType>
 sprawl::threading::CoroutineIterator<YieldType, CoroutineType>& sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::operator++()
 {
-	m_value = reinterpret_cast<CoroutineType&>(m_routine)();
+	m_value = &reinterpret_cast<CoroutineType&>(m_routine)();
 	m_state = m_routine.State();
 	return *this;
 }
@@ -843,13 +1052,13 @@ bool sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::operator!=(
 template<typename YieldType, typename CoroutineType>
 YieldType* sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::operator->()
 {
-	return &m_value;
+	return m_value;
 }
 
 template<typename YieldType, typename CoroutineType>
 YieldType& sprawl::threading::CoroutineIterator<YieldType, CoroutineType>::operator*()
 {
-	return m_value;
+	return *m_value;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
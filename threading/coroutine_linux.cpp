@@ -1,51 +1,156 @@
 #include "coroutine.hpp"
-#include "threadlocal.hpp"
 
-void sprawl::threading::CoroutineBase::Resume()
-{
-	m_holder->m_state = CoroutineState::Executing;
+#if SPRAWL_COROUTINE_ASM_SWITCH
+
+#include <stdint.h>
+
+// void sprawl_coroutine_switch(void** saveStackPointer, void* loadStackPointer)
+//
+// Pushes the callee-saved registers onto the current stack, saves the stack pointer, then loads the other one and
+// pops its registers back off. The return address is saved along with everything else, so the final ret lands
+// wherever the other side last called this from - or, for a new stack, in entryPoint_(). Everything the ABI lets a
+// call clobber is assumed clobbered by the caller anyway, so it doesn't need saving.
+extern "C" void sprawl_coroutine_switch(void** saveStackPointer, void* loadStackPointer);
+
+#ifdef __APPLE__
+#	define SPRAWL_COROUTINE_ASM_SYMBOL "_sprawl_coroutine_switch"
+#	define SPRAWL_COROUTINE_ASM_PROLOGUE ".text\n" ".private_extern " SPRAWL_COROUTINE_ASM_SYMBOL "\n"
+#	define SPRAWL_COROUTINE_ASM_EPILOGUE ""
+#else
+#	define SPRAWL_COROUTINE_ASM_SYMBOL "sprawl_coroutine_switch"
+#	define SPRAWL_COROUTINE_ASM_PROLOGUE ".pushsection .text\n" ".hidden " SPRAWL_COROUTINE_ASM_SYMBOL "\n" ".type " SPRAWL_COROUTINE_ASM_SYMBOL ", %function\n"
+#	define SPRAWL_COROUTINE_ASM_EPILOGUE ".size " SPRAWL_COROUTINE_ASM_SYMBOL ", .-" SPRAWL_COROUTINE_ASM_SYMBOL "\n" ".popsection\n"
+#endif
 
-	m_holder->m_priorCoroutine = *ms_thisThreadCoroutine;
+#if defined(__x86_64__)
 
-	ms_thisThreadCoroutine = *this;
+// Frame, from the saved stack pointer up: mxcsr and x87 control word (8 bytes), r15, r14, r13, r12, rbx, rbp, return address.
+__asm__(
+	SPRAWL_COROUTINE_ASM_PROLOGUE
+	".globl " SPRAWL_COROUTINE_ASM_SYMBOL "\n"
+	".p2align 4\n"
+	SPRAWL_COROUTINE_ASM_SYMBOL ":\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	SPRAWL_COROUTINE_ASM_EPILOGUE
+);
 
-	m_holder->m_priorCoroutine.m_holder->m_state = CoroutineState::Paused;
+/*static*/ void* sprawl::threading::CoroutineBase::prepareStack_(void* stack, size_t stackSize)
+{
+	uintptr_t top = (uintptr_t(stack) + stackSize) & ~uintptr_t(15);
+	uint64_t* frame = reinterpret_cast<uint64_t*>(top) - 9;
 
-	ms_coroutineInitHelper = this;
+	// Start out with the creating thread's floating point settings, as getcontext() would have.
+	uint32_t mxcsr;
+	uint16_t fpuControl;
+	__asm__ __volatile__("stmxcsr %0" : "=m"(mxcsr));
+	__asm__ __volatile__("fnstcw %0" : "=m"(fpuControl));
+	frame[0] = uint64_t(mxcsr) | (uint64_t(fpuControl) << 32);
 
-	swapcontext(&m_holder->m_priorCoroutine.m_holder->m_context, &m_holder->m_context);
-#if SPRAWL_EXCEPTIONS_ENABLED
-	if(m_holder->m_exception)
+	// r15 through rbp start out zeroed; a zero rbp ends the frame chain for debuggers and profilers.
+	for(int i = 1; i < 7; ++i)
 	{
-		std::rethrow_exception(m_holder->m_exception);
+		frame[i] = 0;
 	}
-#endif
+	// Returned to by the first switch, which leaves the stack the way a call would: 8 bytes off 16-byte
+	// alignment, with a null return address that entryPoint_() never uses.
+	frame[7] = uint64_t(uintptr_t(&CoroutineBase::entryPoint_));
+	frame[8] = 0;
+	return frame;
 }
 
-void sprawl::threading::CoroutineBase::reactivate_()
-{
-	m_holder->m_state = CoroutineState::Executing;
+#elif defined(__aarch64__)
 
-	CoroutineBase currentlyActiveCoroutine = *ms_thisThreadCoroutine;
-	ms_thisThreadCoroutine = *this;
-	currentlyActiveCoroutine.releaseRef_();
+// Frame, from the saved stack pointer up: x19-x28, x29 (frame pointer), x30 (link register), d8-d15, fpcr, 8 bytes of padding.
+__asm__(
+	SPRAWL_COROUTINE_ASM_PROLOGUE
+	".globl " SPRAWL_COROUTINE_ASM_SYMBOL "\n"
+	".p2align 4\n"
+	SPRAWL_COROUTINE_ASM_SYMBOL ":\n"
+	"	sub sp, sp, #176\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mrs x2, fpcr\n"
+	"	str x2, [sp, #160]\n"
+	"	mov x2, sp\n"
+	"	str x2, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	ldr x2, [sp, #160]\n"
+	"	msr fpcr, x2\n"
+	"	add sp, sp, #176\n"
+	"	ret\n"
+	SPRAWL_COROUTINE_ASM_EPILOGUE
+);
+
+/*static*/ void* sprawl::threading::CoroutineBase::prepareStack_(void* stack, size_t stackSize)
+{
+	uintptr_t top = (uintptr_t(stack) + stackSize) & ~uintptr_t(15);
+	uint64_t* frame = reinterpret_cast<uint64_t*>(top) - 22;
 
-	swapcontext(&currentlyActiveCoroutine.m_holder->m_context, &m_holder->m_context);
-#if SPRAWL_EXCEPTIONS_ENABLED
-	if(m_holder->m_exception)
+	// Everything starts out zeroed; a zero x29 ends the frame chain for debuggers and profilers.
+	for(int i = 0; i < 22; ++i)
 	{
-		std::rethrow_exception(m_holder->m_exception);
+		frame[i] = 0;
 	}
-#endif
+	// x30, which the first switch returns to.
+	frame[11] = uint64_t(uintptr_t(&CoroutineBase::entryPoint_));
+
+	// Start out with the creating thread's floating point settings, as getcontext() would have.
+	uint64_t fpcr;
+	__asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+	frame[20] = fpcr;
+	return frame;
 }
 
-void sprawl::threading::CoroutineBase::Pause()
-{
-	m_holder->m_state = CoroutineState::Paused;
+#endif
 
-	ms_thisThreadCoroutine = m_holder->m_priorCoroutine;
+/*static*/ void sprawl::threading::CoroutineBase::switch_(Holder<void>* from, Holder<void>* to)
+{
+	sprawl_coroutine_switch(&from->m_stackPointer, to->m_stackPointer);
+}
 
-	m_holder->m_priorCoroutine.m_holder->m_state = CoroutineState::Executing;
+#else
 
-	swapcontext(&m_holder->m_context, &m_holder->m_priorCoroutine.m_holder->m_context);
+/*static*/ void sprawl::threading::CoroutineBase::switch_(Holder<void>* from, Holder<void>* to)
+{
+	swapcontext(&from->m_context, &to->m_context);
 }
+
+#endif
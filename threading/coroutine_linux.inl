@@ -1,5 +1,4 @@
-#include <sys/mman.h>
-#ifdef __APPLE__
+#if defined(__APPLE__) && !SPRAWL_COROUTINE_ASM_SWITCH
 #	pragma GCC diagnostic push
 #	pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 #	include <ucontext.h>
@@ -10,15 +9,20 @@ sprawl::threading::CoroutineBase::Holder<ReturnType>::Holder()
 	: m_function(nullptr)
 	, m_stackSize(0)
 	, m_stack(nullptr)
+	, m_stackAllocator(nullptr)
 	, m_stackPointer(nullptr)
 	, m_state(CoroutineState::Created)
+#if !SPRAWL_COROUTINE_ASM_SWITCH
 	, m_context()
+#endif
 	, m_refCount(1)
 	, m_priorCoroutine(nullptr)
 {
+#if !SPRAWL_COROUTINE_ASM_SWITCH
 	m_stackPointer = &m_context;
 
 	getcontext(&m_context);
+#endif
 }
 
 template<typename ReturnType>
@@ -26,23 +30,29 @@ template<typename ReturnType>
 {
 	if(m_stack)
 	{
-		munmap(m_stack, m_stackSize);
+		m_stackAllocator->Free(m_stack, m_stackSize);
 	}
 }
 
 template<typename ReturnType>
-sprawl::threading::CoroutineBase::Holder<ReturnType>::Holder(std::function<ReturnType()> function, size_t stackSize)
+sprawl::threading::CoroutineBase::Holder<ReturnType>::Holder(std::function<ReturnType()> function, size_t stackSize, StackAllocator* stackAllocator)
 	: m_function(function)
 	, m_stackSize(stackSize == 0 ? 1024 * 1024 : stackSize)
 	, m_stack(nullptr)
+	, m_stackAllocator(stackAllocator != nullptr ? stackAllocator : &StackPool::Default())
 	, m_stackPointer(nullptr)
 	, m_state(CoroutineState::Created)
+#if !SPRAWL_COROUTINE_ASM_SWITCH
 	, m_context()
+#endif
 	, m_refCount(1)
 	, m_priorCoroutine(nullptr)
 {
-	m_stack = mmap(NULL, m_stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	m_stack = m_stackAllocator->Allocate(m_stackSize);
 
+#if SPRAWL_COROUTINE_ASM_SWITCH
+	m_stackPointer = CoroutineBase::prepareStack_(m_stack, m_stackSize);
+#else
 	m_stackPointer = &m_context;
 
 	getcontext(&m_context);
@@ -52,8 +62,9 @@ sprawl::threading::CoroutineBase::Holder<ReturnType>::Holder(std::function<Retur
 	m_context.uc_stack.ss_size = m_stackSize;
 
 	makecontext(&m_context, &CoroutineBase::entryPoint_, 0);
+#endif
 }
 
-#ifdef __APPLE__
+#if defined(__APPLE__) && !SPRAWL_COROUTINE_ASM_SWITCH
 #	pragma GCC diagnostic pop
 #endif
\ No newline at end of file
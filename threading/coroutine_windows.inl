@@ -21,6 +21,7 @@ sprawl::threading::CoroutineBase::Holder<ReturnType>::Holder()
 	: m_function(nullptr)
 	, m_stackSize(0)
 	, m_stack(nullptr)
+	, m_stackAllocator(nullptr)
 	, m_stackPointer(nullptr)
 	, m_state(CoroutineState::Created)
 	, m_refCount(1)
@@ -40,14 +41,16 @@ template<typename ReturnType>
 }
 
 template<typename ReturnType>
-sprawl::threading::CoroutineBase::Holder<ReturnType>::Holder(std::function<ReturnType()> function, size_t stackSize)
+sprawl::threading::CoroutineBase::Holder<ReturnType>::Holder(std::function<ReturnType()> function, size_t stackSize, StackAllocator* /*stackAllocator*/)
 	: m_function(function)
 	, m_stackSize(stackSize)
 	, m_stack(nullptr)
+	, m_stackAllocator(nullptr)
 	, m_stackPointer(nullptr)
 	, m_state(CoroutineState::Created)
 	, m_refCount(1)
 	, m_priorCoroutine(nullptr)
 {
+	// The system allocates fiber stacks itself, so there's nothing here for a StackAllocator to do.
 	m_stackPointer = CreateFiberEx(0, m_stackSize, 0, &detail::EntryPointWin32, &CoroutineBase::entryPoint_);
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "coroutinestack.hpp"
+
+sprawl::threading::StackPool::StackPool(size_t maxCachedPerSize, bool releaseOnFree)
+	: m_mutex()
+	, m_maxCachedPerSize(maxCachedPerSize)
+	, m_releaseOnFree(releaseOnFree)
+{
+	//
+}
+
+sprawl::threading::StackPool::~StackPool()
+{
+	Trim();
+}
+
+void* sprawl::threading::StackPool::Allocate(size_t stackSize)
+{
+	size_t const classSize = sizeClass_(stackSize);
+	collections::Vector<void*>& cached = m_cached[classIndex_(classSize)];
+	{
+		ScopedLock lock(m_mutex);
+		if(!cached.Empty())
+		{
+			void* stack = cached.Back();
+			cached.PopBack();
+			return stack;
+		}
+	}
+
+	void* stack = map_(classSize);
+	if(stack == nullptr)
+	{
+		SPRAWL_ABORT_MSG("Failed to map a coroutine stack.");
+	}
+	return stack;
+}
+
+void sprawl::threading::StackPool::Free(void* stack, size_t stackSize)
+{
+	size_t const classSize = sizeClass_(stackSize);
+	if(m_releaseOnFree)
+	{
+		release_(stack, classSize);
+	}
+
+	collections::Vector<void*>& cached = m_cached[classIndex_(classSize)];
+	{
+		ScopedLock lock(m_mutex);
+		if(size_t(cached.Size()) < m_maxCachedPerSize)
+		{
+			cached.PushBack(stack);
+			return;
+		}
+	}
+	unmap_(stack, classSize);
+}
+
+size_t sprawl::threading::StackPool::CachedCount() const
+{
+	ScopedLock lock(m_mutex);
+	size_t count = 0;
+	for(size_t i = 0; i < c_classCount; ++i)
+	{
+		count += size_t(m_cached[i].Size());
+	}
+	return count;
+}
+
+void sprawl::threading::StackPool::Trim()
+{
+	ScopedLock lock(m_mutex);
+	for(size_t i = 0; i < c_classCount; ++i)
+	{
+		while(!m_cached[i].Empty())
+		{
+			unmap_(m_cached[i].Back(), size_t(1) << i);
+			m_cached[i].PopBack();
+		}
+	}
+}
+
+/*static*/ sprawl::threading::StackPool& sprawl::threading::StackPool::Default()
+{
+	static StackPool* pool = new StackPool();
+	return *pool;
+}
+
+/*static*/ size_t sprawl::threading::StackPool::sizeClass_(size_t stackSize)
+{
+	size_t classSize = pageSize_();
+	while(classSize < stackSize)
+	{
+		classSize <<= 1;
+	}
+	return classSize;
+}
+
+/*static*/ size_t sprawl::threading::StackPool::classIndex_(size_t classSize)
+{
+	size_t index = 0;
+	while((size_t(1) << index) < classSize)
+	{
+		++index;
+	}
+	return index;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+namespace sprawl
+{
+	namespace threading
+	{
+		class StackAllocator;
+		class StackPool;
+	}
+}
+
+#include <stddef.h>
+
+#include "mutex.hpp"
+#include "../collections/Vector.hpp"
+
+/**
+ * @brief	Where a coroutine gets its stack from. Pass one to a coroutine's constructor to use it instead of
+ *			StackPool::Default(); it has to outlive every coroutine using it.
+ * @details	Stacks grow down on every platform coroutines support, so anything that guards against overflow
+ *			belongs below the returned address.
+ *
+ *			On Windows, coroutines are fibers and the system allocates their stacks, so this goes unused.
+ */
+class sprawl::threading::StackAllocator
+{
+public:
+	virtual ~StackAllocator() {}
+
+	/**
+	 * @return	The low end of at least stackSize bytes of readable, writable memory.
+	 */
+	virtual void* Allocate(size_t stackSize) = 0;
+
+	/**
+	 * @brief	Give back a stack from Allocate(), along with the size it was asked for.
+	 */
+	virtual void Free(void* stack, size_t stackSize) = 0;
+};
+
+/**
+ * @brief	Keeps stacks around once their coroutines are done with them, so the next coroutine of about the same
+ *			size doesn't have to map a new one.
+ * @details	Sizes are rounded up to a power of two, at least a page, and each size is pooled separately. Every
+ *			stack gets an inaccessible guard page below it, so an overflow crashes right away instead of quietly
+ *			running over whatever's mapped next to it. On Linux and OSX, memory is reserved without being
+ *			committed, so a page only costs anything once the coroutine touches it.
+ *
+ *			A recycled stack keeps whatever pages its last coroutine touched. With releaseOnFree, they're handed
+ *			back to the system when the stack comes back to the pool, which saves memory when a few deep
+ *			coroutines would otherwise leave a lot of it behind, at the cost of page faults on the next use.
+ *
+ *			All methods are thread-safe.
+ */
+class sprawl::threading::StackPool : public sprawl::threading::StackAllocator
+{
+public:
+	/**
+	 * @param	maxCachedPerSize	How many idle stacks of each size to keep. Beyond that they're unmapped.
+	 * @param	releaseOnFree		Hand back the memory of stacks as they come back to the pool.
+	 */
+	StackPool(size_t maxCachedPerSize = 16, bool releaseOnFree = false);
+	~StackPool();
+
+	virtual void* Allocate(size_t stackSize) override;
+	virtual void Free(void* stack, size_t stackSize) override;
+
+	/**
+	 * @brief	How many idle stacks are waiting to be reused, across all sizes.
+	 */
+	size_t CachedCount() const;
+
+	/**
+	 * @brief	Unmap every idle stack.
+	 */
+	void Trim();
+
+	/**
+	 * @brief	The pool coroutines use when they aren't given an allocator. It's never destroyed, so coroutines
+	 *			that outlive static destruction can still give their stacks back.
+	 */
+	static StackPool& Default();
+private:
+	StackPool(StackPool const& other) = delete;
+	StackPool& operator=(StackPool const& other) = delete;
+
+	static size_t sizeClass_(size_t stackSize);
+	static size_t classIndex_(size_t classSize);
+
+	// Platform-specific. The guard page sits below the address map_() returns.
+	static size_t pageSize_();
+	static void* map_(size_t classSize);
+	static void unmap_(void* stack, size_t classSize);
+	static void release_(void* stack, size_t classSize);
+
+	static constexpr size_t c_classCount = sizeof(size_t) * 8;
+
+	mutable Mutex m_mutex;
+	collections::Vector<void*> m_cached[c_classCount];
+	size_t m_maxCachedPerSize;
+	bool m_releaseOnFree;
+};
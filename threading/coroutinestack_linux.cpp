@@ -0,0 +1,46 @@
+#include "coroutinestack.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*static*/ size_t sprawl::threading::StackPool::pageSize_()
+{
+	static size_t const pageSize = size_t(sysconf(_SC_PAGESIZE));
+	return pageSize;
+}
+
+/*static*/ void* sprawl::threading::StackPool::map_(size_t classSize)
+{
+	size_t const guardSize = pageSize_();
+	int flags = MAP_PRIVATE | MAP_ANON;
+#ifdef MAP_NORESERVE
+	// Don't charge the whole stack against the commit limit up front; most coroutines use a fraction of it.
+	flags |= MAP_NORESERVE;
+#endif
+	void* mapping = mmap(nullptr, classSize + guardSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if(mapping == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	if(mprotect(mapping, guardSize, PROT_NONE) != 0)
+	{
+		munmap(mapping, classSize + guardSize);
+		return nullptr;
+	}
+	return static_cast<char*>(mapping) + guardSize;
+}
+
+/*static*/ void sprawl::threading::StackPool::unmap_(void* stack, size_t classSize)
+{
+	size_t const guardSize = pageSize_();
+	munmap(static_cast<char*>(stack) - guardSize, classSize + guardSize);
+}
+
+/*static*/ void sprawl::threading::StackPool::release_(void* stack, size_t classSize)
+{
+#ifdef __APPLE__
+	madvise(stack, classSize, MADV_FREE);
+#else
+	madvise(stack, classSize, MADV_DONTNEED);
+#endif
+}
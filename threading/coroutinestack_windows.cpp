@@ -0,0 +1,38 @@
+#include "coroutinestack.hpp"
+
+#include <Windows.h>
+
+/*static*/ size_t sprawl::threading::StackPool::pageSize_()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return size_t(info.dwPageSize);
+}
+
+/*static*/ void* sprawl::threading::StackPool::map_(size_t classSize)
+{
+	size_t const guardSize = pageSize_();
+	char* mapping = static_cast<char*>(VirtualAlloc(nullptr, classSize + guardSize, MEM_RESERVE, PAGE_NOACCESS));
+	if(mapping == nullptr)
+	{
+		return nullptr;
+	}
+	// The guard page is left reserved but never committed.
+	if(VirtualAlloc(mapping + guardSize, classSize, MEM_COMMIT, PAGE_READWRITE) == nullptr)
+	{
+		VirtualFree(mapping, 0, MEM_RELEASE);
+		return nullptr;
+	}
+	return mapping + guardSize;
+}
+
+/*static*/ void sprawl::threading::StackPool::unmap_(void* stack, size_t /*classSize*/)
+{
+	VirtualFree(static_cast<char*>(stack) - pageSize_(), 0, MEM_RELEASE);
+}
+
+/*static*/ void sprawl::threading::StackPool::release_(void* stack, size_t classSize)
+{
+	// Drops the contents without giving up the commit, so the stack stays usable.
+	VirtualAlloc(stack, classSize, MEM_RESET, PAGE_READWRITE);
+}
@@ -19,7 +19,19 @@
 		int queue;
 	};
 #else
-	typedef int EventType;
+	struct EventType
+	{
+		// Bit 0 is the signaled flag; the rest count threads parked on this word with a futex.
+		mutable std::atomic<uint32_t> state;
+		// Threads in a WaitAny()/WaitAll() that includes this event. Those threads sleep in epoll on fd, so
+		// while there are any, Notify() writes to it as well.
+		mutable std::atomic<uint32_t> groupWaiters;
+		// An eventfd, only created the first time this event is part of a group wait.
+		mutable std::atomic<int> fd;
+		// Unique for the life of the process; lets a cached epoll registration tell a new event at an old
+		// event's address from the old one.
+		uint64_t id;
+	};
 #endif
 
 namespace sprawl
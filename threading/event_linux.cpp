@@ -1,222 +1,452 @@
 #include "event.hpp"
+#include "eventset.hpp"
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <pthread.h>
+#include <limits.h>
+#include <time.h>
 
-sprawl::threading::Event::Event()
-	: m_event(eventfd(0, 0))
+namespace EventStatic
 {
+	static std::atomic<uint64_t> highId_(0);
 
-}
-
-sprawl::threading::Event::~Event()
-{
-	close(m_event);
-}
+	static uint32_t const c_signaled = 1;
+	static uint32_t const c_waiter = 2;
 
-void sprawl::threading::Event::Notify() const
-{
-	uint64_t const i = 1;
-	write(m_event, &i, sizeof(uint64_t));
-}
-
-void sprawl::threading::Event::Wait() const
-{
-	uint64_t i;
-	read(m_event, &i, sizeof(uint64_t));
-}
+	static int futex_(std::atomic<uint32_t>* address, int op, uint32_t value, struct timespec const* timeout)
+	{
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires a plain 32-bit word");
+		return int(syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), op, value, timeout, nullptr, 0));
+	}
 
-bool sprawl::threading::Event::WaitFor(int64_t nanoseconds) const
-{
-	if(nanoseconds < 0)
+	static bool tryConsume_(EventType const& event)
 	{
+		uint32_t state = event.state.load(std::memory_order_relaxed);
+		while(state & c_signaled)
+		{
+			if(event.state.compare_exchange_weak(state, state & ~c_signaled, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				return true;
+			}
+		}
 		return false;
 	}
 
-	fd_set inSet;
+	// deadline is a SteadyNow() timestamp, or null to wait forever.
+	static bool wait_(EventType const& event, int64_t const* deadline)
+	{
+		for(;;)
+		{
+			uint32_t state = event.state.load(std::memory_order_relaxed);
+			if(state & c_signaled)
+			{
+				if(event.state.compare_exchange_weak(state, state & ~c_signaled, std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					return true;
+				}
+				continue;
+			}
 
-	FD_ZERO(&inSet);
-	FD_SET(m_event, &inSet);
-	int max = m_event;
+			struct timespec ts;
+			struct timespec* timeout = nullptr;
+			if(deadline != nullptr)
+			{
+				int64_t const remaining = *deadline - sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+				if(remaining <= 0)
+				{
+					return false;
+				}
+				int64_t const sec = sprawl::time::Convert(remaining, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Seconds);
+				ts.tv_sec = time_t(sec);
+				ts.tv_nsec = long(remaining - sprawl::time::Convert(sec, sprawl::time::Resolution::Seconds, sprawl::time::Resolution::Nanoseconds));
+				timeout = &ts;
+			}
 
-	struct timeval tv;
-	int64_t sec = sprawl::time::Convert(nanoseconds, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Seconds);
-	int64_t usec = sprawl::time::Convert(nanoseconds, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Microseconds) - sprawl::time::Convert(sec, sprawl::time::Resolution::Seconds, sprawl::time::Resolution::Microseconds);
+			// Count ourselves in first so Notify() knows to make the syscall. If anything changes between
+			// here and the futex call, the kernel sees a different value and we just go around again.
+			if(!event.state.compare_exchange_weak(state, state + c_waiter, std::memory_order_relaxed))
+			{
+				continue;
+			}
+			futex_(&event.state, FUTEX_WAIT_PRIVATE, state + c_waiter, timeout);
+			event.state.fetch_sub(c_waiter, std::memory_order_relaxed);
+		}
+	}
 
-	tv.tv_sec = time_t(sec);
-	tv.tv_usec = suseconds_t(usec);
+	static int getFd_(EventType const& event)
+	{
+		int fd = event.fd.load(std::memory_order_acquire);
+		if(fd != -1)
+		{
+			return fd;
+		}
+		int const created = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(event.fd.compare_exchange_strong(fd, created, std::memory_order_acq_rel))
+		{
+			return created;
+		}
+		// Someone else got there first.
+		close(created);
+		return fd;
+	}
 
-	select(max + 1, &inSet, nullptr, nullptr, &tv);
-	if(FD_ISSET(m_event, &inSet))
+	// Each thread keeps the epoll registration of the last group it waited on, so a loop that waits on the
+	// same group over and over only pays for epoll_wait() after the first time.
+	struct GroupCache
 	{
-		uint64_t i;
-		read(m_event, &i, sizeof(uint64_t));
-		return true;
+		int epollFd;
+		sprawl::collections::Vector<uint64_t> ids;
+	};
+
+	static pthread_key_t cacheKey_;
+	static pthread_once_t cacheKeyOnce_ = PTHREAD_ONCE_INIT;
+
+	static void destroyCache_(void* value)
+	{
+		GroupCache* cache = static_cast<GroupCache*>(value);
+		if(cache->epollFd != -1)
+		{
+			close(cache->epollFd);
+		}
+		delete cache;
 	}
-	return false;
-}
 
-/*static*/ sprawl::threading::Event const* sprawl::threading::Event::WaitAny(EventGroup const& values)
-{
-	fd_set inSet;
+	static void createCacheKey_()
+	{
+		pthread_key_create(&cacheKey_, &destroyCache_);
+	}
 
-	FD_ZERO(&inSet);
-	int max = 0;
-	for(auto& event : values)
+	static int getEpoll_(sprawl::threading::Event::EventGroup const& values)
 	{
-		FD_SET(event->m_event, &inSet);
-		max = event->m_event > max ? event->m_event : max;
+		pthread_once(&cacheKeyOnce_, &createCacheKey_);
+		GroupCache* cache = static_cast<GroupCache*>(pthread_getspecific(cacheKey_));
+		if(cache == nullptr)
+		{
+			cache = new GroupCache();
+			cache->epollFd = -1;
+			pthread_setspecific(cacheKey_, cache);
+		}
+
+		bool matches = cache->epollFd != -1 && cache->ids.Size() == values.Size();
+		for(ssize_t i = 0; matches && i < values.Size(); ++i)
+		{
+			matches = cache->ids[i] == values[i]->m_event.id;
+		}
+		if(matches)
+		{
+			return cache->epollFd;
+		}
+
+		// Closing an eventfd takes it out of every epoll set on its own, so there's nothing to unregister -
+		// starting over is simpler than working out what changed.
+		if(cache->epollFd != -1)
+		{
+			close(cache->epollFd);
+		}
+		cache->epollFd = epoll_create1(EPOLL_CLOEXEC);
+		cache->ids.Clear();
+		for(ssize_t i = 0; i < values.Size(); ++i)
+		{
+			struct epoll_event registration;
+			registration.events = EPOLLIN;
+			registration.data.u64 = uint64_t(i);
+			epoll_ctl(cache->epollFd, EPOLL_CTL_ADD, getFd_(values[i]->m_event), &registration);
+			cache->ids.PushBack(values[i]->m_event.id);
+		}
+		return cache->epollFd;
 	}
 
-	select(max + 1, &inSet, nullptr, nullptr, nullptr);
+	static void beginGroupWait_(sprawl::threading::Event::EventGroup const& values)
+	{
+		for(auto& event : values)
+		{
+			event->m_event.groupWaiters.fetch_add(1, std::memory_order_seq_cst);
+		}
+	}
 
-	Event const* ret = nullptr;
+	static void endGroupWait_(sprawl::threading::Event::EventGroup const& values)
+	{
+		for(auto& event : values)
+		{
+			event->m_event.groupWaiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
 
-	for(auto& event : values)
+	// The epoll_wait() timeout for a deadline (-1 for none); false once it's passed.
+	static bool epollTimeout_(int64_t const* deadline, int& timeoutMs)
 	{
-		if(FD_ISSET(event->m_event, &inSet))
+		timeoutMs = -1;
+		if(deadline != nullptr)
 		{
-			if(ret == nullptr)
+			int64_t const remaining = *deadline - sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+			if(remaining <= 0)
 			{
-				ret = event;
+				return false;
 			}
-			//Clear the signaled state.
-			event->Wait();
+			// Round up; waking a hair early would just mean another pass.
+			int64_t const ms = (remaining + sprawl::time::Resolution::Milliseconds - 1) / sprawl::time::Resolution::Milliseconds;
+			timeoutMs = ms > INT_MAX ? INT_MAX : int(ms);
 		}
+		return true;
 	}
 
-	return ret;
-}
-
-/*static*/ sprawl::threading::Event const* sprawl::threading::Event::WaitAnyFor(EventGroup const& values, int64_t nanoseconds)
-{
-	fd_set inSet;
-
-	FD_ZERO(&inSet);
-	int max = 0;
-	for(auto& event : values)
+	static void drain_(int fd)
 	{
-		FD_SET(event->m_event, &inSet);
-		max = event->m_event > max ? event->m_event : max;
+		uint64_t value;
+		ssize_t const ignored = read(fd, &value, sizeof(value));
+		(void)ignored;
 	}
 
-	struct timeval tv;
-	int64_t sec = sprawl::time::Convert(nanoseconds, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Seconds);
-	int64_t usec = sprawl::time::Convert(nanoseconds, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Microseconds) - sprawl::time::Convert(sec, sprawl::time::Resolution::Seconds, sprawl::time::Resolution::Microseconds);
+	// Sleep until some event in the group has been notified since the last call, or the deadline passes.
+	// The eventfds are only wakeup hints - the state word is what says whether an event is signaled - so
+	// they're just drained here and the caller looks at the events themselves.
+	static bool sleep_(int epollFd, sprawl::threading::Event::EventGroup const& values, int64_t const* deadline)
+	{
+		int timeoutMs;
+		if(!epollTimeout_(deadline, timeoutMs))
+		{
+			return false;
+		}
+
+		struct epoll_event ready[64];
+		int const count = epoll_wait(epollFd, ready, 64, timeoutMs);
+		for(int i = 0; i < count; ++i)
+		{
+			drain_(values[ssize_t(ready[i].data.u64)]->m_event.fd.load(std::memory_order_relaxed));
+		}
+		return true;
+	}
 
-	tv.tv_sec = time_t(sec);
-	tv.tv_usec = suseconds_t(usec);
+	static sprawl::threading::Event const* waitAny_(sprawl::threading::Event::EventGroup const& values, int64_t const* deadline)
+	{
+		int const epollFd = getEpoll_(values);
+		beginGroupWait_(values);
 
-	select(max + 1, &inSet, nullptr, nullptr, &tv);
+		sprawl::threading::Event const* ret = nullptr;
+		for(;;)
+		{
+			for(auto& event : values)
+			{
+				// Clear the signaled state of everything that fired, not just the one we return.
+				if(tryConsume_(event->m_event) && ret == nullptr)
+				{
+					ret = event;
+				}
+			}
+			if(ret != nullptr || !sleep_(epollFd, values, deadline))
+			{
+				break;
+			}
+		}
 
-	Event const* ret = nullptr;
+		endGroupWait_(values);
+		return ret;
+	}
 
-	for(auto& event : values)
+	static bool waitAll_(sprawl::threading::Event::EventGroup const& values, int64_t const* deadline)
 	{
-		if(FD_ISSET(event->m_event, &inSet))
+		int const epollFd = getEpoll_(values);
+		beginGroupWait_(values);
+
+		sprawl::threading::Event::EventGroup pending(values);
+		bool finished = true;
+		for(;;)
 		{
-			if(ret == nullptr)
+			for(ssize_t i = 0; i < pending.Size();)
 			{
-				ret = event;
+				if(tryConsume_(pending[i]->m_event))
+				{
+					pending[i] = pending.Back();
+					pending.PopBack();
+				}
+				else
+				{
+					++i;
+				}
+			}
+			if(pending.Empty())
+			{
+				break;
+			}
+			if(!sleep_(epollFd, values, deadline))
+			{
+				finished = false;
+				break;
 			}
-			//Clear the signaled state.
-			event->Wait();
 		}
-	}
 
-	return ret;
+		endGroupWait_(values);
+		return finished;
+	}
 }
 
+sprawl::threading::Event::Event()
+	: m_event{ {0}, {0}, {-1}, EventStatic::highId_.fetch_add(1, std::memory_order_relaxed) }
+{
 
-/*static*/ void sprawl::threading::Event::WaitAll(EventGroup const& values)
+}
+
+sprawl::threading::Event::~Event()
 {
-	fd_set inSet;
+	int const fd = m_event.fd.load(std::memory_order_relaxed);
+	if(fd != -1)
+	{
+		close(fd);
+	}
+}
 
-	FD_ZERO(&inSet);
-	int max = 0;
-	for(auto& event : values)
+void sprawl::threading::Event::Notify() const
+{
+	uint32_t const state = m_event.state.fetch_or(EventStatic::c_signaled, std::memory_order_seq_cst);
+	if(state & EventStatic::c_signaled)
+	{
+		// Already signaled - whoever signaled it took care of waking someone.
+		return;
+	}
+	if(state >= EventStatic::c_waiter)
+	{
+		EventStatic::futex_(&m_event.state, FUTEX_WAKE_PRIVATE, 1, nullptr);
+	}
+	if(m_event.groupWaiters.load(std::memory_order_seq_cst) != 0)
 	{
-		FD_SET(event->m_event, &inSet);
-		max = event->m_event > max ? event->m_event : max;
+		uint64_t const i = 1;
+		ssize_t const ignored = write(m_event.fd.load(std::memory_order_acquire), &i, sizeof(uint64_t));
+		(void)ignored;
 	}
+}
 
-	ssize_t total = 0;
+void sprawl::threading::Event::Wait() const
+{
+	EventStatic::wait_(m_event, nullptr);
+}
 
-	while(total < values.Size())
+bool sprawl::threading::Event::WaitFor(int64_t nanoseconds) const
+{
+	if(nanoseconds < 0)
 	{
-		total += select(max + 1, &inSet, nullptr, nullptr, nullptr);
+		return false;
+	}
+	int64_t const deadline = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+	return EventStatic::wait_(m_event, &deadline);
+}
 
-		fd_set set = inSet;
-		FD_ZERO(&inSet);
+/*static*/ sprawl::threading::Event const* sprawl::threading::Event::WaitAny(EventGroup const& values)
+{
+	return EventStatic::waitAny_(values, nullptr);
+}
 
-		for(auto& event : values)
-		{
-			if(FD_ISSET(event->m_event, &set))
-			{
-				//Clear the signaled state.
-				event->Wait();
-			}
-			else
-			{
-				FD_SET(event->m_event, &inSet);
-			}
-		}
-	}
+/*static*/ sprawl::threading::Event const* sprawl::threading::Event::WaitAnyFor(EventGroup const& values, int64_t nanoseconds)
+{
+	int64_t const deadline = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+	return EventStatic::waitAny_(values, &deadline);
+}
+
+/*static*/ void sprawl::threading::Event::WaitAll(EventGroup const& values)
+{
+	EventStatic::waitAll_(values, nullptr);
 }
 
 /*static*/ bool sprawl::threading::Event::WaitAllFor(EventGroup const& values, int64_t nanoseconds)
 {
-	int64_t timeout_time = sprawl::time::Now() + nanoseconds;
+	int64_t const deadline = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+	return EventStatic::waitAll_(values, &deadline);
+}
+
+sprawl::threading::EventSet::EventSet()
+	: m_mutex()
+	, m_fired()
+	, m_members()
+	, m_epollFd(epoll_create1(EPOLL_CLOEXEC))
+{
+
+}
 
-	fd_set inSet;
+sprawl::threading::EventSet::~EventSet()
+{
+	for(auto& member : m_members)
+	{
+		member.Value()->m_event.groupWaiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+	close(m_epollFd);
+}
 
-	FD_ZERO(&inSet);
-	int max = 0;
-	for(auto& event : values)
+void sprawl::threading::EventSet::Add(Event const& event)
+{
+	ScopedLock lock(m_mutex);
+	if(m_members.Has(event.m_event.id))
 	{
-		FD_SET(event->m_event, &inSet);
-		max = event->m_event > max ? event->m_event : max;
+		return;
 	}
+	m_members.Insert(event.m_event.id, &event);
 
-	ssize_t total = 0;
+	// Registered interest for as long as it's a member, so every Notify() that signals it reaches epoll.
+	int const fd = EventStatic::getFd_(event.m_event);
+	event.m_event.groupWaiters.fetch_add(1, std::memory_order_seq_cst);
+	struct epoll_event registration;
+	registration.events = EPOLLIN;
+	registration.data.u64 = event.m_event.id;
+	epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &registration);
 
-	while(total < values.Size())
+	if(event.m_event.state.load(std::memory_order_seq_cst) & EventStatic::c_signaled)
 	{
-		// On Linux, tv is updated after select and we don't have to do this
-		// But if this code is used on any other platform with select(), that behavior will probably break
-		struct timeval tv;
-		int64_t sec = sprawl::time::Convert(nanoseconds, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Seconds);
-		int64_t usec = sprawl::time::Convert(nanoseconds, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Microseconds) - sprawl::time::Convert(sec, sprawl::time::Resolution::Seconds, sprawl::time::Resolution::Microseconds);
-
-		tv.tv_sec = time_t(sec);
-		tv.tv_usec = suseconds_t(usec);
+		// Signaled before we were watching its fd.
+		uint64_t const i = 1;
+		ssize_t const ignored = write(fd, &i, sizeof(uint64_t));
+		(void)ignored;
+	}
+}
 
-		int ret = select(max + 1, &inSet, nullptr, nullptr, &tv);
+void sprawl::threading::EventSet::Remove(Event const& event)
+{
+	ScopedLock lock(m_mutex);
+	if(!m_members.Has(event.m_event.id))
+	{
+		return;
+	}
+	m_members.Erase(event.m_event.id);
+	epoll_ctl(m_epollFd, EPOLL_CTL_DEL, event.m_event.fd.load(std::memory_order_relaxed), nullptr);
+	event.m_event.groupWaiters.fetch_sub(1, std::memory_order_relaxed);
+	forgetFired_(&event);
+}
 
-		if(ret == 0)
+sprawl::threading::Event const* sprawl::threading::EventSet::wait_(int64_t const* deadline)
+{
+	for(;;)
+	{
+		Event const* fired = popFired_();
+		if(fired != nullptr)
 		{
-			return false;
+			return fired;
 		}
 
-		total += ret;
-
-		fd_set set = inSet;
-		FD_ZERO(&inSet);
+		int timeoutMs;
+		if(!EventStatic::epollTimeout_(deadline, timeoutMs))
+		{
+			return nullptr;
+		}
+		struct epoll_event ready[64];
+		int const count = epoll_wait(m_epollFd, ready, 64, timeoutMs);
 
-		for(auto& event : values)
+		// Under the lock so nothing we look at can be removed (and destroyed) out from under us.
+		ScopedLock lock(m_mutex);
+		for(int i = 0; i < count; ++i)
 		{
-			if(FD_ISSET(event->m_event, &set))
+			auto it = m_members.find(ready[i].data.u64);
+			if(it == m_members.end())
 			{
-				//Clear the signaled state.
-				event->Wait();
+				// Removed since epoll_wait() returned.
+				continue;
 			}
-			else
+			Event const* event = it.Value();
+			// Drain first: a Notify() landing between the two then leaves the fd readable for next time.
+			EventStatic::drain_(event->m_event.fd.load(std::memory_order_relaxed));
+			if(EventStatic::tryConsume_(event->m_event))
 			{
-				FD_SET(event->m_event, &inSet);
+				m_fired.PushBack(event);
 			}
 		}
-		nanoseconds = timeout_time - sprawl::time::Now();
 	}
-
-	return true;
 }
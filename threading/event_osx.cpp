@@ -1,4 +1,5 @@
 #include "event.hpp"
+#include "eventset.hpp"
 #include <atomic>
 #include <sys/event.h>
 #include <stdio.h>
@@ -207,4 +208,93 @@ bool sprawl::threading::Event::WaitFor(int64_t nanoseconds) const
 	close(multiKqueue);
 
 	return total == values.Size();
-}
\ No newline at end of file
+}
+
+sprawl::threading::EventSet::EventSet()
+	: m_mutex()
+	, m_fired()
+	, m_members()
+	, m_queue(kqueue())
+{
+
+}
+
+sprawl::threading::EventSet::~EventSet()
+{
+	close(m_queue);
+}
+
+void sprawl::threading::EventSet::Add(Event const& event)
+{
+	ScopedLock lock(m_mutex);
+	if(m_members.Has(event.m_event.ident))
+	{
+		return;
+	}
+	m_members.Insert(event.m_event.ident, &event);
+
+	// An event's own kqueue reads as ready while it has a pending trigger, including one from before now.
+	struct kevent change;
+	EV_SET(&change, event.m_event.queue, EVFILT_READ, EV_ADD, 0, 0, (void*)event.m_event.ident);
+	kevent(m_queue, &change, 1, nullptr, 0, nullptr);
+}
+
+void sprawl::threading::EventSet::Remove(Event const& event)
+{
+	ScopedLock lock(m_mutex);
+	if(!m_members.Has(event.m_event.ident))
+	{
+		return;
+	}
+	m_members.Erase(event.m_event.ident);
+	struct kevent change;
+	EV_SET(&change, event.m_event.queue, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+	kevent(m_queue, &change, 1, nullptr, 0, nullptr);
+	forgetFired_(&event);
+}
+
+sprawl::threading::Event const* sprawl::threading::EventSet::wait_(int64_t const* deadline)
+{
+	for(;;)
+	{
+		Event const* fired = popFired_();
+		if(fired != nullptr)
+		{
+			return fired;
+		}
+
+		struct timespec ts;
+		struct timespec* timeout = nullptr;
+		if(deadline != nullptr)
+		{
+			int64_t const remaining = *deadline - sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+			if(remaining <= 0)
+			{
+				return nullptr;
+			}
+			int64_t const sec = sprawl::time::Convert(remaining, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Seconds);
+			ts.tv_sec = time_t(sec);
+			ts.tv_nsec = long(remaining - sprawl::time::Convert(sec, sprawl::time::Resolution::Seconds, sprawl::time::Resolution::Nanoseconds));
+			timeout = &ts;
+		}
+		struct kevent ready[64];
+		int const count = kevent(m_queue, nullptr, 0, ready, 64, timeout);
+
+		// Under the lock so nothing we look at can be removed (and destroyed) out from under us.
+		ScopedLock lock(m_mutex);
+		for(int i = 0; i < count; ++i)
+		{
+			auto it = m_members.find(intptr_t(ready[i].udata));
+			if(it == m_members.end())
+			{
+				continue;
+			}
+			Event const* event = it.Value();
+			// Someone waiting on the event directly may have beaten us to it.
+			if(event->WaitFor(0))
+			{
+				m_fired.PushBack(event);
+			}
+		}
+	}
+}
@@ -1,4 +1,6 @@
 #include "event.hpp"
+#include "eventset.hpp"
+#include "../common/errors.hpp"
 
 sprawl::threading::Event::Event()
 	: m_event(CreateEvent(nullptr, false, false, nullptr))
@@ -89,3 +91,107 @@ bool sprawl::threading::Event::WaitFor(int64_t nanoseconds) const
 	}
 	return true;
 }
+
+sprawl::threading::EventSet::EventSet()
+	: m_mutex()
+	, m_fired()
+	, m_members()
+	, m_changed(CreateEvent(nullptr, false, false, nullptr))
+{
+
+}
+
+sprawl::threading::EventSet::~EventSet()
+{
+	CloseHandle(m_changed);
+}
+
+void sprawl::threading::EventSet::Add(Event const& event)
+{
+	ScopedLock lock(m_mutex);
+	for(auto& member : m_members)
+	{
+		if(member == &event)
+		{
+			return;
+		}
+	}
+	// One slot goes to m_changed.
+	if(m_members.Size() >= MAXIMUM_WAIT_OBJECTS - 1)
+	{
+		SPRAWL_ABORT_MSG("Too many events in one EventSet.");
+	}
+	m_members.PushBack(&event);
+	SetEvent(m_changed);
+}
+
+void sprawl::threading::EventSet::Remove(Event const& event)
+{
+	ScopedLock lock(m_mutex);
+	for(ssize_t i = 0; i < m_members.Size(); ++i)
+	{
+		if(m_members[i] == &event)
+		{
+			m_members[i] = m_members.Back();
+			m_members.PopBack();
+			forgetFired_(&event);
+			SetEvent(m_changed);
+			return;
+		}
+	}
+}
+
+// WaitForMultipleObjects() takes its handles fresh each time, so there's nothing to register up front - but it
+// does say which one fired, and only consumes that one.
+sprawl::threading::Event const* sprawl::threading::EventSet::wait_(int64_t const* deadline)
+{
+	for(;;)
+	{
+		Event const* fired = popFired_();
+		if(fired != nullptr)
+		{
+			return fired;
+		}
+
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+		Event const* events[MAXIMUM_WAIT_OBJECTS];
+		DWORD count = 1;
+		handles[0] = m_changed;
+		{
+			ScopedLock lock(m_mutex);
+			for(auto& member : m_members)
+			{
+				events[count] = member;
+				handles[count] = member->m_event;
+				++count;
+			}
+		}
+
+		DWORD timeoutMs = INFINITE;
+		if(deadline != nullptr)
+		{
+			int64_t const remaining = *deadline - sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+			if(remaining <= 0)
+			{
+				return nullptr;
+			}
+			timeoutMs = DWORD((remaining + sprawl::time::Resolution::Milliseconds - 1) / sprawl::time::Resolution::Milliseconds);
+		}
+
+		DWORD const ret = WaitForMultipleObjects(count, handles, false, timeoutMs);
+		if(ret <= WAIT_OBJECT_0 || ret >= WAIT_OBJECT_0 + count)
+		{
+			// The membership changed, or we timed out; go around and find out which.
+			continue;
+		}
+		Event const* event = events[ret - WAIT_OBJECT_0];
+		ScopedLock lock(m_mutex);
+		for(auto& member : m_members)
+		{
+			if(member == event)
+			{
+				return event;
+			}
+		}
+	}
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "../common/compat.hpp"
+
+#if defined(__APPLE__)
+#	include <pthread.h>
+#endif
+
+namespace sprawl
+{
+	namespace threading
+	{
+		class EventCount;
+	}
+}
+
+/**
+* @class   sprawl::threading::EventCount
+*
+* @brief   Lightweight condition for lock-free data structures - lets consumers park when there's nothing
+*          to do without making producers pay for a syscall when nobody's parked.
+*
+* @details Usage on the consumer side is always the same three steps:
+*
+*              uint32_t key = ec.PrepareWait();
+*              if (checkCondition()) { ec.CancelWait(); return; }
+*              ec.Wait(key);
+*
+*          and producers call Notify() or NotifyAll() after making the condition true. If a producer's Notify()
+*          lands anywhere after PrepareWait(), Wait() will return immediately, so wakeups can't be lost in
+*          the window between checking the condition and going to sleep.
+*
+*          Notify() is a fence and a load when there are no waiters. On Linux parking uses a futex, on Windows
+*          WaitOnAddress(), and on OSX a mutex and condition variable.
+*/
+class sprawl::threading::EventCount
+{
+public:
+	EventCount();
+	~EventCount();
+
+	/**
+	* @brief   Announce intent to wait. Must be followed by exactly one call to either CancelWait() or Wait().
+	*
+	* @return  A key to pass to Wait()/WaitFor()
+	*/
+	inline uint32_t PrepareWait()
+	{
+		m_waiters.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return m_epoch.load(std::memory_order_acquire);
+	}
+
+	/**
+	* @brief   Back out of a PrepareWait() without waiting, because the condition became true.
+	*/
+	inline void CancelWait()
+	{
+		m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief   Park until a Notify() or NotifyAll() that happened after the PrepareWait() that returned key.
+	*          May return spuriously; callers should re-check their condition.
+	*
+	* @param   key   The value returned by PrepareWait()
+	*/
+	void Wait(uint32_t key);
+
+	/**
+	* @brief   Same as Wait(), but will give up after the given amount of time.
+	*
+	* @param   key           The value returned by PrepareWait()
+	* @param   nanoseconds   The maximum amount of time to wait
+	*
+	* @return  false if the wait timed out, true otherwise
+	*/
+	bool WaitFor(uint32_t key, int64_t nanoseconds);
+
+	/**
+	* @brief   Wake one parked waiter, if any.
+	*/
+	inline void Notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (SPRAWL_UNLIKELY(m_waiters.load(std::memory_order_relaxed) != 0))
+		{
+			m_epoch.fetch_add(1, std::memory_order_release);
+			wake_(false);
+		}
+	}
+
+	/**
+	* @brief   Wake every parked waiter, if any.
+	*/
+	inline void NotifyAll()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (SPRAWL_UNLIKELY(m_waiters.load(std::memory_order_relaxed) != 0))
+		{
+			m_epoch.fetch_add(1, std::memory_order_release);
+			wake_(true);
+		}
+	}
+
+private:
+	EventCount(EventCount const& other) = delete;
+	EventCount& operator=(EventCount const& other) = delete;
+
+	void wake_(bool all);
+
+	std::atomic<uint32_t> m_epoch;
+	std::atomic<uint32_t> m_waiters;
+
+#if defined(__APPLE__)
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_conditionVariable;
+#endif
+};
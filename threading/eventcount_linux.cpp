@@ -0,0 +1,67 @@
+#include "eventcount.hpp"
+#include "../time/time.hpp"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+namespace EventCountStatic
+{
+	static int futex_(std::atomic<uint32_t>* address, int op, uint32_t value, struct timespec const* timeout)
+	{
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires a plain 32-bit word");
+		return int(syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), op, value, timeout, nullptr, 0));
+	}
+}
+
+sprawl::threading::EventCount::EventCount()
+	: m_epoch(0)
+	, m_waiters(0)
+{
+
+}
+
+sprawl::threading::EventCount::~EventCount()
+{
+
+}
+
+void sprawl::threading::EventCount::Wait(uint32_t key)
+{
+	while (m_epoch.load(std::memory_order_acquire) == key)
+	{
+		EventCountStatic::futex_(&m_epoch, FUTEX_WAIT_PRIVATE, key, nullptr);
+	}
+	m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool sprawl::threading::EventCount::WaitFor(uint32_t key, int64_t nanoseconds)
+{
+	int64_t const deadline = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+	bool notified = true;
+	while (m_epoch.load(std::memory_order_acquire) == key)
+	{
+		int64_t const remaining = deadline - sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+		if (remaining <= 0)
+		{
+			notified = false;
+			break;
+		}
+
+		struct timespec ts;
+		int64_t sec = sprawl::time::Convert(remaining, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Seconds);
+		ts.tv_sec = time_t(sec);
+		ts.tv_nsec = long(remaining - sprawl::time::Convert(sec, sprawl::time::Resolution::Seconds, sprawl::time::Resolution::Nanoseconds));
+
+		EventCountStatic::futex_(&m_epoch, FUTEX_WAIT_PRIVATE, key, &ts);
+	}
+	m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	return notified;
+}
+
+void sprawl::threading::EventCount::wake_(bool all)
+{
+	EventCountStatic::futex_(&m_epoch, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr);
+}
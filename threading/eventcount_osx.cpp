@@ -0,0 +1,73 @@
+#include "eventcount.hpp"
+#include "../time/time.hpp"
+#include <time.h>
+
+// OSX has no public futex equivalent, so parking falls back to a mutex and condition variable.
+// The fast paths (Notify() with no waiters, PrepareWait()/CancelWait()) never touch either of them.
+
+sprawl::threading::EventCount::EventCount()
+	: m_epoch(0)
+	, m_waiters(0)
+	, m_mutex()
+	, m_conditionVariable()
+{
+	pthread_mutex_init(&m_mutex, nullptr);
+	pthread_cond_init(&m_conditionVariable, nullptr);
+}
+
+sprawl::threading::EventCount::~EventCount()
+{
+	pthread_cond_destroy(&m_conditionVariable);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+void sprawl::threading::EventCount::Wait(uint32_t key)
+{
+	pthread_mutex_lock(&m_mutex);
+	while (m_epoch.load(std::memory_order_acquire) == key)
+	{
+		pthread_cond_wait(&m_conditionVariable, &m_mutex);
+	}
+	pthread_mutex_unlock(&m_mutex);
+	m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool sprawl::threading::EventCount::WaitFor(uint32_t key, int64_t nanoseconds)
+{
+	// pthread_cond_timedwait() takes an absolute time against the realtime clock.
+	int64_t const deadline = sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+	int64_t sec = sprawl::time::Convert(deadline, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Seconds);
+
+	struct timespec ts;
+	ts.tv_sec = time_t(sec);
+	ts.tv_nsec = long(deadline - sprawl::time::Convert(sec, sprawl::time::Resolution::Seconds, sprawl::time::Resolution::Nanoseconds));
+
+	bool notified = true;
+	pthread_mutex_lock(&m_mutex);
+	while (m_epoch.load(std::memory_order_acquire) == key)
+	{
+		if (pthread_cond_timedwait(&m_conditionVariable, &m_mutex, &ts) != 0)
+		{
+			notified = (m_epoch.load(std::memory_order_acquire) != key);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m_mutex);
+	m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	return notified;
+}
+
+void sprawl::threading::EventCount::wake_(bool all)
+{
+	// Taking the lock here closes the window between a waiter checking the epoch and blocking on the condition variable.
+	pthread_mutex_lock(&m_mutex);
+	if (all)
+	{
+		pthread_cond_broadcast(&m_conditionVariable);
+	}
+	else
+	{
+		pthread_cond_signal(&m_conditionVariable);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
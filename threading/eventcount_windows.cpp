@@ -0,0 +1,57 @@
+#include "eventcount.hpp"
+#include "../time/time.hpp"
+#include <Windows.h>
+
+#pragma comment(lib, "Synchronization.lib")
+
+sprawl::threading::EventCount::EventCount()
+	: m_epoch(0)
+	, m_waiters(0)
+{
+
+}
+
+sprawl::threading::EventCount::~EventCount()
+{
+
+}
+
+void sprawl::threading::EventCount::Wait(uint32_t key)
+{
+	while (m_epoch.load(std::memory_order_acquire) == key)
+	{
+		WaitOnAddress(&m_epoch, &key, sizeof(uint32_t), INFINITE);
+	}
+	m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool sprawl::threading::EventCount::WaitFor(uint32_t key, int64_t nanoseconds)
+{
+	int64_t const deadline = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+	bool notified = true;
+	while (m_epoch.load(std::memory_order_acquire) == key)
+	{
+		int64_t const remaining = deadline - sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds);
+		if (remaining <= 0)
+		{
+			notified = false;
+			break;
+		}
+		int64_t const milliseconds = sprawl::time::Convert(remaining, sprawl::time::Resolution::Nanoseconds, sprawl::time::Resolution::Milliseconds);
+		WaitOnAddress(&m_epoch, &key, sizeof(uint32_t), DWORD(milliseconds > 0 ? milliseconds : 1));
+	}
+	m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	return notified;
+}
+
+void sprawl::threading::EventCount::wake_(bool all)
+{
+	if (all)
+	{
+		WakeByAddressAll(&m_epoch);
+	}
+	else
+	{
+		WakeByAddressSingle(&m_epoch);
+	}
+}
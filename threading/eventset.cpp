@@ -0,0 +1,44 @@
+#include "eventset.hpp"
+
+size_t sprawl::threading::EventSet::Size() const
+{
+	ScopedLock lock(m_mutex);
+	return size_t(m_members.Size());
+}
+
+sprawl::threading::Event const* sprawl::threading::EventSet::Wait()
+{
+	return wait_(nullptr);
+}
+
+sprawl::threading::Event const* sprawl::threading::EventSet::WaitFor(int64_t nanoseconds)
+{
+	int64_t const deadline = sprawl::time::SteadyNow(sprawl::time::Resolution::Nanoseconds) + nanoseconds;
+	return wait_(&deadline);
+}
+
+sprawl::threading::Event const* sprawl::threading::EventSet::popFired_()
+{
+	ScopedLock lock(m_mutex);
+	if(m_fired.Empty())
+	{
+		return nullptr;
+	}
+	Event const* event = m_fired.Back();
+	m_fired.PopBack();
+	return event;
+}
+
+// Caller holds m_mutex.
+void sprawl::threading::EventSet::forgetFired_(Event const* event)
+{
+	for(ssize_t i = 0; i < m_fired.Size(); ++i)
+	{
+		if(m_fired[i] == event)
+		{
+			m_fired[i] = m_fired.Back();
+			m_fired.PopBack();
+			return;
+		}
+	}
+}
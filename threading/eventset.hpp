@@ -0,0 +1,91 @@
+#pragma once
+
+namespace sprawl
+{
+	namespace threading
+	{
+		class EventSet;
+	}
+}
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "event.hpp"
+#include "mutex.hpp"
+#include "../collections/Vector.hpp"
+#include "../collections/HashMap.hpp"
+
+/**
+ * @brief	A long-lived group of events to wait on together.
+ * @details	Event::WaitAny() has to set up the whole group on every call. An EventSet registers each event with
+ *			the operating system once, when it's added (epoll on Linux, kqueue on OSX), and a wait hands back
+ *			whichever events fired without looking at the rest - so a loop that waits on the same events over
+ *			and over pays for the wait and nothing else.
+ *
+ *			Like the other waits, Wait() consumes the notification of the event it returns. When several
+ *			events fire at once, they're all consumed together and the rest are handed out by the following
+ *			calls without waiting.
+ *
+ *			Members can be added and removed from any thread, including while another thread is in Wait().
+ *			An event must stay alive until it's removed or the set is destroyed.
+ *
+ *			On Linux, while an event belongs to a set, each Notify() that signals it writes to a file
+ *			descriptor, which is a syscall the plain futex path doesn't make.
+ */
+class sprawl::threading::EventSet
+{
+public:
+	EventSet();
+	~EventSet();
+
+	/**
+	 * @brief	Start watching an event. If it's already signaled, the next wait returns it.
+	 */
+	void Add(Event const& event);
+
+	/**
+	 * @brief	Stop watching an event. Once this returns, no wait will return it - including a notification
+	 *			that was already consumed but not yet handed out, which is lost.
+	 */
+	void Remove(Event const& event);
+
+	size_t Size() const;
+
+	/**
+	 * @brief	Wait until any member is notified. Members added during the wait count.
+	 */
+	Event const* Wait();
+
+	/**
+	 * @return	The event that was notified, or nullptr if none was within the given time.
+	 */
+	Event const* WaitFor(int64_t nanoseconds);
+	Event const* WaitUntil(int64_t nanosecondTimestamp)
+	{
+		return WaitFor(nanosecondTimestamp - sprawl::time::Now(sprawl::time::Resolution::Nanoseconds));
+	}
+private:
+	EventSet(EventSet const& other) = delete;
+	EventSet& operator=(EventSet const& other) = delete;
+
+	Event const* wait_(int64_t const* deadline);
+	Event const* popFired_();
+	void forgetFired_(Event const* event);
+
+	mutable Mutex m_mutex;
+	// Members whose notification has been consumed but that haven't been returned yet.
+	collections::Vector<Event const*> m_fired;
+
+#if defined(_WIN32)
+	collections::Vector<Event const*> m_members;
+	// Signaled when the membership changes, so a waiter can pick up the new list.
+	HANDLE m_changed;
+#elif defined(__APPLE__)
+	collections::BasicHashMap<intptr_t, Event const*> m_members;
+	int m_queue;
+#else
+	collections::BasicHashMap<uint64_t, Event const*> m_members;
+	int m_epollFd;
+#endif
+};
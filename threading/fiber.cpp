@@ -0,0 +1,225 @@
+#include "fiber.hpp"
+#include "threadlocal.hpp"
+
+struct sprawl::threading::fiber::detail::Fiber
+{
+	Fiber(ThreadManager& manager_, uint64_t flags_, std::function<void()>&& function, size_t stackSize, StackAllocator* stackAllocator)
+		: coroutine(std::move(function), stackSize, stackAllocator)
+		, manager(&manager_)
+		, flags(flags_)
+		, releaseAfterPause(nullptr)
+		, yielded(false)
+	{
+		//
+	}
+
+	Coroutine coroutine;
+	ThreadManager* manager;
+	uint64_t flags;
+
+	// What the fiber asked for on its way out, done by the worker once the fiber is off its stack. Until then
+	// nobody else may resume it, so the fiber can't do these itself.
+	threading::Mutex* releaseAfterPause;
+	bool yielded;
+};
+
+namespace FiberStatic
+{
+	using sprawl::threading::fiber::detail::Fiber;
+
+	static sprawl::threading::ThreadLocal<Fiber*> current_;
+
+	static void run_(Fiber* fiber)
+	{
+		// A fiber can end up running another one, e.g. by helping out while it waits on a future.
+		Fiber* const outer = *current_;
+		current_ = fiber;
+#if SPRAWL_EXCEPTIONS_ENABLED
+		try
+		{
+			fiber->coroutine.Resume();
+		}
+		catch(...)
+		{
+			current_ = outer;
+			delete fiber;
+			throw;
+		}
+#else
+		fiber->coroutine.Resume();
+#endif
+		current_ = outer;
+
+		if(fiber->coroutine.State() == sprawl::threading::CoroutineState::Completed)
+		{
+			delete fiber;
+			return;
+		}
+
+		// Read everything first - once the lock is released, another worker may resume the fiber.
+		sprawl::threading::Mutex* const release = fiber->releaseAfterPause;
+		bool const yielded = fiber->yielded;
+		fiber->releaseAfterPause = nullptr;
+		fiber->yielded = false;
+		if(yielded)
+		{
+			fiber->manager->AddTaskToBack([fiber]() { run_(fiber); }, fiber->flags);
+		}
+		else if(release != nullptr)
+		{
+			release->Unlock();
+		}
+	}
+
+	static void schedule_(Fiber* fiber)
+	{
+		fiber->manager->AddTask([fiber]() { run_(fiber); }, fiber->flags);
+	}
+}
+
+void sprawl::threading::fiber::Spawn(ThreadManager& manager, uint64_t threadFlags, std::function<void()> function, size_t stackSize, StackAllocator* stackAllocator)
+{
+	FiberStatic::schedule_(new detail::Fiber(manager, threadFlags, std::move(function), stackSize, stackAllocator));
+}
+
+void sprawl::threading::fiber::Yield()
+{
+	detail::Fiber* fiber = *FiberStatic::current_;
+	if(fiber == nullptr)
+	{
+		return;
+	}
+	fiber->yielded = true;
+	fiber->coroutine.Pause();
+}
+
+bool sprawl::threading::fiber::InFiber()
+{
+	return *FiberStatic::current_ != nullptr;
+}
+
+void sprawl::threading::fiber::detail::Park(threading::Mutex& lock, WaitList& waiters)
+{
+	Waiter waiter;
+	Park(lock, waiters, waiter);
+}
+
+void sprawl::threading::fiber::detail::Park(threading::Mutex& lock, WaitList& waiters, Waiter& waiter)
+{
+	// Wake() runs with the lock held, so either way we can be up and running before the waker is done with it.
+	// Once we've had the lock, it is, and the caller is free to destroy whatever it was waiting on.
+	Fiber* fiber = *FiberStatic::current_;
+	if(fiber != nullptr)
+	{
+		// The waiter lives on the fiber's stack, which stays put while it's parked.
+		waiter.fiber = fiber;
+		waiter.thread = nullptr;
+		waiters.Push(&waiter);
+		fiber->releaseAfterPause = &lock;
+		fiber->coroutine.Pause();
+		lock.Lock();
+		lock.Unlock();
+		return;
+	}
+
+	threading::Event event;
+	waiter.fiber = nullptr;
+	waiter.thread = &event;
+	waiters.Push(&waiter);
+	lock.Unlock();
+	event.Wait();
+	lock.Lock();
+	lock.Unlock();
+}
+
+void sprawl::threading::fiber::detail::Wake(Waiter* waiter)
+{
+	if(waiter->fiber != nullptr)
+	{
+		FiberStatic::schedule_(waiter->fiber);
+	}
+	else
+	{
+		waiter->thread->Notify();
+	}
+}
+
+sprawl::threading::fiber::Mutex::Mutex()
+	: m_lock()
+	, m_locked(false)
+	, m_waiters()
+{
+	//
+}
+
+void sprawl::threading::fiber::Mutex::Lock()
+{
+	m_lock.Lock();
+	if(!m_locked)
+	{
+		m_locked = true;
+		m_lock.Unlock();
+		return;
+	}
+	// Unlock() hands the mutex over without unlocking it, so it's ours as soon as we're woken.
+	detail::Park(m_lock, m_waiters);
+}
+
+bool sprawl::threading::fiber::Mutex::TryLock()
+{
+	ScopedLock lock(m_lock);
+	if(m_locked)
+	{
+		return false;
+	}
+	m_locked = true;
+	return true;
+}
+
+void sprawl::threading::fiber::Mutex::Unlock()
+{
+	ScopedLock lock(m_lock);
+	detail::Waiter* waiter = m_waiters.Pop();
+	if(waiter != nullptr)
+	{
+		detail::Wake(waiter);
+	}
+	else
+	{
+		m_locked = false;
+	}
+}
+
+sprawl::threading::fiber::Event::Event()
+	: m_lock()
+	, m_signaled(false)
+	, m_waiters()
+{
+	//
+}
+
+void sprawl::threading::fiber::Event::Notify()
+{
+	ScopedLock lock(m_lock);
+	detail::Waiter* waiter = m_waiters.Pop();
+	if(waiter != nullptr)
+	{
+		detail::Wake(waiter);
+	}
+	else
+	{
+		m_signaled = true;
+	}
+}
+
+void sprawl::threading::fiber::Event::Wait()
+{
+	m_lock.Lock();
+	if(m_signaled)
+	{
+		m_signaled = false;
+		m_lock.Unlock();
+		return;
+	}
+	detail::Park(m_lock, m_waiters);
+}
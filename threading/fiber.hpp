@@ -0,0 +1,334 @@
+#pragma once
+
+namespace sprawl
+{
+	namespace threading
+	{
+		namespace fiber
+		{
+			class Mutex;
+			class Event;
+
+			template<typename T>
+			class Channel;
+
+			namespace detail
+			{
+				struct Fiber;
+				struct Waiter;
+				struct WaitList;
+			}
+		}
+	}
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+#include "event.hpp"
+#include "mutex.hpp"
+#include "threadmanager.hpp"
+#include "../collections/Deque.hpp"
+// Last, since it defines a yield() macro that trips up other headers.
+#include "coroutine.hpp"
+
+#ifndef SPRAWL_FIBER_STACK_SIZE
+#	define SPRAWL_FIBER_STACK_SIZE (64 * 1024)
+#endif
+
+/**
+ * Fibers are coroutines run by a ThreadManager's worker threads, so many more of them than there are threads
+ * can be in flight at once - each one that's waiting costs a stack, not a thread.
+ *
+ * A fiber is scheduled as an ordinary task for its flags, and resuming it after a yield or a wait is another
+ * task, so it gets whatever the flag group offers: with work stealing turned on, each worker has its own run
+ * queue and idle workers steal from busy ones. A fiber may move to a different worker every time it's resumed,
+ * so it shouldn't hold on to anything that belongs to one thread (ThreadLocal values, a locked
+ * threading::Mutex) across a yield or a wait.
+ *
+ * Blocking calls that aren't fiber-aware (threading::Event::Wait(), this_thread::Sleep(), ...) still work inside
+ * a fiber, but they hold up the worker and every fiber queued behind it.
+ */
+namespace sprawl
+{
+	namespace threading
+	{
+		namespace fiber
+		{
+			/**
+			 * @brief	Start a function as a fiber on the threads with exactly these flags.
+			 * @param	stackAllocator	Where to get the fiber's stack; StackPool::Default() if null.
+			 */
+			void Spawn(ThreadManager& manager, uint64_t threadFlags, std::function<void()> function, size_t stackSize = SPRAWL_FIBER_STACK_SIZE, StackAllocator* stackAllocator = nullptr);
+
+			/**
+			 * @brief	Go to the back of the line: everything already waiting for this fiber's workers runs before
+			 *			it picks up again. Does nothing outside a fiber.
+			 */
+			void Yield();
+
+			bool InFiber();
+
+			namespace detail
+			{
+				struct Waiter
+				{
+					Waiter* next;
+					// Exactly one of these is set, depending on whether a fiber or a plain thread is waiting.
+					Fiber* fiber;
+					threading::Event* thread;
+				};
+
+				struct WaitList
+				{
+					WaitList()
+						: head(nullptr)
+						, tail(nullptr)
+					{
+						//
+					}
+
+					void Push(Waiter* waiter)
+					{
+						waiter->next = nullptr;
+						if(tail == nullptr)
+						{
+							head = waiter;
+						}
+						else
+						{
+							tail->next = waiter;
+						}
+						tail = waiter;
+					}
+
+					Waiter* Pop()
+					{
+						Waiter* waiter = head;
+						if(waiter != nullptr)
+						{
+							head = waiter->next;
+							if(head == nullptr)
+							{
+								tail = nullptr;
+							}
+						}
+						return waiter;
+					}
+
+					Waiter* head;
+					Waiter* tail;
+				};
+
+				/**
+				 * @brief	Add the caller to waiters and release lock, then wait for Wake(). Parks the fiber if
+				 *			called from one, or blocks the thread otherwise. lock must be held on entry.
+				 */
+				void Park(threading::Mutex& lock, WaitList& waiters);
+
+				/**
+				 * @brief	Park() with a waiter supplied by the caller, for waits that need to carry more with them.
+				 *			Park() fills in the fiber or thread.
+				 */
+				void Park(threading::Mutex& lock, WaitList& waiters, Waiter& waiter);
+
+				/**
+				 * @brief	Resume a waiter taken off a WaitList. Must be called with the same lock held that was
+				 *			passed to Park().
+				 */
+				void Wake(Waiter* waiter);
+			}
+		}
+	}
+}
+
+/**
+ * @brief	A mutex that parks the waiting fiber instead of its thread. Also usable from ordinary threads.
+ * @details	Unlock() hands the mutex straight to the longest waiter, so nobody can jump the queue.
+ */
+class sprawl::threading::fiber::Mutex
+{
+public:
+	Mutex();
+
+	void Lock();
+	bool TryLock();
+	void Unlock();
+private:
+	Mutex(Mutex const& other) = delete;
+	Mutex& operator=(Mutex const& other) = delete;
+
+	threading::Mutex m_lock;
+	bool m_locked;
+	detail::WaitList m_waiters;
+};
+
+/**
+ * @brief	An auto-reset event, like threading::Event, that parks the waiting fiber instead of its thread.
+ *			Also usable from ordinary threads.
+ */
+class sprawl::threading::fiber::Event
+{
+public:
+	Event();
+
+	/**
+	 * @brief	Wake one waiter, or if nobody's waiting, let the next Wait() through.
+	 */
+	void Notify();
+	void Wait();
+private:
+	Event(Event const& other) = delete;
+	Event& operator=(Event const& other) = delete;
+
+	threading::Mutex m_lock;
+	bool m_signaled;
+	detail::WaitList m_waiters;
+};
+
+/**
+ * @brief	A queue that any number of fibers or threads can send values through and receive them from, parking
+ *			whoever has to wait: receivers while it's empty, senders while it's full.
+ * @details	With a capacity of 0, every Send() waits for a Receive() to take its value. When one side is already
+ *			waiting, the value is moved straight from the sender to the receiver without going through the
+ *			buffer.
+ *
+ *			Once Close()d, Send() refuses new values and wakes any parked senders empty-handed. Receive() drains
+ *			what's left, then reports that there's nothing more to come.
+ */
+template<typename T>
+class sprawl::threading::fiber::Channel
+{
+public:
+	explicit Channel(size_t capacity = 0)
+		: m_lock()
+		, m_buffer(sprawl::collections::Capacity(capacity > 0 ? capacity : 1))
+		, m_capacity(capacity)
+		, m_closed(false)
+		, m_senders()
+		, m_receivers()
+	{
+		//
+	}
+
+	/**
+	 * @return	false if the channel was closed before the value was taken; value is then left as it was.
+	 */
+	bool Send(T const& value)
+	{
+		T copy(value);
+		return Send(std::move(copy));
+	}
+
+	bool Send(T&& value)
+	{
+		m_lock.Lock();
+		if(m_closed)
+		{
+			m_lock.Unlock();
+			return false;
+		}
+
+		Slot* receiver = static_cast<Slot*>(m_receivers.Pop());
+		if(receiver != nullptr)
+		{
+			*receiver->value = std::move(value);
+			receiver->delivered = true;
+			detail::Wake(receiver);
+			m_lock.Unlock();
+			return true;
+		}
+
+		if(size_t(m_buffer.Size()) < m_capacity)
+		{
+			m_buffer.PushBack(std::move(value));
+			m_lock.Unlock();
+			return true;
+		}
+
+		Slot sender;
+		sender.value = &value;
+		sender.delivered = false;
+		detail::Park(m_lock, m_senders, sender);
+		return sender.delivered;
+	}
+
+	/**
+	 * @return	false if the channel is closed and empty; value is then left as it was.
+	 */
+	bool Receive(T& value)
+	{
+		m_lock.Lock();
+		if(!m_buffer.Empty())
+		{
+			value = std::move(m_buffer.Front());
+			m_buffer.PopFront();
+			// Room for the longest waiting sender.
+			Slot* sender = static_cast<Slot*>(m_senders.Pop());
+			if(sender != nullptr)
+			{
+				m_buffer.PushBack(std::move(*sender->value));
+				sender->delivered = true;
+				detail::Wake(sender);
+			}
+			m_lock.Unlock();
+			return true;
+		}
+
+		Slot* sender = static_cast<Slot*>(m_senders.Pop());
+		if(sender != nullptr)
+		{
+			value = std::move(*sender->value);
+			sender->delivered = true;
+			detail::Wake(sender);
+			m_lock.Unlock();
+			return true;
+		}
+
+		if(m_closed)
+		{
+			m_lock.Unlock();
+			return false;
+		}
+
+		Slot receiver;
+		receiver.value = &value;
+		receiver.delivered = false;
+		detail::Park(m_lock, m_receivers, receiver);
+		return receiver.delivered;
+	}
+
+	void Close()
+	{
+		ScopedLock lock(m_lock);
+		m_closed = true;
+		for(detail::Waiter* waiter = m_senders.Pop(); waiter != nullptr; waiter = m_senders.Pop())
+		{
+			detail::Wake(waiter);
+		}
+		for(detail::Waiter* waiter = m_receivers.Pop(); waiter != nullptr; waiter = m_receivers.Pop())
+		{
+			detail::Wake(waiter);
+		}
+	}
+
+private:
+	Channel(Channel const& other) = delete;
+	Channel& operator=(Channel const& other) = delete;
+
+	// Lives on the waiting side's stack. value is where a receiver wants its value put, or where a sender's
+	// value is waiting to be taken.
+	struct Slot : public detail::Waiter
+	{
+		T* value;
+		bool delivered;
+	};
+
+	threading::Mutex m_lock;
+	collections::Deque<T> m_buffer;
+	size_t m_capacity;
+	bool m_closed;
+	detail::WaitList m_senders;
+	detail::WaitList m_receivers;
+};
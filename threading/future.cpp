@@ -0,0 +1,162 @@
+#include "future.hpp"
+
+sprawl::threading::Mutex sprawl::threading::FutureStateBase::ms_waitMutex;
+sprawl::threading::ConditionVariable sprawl::threading::FutureStateBase::ms_waitCondition;
+
+sprawl::threading::FutureStateBase::FutureStateBase(ThreadManager* manager)
+	: m_refCount(1)
+	, m_continuations(nullptr)
+	, m_waiters(0)
+	, m_helpers(0)
+	, m_manager(manager)
+	, m_abandoned(false)
+{
+	//
+}
+
+sprawl::threading::FutureStateBase::~FutureStateBase()
+{
+	Continuation* continuation = m_continuations.load(std::memory_order_relaxed);
+	if(continuation == readyMarker_())
+	{
+		return;
+	}
+	// Dropped before it was ever made ready, so nothing we'd have fed a result to will get one either.
+	// We can't be kept alive through this, so nothing gets scheduled: dependents are abandoned and the rest
+	// run right here.
+	m_abandoned = true;
+	Continuation* ordered = inOrder_(continuation);
+	while(ordered != nullptr)
+	{
+		Continuation* next = ordered->next;
+		if(ordered->dependent != nullptr)
+		{
+			ordered->dependent->Abandon();
+		}
+		else
+		{
+			ordered->callback();
+		}
+		delete ordered;
+		ordered = next;
+	}
+}
+
+void sprawl::threading::FutureStateBase::AddContinuation(ThreadManager::InlineTask&& callback, bool schedule, uint64_t threadFlags, FutureStateBase* dependent)
+{
+	Continuation* continuation = new Continuation(std::move(callback), schedule, threadFlags, dependent);
+
+	Continuation* head = m_continuations.load(std::memory_order_acquire);
+	do
+	{
+		if(head == readyMarker_())
+		{
+			runContinuation_(continuation);
+			return;
+		}
+		continuation->next = head;
+	} while(!m_continuations.compare_exchange_weak(head, continuation, std::memory_order_acq_rel, std::memory_order_acquire));
+}
+
+void sprawl::threading::FutureStateBase::MarkReady()
+{
+	// Keep ourselves alive through the continuations; the last one may drop what would otherwise be the last reference.
+	IncRef();
+	Continuation* continuation = m_continuations.exchange(readyMarker_(), std::memory_order_seq_cst);
+	if(m_waiters.load(std::memory_order_seq_cst) != 0)
+	{
+		ScopedLock lock(ms_waitMutex);
+		ms_waitCondition.NotifyAll();
+	}
+	if(m_helpers.load(std::memory_order_seq_cst) != 0)
+	{
+		m_manager->NotifyWorkers();
+	}
+	runContinuations_(continuation);
+	DecRef();
+}
+
+void sprawl::threading::FutureStateBase::Abandon()
+{
+	m_abandoned = true;
+	MarkReady();
+}
+
+/*static*/ sprawl::threading::FutureStateBase::Continuation* sprawl::threading::FutureStateBase::inOrder_(Continuation* continuation)
+{
+	// The stack is newest-first; reverse it so continuations run in the order they were added.
+	Continuation* ordered = nullptr;
+	while(continuation != nullptr)
+	{
+		Continuation* next = continuation->next;
+		continuation->next = ordered;
+		ordered = continuation;
+		continuation = next;
+	}
+	return ordered;
+}
+
+void sprawl::threading::FutureStateBase::runContinuations_(Continuation* continuation)
+{
+	Continuation* ordered = inOrder_(continuation);
+	while(ordered != nullptr)
+	{
+		Continuation* next = ordered->next;
+		runContinuation_(ordered);
+		ordered = next;
+	}
+}
+
+void sprawl::threading::FutureStateBase::runContinuation_(Continuation* continuation)
+{
+	if(m_abandoned && continuation->dependent != nullptr)
+	{
+		continuation->dependent->Abandon();
+	}
+	else if(continuation->schedule)
+	{
+		// Scheduled continuations read our result later, from another thread, so they hold a reference until they've run.
+		IncRef();
+		if(m_manager != nullptr)
+		{
+			m_manager->AddTask(std::move(continuation->callback), continuation->threadFlags);
+		}
+		else
+		{
+			continuation->callback();
+		}
+	}
+	else
+	{
+		continuation->callback();
+	}
+	delete continuation;
+}
+
+void sprawl::threading::FutureStateBase::Wait()
+{
+	if(IsReady())
+	{
+		return;
+	}
+	if(m_manager != nullptr && m_manager->IsWorkerThread())
+	{
+		// Keep the worker busy with whatever else it could be running; MarkReady() wakes it if it runs out.
+		m_helpers.fetch_add(1, std::memory_order_seq_cst);
+		m_manager->RunTasksUntil([this]() { return IsReady(); });
+		m_helpers.fetch_sub(1, std::memory_order_seq_cst);
+		return;
+	}
+	while(!IsReady())
+	{
+		m_waiters.fetch_add(1, std::memory_order_seq_cst);
+		{
+			SharedLock lock(ms_waitMutex);
+			if(!IsReady())
+			{
+				ms_waitCondition.Wait(lock);
+			}
+		}
+		m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+	}
+}
@@ -0,0 +1,556 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "../common/errors.hpp"
+#include "threadmanager.hpp"
+#include "mutex.hpp"
+#include "condition_variable.hpp"
+
+namespace sprawl
+{
+	namespace threading
+	{
+		class FutureStateBase;
+
+		template<typename t_ResultType>
+		class FutureState;
+
+		template<typename t_ResultType>
+		class Future;
+
+		template<typename t_RangeType>
+		Future<void> WhenAll(t_RangeType const& futures);
+
+		template<typename t_RangeType>
+		Future<size_t> WhenAny(t_RangeType const& futures);
+	}
+}
+
+/**
+ * @brief	The part of a future's shared state that doesn't depend on the result type: the reference count,
+ *			the ready flag, and the list of continuations waiting for it.
+ * @details	States and continuations are usually freed on a different thread from the one that allocated them
+ *			(a continuation's worker, or whoever drops the last handle), which memory::PoolAllocator's per-thread
+ *			free lists can't take back - so they come from plain new and delete.
+ *
+ *			A state whose last reference goes away before it's ready is abandoned: it never gets a result, and
+ *			neither does anything chained to it with Future::Then(). Those states become ready anyway, so their
+ *			waiters wake up, and Future::Abandoned() reports what happened.
+ */
+class sprawl::threading::FutureStateBase
+{
+public:
+	inline void IncRef()
+	{
+		m_refCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline void DecRef()
+	{
+		if(m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			delete this;
+		}
+	}
+
+	inline bool IsReady() const
+	{
+		return m_continuations.load(std::memory_order_seq_cst) == readyMarker_();
+	}
+
+	/**
+	 * @brief	Check whether the state is ready without a result, because what would have produced it went away.
+	 */
+	inline bool IsAbandoned() const
+	{
+		return IsReady() && m_abandoned;
+	}
+
+	inline ThreadManager* Manager() const
+	{
+		return m_manager;
+	}
+
+	/**
+	 * @brief	Block until the state is ready. On one of the manager's worker threads, this runs other tasks
+	 *			while it waits, and only sleeps when there's nothing left to run.
+	 */
+	void Wait();
+
+	/**
+	 * @brief	Run a callable once the state is ready - right away if it already is.
+	 * @param	callback	The callable
+	 * @param	schedule	If true, the callable is added to the manager as a task with the given flags. If
+	 *						false, it's run directly on whichever thread makes the state ready, so it should be short.
+	 * @param	threadFlags	The flags for the task, if scheduled
+	 * @param	dependent	The state the callable produces a result for, if any. If this state is abandoned, the
+	 *						dependent is abandoned instead of running the callable, so the callable has to hold its
+	 *						own reference to it. Continuations without one run inline even then.
+	 */
+	void AddContinuation(ThreadManager::InlineTask&& callback, bool schedule, uint64_t threadFlags, FutureStateBase* dependent);
+protected:
+	explicit FutureStateBase(ThreadManager* manager);
+	virtual ~FutureStateBase();
+
+	/**
+	 * @brief	Mark the state ready and run everything waiting on it. The result must already be stored.
+	 */
+	void MarkReady();
+
+	/**
+	 * @brief	Mark the state ready without a result, and abandon everything that depends on it.
+	 */
+	void Abandon();
+private:
+	FutureStateBase(FutureStateBase const& other) = delete;
+	FutureStateBase& operator=(FutureStateBase const& other) = delete;
+
+	struct Continuation
+	{
+		Continuation(ThreadManager::InlineTask&& callback_, bool schedule_, uint64_t threadFlags_, FutureStateBase* dependent_)
+			: callback(std::move(callback_))
+			, schedule(schedule_)
+			, threadFlags(threadFlags_)
+			, dependent(dependent_)
+			, next(nullptr)
+		{
+
+		}
+
+		ThreadManager::InlineTask callback;
+		bool schedule;
+		uint64_t threadFlags;
+		FutureStateBase* dependent;
+		Continuation* next;
+	};
+
+	static inline Continuation* readyMarker_()
+	{
+		return reinterpret_cast<Continuation*>(uintptr_t(1));
+	}
+
+	static Continuation* inOrder_(Continuation* continuation);
+	void runContinuations_(Continuation* continuation);
+	void runContinuation_(Continuation* continuation);
+
+	std::atomic<int> m_refCount;
+	// A lock-free stack of continuations, swapped for readyMarker_() when the state becomes ready.
+	std::atomic<Continuation*> m_continuations;
+	// Threads blocked on ms_waitCondition, and workers running other tasks in Wait().
+	std::atomic<int> m_waiters;
+	std::atomic<int> m_helpers;
+	ThreadManager* m_manager;
+	// Written before the state is marked ready, so anyone who's seen it ready sees this too.
+	bool m_abandoned;
+
+	// Blocked waiters share one lock and condition; a state only touches them when someone is actually waiting.
+	static Mutex ms_waitMutex;
+	static ConditionVariable ms_waitCondition;
+};
+
+template<typename t_ResultType>
+class sprawl::threading::FutureState : public sprawl::threading::FutureStateBase
+{
+public:
+	static FutureState* Create(ThreadManager* manager)
+	{
+		return new FutureState(manager);
+	}
+
+	template<typename t_ValueType>
+	void Set(t_ValueType&& value)
+	{
+		new(&m_value) t_ResultType(std::forward<t_ValueType>(value));
+		m_hasValue = true;
+		MarkReady();
+	}
+
+	/**
+	 * @brief	Run a callable and store what it returns.
+	 */
+	template<typename t_CallableType>
+	void Compute(t_CallableType& callable)
+	{
+		Set(callable());
+	}
+
+	/**
+	 * @brief	Call a continuation with the stored result.
+	 */
+	template<typename t_CallableType>
+	auto Apply(t_CallableType& callable) -> decltype(callable(std::declval<t_ResultType const&>()))
+	{
+		return callable(Value());
+	}
+
+	t_ResultType const& Value() const
+	{
+		return *reinterpret_cast<t_ResultType const*>(&m_value);
+	}
+protected:
+	explicit FutureState(ThreadManager* manager)
+		: FutureStateBase(manager)
+		, m_hasValue(false)
+	{
+
+	}
+
+	virtual ~FutureState()
+	{
+		if(m_hasValue)
+		{
+			reinterpret_cast<t_ResultType*>(&m_value)->~t_ResultType();
+		}
+	}
+private:
+	typename std::aligned_storage<sizeof(t_ResultType), alignof(t_ResultType)>::type m_value;
+	bool m_hasValue;
+};
+
+template<>
+class sprawl::threading::FutureState<void> : public sprawl::threading::FutureStateBase
+{
+public:
+	static FutureState* Create(ThreadManager* manager)
+	{
+		return new FutureState(manager);
+	}
+
+	void Set()
+	{
+		MarkReady();
+	}
+
+	template<typename t_CallableType>
+	void Compute(t_CallableType& callable)
+	{
+		callable();
+		MarkReady();
+	}
+
+	template<typename t_CallableType>
+	auto Apply(t_CallableType& callable) -> decltype(callable())
+	{
+		return callable();
+	}
+
+	void Value() const
+	{
+
+	}
+protected:
+	explicit FutureState(ThreadManager* manager)
+		: FutureStateBase(manager)
+	{
+
+	}
+};
+
+/**
+ * @brief	Handle to the result of a task added with ThreadManager::AddTaskWithResult(), or of a continuation.
+ * @details	Handles are cheap to copy and all refer to the same result, which lives until the last handle and
+ *			the task producing it are both gone. Tasks must not throw.
+ */
+template<typename t_ResultType>
+class sprawl::threading::Future
+{
+public:
+	Future()
+		: m_state(nullptr)
+	{
+
+	}
+
+	Future(Future const& other)
+		: m_state(other.m_state)
+	{
+		if(m_state)
+		{
+			m_state->IncRef();
+		}
+	}
+
+	Future(Future&& other)
+		: m_state(other.m_state)
+	{
+		other.m_state = nullptr;
+	}
+
+	Future& operator=(Future const& other)
+	{
+		if(other.m_state)
+		{
+			other.m_state->IncRef();
+		}
+		if(m_state)
+		{
+			m_state->DecRef();
+		}
+		m_state = other.m_state;
+		return *this;
+	}
+
+	Future& operator=(Future&& other)
+	{
+		if(this != &other)
+		{
+			if(m_state)
+			{
+				m_state->DecRef();
+			}
+			m_state = other.m_state;
+			other.m_state = nullptr;
+		}
+		return *this;
+	}
+
+	~Future()
+	{
+		if(m_state)
+		{
+			m_state->DecRef();
+		}
+	}
+
+	bool Valid() const
+	{
+		return m_state != nullptr;
+	}
+
+	bool IsReady() const
+	{
+		return m_state->IsReady();
+	}
+
+	/**
+	 * @brief	Check whether this future is ready but will never have a result, because the task producing it
+	 *			(or one it was chained from) was dropped without running. Get() on such a future aborts.
+	 */
+	bool Abandoned() const
+	{
+		return m_state->IsAbandoned();
+	}
+
+	/**
+	 * @brief	Block until the result is ready. Worker threads run other tasks in the meantime.
+	 */
+	void Wait() const
+	{
+		m_state->Wait();
+	}
+
+	/**
+	 * @brief	Wait for the result and return it (or nothing, for Future<void>).
+	 */
+	auto Get() const -> decltype(std::declval<FutureState<t_ResultType> const&>().Value())
+	{
+		m_state->Wait();
+		if(m_state->IsAbandoned())
+		{
+			SPRAWL_ABORT_MSG("Future::Get() called on an abandoned future: the task producing its result was dropped without running.");
+		}
+		return m_state->Value();
+	}
+
+	/**
+	 * @brief	Add a task that runs with this future's result once it's ready.
+	 * @param	callable		Called with the result (t_ResultType const&), or with nothing for Future<void>
+	 * @param	threadFlags		The flags to run the continuation with
+	 * @return	A future for whatever the continuation returns
+	 */
+	template<typename t_CallableType>
+	auto Then(t_CallableType&& callable, uint64_t threadFlags) -> Future<decltype(std::declval<FutureState<t_ResultType>&>().Apply(std::declval<typename std::decay<t_CallableType>::type&>()))>
+	{
+		typedef decltype(std::declval<FutureState<t_ResultType>&>().Apply(std::declval<typename std::decay<t_CallableType>::type&>())) ContinuationResultType;
+
+		FutureState<ContinuationResultType>* next = FutureState<ContinuationResultType>::Create(m_state->Manager());
+		Future<ContinuationResultType> ret(next);
+		// The continuation only holds a reference to our state once it's scheduled (see FutureStateBase::runContinuation_),
+		// so a state that never becomes ready isn't kept alive by its own continuations. Its reference to next
+		// goes away with it, whether it ran or not.
+		FutureState<t_ResultType>* source = m_state;
+		m_state->AddContinuation(ThreadManager::MakeInlineTask([source, result = ret, callable = typename std::decay<t_CallableType>::type(std::forward<t_CallableType>(callable))]() mutable
+		{
+			auto apply = [source, &callable]() { return source->Apply(callable); };
+			result.m_state->Compute(apply);
+			source->DecRef();
+		}), true, threadFlags, next);
+		return ret;
+	}
+
+private:
+	template<typename t_OtherResultType>
+	friend class Future;
+	friend class ThreadManager;
+
+	template<typename t_RangeType>
+	friend Future<void> WhenAll(t_RangeType const& futures);
+
+	template<typename t_RangeType>
+	friend Future<size_t> WhenAny(t_RangeType const& futures);
+
+	// Takes over the state's initial reference.
+	explicit Future(FutureState<t_ResultType>* state)
+		: m_state(state)
+	{
+
+	}
+
+	FutureState<t_ResultType>* m_state;
+};
+
+template<typename t_ResultType, typename t_CallableType>
+sprawl::threading::Future<t_ResultType> sprawl::threading::ThreadManager::AddTaskWithResult(t_CallableType&& task, uint64_t threadFlags)
+{
+	Future<t_ResultType> ret(FutureState<t_ResultType>::Create(this));
+	// The task's copy of the future keeps the state alive until the task has run - or, if it's dropped without
+	// running, lets the state go so it's abandoned rather than leaked.
+	AddTask([result = ret, task = typename std::decay<t_CallableType>::type(std::forward<t_CallableType>(task))]() mutable
+	{
+		result.m_state->Compute(task);
+	}, threadFlags);
+	return ret;
+}
+
+template<typename t_CallableType>
+sprawl::threading::Future<decltype(std::declval<typename std::decay<t_CallableType>::type&>()())> sprawl::threading::ThreadManager::AddTaskWithResult(t_CallableType&& task, uint64_t threadFlags)
+{
+	return AddTaskWithResult<decltype(std::declval<typename std::decay<t_CallableType>::type&>()())>(std::forward<t_CallableType>(task), threadFlags);
+}
+
+/**
+ * @brief	Get a future that becomes ready once every future in a range is ready. Abandoned futures count as
+ *			ready.
+ * @param	futures		Anything usable in a range-based for whose elements are Futures (of any one type)
+ */
+template<typename t_RangeType>
+sprawl::threading::Future<void> sprawl::threading::WhenAll(t_RangeType const& futures)
+{
+	class JoinState : public FutureState<void>
+	{
+	public:
+		static JoinState* Create(ThreadManager* manager)
+		{
+			return new JoinState(manager);
+		}
+
+		void Arrive()
+		{
+			if(remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				Set();
+			}
+			DecRef();
+		}
+
+		// Starts at one so the join can't complete while inputs are still being registered.
+		std::atomic<size_t> remaining;
+	private:
+		explicit JoinState(ThreadManager* manager)
+			: FutureState<void>(manager)
+			, remaining(1)
+		{
+
+		}
+	};
+
+	ThreadManager* manager = nullptr;
+	for(auto& future : futures)
+	{
+		if(future.m_state)
+		{
+			manager = future.m_state->Manager();
+			break;
+		}
+	}
+
+	JoinState* join = JoinState::Create(manager);
+	Future<void> ret(join);
+	for(auto& future : futures)
+	{
+		if(!future.m_state)
+		{
+			continue;
+		}
+		join->remaining.fetch_add(1, std::memory_order_relaxed);
+		join->IncRef();
+		future.m_state->AddContinuation(ThreadManager::MakeInlineTask([join]() { join->Arrive(); }), false, 0, nullptr);
+	}
+	join->IncRef();
+	join->Arrive();
+	return ret;
+}
+
+/**
+ * @brief	Get a future that becomes ready as soon as any future in a range is ready. Its value is the index of
+ *			the first one to finish, which may be an abandoned one. If the range is empty, it's ready right away
+ *			with a value of 0.
+ * @param	futures		Anything usable in a range-based for whose elements are Futures (of any one type)
+ */
+template<typename t_RangeType>
+sprawl::threading::Future<size_t> sprawl::threading::WhenAny(t_RangeType const& futures)
+{
+	class AnyState : public FutureState<size_t>
+	{
+	public:
+		static AnyState* Create(ThreadManager* manager)
+		{
+			return new AnyState(manager);
+		}
+
+		void Arrive(size_t index)
+		{
+			if(!claimed.exchange(true, std::memory_order_acq_rel))
+			{
+				Set(index);
+			}
+			DecRef();
+		}
+
+		std::atomic<bool> claimed;
+	private:
+		explicit AnyState(ThreadManager* manager)
+			: FutureState<size_t>(manager)
+			, claimed(false)
+		{
+
+		}
+	};
+
+	ThreadManager* manager = nullptr;
+	for(auto& future : futures)
+	{
+		if(future.m_state)
+		{
+			manager = future.m_state->Manager();
+			break;
+		}
+	}
+
+	AnyState* any = AnyState::Create(manager);
+	Future<size_t> ret(any);
+	size_t index = 0;
+	bool empty = true;
+	for(auto& future : futures)
+	{
+		if(future.m_state)
+		{
+			empty = false;
+			any->IncRef();
+			future.m_state->AddContinuation(ThreadManager::MakeInlineTask([any, index]() { any->Arrive(index); }), false, 0, nullptr);
+		}
+		++index;
+	}
+	if(empty)
+	{
+		any->IncRef();
+		any->Arrive(0);
+	}
+	return ret;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sprawl
+{
+	namespace threading
+	{
+		template<size_t t_Capacity>
+		class InplaceTask;
+	}
+}
+
+/**
+* @class   sprawl::threading::InplaceTask
+*
+* @brief   Move-only void() callable that stores its target inline instead of on the heap.
+*
+* @details Works like std::function<void()>, except that the callable is always constructed inside the
+*          InplaceTask's own storage, so creating, moving and destroying one never allocates. A callable that
+*          doesn't fit in t_Capacity bytes is a compile error rather than a silent heap allocation; use Fits<>()
+*          to check ahead of time if you need to fall back to something else.
+*
+*          Because it's move-only, move-only callables (e.g., lambdas capturing a unique_ptr) are fine.
+*
+* @tparam  t_Capacity   Number of bytes of inline storage
+*/
+template<size_t t_Capacity>
+class sprawl::threading::InplaceTask
+{
+public:
+	InplaceTask()
+		: m_ops(nullptr)
+	{
+
+	}
+
+	InplaceTask(std::nullptr_t)
+		: m_ops(nullptr)
+	{
+
+	}
+
+	template<typename t_CallableType, typename = typename std::enable_if<!std::is_same<typename std::decay<t_CallableType>::type, InplaceTask>::value>::type>
+	InplaceTask(t_CallableType&& callable)
+		: m_ops(nullptr)
+	{
+		typedef typename std::decay<t_CallableType>::type CallableType;
+		static_assert(Fits<CallableType>(), "Callable is too large or too strictly aligned for this InplaceTask.");
+		new(&m_storage) CallableType(std::forward<t_CallableType>(callable));
+		m_ops = &Ops<CallableType>::table;
+	}
+
+	InplaceTask(InplaceTask&& other) noexcept
+		: m_ops(other.m_ops)
+	{
+		if(m_ops)
+		{
+			m_ops->move(&m_storage, &other.m_storage);
+			other.m_ops = nullptr;
+		}
+	}
+
+	InplaceTask& operator=(InplaceTask&& other) noexcept
+	{
+		if(this != &other)
+		{
+			reset_();
+			m_ops = other.m_ops;
+			if(m_ops)
+			{
+				m_ops->move(&m_storage, &other.m_storage);
+				other.m_ops = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	InplaceTask& operator=(std::nullptr_t)
+	{
+		reset_();
+		return *this;
+	}
+
+	~InplaceTask()
+	{
+		reset_();
+	}
+
+	void operator()()
+	{
+		m_ops->invoke(&m_storage);
+	}
+
+	explicit operator bool() const
+	{
+		return m_ops != nullptr;
+	}
+
+	/**
+	* @brief   Check whether a callable type can be stored in this InplaceTask.
+	*/
+	template<typename t_CallableType>
+	static constexpr bool Fits()
+	{
+		return sizeof(t_CallableType) <= t_Capacity && alignof(t_CallableType) <= alignof(StorageType);
+	}
+
+private:
+	InplaceTask(InplaceTask const& other) = delete;
+	InplaceTask& operator=(InplaceTask const& other) = delete;
+
+	typedef typename std::aligned_storage<t_Capacity, alignof(std::max_align_t)>::type StorageType;
+
+	struct OpsTable
+	{
+		void (*invoke)(void* storage);
+		// Move-constructs into dst and destroys src.
+		void (*move)(void* dst, void* src);
+		void (*destroy)(void* storage);
+	};
+
+	template<typename t_CallableType>
+	struct Ops
+	{
+		static void invoke(void* storage)
+		{
+			(*static_cast<t_CallableType*>(storage))();
+		}
+
+		static void move(void* dst, void* src)
+		{
+			t_CallableType* source = static_cast<t_CallableType*>(src);
+			new(dst) t_CallableType(std::move(*source));
+			source->~t_CallableType();
+		}
+
+		static void destroy(void* storage)
+		{
+			static_cast<t_CallableType*>(storage)->~t_CallableType();
+		}
+
+		static constexpr OpsTable table = { &invoke, &move, &destroy };
+	};
+
+	inline void reset_()
+	{
+		if(m_ops)
+		{
+			m_ops->destroy(&m_storage);
+			m_ops = nullptr;
+		}
+	}
+
+	StorageType m_storage;
+	OpsTable const* m_ops;
+};
+
+template<size_t t_Capacity>
+template<typename t_CallableType>
+constexpr typename sprawl::threading::InplaceTask<t_Capacity>::OpsTable sprawl::threading::InplaceTask<t_Capacity>::Ops<t_CallableType>::table;
@@ -0,0 +1,134 @@
+#include "task.hpp"
+
+#if SPRAWL_COROUTINE_TASKS
+
+#include "eventset.hpp"
+#include "mutex.hpp"
+#include "thread.hpp"
+
+class sprawl::threading::EventAwaiter::Watcher
+{
+public:
+	static Watcher& Get()
+	{
+		// Never destroyed; its thread sits in the set's Wait() for the life of the process.
+		static Watcher* watcher = new Watcher();
+		return *watcher;
+	}
+
+	void Add(EventAwaiter* awaiter)
+	{
+		ScopedLock lock(m_mutex);
+		bool watching = false;
+		for(EventAwaiter* other = m_head; other != nullptr; other = other->m_next)
+		{
+			if(other->m_event == awaiter->m_event)
+			{
+				watching = true;
+				break;
+			}
+		}
+
+		awaiter->m_next = nullptr;
+		if(m_tail == nullptr)
+		{
+			m_head = awaiter;
+		}
+		else
+		{
+			m_tail->m_next = awaiter;
+		}
+		m_tail = awaiter;
+
+		if(!watching)
+		{
+			m_events.Add(*awaiter->m_event);
+		}
+	}
+
+private:
+	Watcher()
+		: m_mutex()
+		, m_events()
+		, m_head(nullptr)
+		, m_tail(nullptr)
+		, m_thread("EventAwaiter", &Watcher::run_, this)
+	{
+		m_thread.Start();
+	}
+
+	void run_()
+	{
+		for(;;)
+		{
+			Event const* event = m_events.Wait();
+			EventAwaiter* awaiter = pop_(event);
+			if(awaiter == nullptr)
+			{
+				continue;
+			}
+
+			// Once it's resumed, the awaiter goes away with the rest of its Task's frame.
+			std::coroutine_handle<> handle = awaiter->m_handle;
+			awaiter->m_manager->AddTask([handle]() { handle.resume(); }, awaiter->m_threadFlags);
+		}
+	}
+
+	EventAwaiter* pop_(Event const* event)
+	{
+		ScopedLock lock(m_mutex);
+		EventAwaiter* prev = nullptr;
+		EventAwaiter* found = m_head;
+		while(found != nullptr && found->m_event != event)
+		{
+			prev = found;
+			found = found->m_next;
+		}
+		if(found == nullptr)
+		{
+			return nullptr;
+		}
+
+		if(prev == nullptr)
+		{
+			m_head = found->m_next;
+		}
+		else
+		{
+			prev->m_next = found->m_next;
+		}
+		if(m_tail == found)
+		{
+			m_tail = prev;
+		}
+
+		bool stillWatching = false;
+		for(EventAwaiter* other = found->m_next; other != nullptr; other = other->m_next)
+		{
+			if(other->m_event == event)
+			{
+				stillWatching = true;
+				break;
+			}
+		}
+		if(!stillWatching)
+		{
+			m_events.Remove(*event);
+		}
+		return found;
+	}
+
+	Mutex m_mutex;
+	EventSet m_events;
+	// Everyone waiting, oldest first.
+	EventAwaiter* m_head;
+	EventAwaiter* m_tail;
+	Thread m_thread;
+};
+
+/*static*/ void sprawl::threading::EventAwaiter::watch_(EventAwaiter* awaiter)
+{
+	Watcher::Get().Add(awaiter);
+}
+
+#endif
@@ -0,0 +1,473 @@
+#pragma once
+
+#include "../common/compat.hpp"
+
+#if SPRAWL_COROUTINE_TASKS
+
+namespace sprawl
+{
+	namespace threading
+	{
+		template<typename t_ResultType = void>
+		class Task;
+
+		class ScheduleAwaiter;
+		class EventAwaiter;
+
+		template<typename t_YieldType>
+		class GeneratorAwaiter;
+
+		namespace detail
+		{
+			struct TaskPromiseBase;
+
+			template<typename t_ResultType>
+			struct TaskPromise;
+		}
+	}
+}
+
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "../common/errors.hpp"
+#include "../time/time.hpp"
+#include "event.hpp"
+#include "threadmanager.hpp"
+// Last, since it pulls in coroutine.hpp, which defines a yield() macro that trips up other headers.
+#include "fiber.hpp"
+
+/**
+ * Tasks are C++20 coroutines: they keep their locals in a heap-allocated frame instead of on a stack of their
+ * own, so they're far cheaper to keep around in large numbers than Coroutines or fibers.
+ *
+ * A Task doesn't start until something co_awaits it, Wait()s on it, or Detach()es it, and it runs on whatever
+ * thread that happens on until it co_awaits something that suspends it. Where it picks up after that depends on
+ * what it awaited:
+ *
+ *		co_await manager.Schedule(flags);				// a task on the threads with these flags
+ *		co_await manager.SleepFor(flags, nanoseconds);	// a future task, on the manager's timer
+ *		co_await manager.WaitForEvent(event, flags);	// a task, once the event is notified
+ *		co_await otherTask;								// wherever otherTask finished
+ *
+ * Nothing is blocked while a Task is suspended. Stackful code - threads, fibers, Coroutines, generators - gets
+ * at a Task's result with Wait(), and a Task steps through a Generator with co_await Next(generator).
+ *
+ * Tasks need C++20 and are left out otherwise; see SPRAWL_COROUTINE_TASKS.
+ */
+
+namespace sprawl
+{
+	namespace threading
+	{
+		namespace detail
+		{
+			struct TaskPromiseBase
+			{
+				TaskPromiseBase()
+					: continuation()
+					, waiter(nullptr)
+					, detached(false)
+#if SPRAWL_EXCEPTIONS_ENABLED
+					, exception()
+#endif
+				{
+					//
+				}
+
+				std::suspend_always initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				struct FinalAwaiter
+				{
+					bool await_ready() noexcept
+					{
+						return false;
+					}
+
+					template<typename t_PromiseType>
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<t_PromiseType> handle) noexcept
+					{
+						TaskPromiseBase& promise = handle.promise();
+						if(promise.continuation)
+						{
+							return promise.continuation;
+						}
+						if(promise.detached)
+						{
+							handle.destroy();
+						}
+						else if(promise.waiter != nullptr)
+						{
+							// The waiter owns the frame and may destroy it as soon as this returns.
+							promise.waiter->Notify();
+						}
+						return std::noop_coroutine();
+					}
+
+					void await_resume() noexcept
+					{
+						//
+					}
+				};
+
+				FinalAwaiter final_suspend() noexcept
+				{
+					return {};
+				}
+
+				void unhandled_exception()
+				{
+#if SPRAWL_EXCEPTIONS_ENABLED
+					exception = std::current_exception();
+#else
+					std::terminate();
+#endif
+				}
+
+				void Rethrow()
+				{
+#if SPRAWL_EXCEPTIONS_ENABLED
+					if(exception)
+					{
+						std::rethrow_exception(exception);
+					}
+#endif
+				}
+
+				// Whichever of these is set gets told when the task finishes.
+				std::coroutine_handle<> continuation;
+				fiber::Event* waiter;
+				bool detached;
+#if SPRAWL_EXCEPTIONS_ENABLED
+				std::exception_ptr exception;
+#endif
+			};
+
+			template<typename t_ResultType>
+			struct TaskPromise : public TaskPromiseBase
+			{
+				Task<t_ResultType> get_return_object() noexcept;
+
+				template<typename t_ValueType>
+				void return_value(t_ValueType&& value)
+				{
+					result.emplace(std::forward<t_ValueType>(value));
+				}
+
+				t_ResultType TakeResult()
+				{
+					Rethrow();
+					return std::move(*result);
+				}
+
+				std::optional<t_ResultType> result;
+			};
+
+			template<>
+			struct TaskPromise<void> : public TaskPromiseBase
+			{
+				Task<void> get_return_object() noexcept;
+
+				void return_void() noexcept
+				{
+					//
+				}
+
+				void TakeResult()
+				{
+					Rethrow();
+				}
+			};
+		}
+
+		/**
+		 * @brief	co_await from a Task to step a generator: the next value it yields, or nothing once it's done.
+		 * @details	The generator runs on the Task's thread until it yields. As with iterating over it, the value
+		 *			its function returns at the end isn't part of the sequence.
+		 */
+		template<typename t_YieldType>
+		GeneratorAwaiter<t_YieldType> Next(Generator<t_YieldType>& generator);
+	}
+}
+
+/**
+ * @brief	A C++20 coroutine producing a t_ResultType. Move-only; destroying a Task that hasn't finished
+ *			destroys its frame, so it must not be suspended at the time (use Detach() to let it run on its own).
+ */
+template<typename t_ResultType>
+class sprawl::threading::Task
+{
+public:
+	typedef detail::TaskPromise<t_ResultType> promise_type;
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	Task()
+		: m_handle()
+	{
+		//
+	}
+
+	explicit Task(Handle handle)
+		: m_handle(handle)
+	{
+		//
+	}
+
+	Task(Task&& other) noexcept
+		: m_handle(other.m_handle)
+	{
+		other.m_handle = Handle();
+	}
+
+	Task& operator=(Task&& other) noexcept
+	{
+		if(this != &other)
+		{
+			destroy_();
+			m_handle = other.m_handle;
+			other.m_handle = Handle();
+		}
+		return *this;
+	}
+
+	~Task()
+	{
+		destroy_();
+	}
+
+	bool Valid() const
+	{
+		return bool(m_handle);
+	}
+
+	bool Done() const
+	{
+		return m_handle && m_handle.done();
+	}
+
+	/**
+	 * @brief	Start the task and wait for it to finish, then return its result or rethrow what it threw.
+	 * @details	Parks the calling fiber if there is one, otherwise blocks the thread - so don't call this from
+	 *			a worker the task needs to finish on.
+	 */
+	t_ResultType Wait()
+	{
+		fiber::Event finished;
+		m_handle.promise().waiter = &finished;
+		m_handle.resume();
+		finished.Wait();
+		return m_handle.promise().TakeResult();
+	}
+
+	/**
+	 * @brief	Start the task and let go of it: it destroys itself when it's done, and its result is dropped.
+	 */
+	void Detach()
+	{
+		Handle handle = m_handle;
+		m_handle = Handle();
+		handle.promise().detached = true;
+		handle.resume();
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		m_handle.promise().continuation = awaiting;
+		return m_handle;
+	}
+
+	t_ResultType await_resume()
+	{
+		return m_handle.promise().TakeResult();
+	}
+
+private:
+	Task(Task const& other) = delete;
+	Task& operator=(Task const& other) = delete;
+
+	void destroy_()
+	{
+		if(m_handle)
+		{
+			m_handle.destroy();
+		}
+	}
+
+	Handle m_handle;
+};
+
+class sprawl::threading::ScheduleAwaiter
+{
+public:
+	/**
+	 * @param	nanosecondTimestamp	When to carry on, or 0 for as soon as a thread is free.
+	 */
+	ScheduleAwaiter(ThreadManager& manager, uint64_t threadFlags, int64_t nanosecondTimestamp)
+		: m_manager(&manager)
+		, m_threadFlags(threadFlags)
+		, m_nanosecondTimestamp(nanosecondTimestamp)
+	{
+		//
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		if(m_nanosecondTimestamp == 0)
+		{
+			m_manager->AddTask([handle]() { handle.resume(); }, m_threadFlags);
+		}
+		else
+		{
+			m_manager->AddFutureTask([handle]() { handle.resume(); }, m_threadFlags, m_nanosecondTimestamp - sprawl::time::Now(sprawl::time::Resolution::Nanoseconds));
+		}
+	}
+
+	void await_resume() const noexcept
+	{
+		//
+	}
+
+private:
+	ThreadManager* m_manager;
+	uint64_t m_threadFlags;
+	int64_t m_nanosecondTimestamp;
+};
+
+/**
+ * @details	One thread, started the first time it's needed, watches every awaited event through an EventSet and
+ *			hands each waiting Task back to its manager. When several Tasks wait on the same event, each
+ *			notification resumes one of them, longest waiting first.
+ */
+class sprawl::threading::EventAwaiter
+{
+public:
+	EventAwaiter(ThreadManager& manager, Event const& event, uint64_t threadFlags)
+		: m_manager(&manager)
+		, m_event(&event)
+		, m_threadFlags(threadFlags)
+		, m_handle()
+		, m_next(nullptr)
+	{
+		//
+	}
+
+	bool await_ready() const
+	{
+		return m_event->WaitFor(0);
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		m_handle = handle;
+		watch_(this);
+	}
+
+	void await_resume() const noexcept
+	{
+		//
+	}
+
+private:
+	class Watcher;
+
+	static void watch_(EventAwaiter* awaiter);
+
+	ThreadManager* m_manager;
+	Event const* m_event;
+	uint64_t m_threadFlags;
+	std::coroutine_handle<> m_handle;
+	EventAwaiter* m_next;
+};
+
+template<typename t_YieldType>
+class sprawl::threading::GeneratorAwaiter
+{
+public:
+	explicit GeneratorAwaiter(Generator<t_YieldType>& generator)
+		: m_generator(&generator)
+	{
+		//
+	}
+
+	bool await_ready() const noexcept
+	{
+		return true;
+	}
+
+	void await_suspend(std::coroutine_handle<>) const noexcept
+	{
+		//
+	}
+
+	std::optional<t_YieldType> await_resume()
+	{
+		if(m_generator->State() == CoroutineState::Completed)
+		{
+			return std::nullopt;
+		}
+		t_YieldType& value = m_generator->Resume();
+		if(m_generator->State() == CoroutineState::Completed)
+		{
+			return std::nullopt;
+		}
+		return std::move(value);
+	}
+
+private:
+	Generator<t_YieldType>* m_generator;
+};
+
+template<typename t_ResultType>
+inline sprawl::threading::Task<t_ResultType> sprawl::threading::detail::TaskPromise<t_ResultType>::get_return_object() noexcept
+{
+	return Task<t_ResultType>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+inline sprawl::threading::Task<void> sprawl::threading::detail::TaskPromise<void>::get_return_object() noexcept
+{
+	return Task<void>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+template<typename t_YieldType>
+inline sprawl::threading::GeneratorAwaiter<t_YieldType> sprawl::threading::Next(Generator<t_YieldType>& generator)
+{
+	return GeneratorAwaiter<t_YieldType>(generator);
+}
+
+inline sprawl::threading::ScheduleAwaiter sprawl::threading::ThreadManager::Schedule(uint64_t threadFlags)
+{
+	return ScheduleAwaiter(*this, threadFlags, 0);
+}
+
+inline sprawl::threading::ScheduleAwaiter sprawl::threading::ThreadManager::SleepFor(uint64_t threadFlags, int64_t nanoseconds)
+{
+	return ScheduleAwaiter(*this, threadFlags, sprawl::time::Now(sprawl::time::Resolution::Nanoseconds) + nanoseconds);
+}
+
+inline sprawl::threading::ScheduleAwaiter sprawl::threading::ThreadManager::SleepUntil(uint64_t threadFlags, int64_t nanosecondTimestamp)
+{
+	return ScheduleAwaiter(*this, threadFlags, nanosecondTimestamp);
+}
+
+inline sprawl::threading::EventAwaiter sprawl::threading::ThreadManager::WaitForEvent(Event const& event, uint64_t threadFlags)
+{
+	return EventAwaiter(*this, event, threadFlags);
+}
+
+#endif
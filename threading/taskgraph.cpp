@@ -0,0 +1,157 @@
+#include "taskgraph.hpp"
+#include "../common/errors.hpp"
+
+sprawl::threading::TaskGraph::TaskGraph()
+	: m_nodes()
+	, m_roots()
+	, m_validated(true)
+	, m_manager(nullptr)
+	, m_remaining(0)
+	, m_running(false)
+	, m_completeMutex()
+	, m_completeCondition()
+{
+	//
+}
+
+sprawl::threading::TaskGraph::~TaskGraph()
+{
+	for(auto& node : m_nodes)
+	{
+		delete node;
+	}
+}
+
+sprawl::threading::TaskGraph::NodeId sprawl::threading::TaskGraph::addNode_(ThreadManager::InlineTask&& task, uint64_t threadFlags)
+{
+	if(m_running)
+	{
+		SPRAWL_ABORT_MSG("TaskGraph modified while running.");
+	}
+	m_nodes.PushBack(new Node(std::move(task), threadFlags));
+	m_validated = false;
+	return NodeId(m_nodes.Size() - 1);
+}
+
+void sprawl::threading::TaskGraph::AddDependency(NodeId before, NodeId after)
+{
+	if(m_running)
+	{
+		SPRAWL_ABORT_MSG("TaskGraph modified while running.");
+	}
+	if(before >= Size() || after >= Size() || before == after)
+	{
+		SPRAWL_ABORT_MSG("Invalid TaskGraph dependency.");
+	}
+	m_nodes[before]->successors.PushBack(m_nodes[after]);
+	++m_nodes[after]->predecessorCount;
+	m_validated = false;
+}
+
+void sprawl::threading::TaskGraph::validate_()
+{
+	// Kahn's algorithm: if a topological walk can't reach every node, some of them are in a cycle and would
+	// never be released.
+	m_roots.Clear();
+	collections::Vector<Node*> ready;
+	for(auto& node : m_nodes)
+	{
+		node->pending = node->predecessorCount;
+		if(node->predecessorCount == 0)
+		{
+			m_roots.PushBack(node);
+			ready.PushBack(node);
+		}
+	}
+	ssize_t visited = 0;
+	while(visited < ready.Size())
+	{
+		Node* node = ready[visited++];
+		for(auto& successor : node->successors)
+		{
+			if(--successor->pending == 0)
+			{
+				ready.PushBack(successor);
+			}
+		}
+	}
+	if(visited != m_nodes.Size())
+	{
+		SPRAWL_ABORT_MSG("TaskGraph contains a cycle.");
+	}
+	m_validated = true;
+}
+
+void sprawl::threading::TaskGraph::Submit(ThreadManager& manager)
+{
+	if(m_running)
+	{
+		SPRAWL_ABORT_MSG("TaskGraph submitted while already running.");
+	}
+	if(!m_validated)
+	{
+		validate_();
+	}
+	if(m_nodes.Empty())
+	{
+		return;
+	}
+
+	m_manager = &manager;
+	for(auto& node : m_nodes)
+	{
+		node->pending.store(node->predecessorCount, std::memory_order_relaxed);
+	}
+	m_remaining.store(size_t(m_nodes.Size()), std::memory_order_relaxed);
+	m_running.store(true, std::memory_order_release);
+
+	ThreadManager::TaskBatch batch(manager);
+	for(auto& root : m_roots)
+	{
+		batch.Add([this, root]() { runNode_(root); }, root->flags);
+	}
+	batch.Submit();
+}
+
+void sprawl::threading::TaskGraph::runNode_(Node* node)
+{
+	node->task();
+
+	ThreadManager::TaskBatch released(*m_manager);
+	for(auto& successor : node->successors)
+	{
+		if(successor->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			released.Add([this, successor]() { runNode_(successor); }, successor->flags);
+		}
+	}
+	released.Submit();
+
+	if(m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		// Clear the flag under the lock so a waiter can't return, and destroy the graph, while we're still in here.
+		ScopedLock lock(m_completeMutex);
+		m_running.store(false, std::memory_order_release);
+		m_completeCondition.NotifyAll();
+	}
+}
+
+void sprawl::threading::TaskGraph::Wait()
+{
+	SharedLock lock(m_completeMutex);
+	while(m_running.load(std::memory_order_acquire))
+	{
+		m_completeCondition.Wait(lock);
+	}
+}
+
+bool sprawl::threading::TaskGraph::IsComplete()
+{
+	if(m_running.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+	// The last node may still be holding the lock on its way out; wait for it so the caller is free to destroy us.
+	ScopedLock lock(m_completeMutex);
+	return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+namespace sprawl
+{
+	namespace threading
+	{
+		class TaskGraph;
+	}
+}
+
+#include <stdint.h>
+#include <atomic>
+
+#include "../collections/Vector.hpp"
+#include "threadmanager.hpp"
+#include "mutex.hpp"
+#include "condition_variable.hpp"
+
+/**
+ * @brief	A set of tasks with dependencies between them, run on a ThreadManager.
+ * @details	Each node is released to the ThreadManager as soon as every node it depends on has finished, so
+ *			independent chains of work never wait on each other the way they do with staged tasks. The graph
+ *			is built once and can then be submitted over and over (e.g., once per frame); submitting it only
+ *			resets per-node counters and doesn't allocate.
+ *
+ *			The graph must not be modified or resubmitted while it's running, and must not be destroyed until
+ *			Wait() has returned or IsComplete() is true. Nodes run as ordinary ThreadManager tasks, so a thread
+ *			that calls Wait() shouldn't be the only one able to run them.
+ */
+class sprawl::threading::TaskGraph
+{
+public:
+	typedef size_t NodeId;
+
+	TaskGraph();
+	~TaskGraph();
+
+	/**
+	 * @brief	Add a node to the graph.
+	 * @param	task			The callable to run each time the graph is submitted
+	 * @param	threadFlags		The flags to run it with, as with ThreadManager::AddTask()
+	 * @return	The node's id, for use with AddDependency()
+	 */
+	template<typename t_CallableType>
+	NodeId AddNode(t_CallableType&& task, uint64_t threadFlags)
+	{
+		return addNode_(ThreadManager::MakeInlineTask(std::forward<t_CallableType>(task)), threadFlags);
+	}
+
+	/**
+	 * @brief	Declare that one node must finish before another starts.
+	 */
+	void AddDependency(NodeId before, NodeId after);
+
+	/**
+	 * @brief	Start running the graph. Returns right away; use Wait() or IsComplete() to find out when it's done.
+	 */
+	void Submit(ThreadManager& manager);
+
+	/**
+	 * @brief	Block until every node from the last Submit() has finished.
+	 */
+	void Wait();
+
+	/**
+	 * @brief	Check whether every node from the last Submit() has finished, without blocking on it.
+	 */
+	bool IsComplete();
+
+	size_t Size() const { return size_t(m_nodes.Size()); }
+private:
+	TaskGraph(TaskGraph const& other) = delete;
+	TaskGraph& operator=(TaskGraph const& other) = delete;
+
+	struct Node
+	{
+		Node(ThreadManager::InlineTask&& task_, uint64_t flags_)
+			: task(std::move(task_))
+			, flags(flags_)
+			, predecessorCount(0)
+			, pending(0)
+			, successors()
+		{
+
+		}
+
+		ThreadManager::InlineTask task;
+		uint64_t flags;
+		size_t predecessorCount;
+		std::atomic<size_t> pending;
+		collections::Vector<Node*> successors;
+	};
+
+	NodeId addNode_(ThreadManager::InlineTask&& task, uint64_t threadFlags);
+	void validate_();
+	void runNode_(Node* node);
+
+	collections::Vector<Node*> m_nodes;
+	// Nodes with no predecessors. Rebuilt (and the graph checked for cycles) on the first Submit() after a change.
+	collections::Vector<Node*> m_roots;
+	bool m_validated;
+
+	ThreadManager* m_manager;
+	std::atomic<size_t> m_remaining;
+	std::atomic<bool> m_running;
+	Mutex m_completeMutex;
+	ConditionVariable m_completeCondition;
+};
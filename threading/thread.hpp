@@ -12,6 +12,7 @@ namespace sprawl
 	{
 		class Thread;
 		class Handle;
+		class CpuSet;
 		void RunThread(Thread* thread);
 
 		enum class ThreadDestructionBehavior
@@ -21,6 +22,21 @@ namespace sprawl
 			Detach,
 			Abort,
 		};
+
+		/**
+		 * @brief	Scheduling priority relative to other threads. Normal is whatever threads start with.
+		 * @details	On Linux these are nice values (+10, +5, 0, -5, -10); raising a thread above Normal usually
+		 *			needs CAP_SYS_NICE. On Windows they map to the matching THREAD_PRIORITY_* levels, and on
+		 *			macOS to quality-of-service classes.
+		 */
+		enum class ThreadPriority
+		{
+			Lowest,
+			Low,
+			Normal,
+			High,
+			Highest,
+		};
 	}
 
 	namespace this_thread
@@ -29,9 +45,31 @@ namespace sprawl
 		void Sleep(uint64_t nanoseconds);
 		void SleepUntil(uint64_t nanosecondTimestamp);
 		void Yield();
+
+		/**
+		 * @brief	Restrict the calling thread to the given CPUs.
+		 * @return	false if the platform doesn't support it (macOS) or none of the CPUs are usable.
+		 */
+		bool SetAffinity(threading::CpuSet const& cpus);
+		threading::CpuSet GetAffinity();
+
+		/**
+		 * @return	false if the platform refused - typically for lack of permission to raise priority.
+		 */
+		bool SetPriority(threading::ThreadPriority priority);
+
+		/**
+		 * @brief	Ask for the calling thread's future memory allocations to come from the given NUMA node.
+		 * @details	Memory already allocated stays where it is. Only a preference: if the node runs out, memory
+		 *			comes from elsewhere rather than failing.
+		 * @return	false if the platform doesn't support it or the node doesn't exist.
+		 */
+		bool SetPreferredNumaNode(size_t node);
 	}
 }
 
+#include "affinity.hpp"
+
 #ifdef _WIN32
 #	include "thread_windows.hpp"
 #	undef Yield
@@ -70,6 +108,19 @@ public:
 
 	void SetExceptionHandler();
 
+	/**
+	 * @brief	Restrict the thread to the given CPUs once it starts. Must be called before Start().
+	 * @details	An empty set (the default) leaves the thread free to run anywhere.
+	 */
+	void SetAffinity(CpuSet const& cpus) { m_affinity = cpus; }
+	CpuSet const& GetAffinity() const { return m_affinity; }
+
+	/**
+	 * @brief	Set the thread's scheduling priority once it starts. Must be called before Start().
+	 */
+	void SetPriority(ThreadPriority priority) { m_priority = priority; }
+	ThreadPriority GetPriority() const { return m_priority; }
+
 #if SPRAWL_EXCEPTIONS_ENABLED
 	bool HasException() { return bool(m_exception); }
 #else
@@ -87,6 +138,8 @@ protected:
 	Handle m_handle;
 
 	ThreadDestructionBehavior m_destructionBehavior;
+	CpuSet m_affinity;
+	ThreadPriority m_priority;
 #if SPRAWL_EXCEPTIONS_ENABLED
 	bool m_handleExceptions;
 	std::exception_ptr m_exception;
@@ -106,6 +159,8 @@ sprawl::threading::Thread::Thread(Function&& f, Args&&... args)
 	, m_function(std::bind(f, args...))
 	, m_handle()
 	, m_destructionBehavior(ThreadDestructionBehavior::Default)
+	, m_affinity()
+	, m_priority(ThreadPriority::Normal)
 #if SPRAWL_EXCEPTIONS_ENABLED
 	, m_handleExceptions(false)
 	, m_exception()
@@ -120,6 +175,8 @@ sprawl::threading::Thread::Thread(char const* const threadName, Function&& f, Ar
 	, m_function(std::bind(f, args...))
 	, m_handle()
 	, m_destructionBehavior(ThreadDestructionBehavior::Default)
+	, m_affinity()
+	, m_priority(ThreadPriority::Normal)
 #if SPRAWL_EXCEPTIONS_ENABLED
 	, m_handleExceptions(false)
 	, m_exception()
@@ -134,6 +191,8 @@ sprawl::threading::Thread::Thread(Function&& f)
 	, m_function(f)
 	, m_handle()
 	, m_destructionBehavior(ThreadDestructionBehavior::Default)
+	, m_affinity()
+	, m_priority(ThreadPriority::Normal)
 #if SPRAWL_EXCEPTIONS_ENABLED
 	, m_handleExceptions(false)
 	, m_exception()
@@ -148,6 +207,8 @@ sprawl::threading::Thread::Thread(char const* const threadName, Function&& f)
 	, m_function(f)
 	, m_handle()
 	, m_destructionBehavior(ThreadDestructionBehavior::Default)
+	, m_affinity()
+	, m_priority(ThreadPriority::Normal)
 #if SPRAWL_EXCEPTIONS_ENABLED
 	, m_handleExceptions(false)
 	, m_exception()
@@ -193,6 +254,16 @@ inline void sprawl::threading::Thread::Detach()
 
 inline void sprawl::threading::RunThread(Thread* thread)
 {
+	// Applied from the new thread itself, before it does anything else, so all of its work (and any memory it
+	// touches first) happens where it was asked to run.
+	if(!thread->m_affinity.Empty())
+	{
+		this_thread::SetAffinity(thread->m_affinity);
+	}
+	if(thread->m_priority != ThreadPriority::Normal)
+	{
+		this_thread::SetPriority(thread->m_priority);
+	}
 #if SPRAWL_EXCEPTIONS_ENABLED
 	try
 	{
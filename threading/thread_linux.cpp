@@ -4,7 +4,13 @@
 
 #ifdef __APPLE__
 #include <sched.h>
+#include <pthread/qos.h>
 #	define pthread_yield sched_yield
+#else
+#	include <sched.h>
+#	include <unistd.h>
+#	include <sys/resource.h>
+#	include <sys/syscall.h>
 #endif
 
 #include "../common/compat.hpp"
@@ -121,3 +127,72 @@ void sprawl::this_thread::Yield()
 {
 	pthread_yield();
 }
+
+bool sprawl::this_thread::SetAffinity(threading::CpuSet const& cpus)
+{
+#ifdef __APPLE__
+	// macOS only takes affinity hints between threads, not specific CPUs.
+	(void)cpus;
+	return false;
+#else
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for(size_t cpu = cpus.Next(0); cpu != threading::CpuSet::c_maxCpus && cpu < CPU_SETSIZE; cpu = cpus.Next(cpu + 1))
+	{
+		CPU_SET(cpu, &mask);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#endif
+}
+
+sprawl::threading::CpuSet sprawl::this_thread::GetAffinity()
+{
+#ifndef __APPLE__
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if(pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0)
+	{
+		threading::CpuSet cpus;
+		for(size_t cpu = 0; cpu < CPU_SETSIZE && cpu < threading::CpuSet::c_maxCpus; ++cpu)
+		{
+			if(CPU_ISSET(cpu, &mask))
+			{
+				cpus.Add(cpu);
+			}
+		}
+		return cpus;
+	}
+#endif
+	return threading::GetAvailableCpus();
+}
+
+bool sprawl::this_thread::SetPriority(threading::ThreadPriority priority)
+{
+#ifdef __APPLE__
+	static qos_class_t const qosClasses[] = { QOS_CLASS_BACKGROUND, QOS_CLASS_UTILITY, QOS_CLASS_DEFAULT, QOS_CLASS_USER_INITIATED, QOS_CLASS_USER_INTERACTIVE };
+	return pthread_set_qos_class_self_np(qosClasses[int(priority)], 0) == 0;
+#else
+	static int const niceValues[] = { 10, 5, 0, -5, -10 };
+	// Linux keeps a nice value per thread, not per process, addressed by kernel thread id.
+	return setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), niceValues[int(priority)]) == 0;
+#endif
+}
+
+bool sprawl::this_thread::SetPreferredNumaNode(size_t node)
+{
+#if defined(__APPLE__) || !defined(SYS_set_mempolicy)
+	(void)node;
+	return false;
+#else
+	// From linux/mempolicy.h. glibc doesn't wrap set_mempolicy (libnuma does), so make the system call directly.
+	int const preferredPolicy = 1;
+	unsigned long nodeMask[threading::CpuSet::c_maxCpus / (sizeof(unsigned long) * 8)] = {};
+	if(node >= threading::CpuSet::c_maxCpus || node >= threading::GetNumaNodeCount())
+	{
+		return false;
+	}
+	nodeMask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+	// The kernel reads one bit fewer than maxnode.
+	return syscall(SYS_set_mempolicy, preferredPolicy, nodeMask, sizeof(nodeMask) * 8 + 1) == 0;
+#endif
+}
@@ -129,4 +129,52 @@ void sprawl::this_thread::SleepUntil(uint64_t nanosecondTimestamp)
 void sprawl::this_thread::Yield()
 {
 	SwitchToThread();
-}
\ No newline at end of file
+}
+
+bool sprawl::this_thread::SetAffinity(threading::CpuSet const& cpus)
+{
+	DWORD_PTR mask = 0;
+	for(size_t cpu = cpus.Next(0); cpu != threading::CpuSet::c_maxCpus && cpu < sizeof(DWORD_PTR) * 8; cpu = cpus.Next(cpu + 1))
+	{
+		mask |= DWORD_PTR(1) << cpu;
+	}
+	return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+sprawl::threading::CpuSet sprawl::this_thread::GetAffinity()
+{
+	// There's no GetThreadAffinityMask; setting a mask returns the old one, so set it to itself.
+	DWORD_PTR processMask;
+	DWORD_PTR systemMask;
+	threading::CpuSet cpus;
+	if(GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+	{
+		DWORD_PTR const mask = SetThreadAffinityMask(GetCurrentThread(), processMask);
+		if(mask != 0)
+		{
+			SetThreadAffinityMask(GetCurrentThread(), mask);
+			for(size_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu)
+			{
+				if(mask & (DWORD_PTR(1) << cpu))
+				{
+					cpus.Add(cpu);
+				}
+			}
+			return cpus;
+		}
+	}
+	return threading::GetAvailableCpus();
+}
+
+bool sprawl::this_thread::SetPriority(threading::ThreadPriority priority)
+{
+	static int const priorities[] = { THREAD_PRIORITY_LOWEST, THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_NORMAL, THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_HIGHEST };
+	return SetThreadPriority(GetCurrentThread(), priorities[int(priority)]) != 0;
+}
+
+bool sprawl::this_thread::SetPreferredNumaNode(size_t node)
+{
+	// Windows already takes a thread's memory from the node of the processor it's running on, so a pinned thread
+	// gets node-local memory without being asked.
+	return node < threading::GetNumaNodeCount();
+}
@@ -1,74 +1,136 @@
 #include "threadmanager.hpp"
 
-inline sprawl::threading::ThreadManager::TaskInfo::TaskInfo()
-	: what(nullptr)
-	, taken(false)
+namespace
 {
-	//
+	// How many TaskInfos a pool allocates at once when it runs dry.
+	static size_t const c_taskPoolChunkSize = 64;
+
+	// Metrics counters each have a single writer, so they don't need a read-modify-write.
+	template<typename t_Type>
+	inline void AddToCounter(std::atomic<t_Type>& counter, t_Type amount)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	template<typename t_Type>
+	inline void RaiseCounter(std::atomic<t_Type>& counter, t_Type value)
+	{
+		if(value > counter.load(std::memory_order_relaxed))
+		{
+			counter.store(value, std::memory_order_relaxed);
+		}
+	}
 }
 
-inline sprawl::threading::ThreadManager::TaskInfo::TaskInfo(sprawl::threading::ThreadManager::Task&& what_, uint64_t where_, int64_t when_)
-	: what(std::move(what_))
-	, where(where_)
-	, when(when_)
+inline sprawl::threading::ThreadManager::TaskInfo::TaskInfo()
+	: what()
+	, where(0)
+	, when(0)
 	, taken(false)
+	, refCount(1)
 	, stage(0)
+	, deadline(c_noDeadline)
+	, priority(0)
+	, onShed()
+	, pool(nullptr)
+	, nextFree(nullptr)
 {
 	//
 }
 
-inline sprawl::threading::ThreadManager::TaskInfo::TaskInfo(sprawl::threading::ThreadManager::Task const& what_, uint64_t where_, int64_t when_)
-	: what(what_)
-	, where(where_)
-	, when(when_)
-	, taken(false)
-	, stage(0)
+sprawl::threading::ThreadManager::TaskPool::TaskPool(ThreadManager* owner_)
+	: owner(owner_)
+	, freeList(nullptr)
+	, returned()
+	, chunks()
 {
 	//
 }
 
-inline sprawl::threading::ThreadManager::TaskInfo::TaskInfo(sprawl::threading::ThreadManager::Task&& what_, uint64_t where_, int64_t when_, int64_t stage_)
-	: what(std::move(what_))
-	, where(where_)
-	, when(when_)
-	, taken(false)
-	, stage(stage_)
+sprawl::threading::ThreadManager::TaskPool::~TaskPool()
 {
-	//
+	for(auto& chunk : chunks)
+	{
+		delete[] chunk;
+	}
 }
 
-inline sprawl::threading::ThreadManager::TaskInfo::TaskInfo(sprawl::threading::ThreadManager::Task const& what_, uint64_t where_, int64_t when_, int64_t stage_)
-	: what(what_)
-	, where(where_)
-	, when(when_)
-	, taken(false)
-	, stage(stage_)
+sprawl::threading::ThreadManager::TaskHandle::TaskHandle()
+	: m_manager(nullptr)
+	, m_task(nullptr)
 {
-	//
+
 }
 
-inline sprawl::threading::ThreadManager::TaskInfo::TaskInfo(TaskInfo&& other)
-	: what(std::move(other.what))
-	, where(other.where)
-	, when(other.when)
-	, taken(false)
-	, stage(0)
+sprawl::threading::ThreadManager::TaskHandle::TaskHandle(ThreadManager* manager, TaskInfo* task)
+	: m_manager(manager)
+	, m_task(task)
+{
+	m_task->refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+sprawl::threading::ThreadManager::TaskHandle::~TaskHandle()
 {
+	if(m_task)
+	{
+		release_(m_task);
+	}
+}
 
+sprawl::threading::ThreadManager::TaskHandle::TaskHandle(TaskHandle&& other)
+	: m_manager(other.m_manager)
+	, m_task(other.m_task)
+{
+	other.m_manager = nullptr;
+	other.m_task = nullptr;
 }
 
-sprawl::threading::ThreadManager::TaskInfo& sprawl::threading::ThreadManager::TaskInfo::operator=(TaskInfo&& other)
+sprawl::threading::ThreadManager::TaskHandle& sprawl::threading::ThreadManager::TaskHandle::operator=(TaskHandle&& other)
 {
-	what = std::move(other.what);
-	where = other.where;
-	when = other.when;
-	stage = other.stage;
+	if(m_task)
+	{
+		release_(m_task);
+	}
+	m_manager = other.m_manager;
+	m_task = other.m_task;
+	other.m_manager = nullptr;
+	other.m_task = nullptr;
 	return *this;
 }
 
+bool sprawl::threading::ThreadManager::TaskHandle::Cancel()
+{
+	if(!m_task)
+	{
+		return false;
+	}
+	// Claiming the task the same way a worker would means exactly one of us wins - if it's us, it never runs.
+	bool expected = false;
+	if(!m_task->taken.compare_exchange_strong(expected, true))
+	{
+		return false;
+	}
+	m_manager->cancelTask_(m_task);
+	return true;
+}
+
+void sprawl::threading::ThreadManager::TaskBatch::Clear()
+{
+	TaskInfo* task = m_first;
+	while(task != nullptr)
+	{
+		TaskInfo* next = static_cast<TaskInfo*>(task->m_next.load(std::memory_order_relaxed));
+		release_(task);
+		task = next;
+	}
+	m_first = nullptr;
+	m_last = nullptr;
+	m_size = 0;
+}
 
 sprawl::threading::ThreadManager::ThreadManager()
 	: m_taskQueue()
+	, m_cancelQueue()
 	, m_flagGroups()
 	, m_mainThreadMailbox(nullptr)
 	, m_mainThreadQueue(nullptr)
@@ -77,11 +139,26 @@ sprawl::threading::ThreadManager::ThreadManager()
 	, m_running(false)
 	, m_currentStage(0)
 	, m_maxStage(0)
+	, m_workStealing(false)
+	, m_timerTick(time::Resolution::Milliseconds)
+	, m_timerLevels(4)
+	, m_currentThread()
+	, m_taskPool()
+	, m_taskPools()
+	, m_taskPoolsMutex()
 	, m_syncState(SyncState::None)
-	, m_workerSyncEvent()
 	, m_mailmanSyncEvent()
-	, m_syncCount(0)
+	, m_stageBarrier()
 	, m_mailReady()
+	, m_metricsEnabled(false)
+	, m_traceCapacity(0)
+	, m_instrumented(false)
+	, m_traceEpoch(0)
+	, m_tasksDelivered(0)
+	, m_mailmanLag(0)
+	, m_maxMailmanLag(0)
+	, m_tasksShed(0)
+	, m_hasElasticGroups(false)
 {
 	//
 }
@@ -89,11 +166,15 @@ sprawl::threading::ThreadManager::ThreadManager()
 sprawl::threading::ThreadManager::~ThreadManager()
 {
 	TaskInfo* task;
-	decltype(m_taskQueue)::ReadReservationTicket ticket;
-	m_taskQueue.InitializeReservationTicket(ticket);
-	while(m_taskQueue.Dequeue(task, ticket))
+	while((task = m_taskQueue.Dequeue()) != nullptr)
+	{
+		release_(task);
+	}
+	ReservationTicket cancelTicket;
+	m_cancelQueue.InitializeReservationTicket(cancelTicket);
+	while(m_cancelQueue.Dequeue(task, cancelTicket))
 	{
-		delete task;
+		release_(task);
 	}
 	for(auto& group : m_flagGroups)
 	{
@@ -104,31 +185,132 @@ sprawl::threading::ThreadManager::~ThreadManager()
 		delete threadInfo.data;
 		delete threadInfo.thread;
 	}
+	// Anything still sitting in a flag group's queue lives in one of these, so this has to come last.
+	for(auto& pool : m_taskPools)
+	{
+		delete pool;
+	}
 }
 
-void sprawl::threading::ThreadManager::AddThread(uint64_t threadFlags, const char* const threadName)
+sprawl::threading::ThreadManager::FlagGroup* sprawl::threading::ThreadManager::getFlagGroup_(uint64_t threadFlags)
 {
-	ThreadData* data = new ThreadData(threadFlags);
-	m_threads.PushBack(ThreadInfo(data, threadName, std::bind(&ThreadManager::eventLoop_, this, data)));
 	FlagGroup*& group = m_flagGroups[threadFlags];
 	if(group == nullptr)
 	{
 		group = new FlagGroup();
 	}
-	group->events.PushBack(&data->mailbox);
+	return group;
+}
+
+sprawl::threading::ThreadManager::ThreadData* sprawl::threading::ThreadManager::addThread_(uint64_t threadFlags, const char* const threadName)
+{
+	FlagGroup* group = getFlagGroup_(threadFlags);
+	ThreadData* data = new ThreadData(threadFlags, group, size_t(m_threads.Size()));
+	if(threadName != nullptr)
+	{
+		m_threads.PushBack(ThreadInfo(data, threadName, std::bind(&ThreadManager::eventLoop_, this, data)));
+	}
+	else
+	{
+		m_threads.PushBack(ThreadInfo(data, std::bind(&ThreadManager::eventLoop_, this, data)));
+	}
+	group->members.PushBack(data);
+	return data;
+}
+
+void sprawl::threading::ThreadManager::AddThread(uint64_t threadFlags, const char* const threadName)
+{
+	addThread_(threadFlags, threadName);
 }
 
 
 void sprawl::threading::ThreadManager::AddThread(uint64_t threadFlags)
 {
-	ThreadData* data = new ThreadData(threadFlags);
-	m_threads.PushBack(ThreadInfo(data, std::bind(&ThreadManager::eventLoop_, this, data)));
-	FlagGroup*& group = m_flagGroups[threadFlags];
-	if(group == nullptr)
+	addThread_(threadFlags, nullptr);
+}
+
+void sprawl::threading::ThreadManager::AddThread(uint64_t threadFlags, CpuSet const& affinity, char const* const threadName)
+{
+	ThreadData* data = addThread_(threadFlags, threadName);
+	m_threads.Back().thread->SetAffinity(affinity);
+
+	if(GetNumaNodeCount() > 1 && !affinity.Empty())
 	{
-		group = new FlagGroup();
+		size_t const node = GetNumaNode(affinity.Next(0));
+		for(size_t cpu = affinity.Next(0); cpu != CpuSet::c_maxCpus; cpu = affinity.Next(cpu + 1))
+		{
+			if(GetNumaNode(cpu) != node)
+			{
+				// Spans nodes, so there's no one place its memory belongs.
+				return;
+			}
+		}
+		data->numaNode = int(node);
+	}
+}
+
+void sprawl::threading::ThreadManager::AddThread(uint64_t threadFlags, CpuSet const& affinity)
+{
+	AddThread(threadFlags, affinity, nullptr);
+}
+
+int sprawl::threading::ThreadManager::AddThreadPerCore(uint64_t threadFlags, int maxThreads, char const* const threadName)
+{
+	int added = 0;
+	for(auto& core : GetPhysicalCores())
+	{
+		if(maxThreads > 0 && added == maxThreads)
+		{
+			break;
+		}
+		AddThread(threadFlags, core, threadName);
+		++added;
+	}
+	return added;
+}
+
+int sprawl::threading::ThreadManager::AddThreadPerCore(uint64_t threadFlags, int maxThreads)
+{
+	return AddThreadPerCore(threadFlags, maxThreads, nullptr);
+}
+
+void sprawl::threading::ThreadManager::SetElastic(uint64_t threadFlags, int minThreads, int maxThreads, int64_t growAfterWaitNanosecs, int64_t retireAfterIdleNanosecs)
+{
+	if(minThreads < 0 || maxThreads < 1 || minThreads > maxThreads)
+	{
+		SPRAWL_ABORT_MSG("Invalid elastic thread bounds.");
+	}
+	FlagGroup* group = getFlagGroup_(threadFlags);
+	group->elastic = true;
+	group->minThreads = minThreads;
+	group->maxThreads = maxThreads;
+	group->growAfterWait = growAfterWaitNanosecs;
+	group->retireAfterIdle = retireAfterIdleNanosecs;
+	m_hasElasticGroups = true;
+}
+
+int sprawl::threading::ThreadManager::GetActiveThreadCount(uint64_t threadFlags)
+{
+	FlagGroup* group = getFlagGroup_(threadFlags);
+	if(group->elastic)
+	{
+		return group->activeThreads.load(std::memory_order_relaxed);
+	}
+	int count = 0;
+	for(auto& member : group->members)
+	{
+		// The main thread runs on the caller's own thread, so its Thread object is never started.
+		if(m_threads[member->index].thread->Joinable())
+		{
+			++count;
+		}
 	}
-	group->events.PushBack(&data->mailbox);
+	return count;
+}
+
+void sprawl::threading::ThreadManager::SetGroupPriority(uint64_t threadFlags, ThreadPriority priority)
+{
+	getFlagGroup_(threadFlags)->priority = priority;
 }
 
 
@@ -151,22 +333,22 @@ void sprawl::threading::ThreadManager::AddThreads(uint64_t threadFlags, int coun
 
 void sprawl::threading::ThreadManager::AddTask(sprawl::threading::ThreadManager::Task&& task, uint64_t threadFlags, int64_t whenNanosecs)
 {
-	pushTask_(new TaskInfo(std::move(task), threadFlags, whenNanosecs));
+	pushTask_(newTask_(std::move(task), threadFlags, whenNanosecs, 0));
 }
 
 void sprawl::threading::ThreadManager::AddTask(sprawl::threading::ThreadManager::Task const& task, uint64_t threadFlags, int64_t whenNanosecs)
 {
-	pushTask_(new TaskInfo(task, threadFlags, whenNanosecs));
+	pushTask_(newTask_(task, threadFlags, whenNanosecs, 0));
 }
 
 void sprawl::threading::ThreadManager::AddTaskStaged(uint64_t stage, sprawl::threading::ThreadManager::Task&& task, uint64_t threadFlags, int64_t whenNanosecs)
 {
-	pushTask_(new TaskInfo(std::move(task), threadFlags, whenNanosecs, stage));
+	pushTask_(newTask_(std::move(task), threadFlags, whenNanosecs, stage));
 }
 
 void sprawl::threading::ThreadManager::AddTaskStaged(uint64_t stage, sprawl::threading::ThreadManager::Task const& task, uint64_t threadFlags, int64_t whenNanosecs)
 {
-	pushTask_(new TaskInfo(task, threadFlags, whenNanosecs, stage));
+	pushTask_(newTask_(task, threadFlags, whenNanosecs, stage));
 }
 
 void sprawl::threading::ThreadManager::SetMaxStage(uint64_t maxStage)
@@ -174,49 +356,142 @@ void sprawl::threading::ThreadManager::SetMaxStage(uint64_t maxStage)
 	m_maxStage = maxStage;
 }
 
-void sprawl::threading::ThreadManager::AddFutureTask(sprawl::threading::ThreadManager::Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
+void sprawl::threading::ThreadManager::SetWorkStealing(bool enabled)
+{
+	m_workStealing = enabled;
+}
+
+void sprawl::threading::ThreadManager::SetMetricsEnabled(bool enabled)
+{
+	m_metricsEnabled = enabled;
+}
+
+void sprawl::threading::ThreadManager::SetTracing(size_t eventsPerThread)
+{
+	m_traceCapacity = eventsPerThread;
+}
+
+sprawl::threading::ThreadManager::Metrics sprawl::threading::ThreadManager::GetMetrics()
+{
+	Metrics metrics;
+	for(auto& threadInfo : m_threads)
+	{
+		ThreadData* data = threadInfo.data;
+		ThreadMetrics thread;
+		thread.flags = data->flags;
+		thread.tasksRun = data->counters.tasksRun.load(std::memory_order_relaxed);
+		thread.tasksStolen = data->counters.tasksStolen.load(std::memory_order_relaxed);
+		thread.totalWaitTime = data->counters.waitTime.load(std::memory_order_relaxed);
+		thread.maxWaitTime = data->counters.maxWaitTime.load(std::memory_order_relaxed);
+		thread.totalRunTime = data->counters.runTime.load(std::memory_order_relaxed);
+		thread.idleTime = data->counters.idleTime.load(std::memory_order_relaxed);
+		metrics.threads.PushBack(thread);
+	}
+	for(auto& flagGroup : m_flagGroups)
+	{
+		FlagGroup* group = flagGroup.Value();
+		GroupMetrics groupMetrics;
+		groupMetrics.flags = uint64_t(flagGroup.Key());
+		groupMetrics.threadCount = size_t(group->members.Size());
+		uint64_t read = 0;
+		for(auto& member : group->members)
+		{
+			read += member->counters.queueReads.load(std::memory_order_relaxed);
+		}
+		groupMetrics.queueDepth = int64_t(group->enqueued.load(std::memory_order_relaxed) - read);
+		if(groupMetrics.queueDepth < 0)
+		{
+			groupMetrics.queueDepth = 0;
+		}
+		metrics.groups.PushBack(groupMetrics);
+	}
+	metrics.tasksDelivered = m_tasksDelivered.load(std::memory_order_relaxed);
+	metrics.totalMailmanLag = m_mailmanLag.load(std::memory_order_relaxed);
+	metrics.maxMailmanLag = m_maxMailmanLag.load(std::memory_order_relaxed);
+	metrics.tasksShed = m_tasksShed.load(std::memory_order_relaxed);
+	return metrics;
+}
+
+void sprawl::threading::ThreadManager::WriteChromeTrace(FILE* file)
+{
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool first = true;
+	for(size_t i = 0; i < size_t(m_threads.Size()); ++i)
+	{
+		ThreadData* data = m_threads[i].data;
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"Thread %zu (flags 0x%" SPRAWL_I64FMT "x)\"}}",
+			first ? "" : ",\n", i, i, data->flags);
+		first = false;
+
+		size_t const count = data->traceCount.load(std::memory_order_acquire);
+		for(size_t j = 0; j < count; ++j)
+		{
+			TraceEvent const& event = data->traceEvents[j];
+			int64_t const wait = event.start > event.due ? event.start - event.due : 0;
+			// Trace timestamps are in (fractional) microseconds.
+			fprintf(file, ",\n{\"name\":\"Task\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"flags\":\"0x%" SPRAWL_I64FMT "x\",\"stage\":%" SPRAWL_I64FMT "u,\"wait_us\":%.3f}}",
+				i,
+				double(event.start - m_traceEpoch) / 1000.0,
+				double(event.end - event.start) / 1000.0,
+				event.where,
+				event.stage,
+				double(wait) / 1000.0);
+		}
+	}
+	fprintf(file, "\n]}\n");
+}
+
+void sprawl::threading::ThreadManager::SetTimerResolution(int64_t tickNanosecs, size_t levelCount)
+{
+	m_timerTick = tickNanosecs;
+	m_timerLevels = levelCount;
+}
+
+sprawl::threading::ThreadManager::TaskHandle sprawl::threading::ThreadManager::AddFutureTask(sprawl::threading::ThreadManager::Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
 {
-	AddTask(std::move(task), threadFlags, nanosecondsFromNow + time::Now());
+	return pushFutureTask_(newTask_(std::move(task), threadFlags, nanosecondsFromNow + time::Now(), 0));
 }
 
-void sprawl::threading::ThreadManager::AddFutureTask(sprawl::threading::ThreadManager::Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
+sprawl::threading::ThreadManager::TaskHandle sprawl::threading::ThreadManager::AddFutureTask(sprawl::threading::ThreadManager::Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
 {
-	AddTask(task, threadFlags, nanosecondsFromNow + time::Now());
+	return pushFutureTask_(newTask_(task, threadFlags, nanosecondsFromNow + time::Now(), 0));
 }
 
-void sprawl::threading::ThreadManager::AddFutureTaskStaged(uint64_t stage, sprawl::threading::ThreadManager::Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
+sprawl::threading::ThreadManager::TaskHandle sprawl::threading::ThreadManager::AddFutureTaskStaged(uint64_t stage, sprawl::threading::ThreadManager::Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
 {
-	AddTaskStaged(stage, std::move(task), threadFlags, nanosecondsFromNow + time::Now());
+	return pushFutureTask_(newTask_(std::move(task), threadFlags, nanosecondsFromNow + time::Now(), stage));
 }
 
-void sprawl::threading::ThreadManager::AddFutureTaskStaged(uint64_t stage, sprawl::threading::ThreadManager::Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
+sprawl::threading::ThreadManager::TaskHandle sprawl::threading::ThreadManager::AddFutureTaskStaged(uint64_t stage, sprawl::threading::ThreadManager::Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
 {
-	AddTaskStaged(stage, task, threadFlags, nanosecondsFromNow + time::Now());
+	return pushFutureTask_(newTask_(task, threadFlags, nanosecondsFromNow + time::Now(), stage));
 }
 
 void sprawl::threading::ThreadManager::RunStaged(uint64_t thisThreadFlags)
 {
-	m_running = true;
-	m_currentStage = 1;
-	m_syncState = SyncState::Threads;
-	for(auto& threadData : m_threads)
+	if(m_hasElasticGroups)
 	{
-		threadData.thread->Start();
+		SPRAWL_ABORT_MSG("Elastic thread groups can't be used with stages.");
 	}
+	// The main thread is registered before any worker starts so the flag groups never change under a running thread.
 	AddThread(thisThreadFlags, "Main Thread");
 	m_mainThreadMailbox = &m_threads.Back().data->mailbox;
 	m_mainThreadQueue = &m_flagGroups.Get(m_threads.Back().data->flags)->taskQueue;
 
 	size_t threadCount = m_threads.Size() - 1;
 
-	while(m_syncCount != threadCount)
-	{
-		m_workerSyncEvent.Wait();
-	}
+	m_stageBarrier.Reset(threadCount + 1);
+	m_running = true;
+	m_currentStage = 1;
+	m_syncState = SyncState::Threads;
+	startWorkers_(threadCount);
+
+	// Wait for every worker to reach the sync point before the first stage.
+	m_stageBarrier.Wait(threadCount);
 
 	m_mailmanThread.Start();
-	decltype(m_taskQueue)::ReadReservationTicket ticket;
-	m_taskQueue.InitializeReservationTicket(ticket);
+	ReservationTicket ticket;
+	m_mainThreadQueue->InitializeReservationTicket(ticket);
 	while(m_running)
 	{
 		RunNextStage(ticket);
@@ -225,21 +500,31 @@ void sprawl::threading::ThreadManager::RunStaged(uint64_t thisThreadFlags)
 
 void sprawl::threading::ThreadManager::Run(uint64_t thisThreadFlags)
 {
-	m_running = true;
-	for(auto& threadData : m_threads)
-	{
-		threadData.thread->Start();
-	}
+	prepareElasticGroups_();
 	AddThread(thisThreadFlags, "Main Thread");
 	m_mainThreadMailbox = &m_threads.Back().data->mailbox;
 	m_mainThreadQueue = &m_flagGroups.Get(m_threads.Back().data->flags)->taskQueue;
 
+	size_t threadCount = m_threads.Size() - 1;
+
+	m_stageBarrier.Reset(threadCount + 1);
+	m_running = true;
+	startWorkers_(threadCount);
+
 	m_mailmanThread.Start();
 	eventLoop_(m_threads.Back().data);
 }
 
 void sprawl::threading::ThreadManager::Start(uint64_t thisThreadFlags)
 {
+	prepareElasticGroups_();
+	AddThread(thisThreadFlags, "Main Thread");
+	m_mainThreadMailbox = &m_threads.Back().data->mailbox;
+	m_mainThreadQueue = &m_flagGroups.Get(m_threads.Back().data->flags)->taskQueue;
+
+	size_t threadCount = m_threads.Size() - 1;
+
+	m_stageBarrier.Reset(threadCount + 1);
 	m_running = true;
 
 	if(m_maxStage != 0)
@@ -247,70 +532,131 @@ void sprawl::threading::ThreadManager::Start(uint64_t thisThreadFlags)
 		m_syncState = SyncState::Threads;
 		m_currentStage = 1;
 	}
-	for(auto& threadInfo : m_threads)
-	{
-		threadInfo.thread->Start();
-	}
-	AddThread(thisThreadFlags, "Main Thread");
-	m_mainThreadMailbox = &m_threads.Back().data->mailbox;
-	m_mainThreadQueue = &m_flagGroups.Get(m_threads.Back().data->flags)->taskQueue;
+	startWorkers_(threadCount);
 
 	if(m_maxStage != 0)
 	{
-		size_t threadCount = m_threads.Size() - 1;
+		m_stageBarrier.Wait(threadCount);
+	}
+
+	m_mailmanThread.Start();
+}
 
-		while(m_syncCount != threadCount)
+void sprawl::threading::ThreadManager::startWorkers_(size_t threadCount)
+{
+	// Every thread, including the calling one, has been added by now.
+	m_instrumented = m_metricsEnabled || m_traceCapacity != 0;
+	m_traceEpoch = time::Now();
+	if(m_traceCapacity != 0)
+	{
+		for(auto& threadInfo : m_threads)
 		{
-			m_workerSyncEvent.Wait();
+			delete[] threadInfo.data->traceEvents;
+			threadInfo.data->traceEvents = new TraceEvent[m_traceCapacity];
+			threadInfo.data->traceCapacity = m_traceCapacity;
+			threadInfo.data->traceCount.store(0, std::memory_order_relaxed);
 		}
 	}
 
-	m_mailmanThread.Start();
+	for(size_t i = 0; i < threadCount; ++i)
+	{
+		ThreadData* data = m_threads[i].data;
+		m_threads[i].thread->SetPriority(data->group->priority);
+		if(data->dormant.load(std::memory_order_relaxed))
+		{
+			continue;
+		}
+		if(data->retirable)
+		{
+			data->group->activeThreads.fetch_add(1, std::memory_order_relaxed);
+		}
+		m_threads[i].thread->Start();
+	}
 }
 
-void sprawl::threading::ThreadManager::Pump(decltype(m_taskQueue)::ReadReservationTicket& ticket)
+void sprawl::threading::ThreadManager::prepareElasticGroups_()
 {
-	TaskInfo* task;
-	while(m_mainThreadQueue->Dequeue(task, ticket))
+	if(!m_hasElasticGroups)
+	{
+		return;
+	}
+	if(m_maxStage != 0)
+	{
+		SPRAWL_ABORT_MSG("Elastic thread groups can't be used with stages.");
+	}
+	// Collect the flags first; adding threads below looks the groups up again.
+	collections::Vector<uint64_t> elasticFlags;
+	for(auto& flagGroup : m_flagGroups)
 	{
-		bool expected = false;
-		if(task->taken.compare_exchange_strong(expected, true))
+		if(flagGroup.Value()->elastic)
 		{
-			task->what();
-			delete task;
+			elasticFlags.PushBack(uint64_t(flagGroup.Key()));
+		}
+	}
+
+	// Every thread an elastic group could ever need is created now, so the thread list and the group
+	// memberships never change once anything is running. Slots beyond the minimum start out dormant.
+	for(auto& flags : elasticFlags)
+	{
+		FlagGroup* group = m_flagGroups.Get(flags);
+		int const existing = int(group->members.Size());
+		int const startCount = existing > group->minThreads ? existing : group->minThreads;
+		for(int i = existing; i < group->maxThreads; ++i)
+		{
+			addThread_(flags, nullptr);
+		}
+		int index = 0;
+		for(auto& member : group->members)
+		{
+			member->retirable = true;
+			member->dormant.store(index >= startCount, std::memory_order_relaxed);
+			++index;
 		}
 	}
 }
 
-void sprawl::threading::ThreadManager::pump_(decltype(m_taskQueue)::ReadReservationTicket& ticket)
+void sprawl::threading::ThreadManager::Pump(ReservationTicket& ticket)
+{
+	if(ticket.queue == nullptr)
+	{
+		m_mainThreadQueue->InitializeReservationTicket(ticket);
+	}
+	pump_(ticket);
+}
+
+void sprawl::threading::ThreadManager::pump_(ReservationTicket& ticket)
 {
+	// The calling thread is always the last one added.
+	ThreadData* mainThread = m_threads.Back().data;
 	TaskInfo* task;
+	while(popDeadlineTask_(*mainThread->group, task))
+	{
+		runTask_(task, mainThread);
+	}
 	while(m_mainThreadQueue->Dequeue(task, ticket))
 	{
-		bool expected = false;
-		if(task->taken.compare_exchange_strong(expected, true))
+		if(m_metricsEnabled)
 		{
-			task->what();
-			delete task;
+			AddToCounter(mainThread->counters.queueReads, uint64_t(1));
 		}
+		runTask_(task, mainThread);
 	}
 }
 
-uint64_t sprawl::threading::ThreadManager::RunNextStage(decltype(m_taskQueue)::ReadReservationTicket& ticket)
+// Workers pass the stage barrier twice per stage: once when they reach the sync point at the end of a stage,
+// and once when the main thread lets them into the next one. The main thread is the last participant.
+uint64_t sprawl::threading::ThreadManager::RunNextStage(ReservationTicket& ticket)
 {
-	//Don't wait on the main thread...
-	size_t threadCount = m_threads.Size() - 1;
-	m_syncCount = 0;
-	m_syncState = SyncState::None;
-
-	for(auto& threadInfo : m_threads)
+	if(ticket.queue == nullptr)
 	{
-		threadInfo.data->mailbox.Notify();
+		m_mainThreadQueue->InitializeReservationTicket(ticket);
 	}
+	size_t const mainIndex = m_threads.Size() - 1;
+	m_syncState = SyncState::None;
 
-	while(m_syncCount != threadCount)
+	if(!m_stageBarrier.Wait(mainIndex))
 	{
-		m_workerSyncEvent.Wait();
+		return m_currentStage;
 	}
 
 	//Ensure any existing events on the mailmanSyncEvent are consumed
@@ -328,17 +674,12 @@ uint64_t sprawl::threading::ThreadManager::RunNextStage(decltype(m_taskQueue)::R
 
 	pump_(ticket);
 
-	m_syncCount = 0;
 	m_syncState = SyncState::Threads;
+	notifyQueues_();
 
-	for(auto& threadInfo : m_threads)
-	{
-		threadInfo.data->mailbox.Notify();
-	}
-
-	while(m_syncCount != threadCount)
+	if(!m_stageBarrier.Wait(mainIndex))
 	{
-		m_workerSyncEvent.Wait();
+		return m_currentStage;
 	}
 
 	uint64_t stageJustRun = m_currentStage;
@@ -353,20 +694,14 @@ uint64_t sprawl::threading::ThreadManager::RunNextStage(decltype(m_taskQueue)::R
 //Sync is basically the opposite of RunNextStage... instead of doing start stage, run, finish stage, it does finish stage, start stage, and expects the user to call Pump()
 uint64_t sprawl::threading::ThreadManager::Sync()
 {
-	//Don't wait on the main thread...
-	size_t threadCount = m_threads.Size() - 1;
+	size_t const mainIndex = m_threads.Size() - 1;
 
-	m_syncCount = 0;
 	m_syncState = SyncState::Threads;
+	notifyQueues_();
 
-	for(auto& threadInfo : m_threads)
-	{
-		threadInfo.data->mailbox.Notify();
-	}
-
-	while(m_syncCount != threadCount)
+	if(!m_stageBarrier.Wait(mainIndex))
 	{
-		m_workerSyncEvent.Wait();
+		return m_currentStage;
 	}
 
 	uint64_t stageJustRun = m_currentStage;
@@ -376,17 +711,11 @@ uint64_t sprawl::threading::ThreadManager::Sync()
 		m_currentStage = 1;
 	}
 
-	m_syncCount = 0;
 	m_syncState = SyncState::None;
 
-	for(auto& threadInfo : m_threads)
-	{
-		threadInfo.data->mailbox.Notify();
-	}
-
-	while(m_syncCount != threadCount)
+	if(!m_stageBarrier.Wait(mainIndex))
 	{
-		m_workerSyncEvent.Wait();
+		return stageJustRun;
 	}
 
 	//Ensure any existing events on the mailmanSyncEvent are consumed
@@ -414,11 +743,9 @@ void sprawl::threading::ThreadManager::Stop()
 {
 	m_syncState = SyncState::None;
 	m_running = false;
+	m_stageBarrier.Break();
 	m_mailReady.Notify();
-	for(auto& threadInfo : m_threads)
-	{
-		threadInfo.data->mailbox.Notify();
-	}
+	wakeThreads_();
 }
 
 void sprawl::threading::ThreadManager::ShutDown()
@@ -427,6 +754,8 @@ void sprawl::threading::ThreadManager::ShutDown()
 	{
 		Stop();
 	}
+	// The mailman goes first: it's the one that restarts dormant elastic threads.
+	m_mailmanThread.Join();
 	for(auto& threadInfo : m_threads)
 	{
 		if(threadInfo.thread->Joinable() && threadInfo.thread->GetHandle() != sprawl::this_thread::GetHandle())
@@ -434,108 +763,733 @@ void sprawl::threading::ThreadManager::ShutDown()
 			threadInfo.thread->Join();
 		}
 	}
-	m_mailmanThread.Join();
+	for(auto& threadInfo : m_threads)
+	{
+		TaskInfo* task;
+		while(threadInfo.data->localTasks.Pop(task))
+		{
+			release_(task);
+		}
+	}
 	m_threads.Clear();
 }
 
-void sprawl::threading::ThreadManager::pushTask_(TaskInfo* task)
+void sprawl::threading::ThreadManager::notifyQueues_()
+{
+	// Workers parked in their group's queue re-check the sync state when woken.
+	for(auto& group : m_flagGroups)
+	{
+		group.Value()->taskQueue.NotifyWaiters();
+	}
+}
+
+void sprawl::threading::ThreadManager::wakeThreads_()
+{
+	// Threads in the sync handshake are waiting on their mailboxes; everyone else is parked in their group's queue.
+	for(auto& threadInfo : m_threads)
+	{
+		threadInfo.data->mailbox.Notify();
+	}
+	for(auto& group : m_flagGroups)
+	{
+		group.Value()->taskQueue.NotifyWaiters();
+	}
+}
+
+sprawl::threading::ThreadManager::TaskInfo* sprawl::threading::ThreadManager::acquireTask_()
+{
+	TaskPool* pool = *m_taskPool;
+	if(SPRAWL_UNLIKELY(pool == nullptr))
+	{
+		pool = new TaskPool(this);
+		{
+			ScopedLock lock(m_taskPoolsMutex);
+			m_taskPools.PushBack(pool);
+		}
+		m_taskPool = pool;
+	}
+	TaskInfo* task = pool->freeList;
+	if(SPRAWL_UNLIKELY(task == nullptr))
+	{
+		task = refillPool_(pool);
+	}
+	pool->freeList = task->nextFree;
+	task->taken.store(false, std::memory_order_relaxed);
+	task->refCount.store(1, std::memory_order_relaxed);
+	return task;
+}
+
+sprawl::threading::ThreadManager::TaskInfo* sprawl::threading::ThreadManager::refillPool_(TaskPool* pool)
 {
+	// Take back whatever other threads have finished with before growing.
+	TaskInfo* task;
+	while((task = pool->returned.Dequeue()) != nullptr)
+	{
+		task->nextFree = pool->freeList;
+		pool->freeList = task;
+	}
+	if(pool->freeList == nullptr)
+	{
+		TaskInfo* chunk = new TaskInfo[c_taskPoolChunkSize];
+		pool->chunks.PushBack(chunk);
+		for(size_t i = 0; i < c_taskPoolChunkSize; ++i)
+		{
+			chunk[i].pool = pool;
+			chunk[i].nextFree = pool->freeList;
+			pool->freeList = &chunk[i];
+		}
+	}
+	return pool->freeList;
+}
+
+// The handle has to take its reference before the task is pushed, since it could run and be released right away.
+sprawl::threading::ThreadManager::TaskHandle sprawl::threading::ThreadManager::pushFutureTask_(TaskInfo* info)
+{
+	TaskHandle handle(this, info);
+	pushTask_(info);
+	return handle;
+}
+
+void sprawl::threading::ThreadManager::pushTask_(TaskInfo* task, bool allowLocal)
+{
+	if(m_workStealing && m_running && m_maxStage == 0 && task->stage == 0 && task->when <= time::Now())
+	{
+		ThreadData* current = *m_currentThread;
+		// Deadline tasks have to go through their groups' deadline queues to be run in order.
+		if(allowLocal && current != nullptr && !task->IsOrdered() && (task->where == 0 || (task->where & current->flags) != 0))
+		{
+			current->localTasks.Push(task);
+			// Peers parked in the group's queue need to know there's something to steal.
+			m_flagGroups.Get(current->flags)->taskQueue.NotifyWaiters();
+			return;
+		}
+		bool deliveredToMainThread = false;
+		if(deliverTask_(task, deliveredToMainThread))
+		{
+			if(deliveredToMainThread)
+			{
+				m_mainThreadMailbox->Notify();
+			}
+			if(m_hasElasticGroups)
+			{
+				// It may have landed in a dormant thread's reservation; the mailman passes those along.
+				m_mailReady.Notify();
+			}
+			release_(task);
+			return;
+		}
+	}
 	m_taskQueue.Enqueue(task);
 	m_mailReady.Notify();
 }
 
+void sprawl::threading::ThreadManager::pushTasks_(TaskInfo* first, TaskInfo* last)
+{
+	if(m_workStealing && m_running && m_maxStage == 0)
+	{
+		ThreadData* current = *m_currentThread;
+		if(current != nullptr)
+		{
+			// Keep what this worker can run itself and pass the rest on, preserving their order.
+			int64_t const now = time::Now();
+			TaskInfo* remainingFirst = nullptr;
+			TaskInfo* remainingLast = nullptr;
+			bool pushedLocal = false;
+			TaskInfo* task = first;
+			while(task != nullptr)
+			{
+				// Read the link first - once the task is on the deque, a thief may run and recycle it.
+				TaskInfo* next = (task == last) ? nullptr : static_cast<TaskInfo*>(task->m_next.load(std::memory_order_relaxed));
+				if(task->stage == 0 && task->when <= now && !task->IsOrdered() && (task->where == 0 || (task->where & current->flags) != 0))
+				{
+					current->localTasks.Push(task);
+					pushedLocal = true;
+				}
+				else
+				{
+					if(remainingLast == nullptr)
+					{
+						remainingFirst = task;
+					}
+					else
+					{
+						remainingLast->m_next.store(task, std::memory_order_relaxed);
+					}
+					remainingLast = task;
+				}
+				task = next;
+			}
+			if(pushedLocal)
+			{
+				m_flagGroups.Get(current->flags)->taskQueue.NotifyWaiters();
+			}
+			if(remainingFirst == nullptr)
+			{
+				return;
+			}
+			first = remainingFirst;
+			last = remainingLast;
+		}
+	}
+	m_taskQueue.EnqueueChain(first, last);
+	m_mailReady.Notify();
+}
+
+// Each group queue gets its own reference; the caller still owns the one it came in with.
+bool sprawl::threading::ThreadManager::deliverTask_(TaskInfo* task, bool& deliveredToMainThread)
+{
+	bool delivered = false;
+	for(auto& flagGroup : m_flagGroups)
+	{
+		if(task->where != 0 && (task->where & flagGroup.Key()) == 0)
+		{
+			continue;
+		}
+		task->refCount.fetch_add(1, std::memory_order_relaxed);
+		if(flagGroup.Value()->elastic)
+		{
+			flagGroup.Value()->added.fetch_add(1, std::memory_order_relaxed);
+		}
+		if(task->IsOrdered())
+		{
+			flagGroup.Value()->deadlineQueue.Push(task);
+			// Parked threads only watch the FIFO queue; tell them to look again.
+			flagGroup.Value()->taskQueue.NotifyWaiters();
+		}
+		else
+		{
+			if(m_metricsEnabled)
+			{
+				flagGroup.Value()->enqueued.fetch_add(1, std::memory_order_relaxed);
+			}
+			flagGroup.Value()->taskQueue.Enqueue(task);
+		}
+		if(&flagGroup.Value()->taskQueue == m_mainThreadQueue)
+		{
+			deliveredToMainThread = true;
+		}
+		delivered = true;
+	}
+	return delivered;
+}
+
+void sprawl::threading::ThreadManager::runTask_(TaskInfo* task, ThreadData* runner)
+{
+	bool expected = false;
+	if(task->taken.compare_exchange_strong(expected, true))
+	{
+		if(SPRAWL_UNLIKELY(m_instrumented))
+		{
+			runInstrumented_(task, runner);
+		}
+		else
+		{
+			task->what();
+		}
+	}
+	release_(task);
+}
+
+void sprawl::threading::ThreadManager::runInstrumented_(TaskInfo* task, ThreadData* runner)
+{
+	int64_t const start = time::Now();
+	task->what();
+	int64_t const end = time::Now();
+
+	if(m_metricsEnabled)
+	{
+		ThreadCounters& counters = runner->counters;
+		int64_t const wait = start > task->when ? start - task->when : 0;
+		AddToCounter(counters.tasksRun, uint64_t(1));
+		AddToCounter(counters.waitTime, wait);
+		RaiseCounter(counters.maxWaitTime, wait);
+		AddToCounter(counters.runTime, end - start);
+	}
+
+	size_t const index = runner->traceCount.load(std::memory_order_relaxed);
+	if(index < runner->traceCapacity)
+	{
+		TraceEvent& event = runner->traceEvents[index];
+		event.due = task->when;
+		event.start = start;
+		event.end = end;
+		event.where = task->where;
+		event.stage = task->stage;
+		runner->traceCount.store(index + 1, std::memory_order_release);
+	}
+}
+
+void sprawl::threading::ThreadManager::cancelTask_(TaskInfo* task)
+{
+	task->refCount.fetch_add(1, std::memory_order_relaxed);
+	m_cancelQueue.Enqueue(task);
+	m_mailReady.Notify();
+}
+
+void sprawl::threading::ThreadManager::release_(TaskInfo* task)
+{
+	if(task->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+	// Drop the callable now rather than when the task is reused, so whatever it captured is freed promptly.
+	task->what = nullptr;
+	if(task->onShed)
+	{
+		task->onShed = nullptr;
+	}
+	TaskPool* pool = task->pool;
+	if(*pool->owner->m_taskPool == pool)
+	{
+		task->nextFree = pool->freeList;
+		pool->freeList = task;
+	}
+	else
+	{
+		pool->returned.Enqueue(task);
+	}
+}
+
+bool sprawl::threading::ThreadManager::stealTask_(ThreadData* thief, FlagGroup& group, TaskInfo*& task)
+{
+	// Start each search at a different peer so idle threads don't all pile onto the same victim.
+	size_t const memberCount = group.members.Size();
+	for(size_t i = 0; i < memberCount; ++i)
+	{
+		ThreadData* victim = group.members[(thief->nextVictim + i) % memberCount];
+		if(victim != thief && victim->localTasks.Steal(task))
+		{
+			thief->nextVictim = (thief->nextVictim + i + 1) % memberCount;
+			return true;
+		}
+	}
+	thief->nextVictim = (thief->nextVictim + 1) % memberCount;
+	return false;
+}
+
+// Deadline tasks first, since they're the ones that go stale. Then our own deque since its tasks are the most
+// likely to be hot in cache, then the shared queue, then peers.
+bool sprawl::threading::ThreadManager::findTask_(ThreadData* threadData, TaskInfo*& task)
+{
+	if(popDeadlineTask_(*threadData->group, task))
+	{
+		return true;
+	}
+	if(m_workStealing && threadData->localTasks.Pop(task))
+	{
+		return true;
+	}
+	if(threadData->group->taskQueue.Dequeue(task, threadData->ticket))
+	{
+		countDequeue_(*threadData->group);
+		if(m_metricsEnabled)
+		{
+			AddToCounter(threadData->counters.queueReads, uint64_t(1));
+		}
+		return true;
+	}
+	if(m_workStealing && stealTask_(threadData, *threadData->group, task))
+	{
+		if(m_metricsEnabled)
+		{
+			AddToCounter(threadData->counters.tasksStolen, uint64_t(1));
+		}
+		return true;
+	}
+	return false;
+}
+
+bool sprawl::threading::ThreadManager::TryRunTask()
+{
+	ThreadData* current = *m_currentThread;
+	if(current == nullptr)
+	{
+		return false;
+	}
+	TaskInfo* task;
+	if(!findTask_(current, task))
+	{
+		return false;
+	}
+	runTask_(task, current);
+	return true;
+}
+
+void sprawl::threading::ThreadManager::RunTasksUntil(std::function<bool()> const& done)
+{
+	ThreadData* current = *m_currentThread;
+	if(current == nullptr)
+	{
+		return;
+	}
+	FlagGroup& group = *current->group;
+	auto stopWaiting = [this, &group, &done]()
+	{
+		return done() || !group.deadlineQueue.Empty() || (m_workStealing && hasStealableTask_(group));
+	};
+
+	TaskInfo* task;
+	while(!done())
+	{
+		if(findTask_(current, task))
+		{
+			runTask_(task, current);
+		}
+		else if(group.taskQueue.DequeueWait(task, current->ticket, stopWaiting))
+		{
+			countDequeue_(group);
+			if(m_metricsEnabled)
+			{
+				AddToCounter(current->counters.queueReads, uint64_t(1));
+			}
+			runTask_(task, current);
+		}
+	}
+}
+
+void sprawl::threading::ThreadManager::NotifyWorkers()
+{
+	notifyQueues_();
+}
+
+bool sprawl::threading::ThreadManager::IsWorkerThread()
+{
+	return *m_currentThread != nullptr;
+}
+
+bool sprawl::threading::ThreadManager::popDeadlineTask_(FlagGroup& group, TaskInfo*& task)
+{
+	if(group.deadlineQueue.Empty())
+	{
+		return false;
+	}
+	int64_t const now = time::Now();
+	while(group.deadlineQueue.Pop(task))
+	{
+		countDequeue_(group);
+		if(task->taken.load(std::memory_order_relaxed) || shedIfLate_(task, now))
+		{
+			// Already run, cancelled, or shed, by way of another group or just now.
+			release_(task);
+			continue;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool sprawl::threading::ThreadManager::shedIfLate_(TaskInfo* task, int64_t now)
+{
+	if(now <= task->deadline)
+	{
+		return false;
+	}
+	bool expected = false;
+	if(task->taken.compare_exchange_strong(expected, true))
+	{
+		m_tasksShed.fetch_add(1, std::memory_order_relaxed);
+		if(task->onShed)
+		{
+			task->onShed();
+		}
+	}
+	return true;
+}
+
+bool sprawl::threading::ThreadManager::hasStealableTask_(FlagGroup& group)
+{
+	for(auto& member : group.members)
+	{
+		if(!member->localTasks.Empty())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 void sprawl::threading::ThreadManager::eventLoop_(ThreadData* threadData)
 {
-	collections::ConcurrentQueue<TaskInfo*>& queue = m_flagGroups.Get(threadData->flags)->taskQueue;
-	Event& mailbox = threadData->mailbox;
+	FlagGroup& group = *threadData->group;
+	collections::BlockingConcurrentQueue<TaskInfo*>& queue = group.taskQueue;
+	ReservationTicket& ticket = threadData->ticket;
+	if(ticket.queue == nullptr)
+	{
+		queue.InitializeReservationTicket(ticket);
+	}
+	if(threadData->taskPool != nullptr)
+	{
+		// Restarted after retiring; take back the pool the last run of this thread left behind.
+		m_taskPool = threadData->taskPool;
+	}
+	m_currentThread = threadData;
+
+	if(threadData->numaNode >= 0)
+	{
+		// We're already running on our own node; have our allocations come from it too, and move the deque
+		// (allocated by whoever added us) over. The task pool is created on first use by this thread, so it
+		// lands here on its own.
+		this_thread::SetPreferredNumaNode(size_t(threadData->numaNode));
+		threadData->localTasks.Reallocate();
+	}
+
+	auto stopWaiting = [this, &group]()
+	{
+		return !m_running || m_syncState == SyncState::Threads || !group.deadlineQueue.Empty() || (m_workStealing && hasStealableTask_(group));
+	};
 
-	decltype(m_taskQueue)::ReadReservationTicket ticket;
-	m_taskQueue.InitializeReservationTicket(ticket);
+	bool retired = false;
 	while(m_running)
 	{
 		TaskInfo* task;
-		while(queue.Dequeue(task, ticket))
+		while(findTask_(threadData, task))
 		{
-			bool expected = false;
-			if(task->taken.compare_exchange_strong(expected, true))
-			{
-				task->what();
-				delete task;
-			}
+			runTask_(task, threadData);
 		}
+		int64_t const idleStart = m_metricsEnabled ? time::Now() : 0;
 		if(m_syncState == SyncState::Threads)
 		{
-			++m_syncCount;
-			m_workerSyncEvent.Notify();
-			while(m_syncState == SyncState::Threads)
+			// End of the stage, then wait to be let into the next one.
+			if(m_stageBarrier.Wait(threadData->index))
+			{
+				m_stageBarrier.Wait(threadData->index);
+			}
+			if(m_metricsEnabled)
 			{
-				mailbox.Wait();
+				AddToCounter(threadData->counters.idleTime, time::Now() - idleStart);
 			}
-			++m_syncCount;
-			m_workerSyncEvent.Notify();
 		}
 		else
 		{
-			mailbox.Wait();
+			bool const dequeued = threadData->retirable
+				? queue.DequeueWaitFor(task, ticket, group.retireAfterIdle, stopWaiting)
+				: queue.DequeueWait(task, ticket, stopWaiting);
+			if(m_metricsEnabled)
+			{
+				AddToCounter(threadData->counters.idleTime, time::Now() - idleStart);
+				if(dequeued)
+				{
+					AddToCounter(threadData->counters.queueReads, uint64_t(1));
+				}
+			}
+			if(dequeued)
+			{
+				countDequeue_(group);
+				runTask_(task, threadData);
+			}
+			else if(threadData->retirable && !stopWaiting() && tryRetire_(threadData))
+			{
+				retired = true;
+				break;
+			}
+		}
+	}
+	// The pool outlives this OS thread, and whichever one runs this slot next picks it up again.
+	threadData->taskPool = *m_taskPool;
+	m_currentThread = nullptr;
+	if(retired)
+	{
+		// Last - from here on the mailman owns this slot, its ticket included, and may restart it.
+		threadData->dormant.store(true, std::memory_order_release);
+		// Something may already be waiting in our reservation.
+		m_mailReady.Notify();
+	}
+}
+
+bool sprawl::threading::ThreadManager::tryRetire_(ThreadData* threadData)
+{
+	FlagGroup& group = *threadData->group;
+	int active = group.activeThreads.load(std::memory_order_relaxed);
+	while(active > group.minThreads)
+	{
+		if(group.activeThreads.compare_exchange_weak(active, active - 1, std::memory_order_relaxed))
+		{
+			return true;
 		}
 	}
+	return false;
 }
 
-#include <map>
+/*static*/ void sprawl::threading::ThreadManager::countDequeue_(FlagGroup& group)
+{
+	if(group.elastic)
+	{
+		group.removed.fetch_add(1, std::memory_order_relaxed);
+	}
+}
 
-void sprawl::threading::ThreadManager::mailMan_()
+int64_t sprawl::threading::ThreadManager::superviseElasticGroups_()
 {
-	std::map<int64_t, TaskInfo*> prioritizedTasks;
-	decltype(m_taskQueue)::ReadReservationTicket ticket;
-	m_taskQueue.InitializeReservationTicket(ticket);
-	
-	while(m_running)
+	int64_t const now = time::Now();
+	int64_t nextCheck = c_noDeadline;
+	for(auto& flagGroup : m_flagGroups)
 	{
-		TaskInfo* task;
-		while(m_taskQueue.Dequeue(task, ticket))
+		FlagGroup* group = flagGroup.Value();
+		if(!group->elastic)
 		{
-			while(prioritizedTasks.find(task->when) != prioritizedTasks.end())
+			continue;
+		}
+		// Every task delivered to a group either comes through the mailman or wakes it, so a backlog can't
+		// start unseen. Workers tied up in long tasks don't pick anything up, so it's the queue that says when
+		// more are needed, not the tasks being run: if what was waiting at backlogSince still hasn't all been
+		// taken, something has been waiting at least that long.
+		uint64_t const removed = group->removed.load(std::memory_order_relaxed);
+		if(group->backlogSince != 0 && removed >= group->backlogMark)
+		{
+			group->backlogSince = 0;
+		}
+		if(group->backlogSince == 0)
+		{
+			uint64_t const added = group->added.load(std::memory_order_relaxed);
+			if(added > removed)
 			{
-				++task->when;
+				group->backlogSince = now;
+				group->backlogMark = added;
 			}
-			prioritizedTasks.emplace(task->when, task);
 		}
-		collections::HashSet<int64_t> keysToDelete;
-		int64_t lastTime = 0;
-		for(auto& flagGroup : m_flagGroups)
+		// Only the mailman ever adds to activeThreads, so nobody can push it past maxThreads behind our back.
+		int const active = group->activeThreads.load(std::memory_order_relaxed);
+		bool grow = false;
+		if(group->backlogSince != 0 && active < group->maxThreads)
 		{
-			bool addedTask = false;
-			auto it = prioritizedTasks.begin();
-			for(;it != prioritizedTasks.end() && it->first <= time::Now();++it)
+			// With nobody running, waiting any longer gets nothing done.
+			grow = active == 0 || now - group->backlogSince > group->growAfterWait;
+		}
+		if(grow)
+		{
+			for(auto& member : group->members)
 			{
-				if(it->second->where != 0 && (it->second->where & flagGroup.Key()) == 0)
+				if(!member->dormant.load(std::memory_order_acquire))
 				{
 					continue;
 				}
-				if(m_currentStage != 0 && it->second->stage != 0 && (it->second->stage & m_currentStage) == 0)
+				group->activeThreads.fetch_add(1, std::memory_order_relaxed);
+				member->dormant.store(false, std::memory_order_relaxed);
+				Thread& thread = *m_threads[member->index].thread;
+				if(thread.Joinable())
 				{
-					continue;
+					thread.Join();
 				}
-				flagGroup.Value()->taskQueue.Enqueue(it->second);
-				addedTask = true;
-				keysToDelete.Insert(it->first);
+				thread.Start();
+				break;
 			}
-			if(addedTask)
+			// Give the new thread a chance to catch up before starting another.
+			group->backlogSince = now;
+			group->backlogMark = group->added.load(std::memory_order_relaxed);
+		}
+		if(group->backlogSince != 0 && group->activeThreads.load(std::memory_order_relaxed) < group->maxThreads)
+		{
+			int64_t const growAt = group->backlogSince + group->growAfterWait + 1;
+			nextCheck = growAt < nextCheck ? growAt : nextCheck;
+		}
+
+		// A retired thread left a reservation in the queue behind, and whatever gets written there is only
+		// readable through its ticket. Pass those along. Re-enqueueing can land in another dormant reservation
+		// we already looked at, so keep going until a pass finds nothing; each rescue uses one up, so this ends.
+		bool rescued = true;
+		while(rescued)
+		{
+			rescued = false;
+			for(auto& member : group->members)
 			{
-				for(auto& event : flagGroup.Value()->events)
+				TaskInfo* task;
+				if(member->dormant.load(std::memory_order_acquire) && member->ticket.ptr != nullptr && group->taskQueue.Dequeue(task, member->ticket))
 				{
-					event->Notify();
+					group->taskQueue.Enqueue(task);
+					rescued = true;
 				}
 			}
-			if(it != prioritizedTasks.end())
+		}
+	}
+	return nextCheck;
+}
+
+void sprawl::threading::ThreadManager::mailMan_()
+{
+	collections::TimerWheel<TaskInfo> timers(time::Now(), m_timerTick, m_timerLevels);
+	// Tasks whose time has come but which can't be delivered yet, because their stage isn't running or no
+	// flag group matches them.
+	collections::Vector<TaskInfo*> dueTasks;
+	ReservationTicket cancelTicket;
+	m_cancelQueue.InitializeReservationTicket(cancelTicket);
+
+	while(m_running)
+	{
+		TaskInfo* task;
+		int64_t const now = time::Now();
+		while((task = m_taskQueue.Dequeue()) != nullptr)
+		{
+			if(task->taken)
+			{
+				// Cancelled before it ever reached us.
+				release_(task);
+				continue;
+			}
+			if(task->when <= now)
+			{
+				// Already due - the wheel would hold it until the next tick boundary.
+				dueTasks.PushBack(task);
+				continue;
+			}
+			timers.Insert(task, task->when);
+		}
+		while(m_cancelQueue.Dequeue(task, cancelTicket))
+		{
+			if(collections::TimerWheel<TaskInfo>::Contains(task))
 			{
-				lastTime = it->first;
+				timers.Remove(task);
+				release_(task);
 			}
+			release_(task);
 		}
 
-		for(auto& key : keysToDelete)
+		timers.Advance(time::Now(), [&dueTasks](TaskInfo* expired)
+		{
+			dueTasks.PushBack(expired);
+		});
+
+		bool deliveredToMainThread = false;
+		ssize_t stillWaiting = 0;
+		for(ssize_t i = 0; i < dueTasks.Size(); ++i)
+		{
+			task = dueTasks[i];
+			if(task->taken || shedIfLate_(task, now))
+			{
+				release_(task);
+				continue;
+			}
+			if(m_currentStage != 0 && task->stage != 0 && (task->stage & m_currentStage) == 0)
+			{
+				dueTasks[stillWaiting++] = task;
+				continue;
+			}
+			if(!deliverTask_(task, deliveredToMainThread))
+			{
+				dueTasks[stillWaiting++] = task;
+				continue;
+			}
+			if(m_metricsEnabled)
+			{
+				int64_t const lag = time::Now() - task->when;
+				AddToCounter(m_tasksDelivered, uint64_t(1));
+				AddToCounter(m_mailmanLag, lag);
+				RaiseCounter(m_maxMailmanLag, lag);
+			}
+			release_(task);
+		}
+		while(dueTasks.Size() > stillWaiting)
+		{
+			dueTasks.PopBack();
+		}
+		// Worker threads are woken by the queue itself; only the main thread's Wait() still uses its mailbox.
+		if(deliveredToMainThread)
+		{
+			m_mainThreadMailbox->Notify();
+		}
+		int64_t nextSupervision = c_noDeadline;
+		if(m_hasElasticGroups && m_running)
 		{
-			prioritizedTasks.erase(key.Key());
+			nextSupervision = superviseElasticGroups_();
 		}
 
 		auto syncStatePreNotify = m_syncState.load();
@@ -549,9 +1503,14 @@ void sprawl::threading::ThreadManager::mailMan_()
 		}
 		else
 		{
-			if(lastTime != 0)
+			int64_t nextTime;
+			if(!timers.NextExpiry(nextTime) || nextSupervision < nextTime)
+			{
+				nextTime = nextSupervision;
+			}
+			if(nextTime != c_noDeadline)
 			{
-				m_mailReady.WaitUntil(lastTime);
+				m_mailReady.WaitUntil(nextTime);
 			}
 			else
 			{
@@ -560,8 +1519,12 @@ void sprawl::threading::ThreadManager::mailMan_()
 		}
 	}
 
-	for(auto& task : prioritizedTasks)
+	timers.Clear([](TaskInfo* remaining)
+	{
+		release_(remaining);
+	});
+	for(auto& remaining : dueTasks)
 	{
-		delete task.second;
+		release_(remaining);
 	}
 }
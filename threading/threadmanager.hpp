@@ -1,17 +1,31 @@
+#pragma once
+
 namespace sprawl
 {
 	namespace threading
 	{
 		class ThreadManager;
+
+		template<typename t_ResultType>
+		class Future;
+
+		class ScheduleAwaiter;
+		class EventAwaiter;
 	}
 }
 
 #include <stdint.h>
+#include <stdio.h>
 #include <functional>
 
 #include "../time/time.hpp"
 #include "../collections/Vector.hpp"
 #include "../collections/ConcurrentQueue.hpp"
+#include "../collections/BlockingConcurrentQueue.hpp"
+#include "../collections/IntrusiveMPSCQueue.hpp"
+#include "../collections/ConcurrentPriorityQueue.hpp"
+#include "../collections/WorkStealingDeque.hpp"
+#include "../collections/TimerWheel.hpp"
 #include "../collections/BinaryTree.hpp"
 #include "../collections/HashMap.hpp"
 
@@ -19,47 +33,196 @@ namespace sprawl
 #include "mutex.hpp"
 #include "condition_variable.hpp"
 #include "event.hpp"
+#include "threadlocal.hpp"
+#include "inplacetask.hpp"
+#include "barrier.hpp"
 
 #include <atomic>
+#include <type_traits>
+
+#ifndef SPRAWL_THREADMANAGER_INPLACE_TASK_SIZE
+#	define SPRAWL_THREADMANAGER_INPLACE_TASK_SIZE 64
+#endif
 
 class sprawl::threading::ThreadManager
 {
 
 public:
 	typedef std::function<void()> Task;
+	/**
+	 * @brief	What tasks are actually stored as. Any callable that fits is stored inline without allocating;
+	 *			anything bigger is wrapped in a Task first, which always fits.
+	 */
+	typedef InplaceTask<SPRAWL_THREADMANAGER_INPLACE_TASK_SIZE> InlineTask;
+	static_assert(InlineTask::Fits<Task>(), "SPRAWL_THREADMANAGER_INPLACE_TASK_SIZE must be large enough to hold a std::function.");
+
+	/**
+	 * @brief	Store any callable as an InlineTask, wrapping it in a Task first if it's too big to fit inline.
+	 */
+	template<typename t_CallableType>
+	static InlineTask MakeInlineTask(t_CallableType&& task)
+	{
+		typedef typename std::decay<t_CallableType>::type CallableType;
+		return wrapTask_(std::forward<t_CallableType>(task), std::integral_constant<bool, InlineTask::Fits<CallableType>()>());
+	}
+
+	static InlineTask MakeInlineTask(InlineTask&& task)
+	{
+		return std::move(task);
+	}
+
+	static constexpr int64_t c_noDeadline = INT64_MAX;
 private:
-	struct TaskInfo
+	struct TaskPool;
+
+	struct TaskInfo : public collections::IntrusiveMPSCQueueNode, public collections::TimerWheelNode
 	{
 		TaskInfo();
-		TaskInfo(Task&& what_, uint64_t where_, int64_t when_);
-		TaskInfo(Task const& what_, uint64_t where_, int64_t when_);
-		TaskInfo(Task&& what_, uint64_t where_, int64_t when_, int64_t stage);
-		TaskInfo(Task const& what_, uint64_t where_, int64_t when_, int64_t stage);
-		TaskInfo(TaskInfo&& other);
-		TaskInfo& operator=(TaskInfo&& other);
-
-		Task what;
+
+		InlineTask what;
 		uint64_t where;
 		int64_t when;
 		std::atomic<bool> taken;
+		// One reference for each queue or handle holding this task; whoever drops the last one recycles it.
+		std::atomic<int> refCount;
 		uint64_t stage;
+		// c_noDeadline and 0 for ordinary tasks; anything else puts the task in its groups' deadline queues.
+		int64_t deadline;
+		int priority;
+		Task onShed;
+		// The pool this task goes back to when it's released.
+		TaskPool* pool;
+		TaskInfo* nextFree;
 		inline int64_t When()
 		{
 			return when;
 		}
+
+		inline bool IsOrdered() const
+		{
+			return deadline != c_noDeadline || priority != 0;
+		}
+	};
+
+	// Highest priority first, then earliest deadline.
+	struct DeadlineOrder
+	{
+		bool operator()(TaskInfo const* a, TaskInfo const* b) const
+		{
+			if(a->priority != b->priority)
+			{
+				return a->priority < b->priority;
+			}
+			return a->deadline > b->deadline;
+		}
+	};
+
+	/**
+	 * @brief	Per-thread free list of TaskInfos, so submitting a task doesn't touch the global allocator.
+	 * @details	Only the owning thread takes tasks from the free list. A task released on another thread is
+	 *			handed back through the returned queue, reusing the task's own queue link, and the owner collects
+	 *			those when its free list runs dry.
+	 */
+	struct TaskPool
+	{
+		explicit TaskPool(ThreadManager* owner_);
+		~TaskPool();
+
+		ThreadManager* owner;
+		TaskInfo* freeList;
+		collections::IntrusiveMPSCQueue<TaskInfo> returned;
+		collections::Vector<TaskInfo*> chunks;
+	};
+
+	struct FlagGroup;
+
+	/**
+	 * @brief	What each thread counts about itself while metrics are enabled. Only the owning thread writes
+	 *			them, so updating them is a plain load and store; GetMetrics() reads them from anywhere.
+	 */
+	struct ThreadCounters
+	{
+		ThreadCounters()
+			: tasksRun(0)
+			, tasksStolen(0)
+			, queueReads(0)
+			, waitTime(0)
+			, maxWaitTime(0)
+			, runTime(0)
+			, idleTime(0)
+		{
+
+		}
+
+		std::atomic<uint64_t> tasksRun;
+		std::atomic<uint64_t> tasksStolen;
+		// Everything taken off the group queue, including tasks another group got to first.
+		std::atomic<uint64_t> queueReads;
+		std::atomic<int64_t> waitTime;
+		std::atomic<int64_t> maxWaitTime;
+		std::atomic<int64_t> runTime;
+		std::atomic<int64_t> idleTime;
+	};
+
+	struct TraceEvent
+	{
+		int64_t due;
+		int64_t start;
+		int64_t end;
+		uint64_t where;
+		uint64_t stage;
 	};
 
 	struct ThreadData
 	{
-		explicit ThreadData(uint64_t flags_)
+		ThreadData(uint64_t flags_, FlagGroup* group_, size_t index_)
 			: flags(flags_)
+			, group(group_)
+			, index(index_)
+			, numaNode(-1)
+			, retirable(false)
+			, dormant(false)
+			, taskPool(nullptr)
+			, ticket()
 			, mailbox()
+			, localTasks()
+			, nextVictim(0)
+			, counters()
+			, traceEvents(nullptr)
+			, traceCapacity(0)
+			, traceCount(0)
 		{
 
 		}
 
+		~ThreadData()
+		{
+			delete[] traceEvents;
+		}
+
 		uint64_t flags;
+		FlagGroup* group;
+		// This thread's participant index in the stage barrier.
+		size_t index;
+		// The NUMA node this thread is pinned to, if it's pinned to a single node on a multi-node system; else -1.
+		int numaNode;
+		// Elastic groups only: whether this thread may be retired, and whether it's retired (or not started yet)
+		// right now. While it's dormant, the mailman owns its ticket.
+		bool retirable;
+		std::atomic<bool> dormant;
+		// Handed from one run of the thread to the next, so restarting it doesn't leave a new pool behind each time.
+		TaskPool* taskPool;
+		// This thread's ticket for its group's queue, shared by its event loop and TryRunTask().
+		collections::ConcurrentQueue<TaskInfo*>::ReadReservationTicket ticket;
 		Event mailbox;
+		// Only used in work-stealing mode: tasks this thread spawned for itself, which idle peers may steal.
+		collections::WorkStealingDeque<TaskInfo*> localTasks;
+		size_t nextVictim;
+		ThreadCounters counters;
+		// Filled in order and never overwritten, so the first traceCount events can be read at any time.
+		TraceEvent* traceEvents;
+		size_t traceCapacity;
+		std::atomic<size_t> traceCount;
 	};
 
 	struct ThreadInfo
@@ -109,14 +272,211 @@ private:
 		Thread* thread;
 	};
 
+public:
+	/**
+	 * @brief	Handle to a future task, which can be used to cancel it before it runs.
+	 * @details	Holding a handle keeps the task's bookkeeping alive but doesn't keep the task scheduled - dropping
+	 *			the handle without calling Cancel() leaves the task to run as normal. Handles must not outlive
+	 *			the ThreadManager that created them.
+	 */
+	class TaskHandle
+	{
+	public:
+		TaskHandle();
+		~TaskHandle();
+		TaskHandle(TaskHandle&& other);
+		TaskHandle& operator=(TaskHandle&& other);
+
+		/**
+		 * @brief	Cancel the task if it hasn't started yet.
+		 * @return	true if the task was cancelled and will never run; false if it has already started, already
+		 *			finished, was already cancelled, or this handle is empty.
+		 */
+		bool Cancel();
+
+		bool Valid() const { return m_task != nullptr; }
+	private:
+		friend class ThreadManager;
+		TaskHandle(ThreadManager* manager, TaskInfo* task);
+		TaskHandle(TaskHandle const& other) = delete;
+		TaskHandle& operator=(TaskHandle const& other) = delete;
+
+		ThreadManager* m_manager;
+		TaskInfo* m_task;
+	};
+
+	/**
+	 * @brief	Collects tasks and publishes them all at once.
+	 * @details	Submit() hands the whole batch to the mailman with a single queue operation and a single wakeup,
+	 *			rather than one of each per task. In work-stealing mode, tasks that are due now and match the
+	 *			submitting worker go straight onto its own deque instead, again with one wakeup for the batch.
+	 *			Tasks added but never submitted are discarded when the batch is destroyed.
+	 */
+	class TaskBatch
+	{
+	public:
+		explicit TaskBatch(ThreadManager& manager)
+			: m_manager(&manager)
+			, m_first(nullptr)
+			, m_last(nullptr)
+			, m_size(0)
+		{
+
+		}
+
+		~TaskBatch()
+		{
+			Clear();
+		}
+
+		template<typename t_CallableType>
+		void Add(t_CallableType&& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds))
+		{
+			append_(m_manager->newTask_(std::forward<t_CallableType>(task), threadFlags, whenNanosecs, 0));
+		}
+
+		template<typename t_CallableType>
+		void AddStaged(uint64_t stage, t_CallableType&& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds))
+		{
+			append_(m_manager->newTask_(std::forward<t_CallableType>(task), threadFlags, whenNanosecs, stage));
+		}
+
+		/**
+		 * @brief	Publish every task added so far. The batch is empty afterward and can be reused.
+		 */
+		void Submit()
+		{
+			if(m_first != nullptr)
+			{
+				m_manager->pushTasks_(m_first, m_last);
+				m_first = nullptr;
+				m_last = nullptr;
+				m_size = 0;
+			}
+		}
+
+		/**
+		 * @brief	Discard every task added since the last Submit() without running it.
+		 */
+		void Clear();
+
+		size_t Size() const { return m_size; }
+		bool Empty() const { return m_size == 0; }
+	private:
+		TaskBatch(TaskBatch const& other) = delete;
+		TaskBatch& operator=(TaskBatch const& other) = delete;
+
+		inline void append_(TaskInfo* task)
+		{
+			// The tasks are linked through the same pointer the mailman's queue uses, so the chain can be
+			// spliced into it as-is.
+			task->m_next.store(nullptr, std::memory_order_relaxed);
+			if(m_last == nullptr)
+			{
+				m_first = task;
+			}
+			else
+			{
+				m_last->m_next.store(task, std::memory_order_relaxed);
+			}
+			m_last = task;
+			++m_size;
+		}
+
+		ThreadManager* m_manager;
+		TaskInfo* m_first;
+		TaskInfo* m_last;
+		size_t m_size;
+	};
+private:
 	struct FlagGroup
 	{
-		collections::Vector<Event*> events;
-		collections::ConcurrentQueue<TaskInfo*> taskQueue;
+		FlagGroup()
+			: taskQueue()
+			, deadlineQueue(1)
+			, members()
+			, priority(ThreadPriority::Normal)
+			, enqueued(0)
+			, elastic(false)
+			, minThreads(0)
+			, maxThreads(0)
+			, growAfterWait(0)
+			, retireAfterIdle(0)
+			, activeThreads(0)
+			, added(0)
+			, removed(0)
+			, backlogSince(0)
+			, backlogMark(0)
+		{
+
+		}
+
+		collections::BlockingConcurrentQueue<TaskInfo*> taskQueue;
+		// Tasks with a deadline or priority. A single heap, so they come out in exactly the right order.
+		collections::ConcurrentPriorityQueue<TaskInfo*, DeadlineOrder> deadlineQueue;
+		// Every thread with exactly these flags. Fixed once the manager starts.
+		collections::Vector<ThreadData*> members;
+		ThreadPriority priority;
+		// Only counted while metrics are enabled.
+		std::atomic<uint64_t> enqueued;
+
+		// See SetElastic(). Every thread the group could ever need is in members from the start; growing and
+		// shrinking only starts and stops them.
+		bool elastic;
+		int minThreads;
+		int maxThreads;
+		int64_t growAfterWait;
+		int64_t retireAfterIdle;
+		std::atomic<int> activeThreads;
+		// Running totals of entries put into and taken out of taskQueue and deadlineQueue. Counted for elastic
+		// groups only.
+		std::atomic<uint64_t> added;
+		std::atomic<uint64_t> removed;
+		// Only the mailman touches these. When it saw entries waiting that haven't all been taken out yet, and
+		// what added was then; backlogSince is 0 if there's no such backlog.
+		int64_t backlogSince;
+		uint64_t backlogMark;
 	};
 public:
 	typedef collections::ConcurrentQueue<TaskInfo*>::ReadReservationTicket ReservationTicket;
 
+	/**
+	 * @brief	One thread's totals since metrics were enabled. All times are in nanoseconds.
+	 */
+	struct ThreadMetrics
+	{
+		uint64_t flags;
+		uint64_t tasksRun;
+		// Tasks taken from a peer's deque in work-stealing mode.
+		uint64_t tasksStolen;
+		// From when each task was due to run (normally, when it was added) until it started.
+		int64_t totalWaitTime;
+		int64_t maxWaitTime;
+		int64_t totalRunTime;
+		// Time spent parked, waiting for work or for the next stage.
+		int64_t idleTime;
+	};
+
+	struct GroupMetrics
+	{
+		uint64_t flags;
+		size_t threadCount;
+		// Tasks delivered to the group's queue and not yet picked up. Approximate while threads are running.
+		int64_t queueDepth;
+	};
+
+	struct Metrics
+	{
+		collections::Vector<ThreadMetrics> threads;
+		collections::Vector<GroupMetrics> groups;
+		// How late the mailman delivered tasks, compared to when they were due.
+		uint64_t tasksDelivered;
+		int64_t totalMailmanLag;
+		int64_t maxMailmanLag;
+		// Same as GetShedCount(); counted even with metrics off.
+		uint64_t tasksShed;
+	};
+
 	ThreadManager();
 	~ThreadManager();
 
@@ -126,19 +486,286 @@ public:
 	void AddThreads(uint64_t threadFlags, int count, char const* const threadName);
 	void AddThreads(uint64_t threadFlags, int count);
 
+	/**
+	 * @brief	Add a thread that only runs on the given CPUs.
+	 * @details	If the CPUs all belong to one NUMA node, the thread also asks for its memory to come from that
+	 *			node, and allocates its own queues there when it starts.
+	 */
+	void AddThread(uint64_t threadFlags, CpuSet const& affinity, char const* const threadName);
+	void AddThread(uint64_t threadFlags, CpuSet const& affinity);
+
+	/**
+	 * @brief	Add one thread for each physical core this process may run on, each pinned to its own core.
+	 * @details	Threads are added in GetPhysicalCores() order, so consecutive threads share a NUMA node. The
+	 *			calling thread isn't pinned, so a core's worth of work may end up sharing with it.
+	 * @param	threadFlags		The flags for every thread added
+	 * @param	maxThreads		Stop after this many threads; 0 for no limit
+	 * @return	The number of threads added
+	 */
+	int AddThreadPerCore(uint64_t threadFlags, int maxThreads, char const* const threadName);
+	int AddThreadPerCore(uint64_t threadFlags, int maxThreads = 0);
+
+	/**
+	 * @brief	Let the number of worker threads with exactly these flags grow and shrink with demand. Must be
+	 *			called before Run() or Start(); can't be combined with stages or Sync().
+	 * @details	Threads already added with these flags count towards the total and all start running; more are
+	 *			started if that's fewer than minThreads. After that, whenever the group's tasks have been left
+	 *			waiting in its queue for longer than growAfterWaitNanosecs, another is started (up to maxThreads),
+	 *			and any thread that goes retireAfterIdleNanosecs without work stops (down to minThreads). With a
+	 *			minThreads of 0, a thread is started as soon as a task arrives while none are running.
+	 *
+	 *			Every thread the group might need is created up front and stays in the group while it's retired,
+	 *			so peers looking for work never see the group change under them. The mailman does the starting,
+	 *			and looks after retired threads' place in the queue so no task is stranded with them.
+	 */
+	void SetElastic(uint64_t threadFlags, int minThreads, int maxThreads, int64_t growAfterWaitNanosecs, int64_t retireAfterIdleNanosecs);
+
+	/**
+	 * @brief	The number of worker threads with exactly these flags that are running right now.
+	 */
+	int GetActiveThreadCount(uint64_t threadFlags);
+
+	/**
+	 * @brief	Set the scheduling priority of every worker thread with exactly these flags, e.g. to favor a
+	 *			latency-critical group. Must be called before Run(), RunStaged() or Start().
+	 * @details	Applies to worker threads only; the thread that calls Run(), RunStaged() or Start() keeps its
+	 *			own priority. See ThreadPriority for what each level means on each platform.
+	 */
+	void SetGroupPriority(uint64_t threadFlags, ThreadPriority priority);
+
 	void AddTask(Task&& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds));
 	void AddTask(Task const& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds));
 
+	/**
+	 * @brief	Add a task from any callable. Callables up to SPRAWL_THREADMANAGER_INPLACE_TASK_SIZE bytes are
+	 *			stored inline, so submitting them doesn't allocate once the calling thread's task pool is warm.
+	 */
+	template<typename t_CallableType>
+	void AddTask(t_CallableType&& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds))
+	{
+		pushTask_(newTask_(std::forward<t_CallableType>(task), threadFlags, whenNanosecs, 0));
+	}
+
+	/**
+	 * @brief	Add a task behind everything already waiting for these flags. With work stealing, AddTask() from
+	 *			a worker puts the task on that worker's own deque, where it's the next thing the worker runs;
+	 *			this is for a task that's handing its thread over to the others, like a fiber yielding.
+	 */
+	template<typename t_CallableType>
+	void AddTaskToBack(t_CallableType&& task, uint64_t threadFlags)
+	{
+		pushTask_(newTask_(std::forward<t_CallableType>(task), threadFlags, time::Now(time::Resolution::Nanoseconds), 0), false);
+	}
+
+	/**
+	 * @brief	Add a task that has a deadline, a priority, or both.
+	 * @details	Within a flag group these run ahead of ordinary tasks - highest priority first, then earliest
+	 *			deadline first. A task that hasn't started by its deadline is shed rather than run: onShed is
+	 *			called in its place and GetShedCount() goes up. onShed runs on whichever thread notices the missed
+	 *			deadline, which may be the mailman, so it should be quick.
+	 * @param	task				The callable to run
+	 * @param	threadFlags			As with AddTask()
+	 * @param	deadlineNanosecs	Absolute time (as from time::Now()) the task has to start by, or c_noDeadline
+	 * @param	priority			Higher runs first
+	 * @param	onShed				Called instead of the task if it's shed; may be empty
+	 * @param	whenNanosecs		Absolute time the task becomes due, as with AddTask()
+	 * @return	A handle that can cancel the task, as with AddFutureTask()
+	 */
+	template<typename t_CallableType>
+	TaskHandle AddDeadlineTask(t_CallableType&& task, uint64_t threadFlags, int64_t deadlineNanosecs, int priority = 0, Task onShed = Task(), int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds))
+	{
+		TaskInfo* info = newTask_(std::forward<t_CallableType>(task), threadFlags, whenNanosecs, 0);
+		info->deadline = deadlineNanosecs;
+		info->priority = priority;
+		info->onShed = std::move(onShed);
+		return pushFutureTask_(info);
+	}
+
+	/**
+	 * @brief	The number of tasks shed for missing their deadlines.
+	 */
+	uint64_t GetShedCount() const { return m_tasksShed.load(std::memory_order_relaxed); }
+
 	void AddTaskStaged(uint64_t stage, Task&& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds));
 	void AddTaskStaged(uint64_t stage, Task const& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds));
 
+	template<typename t_CallableType>
+	void AddTaskStaged(uint64_t stage, t_CallableType&& task, uint64_t threadFlags, int64_t whenNanosecs = time::Now(time::Resolution::Nanoseconds))
+	{
+		pushTask_(newTask_(std::forward<t_CallableType>(task), threadFlags, whenNanosecs, stage));
+	}
+
+	/**
+	 * @brief	Add every callable in a range as a task, publishing them as a single batch.
+	 * @param	tasks			Anything usable in a range-based for whose elements are callables. Each one is copied.
+	 * @param	threadFlags		The flags for every task in the range
+	 */
+	template<typename t_RangeType>
+	void AddTasks(t_RangeType const& tasks, uint64_t threadFlags)
+	{
+		TaskBatch batch(*this);
+		for(auto& task : tasks)
+		{
+			batch.Add(task, threadFlags);
+		}
+		batch.Submit();
+	}
+
+	/**
+	 * @brief	Run fn(i) for every i in [begin, end), split into tasks of up to grain indices each.
+	 * @details	The chunks are published as a single batch. This doesn't wait for them to finish - fn is
+	 *			responsible for signalling completion if the caller needs it. fn is copied into each chunk, so it
+	 *			should be cheap to copy; capture large state by reference.
+	 * @param	begin			The first index
+	 * @param	end				One past the last index
+	 * @param	grain			The maximum number of indices per task
+	 * @param	fn				Callable taking a t_IndexType
+	 * @param	threadFlags		The flags for every chunk
+	 */
+	template<typename t_IndexType, typename t_FunctionType>
+	void ParallelFor(t_IndexType begin, t_IndexType end, t_IndexType grain, t_FunctionType const& fn, uint64_t threadFlags)
+	{
+		if(grain < 1)
+		{
+			grain = 1;
+		}
+		TaskBatch batch(*this);
+		while(begin < end)
+		{
+			t_IndexType const chunkEnd = (end - begin > grain) ? begin + grain : end;
+			batch.Add([fn, begin, chunkEnd]()
+			{
+				for(t_IndexType i = begin; i < chunkEnd; ++i)
+				{
+					fn(i);
+				}
+			}, threadFlags);
+			begin = chunkEnd;
+		}
+		batch.Submit();
+	}
+
+	/**
+	 * @brief	Add a task whose return value is delivered through a Future.
+	 * @details	Defined in future.hpp, which must be included to use it. The explicit-type version converts
+	 *			the callable's return value to t_ResultType.
+	 */
+	template<typename t_ResultType, typename t_CallableType>
+	Future<t_ResultType> AddTaskWithResult(t_CallableType&& task, uint64_t threadFlags);
+
+	template<typename t_CallableType>
+	Future<decltype(std::declval<typename std::decay<t_CallableType>::type&>()())> AddTaskWithResult(t_CallableType&& task, uint64_t threadFlags);
+
+#if SPRAWL_COROUTINE_TASKS
+	/**
+	 * @brief	co_await from a Task to carry on as a task on the threads with these flags.
+	 * @details	These are defined in task.hpp, which must be included to use them.
+	 */
+	ScheduleAwaiter Schedule(uint64_t threadFlags);
+
+	/**
+	 * @brief	co_await from a Task to carry on as a future task: nothing is blocked in the meantime.
+	 */
+	ScheduleAwaiter SleepFor(uint64_t threadFlags, int64_t nanoseconds);
+	ScheduleAwaiter SleepUntil(uint64_t threadFlags, int64_t nanosecondTimestamp);
+
+	/**
+	 * @brief	co_await from a Task to consume the event's next notification, as Event::Wait() would, then
+	 *			carry on as a task on the threads with these flags. Nothing is blocked in the meantime.
+	 */
+	EventAwaiter WaitForEvent(Event const& event, uint64_t threadFlags);
+#endif
+
+	/**
+	 * @brief	Run one task the calling thread would otherwise pick up from its event loop, if there is one.
+	 * @details	Lets a worker do useful work while it waits on something else (e.g., Future::Get()).
+	 * @return	true if a task was run; false if nothing was available or the caller isn't one of this
+	 *			manager's worker threads.
+	 */
+	bool TryRunTask();
+
+	/**
+	 * @brief	Run tasks on the calling worker thread until done() returns true, sleeping on its group's queue
+	 *			whenever there's nothing to run.
+	 * @details	Whatever makes done() true has to call NotifyWorkers() afterward, or the worker may sleep on until
+	 *			the next task shows up. Returns right away if the caller isn't one of this manager's worker threads.
+	 */
+	void RunTasksUntil(std::function<bool()> const& done);
+
+	/**
+	 * @brief	Wake every worker sleeping in RunTasksUntil() so it checks its condition again.
+	 */
+	void NotifyWorkers();
+
+	/**
+	 * @brief	Check whether the calling thread is running this manager's event loop.
+	 */
+	bool IsWorkerThread();
+
 	void SetMaxStage(uint64_t maxStage);
 
-	void AddFutureTask(Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
-	void AddFutureTask(Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
+	/**
+	 * @brief	Enable or disable work-stealing mode. Must be called before Run(), RunStaged() or Start().
+	 * @details	In work-stealing mode, a task that's due immediately skips the mailman. If it's added from a
+	 *			worker whose flags it matches, it goes onto that worker's own deque; otherwise it goes straight
+	 *			into the matching flag groups' queues. Idle workers steal from the deques of peers with the same
+	 *			flags. Future tasks and staged tasks still go through the mailman.
+	 */
+	void SetWorkStealing(bool enabled);
+
+	TaskHandle AddFutureTask(Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
+	TaskHandle AddFutureTask(Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
+
+	template<typename t_CallableType>
+	TaskHandle AddFutureTask(t_CallableType&& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
+	{
+		return pushFutureTask_(newTask_(std::forward<t_CallableType>(task), threadFlags, nanosecondsFromNow + time::Now(), 0));
+	}
+
+	TaskHandle AddFutureTaskStaged(uint64_t stage, Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
+	TaskHandle AddFutureTaskStaged(uint64_t stage, Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
 
-	void AddFutureTaskStaged(uint64_t stage, Task&& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
-	void AddFutureTaskStaged(uint64_t stage, Task const& task, uint64_t threadFlags, int64_t nanosecondsFromNow);
+	template<typename t_CallableType>
+	TaskHandle AddFutureTaskStaged(uint64_t stage, t_CallableType&& task, uint64_t threadFlags, int64_t nanosecondsFromNow)
+	{
+		return pushFutureTask_(newTask_(std::forward<t_CallableType>(task), threadFlags, nanosecondsFromNow + time::Now(), stage));
+	}
+
+	/**
+	 * @brief	Turn on per-thread counters, for GetMetrics(). Must be called before Run(), RunStaged() or Start().
+	 * @details	With metrics and tracing both off, the only cost is one predictable branch per task.
+	 */
+	void SetMetricsEnabled(bool enabled);
+
+	/**
+	 * @brief	Add up every thread's counters. Safe to call while running; must be called before ShutDown().
+	 */
+	Metrics GetMetrics();
+
+	/**
+	 * @brief	Record when each task was due, started and finished, for WriteChromeTrace(). Must be called
+	 *			before Run(), RunStaged() or Start().
+	 * @details	Each thread gets a fixed buffer and stops recording once it's full, so recording never allocates
+	 *			or overwrites events that might be being read.
+	 * @param	eventsPerThread		How many tasks each thread can record; 0 turns tracing off
+	 */
+	void SetTracing(size_t eventsPerThread);
+
+	/**
+	 * @brief	Write every recorded task as Chrome trace-event JSON, viewable in chrome://tracing or Perfetto.
+	 *			Safe to call while running; must be called before ShutDown().
+	 */
+	void WriteChromeTrace(FILE* file);
+
+	/**
+	 * @brief	Configure the mailman's timer wheel. Must be called before Run(), RunStaged() or Start().
+	 * @details	Timed tasks are dispatched at tick granularity - never early, and at most one tick late. Each level
+	 *			covers 256 times the range of the one below it; the defaults (1ms, 4 levels) cover about 50 days
+	 *			before tasks have to be re-placed.
+	 * @param	tickNanosecs	The width of one tick
+	 * @param	levelCount		The number of levels in the wheel
+	 */
+	void SetTimerResolution(int64_t tickNanosecs, size_t levelCount);
 
 	/**
 	 * @brief	Start all threads and include the calling thread in a loop controlled by the thread manager
@@ -164,20 +791,81 @@ public:
 	void ShutDown();
 private:
 	void pump_(ReservationTicket& ticket);
-	void pushTask_(TaskInfo* info);
+	ThreadData* addThread_(uint64_t threadFlags, char const* const threadName);
+	FlagGroup* getFlagGroup_(uint64_t threadFlags);
+	void startWorkers_(size_t threadCount);
+	void prepareElasticGroups_();
+	static void countDequeue_(FlagGroup& group);
+	bool tryRetire_(ThreadData* threadData);
+	// Returns when it next needs to look at the groups again, or c_noDeadline if only new work would change anything.
+	int64_t superviseElasticGroups_();
+
+	template<typename t_CallableType>
+	TaskInfo* newTask_(t_CallableType&& task, uint64_t where, int64_t when, uint64_t stage)
+	{
+		TaskInfo* info = acquireTask_();
+		info->what = MakeInlineTask(std::forward<t_CallableType>(task));
+		info->where = where;
+		info->when = when;
+		info->stage = stage;
+		info->deadline = c_noDeadline;
+		info->priority = 0;
+		return info;
+	}
+
+	template<typename t_CallableType>
+	static InlineTask wrapTask_(t_CallableType&& task, std::true_type /*fitsInline*/)
+	{
+		return InlineTask(std::forward<t_CallableType>(task));
+	}
+
+	template<typename t_CallableType>
+	static InlineTask wrapTask_(t_CallableType&& task, std::false_type /*fitsInline*/)
+	{
+		return InlineTask(Task(std::forward<t_CallableType>(task)));
+	}
+
+	TaskInfo* acquireTask_();
+	TaskInfo* refillPool_(TaskPool* pool);
+	TaskHandle pushFutureTask_(TaskInfo* info);
+	void pushTask_(TaskInfo* info, bool allowLocal = true);
+	void pushTasks_(TaskInfo* first, TaskInfo* last);
+	bool deliverTask_(TaskInfo* info, bool& deliveredToMainThread);
+	void runTask_(TaskInfo* task, ThreadData* runner);
+	void runInstrumented_(TaskInfo* task, ThreadData* runner);
+	void cancelTask_(TaskInfo* task);
+	static void release_(TaskInfo* task);
+	bool stealTask_(ThreadData* thief, FlagGroup& group, TaskInfo*& task);
+	bool findTask_(ThreadData* threadData, TaskInfo*& task);
+	bool popDeadlineTask_(FlagGroup& group, TaskInfo*& task);
+	bool shedIfLate_(TaskInfo* task, int64_t now);
+	bool hasStealableTask_(FlagGroup& group);
 	void eventLoop_(ThreadData* threadData);
 	void mailMan_();
+	void notifyQueues_();
+	void wakeThreads_();
 
-	collections::ConcurrentQueue<TaskInfo*> m_taskQueue;
+	// Only the mailman reads from this, and tasks link themselves into it.
+	collections::IntrusiveMPSCQueue<TaskInfo> m_taskQueue;
+	// Cancelled timed tasks, so the mailman can pull them out of its timer wheel right away.
+	collections::ConcurrentQueue<TaskInfo*> m_cancelQueue;
 	collections::BasicHashMap<int64_t, FlagGroup*> m_flagGroups;
 	Event* m_mainThreadMailbox;
-	collections::ConcurrentQueue<TaskInfo*>* m_mainThreadQueue;
+	collections::BlockingConcurrentQueue<TaskInfo*>* m_mainThreadQueue;
 
 	collections::Vector<ThreadInfo> m_threads;
 	Thread m_mailmanThread;
 	std::atomic<bool> m_running;
 	uint64_t m_currentStage;
 	uint64_t m_maxStage;
+	bool m_workStealing;
+	int64_t m_timerTick;
+	size_t m_timerLevels;
+	ThreadLocal<ThreadData*> m_currentThread;
+	ThreadLocal<TaskPool*> m_taskPool;
+	// Every pool any thread has created, so they can be freed along with the manager.
+	collections::Vector<TaskPool*> m_taskPools;
+	Mutex m_taskPoolsMutex;
 
 	enum class SyncState
 	{
@@ -187,9 +875,21 @@ private:
 	};
 
 	std::atomic<SyncState> m_syncState;
-	Event m_workerSyncEvent;
 	Event m_mailmanSyncEvent;
-	std::atomic<size_t> m_syncCount;
+	Barrier m_stageBarrier;
 
 	Event m_mailReady;
+
+	bool m_metricsEnabled;
+	size_t m_traceCapacity;
+	// Either of the above; checked once per task.
+	bool m_instrumented;
+	int64_t m_traceEpoch;
+	// Written only by the mailman.
+	std::atomic<uint64_t> m_tasksDelivered;
+	std::atomic<int64_t> m_mailmanLag;
+	std::atomic<int64_t> m_maxMailmanLag;
+	std::atomic<uint64_t> m_tasksShed;
+
+	bool m_hasElasticGroups;
 };